@@ -12,7 +12,7 @@ function(InstallCommon includeListVar linkListVar dependenciesVar)
     ELSEIF(APPLE)
         # 处理 macOS 平台
         list(APPEND ${linkListVar}  "CalCommon")
-    ELSEIF(LINUX)
+    ELSEIF(UNIX)
         # 处理 Linux 平台
         list(APPEND ${linkListVar} "CalCommon")
     ENDIF()
@@ -28,12 +28,13 @@ namespace cal {
     void Logger::addLog(float val) { ss << val; }
     void Logger::addLog(double val) { ss << val; }
 
-    void Logger::init(const char* name) {
+    void Logger::init(const char* name, bool use_stderr) {
         std::string fileName(name);
         fileName.append(".log");
 
         std::vector<spdlog::sink_ptr> logSinks;
-		logSinks.emplace_back(std::make_shared<spdlog::sinks::stdout_color_sink_mt>());
+		if (use_stderr) logSinks.emplace_back(std::make_shared<spdlog::sinks::stderr_color_sink_mt>());
+		else logSinks.emplace_back(std::make_shared<spdlog::sinks::stdout_color_sink_mt>());
 		logSinks.emplace_back(std::make_shared<spdlog::sinks::basic_file_sink_mt>(fileName, true));
 
 		logSinks[0]->set_pattern(FORMAT);
@@ -48,10 +49,9 @@ namespace cal {
     void Logger::emitLog(LogLevel level) {
         auto stdstr = ss.str();
         const char* str = stdstr.c_str();
-        //TODO Add Log Callback Action To Here
         ss.str("");
         ss.clear();
-        
+
 
         switch (level)
         {
@@ -66,13 +66,20 @@ namespace cal {
         case LogTrace:
             m_backend->trace(str); break;
         }
+        if (m_callback) m_callback(level, str, m_callback_user);
+    }
+
+    void Logger::setCallback(LogCallback callback, void* user) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_callback = callback;
+        m_callback_user = user;
     }
     
     std::shared_ptr<Logger> LoggerManager::getLogger() 
     { return s_logger; }
     
-    void LoggerManager::createLogger() {
-        s_logger = std::make_shared<Logger>();
+    void LoggerManager::createLogger(bool use_stderr) {
+        s_logger = std::make_shared<Logger>("cal", use_stderr);
     }
 
 } // namespace cation::debug
\ No newline at end of file
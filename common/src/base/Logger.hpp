@@ -5,6 +5,7 @@
 #include <string>
 #include <sstream>
 #include <memory>
+#include <mutex>
 #include "base/types/String.hpp"
 #include "globals.hpp"
 
@@ -20,6 +21,9 @@ namespace cal {
         LogWarn, LogError, LogDebug, LogInfo, LogTrace
     };
 
+    // sees every message after the backend did, under the logger lock so never concurrently
+    using LogCallback = void (*)(LogLevel level, const char* message, void* user);
+
     class Logger
     {
     private:
@@ -43,19 +47,24 @@ namespace cal {
 
         void emitLog(LogLevel level);
 
+        // workers log concurrently, the message buffer is shared
         template <typename... T> 
         void log(LogLevel level, const T&... args) {
+            std::lock_guard<std::mutex> lock(m_mutex);
             int tmp[] = { (addLog(args), 0) ... };
             (void)tmp;
             emitLog(level);
         }
 
     public:
-        Logger(const char* name = "cal") {
-            init(name);
+        // use_stderr keeps stdout free for protocol output (lsp mode)
+        Logger(const char* name = "cal", bool use_stderr = false) {
+            init(name, use_stderr);
         }
 
-        void init(const char* name = "cal");
+        void init(const char* name = "cal", bool use_stderr = false);
+        // nullptr removes it, a call returns once no message is handed to the previous callback anymore
+        void setCallback(LogCallback callback, void* user);
 
         template <typename... T> 
         void info(const T&... args) 
@@ -79,19 +88,23 @@ namespace cal {
 
     private:
         std::stringstream ss;
+        std::mutex m_mutex;
         std::shared_ptr<spdlog::logger> m_backend;
+        LogCallback m_callback = nullptr;
+        void* m_callback_user = nullptr;
     };
 
     class LoggerManager {
     public:
         static std::shared_ptr<Logger> getLogger();
-        static void createLogger();
+        static void createLogger(bool use_stderr = false);
     private:
         static std::shared_ptr<Logger> s_logger;
     };
 }
 
 #define InitLogger() ::cal::LoggerManager::createLogger()
+#define InitStderrLogger() ::cal::LoggerManager::createLogger(true)
 
 #define LogInfo(...)  ::cal::LoggerManager::getLogger()->info(__VA_ARGS__)
 #define LogWarn(...)  ::cal::LoggerManager::getLogger()->warn(__VA_ARGS__)
@@ -1,31 +1,71 @@
 #include "Allocators.hpp"
 
 #include "base/math/Math.hpp"
-#include "system/StdLibExt.hpp"
+#include "base/threading/Atomic.hpp"
 #include "system/Sys.hpp"
 
+#include <cstddef>
+
 namespace cal {
 
+    static thread_local AllocationCounters s_thread_counters;
+
+
+    static CAL_FORCE_INLINE void countAllocation(size_t size) {
+        ++s_thread_counters.count;
+        s_thread_counters.bytes += size;
+    }
+
+
+    AllocationCounters getThreadAllocationCounters() {
+        return s_thread_counters;
+    }
+
+
+    // four bins per doubling above 64 bytes, rounding loses at most 20%. sizes past 16 are multiples of 16
+    static constexpr u32 BIN_SIZES[Allocator::BIN_COUNT] = {
+        8, 16, 32, 48, 64,
+        80, 96, 112, 128,
+        160, 192, 224, 256,
+        320, 384, 448, 512,
+        640, 768, 896, 1024,
+        1280, 1536, 1792, 2048,
+        2560, 3072, 3584, 4096
+    };
+
+    static constexpr u64 ARENA_SIZE = (u64)PAGE_SIZE * MAX_PAGE_COUNT;
+    static constexpr u64 SPAN_GRANULARITY = 4096;
+    static constexpr u32 SPAN_HEADER_SIZE = 64;
+    static constexpr u64 SPAN_CACHE_COMMITTED = 32 * 1024 * 1024;   // free spans keep at most this much committed
+    static constexpr u64 SPAN_CACHE_RESERVED = 256 * 1024 * 1024;   // and reserved, the oldest go first
+
     static u32 sizeToBin(size_t n) {
         ASSERT(n > 0);
         ASSERT(n <= SMALL_ALLOC_MAX_SIZE);
+        if (n <= 64) return n <= 8 ? 0 : n <= 16 ? 1 : n <= 32 ? 2 : n <= 48 ? 3 : 4;
 #ifdef _WIN32
-        unsigned long res;
-        return _BitScanReverse(&res, ((unsigned long)n - 1) >> 2) ? res : 0;
+        unsigned long shift;
+        _BitScanReverse(&shift, (unsigned long)n - 1);
 #else
-        size_t tmp = (n - 1) >> 2;
-        auto res = tmp == 0 ? 0 : 31 - __builtin_clz(tmp);
-        ASSERT(res <= lengthOf(((Allocator*)nullptr)->m_free_lists));
-        return res;
+        const u32 shift = 31 - __builtin_clz((u32)n - 1);
 #endif
+        // n - 1 is in [2^shift, 2^(shift + 1)), split in four
+        const u32 res = 5 + (shift - 6) * 4 + (u32)((n - 1 - (1u << shift)) >> (shift - 2));
+        ASSERT(res < Allocator::BIN_COUNT && BIN_SIZES[res] >= n);
+        return res;
     }
 
     struct Allocator::Page {
+        static constexpr u32 NO_SLOT = 0xffFFffFF;
+
         struct Header {
-            Page* prev;
+            Page* prev;             // pages of the owner with free slots
             Page* next;
-            u32 first_free;
+            ThreadHeap* owner;
+            u32 first_free;         // freed slots, NO_SLOT when there is none
+            u32 bump;               // slots from here on were never handed out
             u32 item_size;
+            u32 used;
         };
         u8 data[PAGE_SIZE - sizeof(Header)];
         Header header;
@@ -33,17 +73,29 @@ namespace cal {
 
     static_assert(sizeof(Allocator::Page) == PAGE_SIZE);
 
+    // start of a large allocation, the pointer handed out is preceded by a pointer back to it
+    struct Allocator::Span {
+        Span* prev;                 // in the cache while free, most recently freed first
+        Span* next;
+        u64 reserved;
+        u64 committed;              // from the start of the span
+    };
+
+    struct Allocator::ThreadHeap : ThreadSlot {
+        Page* pages[BIN_COUNT];         // pages with free slots, allocations come from the first one
+        volatile i64 remote_free;       // slots freed by other threads, linked through their first 8 bytes
+    };
+
     void initPage(u32 item_size, Allocator::Page* page) {
         platform::memCommit(page, PAGE_SIZE);
         page = new (NewPlaceholder(), page) Allocator::Page;
-        page->header.first_free = 0;
+        page->header.first_free = Allocator::Page::NO_SLOT;
+        page->header.bump = 0;
         page->header.prev = nullptr;
         page->header.next = nullptr;
+        page->header.owner = nullptr;
         page->header.item_size = item_size;
-
-        for (u32 i = 0; i < sizeof(page->data) / item_size; ++i) {
-            *(u32*)&page->data[i * item_size] = u32(i * item_size + item_size);
-        }
+        page->header.used = 0;
     }
 
 
@@ -51,21 +103,99 @@ namespace cal {
         return (Allocator::Page*)((uintptr)ptr & ~u64(PAGE_SIZE - 1));
     }
 
+
+    static bool isPageFull(const Allocator::Page* page) {
+        return page->header.first_free == Allocator::Page::NO_SLOT && page->header.bump + page->header.item_size > sizeof(page->data);
+    }
+
+
+    static ThreadSlot* createHeap(void*) {
+        Allocator::ThreadHeap* heap = (Allocator::ThreadHeap*)malloc(sizeof(Allocator::ThreadHeap));
+        memset(heap, 0, sizeof(*heap));
+        return heap;
+    }
+
+
+    // nullptr when the thread already exited or uses too many allocators, it goes through the shared heap then
+    static CAL_FORCE_INLINE Allocator::ThreadHeap* getThreadHeap(Allocator& allocator) {
+        return (Allocator::ThreadHeap*)allocator.m_heaps.get();
+    }
+
+
+    static void linkPage(Allocator::ThreadHeap& heap, u32 bin, Allocator::Page* page) {
+        page->header.prev = nullptr;
+        page->header.next = heap.pages[bin];
+        if (heap.pages[bin]) heap.pages[bin]->header.prev = page;
+        heap.pages[bin] = page;
+    }
+
+
+    static void unlinkPage(Allocator::ThreadHeap& heap, u32 bin, Allocator::Page* page) {
+        if (heap.pages[bin] == page) heap.pages[bin] = page->header.next;
+        if (page->header.next) page->header.next->header.prev = page->header.prev;
+        if (page->header.prev) page->header.prev->header.next = page->header.next;
+        page->header.next = page->header.prev = nullptr;
+    }
+
+
+    // called by the owner of the page (or under m_mutex for the shared heap)
+    static void freeLocal(Allocator& allocator, Allocator::ThreadHeap& heap, Allocator::Page* page, u8* ptr) {
+        const u32 bin = sizeToBin(page->header.item_size);
+        const bool was_full = isPageFull(page);
+        *(u32*)ptr = page->header.first_free;
+        page->header.first_free = u32(ptr - page->data);
+        --page->header.used;
+
+        if (was_full) {
+            linkPage(heap, bin, page);
+            return;
+        }
+
+        // keep one page per bin, hand the other empty ones back so other threads and bins can use them
+        const bool is_only_page = !page->header.prev && !page->header.next;
+        if (page->header.used > 0 || is_only_page || &heap == allocator.m_shared_heap) return;
+
+        unlinkPage(heap, bin, page);
+        MutexGuard guard(allocator.m_mutex);
+        page->header.owner = nullptr;
+        page->header.next = allocator.m_free_pages;
+        allocator.m_free_pages = page;
+    }
+
+
+    static void freeRemote(Allocator::ThreadHeap& owner, void* ptr) {
+        for (;;) {
+            const i64 head = owner.remote_free;
+            *(i64*)ptr = head;
+            // only the owner pops, and it takes the whole list at once, so there is no ABA to care about
+            if (compareAndExchange64(&owner.remote_free, (i64)ptr, head)) return;
+        }
+    }
+
+
+    static void collectRemoteFrees(Allocator& allocator, Allocator::ThreadHeap& heap) {
+        i64 head = heap.remote_free;
+        while (head && !compareAndExchange64(&heap.remote_free, 0, head)) head = heap.remote_free;
+
+        while (head) {
+            u8* ptr = (u8*)head;
+            head = *(i64*)ptr;
+            freeLocal(allocator, heap, getPage(ptr), ptr);
+        }
+    }
+
+
     static void freeSmall(Allocator& allocator, void* mem) {
         u8* ptr = (u8*)mem;
         Allocator::Page* page = getPage(ptr);
+        Allocator::ThreadHeap* owner = page->header.owner;
+        ASSERT(owner);
 
-        MutexGuard guard(allocator.m_mutex);
-        if (page->header.first_free + page->header.item_size > sizeof(page->data)) {
-            ASSERT(!page->header.next);
-            ASSERT(!page->header.prev);
-            const u32 bin = sizeToBin(page->header.item_size);
-            page->header.next = allocator.m_free_lists[bin];
-            allocator.m_free_lists[bin] = page;
+        if (owner == allocator.m_heaps.find()) {
+            freeLocal(allocator, *owner, page, ptr);
+            return;
         }
-
-        *(u32*)ptr = page->header.first_free;
-        page->header.first_free = u32(ptr - page->data);
+        freeRemote(*owner, ptr);
     }
 
     static void* reallocSmallAligned(Allocator& allocator, void* mem, size_t n, size_t align) {
@@ -81,94 +211,266 @@ namespace cal {
         return new_mem;
     }
 
-    static void* allocSmall(Allocator& allocator, size_t n) {
-        const u32 bin = sizeToBin(n);
 
-        MutexGuard guard(allocator.m_mutex);
+    // huge pages only for reservations made of whole huge pages
+    static void* reserve(const Allocator& allocator, u64 size) {
+        const u32 huge_page_size = platform::getHugePageSize();
+        const bool huge = huge_page_size != 0 && size % huge_page_size == 0;
+        return platform::memReserve(size, huge ? allocator.m_huge_pages : platform::HugePages::None, allocator.m_numa_node);
+    }
 
-        if (!allocator.m_small_allocations) {
-            allocator.m_small_allocations = (u8*)platform::memReserve(PAGE_SIZE * MAX_PAGE_COUNT);
-        }
-        Allocator::Page* p = allocator.m_free_lists[bin];
-        if (!p) {
-            if (allocator.m_page_count == MAX_PAGE_COUNT) return nullptr;
 
-            p = (Allocator::Page*)(allocator.m_small_allocations + PAGE_SIZE * allocator.m_page_count);
-            initPage(8 << bin, p);
-            allocator.m_free_lists[bin] = p;
+    // pages have to be aligned to their size so getPage() can find them, huge pages already are
+    static u64 getArenaReservedSize(const Allocator& allocator) {
+        const u32 huge_page_size = platform::getHugePageSize();
+        const bool huge = allocator.m_huge_pages != platform::HugePages::None && huge_page_size != 0
+            && huge_page_size % PAGE_SIZE == 0 && ARENA_SIZE % huge_page_size == 0;
+        return huge ? ARENA_SIZE : ARENA_SIZE + PAGE_SIZE;
+    }
+
+
+    static bool addArena(Allocator& allocator) {
+        const i32 count = allocator.m_arena_count;
+        if (count == Allocator::MAX_ARENA_COUNT) return false;
+
+        u8* reservation = (u8*)reserve(allocator, getArenaReservedSize(allocator));
+        if (!reservation) return false;
+        allocator.m_arena_reservations[count] = reservation;
+        allocator.m_arenas[count] = (u8*)(((uintptr)reservation + PAGE_SIZE - 1) & ~uintptr(PAGE_SIZE - 1));
+        allocator.m_page_count = 0;
+        // isSmallAlloc() reads the arenas without locking
+        memoryBarrier();
+        allocator.m_arena_count = count + 1;
+        return true;
+    }
+
+
+    static Allocator::Page* takePage(Allocator& allocator, Allocator::ThreadHeap& heap, u32 bin, bool locked) {
+        if (!locked) allocator.m_mutex.enter();
+
+        Allocator::Page* p = allocator.m_free_pages;
+        if (p) {
+            allocator.m_free_pages = p->header.next;
+        }
+        else if ((allocator.m_arena_count > 0 && allocator.m_page_count < MAX_PAGE_COUNT) || addArena(allocator)) {
+            u8* arena = allocator.m_arenas[allocator.m_arena_count - 1];
+            p = (Allocator::Page*)(arena + PAGE_SIZE * allocator.m_page_count);
             ++allocator.m_page_count;
         }
 
-        ASSERT(p->header.item_size > 0);
-        ASSERT(p->header.first_free + n < sizeof(p->data));
-        void* res = &p->data[p->header.first_free];
-        p->header.first_free = *(u32*)res;
+        if (!locked) allocator.m_mutex.exit();
+        if (!p) return nullptr;
 
-        const bool is_page_full = p->header.first_free + p->header.item_size > sizeof(p->data);
-        if (is_page_full) {
-            if (allocator.m_free_lists[bin] == p) {
-                allocator.m_free_lists[bin] = p->header.next;
-            }
-            if (p->header.next) {
-                p->header.next->header.prev = p->header.prev;
-            }
-            if (p->header.prev) {
-                p->header.prev->header.next = p->header.next;
+        initPage(BIN_SIZES[bin], p);
+        p->header.owner = &heap;
+        linkPage(heap, bin, p);
+        return p;
+    }
+
+
+    static void* allocFromHeap(Allocator& allocator, Allocator::ThreadHeap& heap, size_t n, bool locked) {
+        const u32 bin = sizeToBin(n);
+
+        Allocator::Page* p = heap.pages[bin];
+        if (!p) {
+            collectRemoteFrees(allocator, heap);
+            p = heap.pages[bin];
+            if (!p) {
+                p = takePage(allocator, heap, bin, locked);
+                if (!p) return nullptr;
             }
-            p->header.next = p->header.prev = nullptr;
         }
 
+        void* res;
+        if (p->header.first_free != Allocator::Page::NO_SLOT) {
+            res = &p->data[p->header.first_free];
+            p->header.first_free = *(u32*)res;
+        }
+        else {
+            // never touching slots before they are needed keeps pages of rarely used bins mostly uncommitted
+            res = &p->data[p->header.bump];
+            p->header.bump += p->header.item_size;
+        }
+        ++p->header.used;
+
+        if (isPageFull(p)) unlinkPage(heap, bin, p);
         return res;
     }
 
+    static void* allocSmall(Allocator& allocator, size_t n) {
+        Allocator::ThreadHeap* heap = getThreadHeap(allocator);
+        if (heap) return allocFromHeap(allocator, *heap, n, false);
+
+        MutexGuard guard(allocator.m_mutex);
+        return allocFromHeap(allocator, *allocator.m_shared_heap, n, true);
+    }
+
     static bool isSmallAlloc(Allocator& allocator, void* p) {
-        return allocator.m_small_allocations && p >= allocator.m_small_allocations && p < allocator.m_small_allocations + (PAGE_SIZE * MAX_PAGE_COUNT);
+        const i32 count = allocator.m_arena_count;
+        for (i32 i = 0; i < count; ++i) {
+            const u8* arena = allocator.m_arenas[i];
+            if (p >= arena && p < arena + ARENA_SIZE) return true;
+        }
+        return false;
     }
 
-    Allocator::Allocator() {
-        m_page_count = 0;
-        memset(m_free_lists, 0, sizeof(m_free_lists));
+
+    static void unlinkSpan(Allocator& allocator, Allocator::Span* span) {
+        if (span->prev) span->prev->next = span->next;
+        else allocator.m_spans_head = span->next;
+        if (span->next) span->next->prev = span->prev;
+        else allocator.m_spans_tail = span->prev;
+        allocator.m_cached_reserved -= span->reserved;
+        allocator.m_cached_committed -= span->committed;
     }
 
-    Allocator::~Allocator() {
-        platform::memRelease(m_small_allocations, PAGE_SIZE * MAX_PAGE_COUNT);
+
+    static Allocator::Span* takeCachedSpan(Allocator& allocator, u64 size) {
+        MutexGuard guard(allocator.m_span_mutex);
+        for (Allocator::Span* span = allocator.m_spans_head; span; span = span->next) {
+            // do not waste more than half of a span
+            if (span->reserved >= size && span->reserved - size <= size / 2) {
+                unlinkSpan(allocator, span);
+                return span;
+            }
+        }
+        return nullptr;
     }
 
-#ifdef _WIN32
-    void* Allocator::allocate(size_t size, size_t align)
-    {
-        if (size <= SMALL_ALLOC_MAX_SIZE && align <= size) {
-            return allocSmall(*this, size);
+
+    // growable spans reserve twice what they commit, so reallocating them again mostly stays in place
+    static void* allocLarge(Allocator& allocator, size_t size, size_t align, bool growable) {
+        // align 0 means "don't care", the rounding below needs a power of two
+        align = maximum(align, alignof(max_align_t));
+        const u64 slack = align > SPAN_HEADER_SIZE ? align : 0;
+        const u64 needed = (SPAN_HEADER_SIZE + slack + size + SPAN_GRANULARITY - 1) & ~(SPAN_GRANULARITY - 1);
+
+        Allocator::Span* span = takeCachedSpan(allocator, needed);
+        if (!span) {
+            u64 reserved = growable ? needed * 2 : needed;
+            const u32 huge_page_size = platform::getHugePageSize();
+            if (allocator.m_huge_pages != platform::HugePages::None && huge_page_size != 0 && reserved >= huge_page_size) {
+                reserved = (reserved + huge_page_size - 1) & ~u64(huge_page_size - 1);
+            }
+            span = (Allocator::Span*)reserve(allocator, reserved);
+            if (!span) return nullptr;
+            platform::memCommit(span, needed);
+            span->reserved = reserved;
+            span->committed = needed;
+        }
+        else if (span->committed < needed) {
+            platform::memCommit((u8*)span + span->committed, needed - span->committed);
+            span->committed = needed;
         }
-        return _aligned_malloc(size, align);
+
+        u8* ptr = (u8*)(((uintptr)span + SPAN_HEADER_SIZE + align - 1) & ~uintptr(align - 1));
+        ((Allocator::Span**)ptr)[-1] = span;
+        return ptr;
     }
 
 
-    void Allocator::deallocate(void* ptr)
-    {
-        if (isSmallAlloc(*this, ptr)) {
-            freeSmall(*this, ptr);
+    static void freeLarge(Allocator& allocator, void* ptr) {
+        if (!ptr) return;
+
+        Allocator::Span* span = ((Allocator::Span**)ptr)[-1];
+        if (span->reserved > SPAN_CACHE_RESERVED / 4) {
+            platform::memRelease(span, span->reserved);
             return;
         }
-        _aligned_free(ptr);
+
+        MutexGuard guard(allocator.m_span_mutex);
+        span->prev = nullptr;
+        span->next = allocator.m_spans_head;
+        if (span->next) span->next->prev = span;
+        else allocator.m_spans_tail = span;
+        allocator.m_spans_head = span;
+        allocator.m_cached_reserved += span->reserved;
+        allocator.m_cached_committed += span->committed;
+
+        // spans idle for the longest give their memory back first, the header page stays committed
+        while (allocator.m_cached_reserved > SPAN_CACHE_RESERVED) {
+            Allocator::Span* oldest = allocator.m_spans_tail;
+            unlinkSpan(allocator, oldest);
+            platform::memRelease(oldest, oldest->reserved);
+        }
+        Allocator::Span* prev;
+        for (Allocator::Span* old = allocator.m_spans_tail; old && allocator.m_cached_committed > SPAN_CACHE_COMMITTED; old = prev) {
+            prev = old->prev;
+            if (old->committed <= SPAN_GRANULARITY) continue;
+            if (platform::memDecommit((u8*)old + SPAN_GRANULARITY, old->committed - SPAN_GRANULARITY)) {
+                allocator.m_cached_committed -= old->committed - SPAN_GRANULARITY;
+                old->committed = SPAN_GRANULARITY;
+            }
+            else {
+                // explicit huge pages can't be given back piecewise, the whole span goes
+                unlinkSpan(allocator, old);
+                platform::memRelease(old, old->reserved);
+            }
+        }
     }
 
 
-    void* Allocator::reallocate(void* ptr, size_t new_size, size_t old_size, size_t align)
+    static void* allocate(Allocator& allocator, size_t size, size_t align) {
+        const size_t n = maximum(size, align);
+        if (n > 0 && n <= SMALL_ALLOC_MAX_SIZE) {
+            // bins that are not a power of two only keep 16 byte alignment
+            return allocSmall(allocator, align > 16 ? nextPow2((u32)n) : n);
+        }
+        return allocLarge(allocator, size, align, false);
+    }
+
+
+    static void* reallocLarge(Allocator& allocator, void* ptr, size_t new_size, size_t old_size, size_t align) {
+        Allocator::Span* span = ((Allocator::Span**)ptr)[-1];
+        const u64 offset = (u8*)ptr - (u8*)span;
+        if (offset + new_size <= span->reserved) {
+            const u64 needed = (offset + new_size + SPAN_GRANULARITY - 1) & ~(SPAN_GRANULARITY - 1);
+            if (needed > span->committed) {
+                platform::memCommit((u8*)span + span->committed, needed - span->committed);
+                span->committed = needed;
+            }
+            return ptr;
+        }
+
+        void* new_mem = allocLarge(allocator, new_size, align, true);
+        if (!new_mem) return nullptr;
+        memcpy(new_mem, ptr, minimum(new_size, old_size));
+        freeLarge(allocator, ptr);
+        return new_mem;
+    }
+
+    Allocator::Allocator(platform::HugePages huge_pages, i32 numa_node)
+        : m_huge_pages(huge_pages)
+        , m_numa_node(numa_node)
+        , m_heaps(this, m_mutex, &createHeap)
     {
-        if (isSmallAlloc(*this, ptr)) {
-            return reallocSmallAligned(*this, ptr, new_size, align);
+        m_page_count = 0;
+        m_shared_heap = (ThreadHeap*)m_heaps.create();
+    }
+
+    Allocator::~Allocator() {
+        // threads that still have a heap here forget about it, they must not use this allocator anymore
+        ThreadSlot* heap = m_heaps.detach();
+        while (heap) {
+            ThreadSlot* next = heap->next;
+            free(heap);
+            heap = next;
+        }
+        while (m_spans_head) {
+            Span* next = m_spans_head->next;
+            platform::memRelease(m_spans_head, m_spans_head->reserved);
+            m_spans_head = next;
+        }
+        for (i32 i = 0; i < m_arena_count; ++i) {
+            platform::memRelease(m_arena_reservations[i], getArenaReservedSize(*this));
         }
-        return _aligned_realloc(ptr, new_size, align);
     }
-#else
+
+
     void* Allocator::allocate(size_t size, size_t align)
     {
-        if (size <= SMALL_ALLOC_MAX_SIZE && align <= size) {
-            return allocSmall(*this, size);
-        }
-        void* ptr = platform::toy_aligned_alloc(size, align);
-        return ptr;
+        countAllocation(size);
+        return cal::allocate(*this, size, align);
     }
 
 
@@ -178,29 +480,21 @@ namespace cal {
             freeSmall(*this, ptr);
             return;
         }
-        free(ptr);
+        freeLarge(*this, ptr);
     }
 
 
     void* Allocator::reallocate(void* ptr, size_t new_size, size_t old_size, size_t align)
     {
-        if (isSmallAlloc(*this, ptr)) {
-            return reallocSmallAligned(*this, ptr, new_size, align);
-        }
-        // POSIX and glibc do not provide a way to realloc with alignment preservation
+        if (new_size > 0) countAllocation(new_size);
+        if (!ptr) return new_size > 0 ? cal::allocate(*this, new_size, align) : nullptr;
         if (new_size == 0) {
-            free(ptr);
+            deallocate(ptr);
             return nullptr;
         }
-        void* newptr = platform::toy_aligned_alloc(align, new_size);
-        if (newptr == nullptr) {
-            return nullptr;
+        if (isSmallAlloc(*this, ptr)) {
+            return reallocSmallAligned(*this, ptr, new_size, align);
         }
-        if (ptr) memcpy(newptr, ptr, minimum(new_size, old_size));
-        free(ptr);
-        return newptr;
+        return reallocLarge(*this, ptr, new_size, old_size, align);
     }
-#endif
-
-
-}
\ No newline at end of file
+}
@@ -2,26 +2,49 @@
 
 #include "globals.hpp"
 #include "IAllocator.hpp"
+#include "ThreadSlots.hpp"
 #include "base/threading/SyncMutex.hpp"
+#include "system/Sys.hpp"
 
 namespace cal {
-    
+
     // use buckets for small allocations - relatively fast
-    // fallback to system allocator for big allocations
+    // bigger allocations get their own span of reserved memory, freed spans are cached for reuse
+    // and decommitted when they stay unused
     // use case: use this unless you really require something special
+    // every thread allocates from its own pages without locking, a free from another thread goes
+    // to the owner's remote free list, the mutex is only taken to hand whole pages around
+    // arenas and large spans can be backed by huge pages (fewer tlb misses) and prefer one numa node
     struct Allocator final : IAllocator {
         struct Page;
+        struct ThreadHeap;
+        struct Span;
+
+        static constexpr u32 BIN_COUNT = 29;
+        static constexpr i32 MAX_ARENA_COUNT = 64;
 
-        Allocator();
+        explicit Allocator(platform::HugePages huge_pages = platform::HugePages::None, i32 numa_node = -1);
         ~Allocator();
 
         void* allocate(size_t size, size_t align) override;
         void deallocate(void* ptr) override;
         void* reallocate(void* ptr, size_t new_size, size_t old_size, size_t align) override;
 
-        u8* m_small_allocations = nullptr;
-        Page* m_free_lists[4];
-        u32 m_page_count = 0;
+        platform::HugePages m_huge_pages;
+        i32 m_numa_node;                        // -1 for any
+        u8* m_arenas[MAX_ARENA_COUNT] = {};     // MAX_PAGE_COUNT pages each, another is reserved when the last fills up
+        u8* m_arena_reservations[MAX_ARENA_COUNT] = {};
+        volatile i32 m_arena_count = 0;
+        u32 m_page_count = 0;                   // pages used in the last arena
+        Page* m_free_pages = nullptr;           // emptied pages given back by the heaps, any bin
         Mutex m_mutex;
+        ThreadSlotList m_heaps;                 // a heap per thread, heaps of exited threads are adopted by new ones
+        ThreadHeap* m_shared_heap = nullptr;    // used under m_mutex by threads that have no heap
+
+        Span* m_spans_head = nullptr;           // free spans, most recently freed first
+        Span* m_spans_tail = nullptr;
+        u64 m_cached_reserved = 0;
+        u64 m_cached_committed = 0;
+        Mutex m_span_mutex;
     };
-}
\ No newline at end of file
+}
@@ -4,9 +4,18 @@
 
 namespace cal {
 
-    static constexpr u32 PAGE_SIZE = 4096;
-    static constexpr size_t MAX_PAGE_COUNT = 16384;
-    static constexpr u32 SMALL_ALLOC_MAX_SIZE = 64;
+    static constexpr u32 PAGE_SIZE = 64 * 1024;     // Allocator page, holds slots of one size class
+    static constexpr size_t MAX_PAGE_COUNT = 1024;  // per arena
+    static constexpr u32 SMALL_ALLOC_MAX_SIZE = 4096;
+
+    // allocation activity of the calling thread, counted by Allocator
+    // reallocations count as a new allocation of the new size
+    struct AllocationCounters {
+        u64 count = 0;
+        u64 bytes = 0;
+    };
+
+    AllocationCounters getThreadAllocationCounters();
 
     void initPage(u32 item_size, Allocator::Page *page);
     // used for stuff that can't access engine's allocator
@@ -3,60 +3,221 @@
 #include "base/threading/Atomic.hpp"
 #include "base/math/Math.hpp"
 
+#include <cstring>
+
 namespace cal {
 
-    LinearAllocator::LinearAllocator(u32 reserved) {
-        m_end = 0;
-        m_commited_bytes = 0;
-        m_reserved = reserved;
-        m_mem = (u8*)platform::memReserve(reserved);
+    static constexpr i64 CHUNK_HEADER_SIZE = 64;
+    static constexpr i64 COMMIT_SIZE = 64 * 1024;
+    static constexpr u64 MAX_CHUNK_GROWTH = 256 * 1024 * 1024;   // chunks double up to this size
+    static constexpr u32 MIN_ALIGN = 8;                         // every end is a multiple of this
+    static constexpr u32 SCRATCH_RESERVED = 16 * 1024 * 1024;
+
+    // lives at the start of its reservation, offsets are from the chunk
+    struct LinearAllocator::Chunk {
+        Chunk* prev;
+        u64 reserved;
+        volatile i64 end;
+        volatile i64 commited;
+    };
+
+    static_assert(sizeof(LinearAllocator::Chunk) <= CHUNK_HEADER_SIZE);
+
+    volatile i64 LinearAllocator::g_total_commited_bytes = 0;
+
+    static u64 roundUp(u64 val, u64 align) {
+        ASSERT(isPowOfTwo(align));
+        return (val + align - 1) & ~(align - 1);
+    }
+
+    LinearAllocator::LinearAllocator(u32 reserved, bool shared, platform::HugePages huge_pages, i32 numa_node)
+        : m_reserved(reserved)
+        , m_shared(shared)
+        , m_huge_pages(huge_pages)
+        , m_numa_node(numa_node)
+    {
+        m_first = createChunk(reserved);
+        m_current = (i64)m_first;
     }
 
     LinearAllocator::~LinearAllocator() {
-        ASSERT(m_end == 0);
-        platform::memRelease(m_mem, m_reserved);
-        atomicSubtract(&g_total_commited_bytes, m_commited_bytes);
+        ASSERT((Chunk*)m_current == m_first && m_first->end == CHUNK_HEADER_SIZE);
+        if (m_spare) releaseMemory((Chunk*)m_spare);
+        releaseMemory(m_first);
+    }
+
+    LinearAllocator::Chunk* LinearAllocator::createChunk(u64 size) {
+        const u32 huge_page_size = platform::getHugePageSize();
+        const bool huge = m_huge_pages != platform::HugePages::None && huge_page_size != 0;
+        size = roundUp(maximum(size, (u64)COMMIT_SIZE), huge ? maximum((u64)huge_page_size, (u64)COMMIT_SIZE) : COMMIT_SIZE);
+        Chunk* chunk = (Chunk*)platform::memReserve(size, huge ? m_huge_pages : platform::HugePages::None, m_numa_node);
+        platform::memCommit(chunk, COMMIT_SIZE);
+        atomicAdd(&m_commited_bytes, COMMIT_SIZE);
+        atomicAdd(&g_total_commited_bytes, COMMIT_SIZE);
+
+        chunk->prev = nullptr;
+        chunk->reserved = size;
+        chunk->end = CHUNK_HEADER_SIZE;
+        chunk->commited = COMMIT_SIZE;
+        return chunk;
+    }
+
+    void LinearAllocator::releaseMemory(Chunk* chunk) {
+        atomicSubtract(&m_commited_bytes, chunk->commited);
+        atomicSubtract(&g_total_commited_bytes, chunk->commited);
+        platform::memRelease(chunk, chunk->reserved);
+    }
+
+    // the biggest dropped chunk stays reserved for the next grow(), the rest goes back to the system
+    void LinearAllocator::releaseChunk(Chunk* chunk) {
+        Chunk* spare = (Chunk*)m_spare;
+        if (spare && spare->reserved >= chunk->reserved) {
+            releaseMemory(chunk);
+            return;
+        }
+
+        const i64 decommited = chunk->commited - COMMIT_SIZE;
+        if (decommited > 0 && platform::memDecommit((u8*)chunk + COMMIT_SIZE, decommited)) {
+            atomicSubtract(&m_commited_bytes, decommited);
+            atomicSubtract(&g_total_commited_bytes, decommited);
+            chunk->commited = COMMIT_SIZE;
+        }
+        chunk->prev = nullptr;
+        chunk->end = CHUNK_HEADER_SIZE;
+        m_spare = (i64)chunk;
+        if (spare) releaseMemory(spare);
     }
 
     void LinearAllocator::reset() {
-        m_end = 0;
+        restore({ m_first, CHUNK_HEADER_SIZE });
     }
 
-    static u32 roundUp(u32 val, u32 align) {
-        ASSERT(isPowOfTwo(align));
-        return (val + align - 1) & ~(align - 1);
+    LinearAllocator::Mark LinearAllocator::getMark() const {
+        Chunk* chunk = (Chunk*)m_current;
+        return { chunk, chunk->end };
     }
 
-    void* LinearAllocator::allocate(size_t size, size_t align) {
-        ASSERT(size < 0xffFFffFF);
-        u32 start;
+    void LinearAllocator::restore(const Mark& mark) {
+        Chunk* chunk = (Chunk*)m_current;
+        while (chunk != mark.chunk) {
+            ASSERT(chunk != m_first);
+            Chunk* prev = chunk->prev;
+            releaseChunk(chunk);
+            chunk = prev;
+        }
+        ASSERT(mark.end <= chunk->end || chunk->end > (i64)chunk->reserved);
+        chunk->end = mark.end;
+        m_current = (i64)chunk;
+    }
+
+    // a chunk stays committed up to its high water mark until it is released
+    void LinearAllocator::commit(Chunk* chunk, i64 end) {
+        const i64 target = (i64)minimum(roundUp(end, COMMIT_SIZE), chunk->reserved);
         for (;;) {
-            const u32 end = m_end;
-            start = roundUp(end, (u32)align);
-            if (compareAndExchange(&m_end, u32(start + size), end)) break;
+            const i64 commited = chunk->commited;
+            if (end <= commited) return;
+
+            // committing twice is harmless, only the thread that moves the mark counts the bytes
+            platform::memCommit((u8*)chunk + commited, target - commited);
+            if (!m_shared) {
+                chunk->commited = target;
+            }
+            else if (!compareAndExchange64(&chunk->commited, target, commited)) {
+                continue;
+            }
+            atomicAdd(&m_commited_bytes, target - commited);
+            atomicAdd(&g_total_commited_bytes, target - commited);
+            return;
         }
+    }
 
-        if (start + size <= m_commited_bytes) return m_mem + start;
+    // chains a chunk with room for size bytes after full, unless another thread already did
+    void LinearAllocator::grow(Chunk* full, u64 size) {
+        if ((Chunk*)m_current != full) return;
 
-        MutexGuard guard(m_mutex);
-        if (start + size <= m_commited_bytes) return m_mem + start;
+        const u64 needed = roundUp(CHUNK_HEADER_SIZE + size, COMMIT_SIZE);
+        const u64 chunk_size = maximum(needed, minimum(full->reserved * 2, MAX_CHUNK_GROWTH));
 
-        const u32 commited = roundUp(start + (u32)size, 4096);
-        ASSERT(commited < m_reserved);
-        platform::memCommit(m_mem + m_commited_bytes, commited - m_commited_bytes);
-        atomicAdd(&g_total_commited_bytes, commited - m_commited_bytes);
-        m_commited_bytes = commited;
+        Chunk* chunk = nullptr;
+        const i64 spare = m_spare;
+        if (spare && ((Chunk*)spare)->reserved >= needed) {
+            if (!m_shared) {
+                m_spare = 0;
+                chunk = (Chunk*)spare;
+            }
+            else if (compareAndExchange64(&m_spare, 0, spare)) {
+                chunk = (Chunk*)spare;
+            }
+        }
+        if (!chunk) chunk = createChunk(maximum(chunk_size, (u64)m_reserved));
+        chunk->prev = full;
 
-        return m_mem + start;
+        if (!m_shared) {
+            m_current = (i64)chunk;
+            return;
+        }
+        if (compareAndExchange64(&m_current, (i64)chunk, (i64)full)) return;
+
+        // somebody else chained one first
+        releaseMemory(chunk);
     }
 
-    volatile i64 LinearAllocator::g_total_commited_bytes = 0;
+    void* LinearAllocator::allocate(size_t size, size_t align) {
+        align = maximum(align, (size_t)MIN_ALIGN);
+        // ends stay multiples of MIN_ALIGN, a shared instance can't know the start and pads for bigger alignments
+        const i64 padding = m_shared ? (i64)align - MIN_ALIGN : 0;
+        const i64 needed = (i64)roundUp(size, MIN_ALIGN) + padding;
+        for (;;) {
+            Chunk* chunk = (Chunk*)m_current;
+            i64 start;
+            i64 end;
+            if (m_shared) {
+                start = atomicAdd(&chunk->end, needed);
+                end = start + needed;
+            }
+            else {
+                start = chunk->end;
+                end = (i64)roundUp(start, align) + needed;
+                chunk->end = end;
+            }
+
+            if (end <= (i64)chunk->reserved) {
+                if (end > chunk->commited) commit(chunk, end);
+                return (u8*)chunk + roundUp(start, align);
+            }
+
+            // the chunk is full, its end stays past the reservation until a restore() moves it back
+            grow(chunk, needed + align);
+        }
+    }
 
     void LinearAllocator::deallocate(void* ptr) { /*everything should be "deallocated" with reset()*/ }
+
     void* LinearAllocator::reallocate(void* ptr, size_t new_size, size_t old_size, size_t align) {
         if (!ptr) return allocate(new_size, align);
-        // realloc not supported
-        ASSERT(false);
-        return nullptr;
+
+        Chunk* chunk = (Chunk*)m_current;
+        const i64 offset = (u8*)ptr - (u8*)chunk;
+        const i64 old_end = offset + (i64)roundUp(old_size, MIN_ALIGN);
+        const i64 new_end = offset + (i64)roundUp(new_size, MIN_ALIGN);
+        if (offset >= CHUNK_HEADER_SIZE && old_end == chunk->end && new_end <= (i64)chunk->reserved) {
+            bool resized = true;
+            if (m_shared) resized = compareAndExchange64(&chunk->end, new_end, old_end);
+            else chunk->end = new_end;
+
+            if (resized) {
+                if (new_end > chunk->commited) commit(chunk, new_end);
+                return ptr;
+            }
+        }
+
+        void* result = allocate(new_size, align);
+        memcpy(result, ptr, minimum(new_size, old_size));
+        return result;
+    }
+
+    LinearAllocator& getScratchAllocator() {
+        static thread_local LinearAllocator scratch(SCRATCH_RESERVED, false, platform::HugePages::Transparent);
+        return scratch;
     }
-}
\ No newline at end of file
+}
@@ -1,32 +1,74 @@
 #pragma once
 
 #include "IAllocator.hpp"
-#include "base/threading/SyncMutex.hpp"
 #include "globals.hpp"
+#include "system/Sys.hpp"
 
 namespace cal {
-    
+
     // allocations in a row one after another, deallocate everything at once
-    // use case: data for one frame
+    // use case: data for one frame, scratch memory of one task
+    // any thread can allocate, the end is bumped with an atomic add. a full chunk gets a bigger one chained
+    // after it. a mark saves the current end, restoring it drops everything allocated since, chunks included
+    // (nobody may allocate meanwhile). a non shared instance touches no atomics at all
+    // chunks can be backed by huge pages and prefer a numa node, see platform::memReserve()
     struct LinearAllocator : IAllocator {
-        LinearAllocator(u32 reserved);
+        struct Chunk;
+
+        struct Mark {
+            Chunk* chunk;
+            i64 end;
+        };
+
+        explicit LinearAllocator(u32 reserved, bool shared = true, platform::HugePages huge_pages = platform::HugePages::None, i32 numa_node = -1);
         ~LinearAllocator();
 
         void reset();
+        Mark getMark() const;
+        void restore(const Mark& mark);
+
         void* allocate(size_t size, size_t align) override;
         void deallocate(void* ptr) override;
+        // the last allocation grows in place
         void* reallocate(void* ptr, size_t new_size, size_t old_size, size_t align) override;
 
-        u32 getCommitedBytes() const { return m_commited_bytes; }
+        size_t getCommitedBytes() const { return m_commited_bytes; }
         static size_t getTotalCommitedBytes() { return g_total_commited_bytes; }
 
     private:
-        u32 m_commited_bytes;
+        Chunk* createChunk(u64 size);
+        void releaseChunk(Chunk* chunk);
+        void releaseMemory(Chunk* chunk);
+        void grow(Chunk* full, u64 size);
+        void commit(Chunk* chunk, i64 end);
+
+        volatile i64 m_current;         // Chunk*, the one allocations come from
+        Chunk* m_first;
+        volatile i64 m_spare = 0;       // Chunk*, the biggest one restore() dropped
         u32 m_reserved;
-        volatile i32 m_end;
-        u8* m_mem;
-        Mutex m_mutex;
+        bool m_shared;
+        platform::HugePages m_huge_pages;
+        i32 m_numa_node;
+        volatile i64 m_commited_bytes = 0;
 
         static volatile i64 g_total_commited_bytes;
     };
-}
\ No newline at end of file
+
+
+    // everything allocated during the scope is dropped at its end
+    struct LinearAllocatorScope {
+        explicit LinearAllocatorScope(LinearAllocator& allocator) : m_allocator(allocator), m_mark(allocator.getMark()) {}
+        ~LinearAllocatorScope() { m_allocator.restore(m_mark); }
+
+        LinearAllocatorScope(const LinearAllocatorScope&) = delete;
+        void operator =(const LinearAllocatorScope&) = delete;
+
+    private:
+        LinearAllocator& m_allocator;
+        LinearAllocator::Mark m_mark;
+    };
+
+
+    // the calling thread's scratch memory, not shared. use it inside a LinearAllocatorScope
+    LinearAllocator& getScratchAllocator();
+}
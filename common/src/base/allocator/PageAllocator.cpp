@@ -2,10 +2,54 @@
 
 #include "system/Sys.hpp"
 
+#include <cstring>
+
 namespace cal {
 
+    static constexpr u32 PAGE_NUMBER_BITS = 36;    // 48 bit addresses of 4 KiB pages
+    static constexpr u64 PAGE_NUMBER_MASK = (u64(1) << PAGE_NUMBER_BITS) - 1;
+
+    // lives in the first bytes of a free page, the first page of a batch carries the batch
+    struct PageAllocator::FreePage {
+        FreePage* next;             // in the same batch
+        FreePage* next_batch;       // in the stack
+        u32 count;                  // pages in the batch
+    };
+
+    struct PageAllocator::Magazine : ThreadSlot {
+        FreePage* pages;
+        u32 count;
+        i32 allocated;              // minus freed, only the owning thread writes it
+    };
+
+
+    // the counter changes with every push, a stale top seen by popBatch() fails its exchange even when
+    // the same page got pushed again meanwhile
+    static i64 packTop(PageAllocator::FreePage* page, u64 counter) {
+        ASSERT(((uintptr)page >> 12) <= PAGE_NUMBER_MASK);
+        return (i64)(((uintptr)page >> 12) | (counter << PAGE_NUMBER_BITS));
+    }
+
+
+    // no range check, popBatch() reads next_batch without owning the batch and it can be garbage
+    static i64 packStaleTop(PageAllocator::FreePage* page, u64 counter) {
+        return (i64)((((uintptr)page >> 12) & PAGE_NUMBER_MASK) | (counter << PAGE_NUMBER_BITS));
+    }
+
+
+    static PageAllocator::FreePage* getTopPage(i64 top) {
+        return (PageAllocator::FreePage*)(((u64)top & PAGE_NUMBER_MASK) << 12);
+    }
+
+
+    static u64 getTopCounter(i64 top) {
+        return (u64)top >> PAGE_NUMBER_BITS;
+    }
+
+
     PageAllocator::PageAllocator(IAllocator& fallback)
-        : free_pages(fallback)
+        : fallback(fallback)
+        , magazines(this, mutex, &createMagazine, &releaseMagazine)
     {
         ASSERT(platform::getMemPageAlignment() % PAGE_SIZE == 0);
     }
@@ -13,45 +57,128 @@ namespace cal {
 
     PageAllocator::~PageAllocator()
     {
-        ASSERT(allocated_count == 0);
+        ASSERT(getAllocatedCount() == 0);
+
+        // threads that still have a magazine here forget about it, they must not use this allocator anymore
+        ThreadSlot* slot = magazines.detach();
+        while (slot) {
+            Magazine* magazine = (Magazine*)slot;
+            slot = slot->next;
+            FreePage* page = magazine->pages;
+            while (page) {
+                FreePage* tmp = page;
+                page = page->next;
+                platform::memRelease(tmp, PAGE_SIZE);
+            }
+            fallback.deallocate(magazine);
+        }
 
-        void* p;
-        while (free_pages.pop(p)) {
-            platform::memRelease(p, PAGE_SIZE);
+        FreePage* batch = getTopPage(free_batches);
+        while (batch) {
+            FreePage* next_batch = batch->next_batch;
+            FreePage* page = batch;
+            while (page) {
+                FreePage* tmp = page;
+                page = page->next;
+                platform::memRelease(tmp, PAGE_SIZE);
+            }
+            batch = next_batch;
         }
-        while (free_pages.popSecondary(p)) {
-            platform::memRelease(p, PAGE_SIZE);
+    }
+
+
+    u32 PageAllocator::getAllocatedCount() const
+    {
+        MutexGuard guard(mutex);
+        i32 count = allocated_count;
+        for (const ThreadSlot* slot = magazines.getSlots(); slot; slot = slot->next) {
+            count += ((const Magazine*)slot)->allocated;
         }
+        return (u32)count;
+    }
+
+
+    ThreadSlot* PageAllocator::createMagazine(void* owner) {
+        PageAllocator* allocator = (PageAllocator*)owner;
+        Magazine* magazine = (Magazine*)allocator->fallback.allocate(sizeof(Magazine), alignof(Magazine));
+        memset(magazine, 0, sizeof(*magazine));
+        return magazine;
+    }
+
+
+    // the pages go to the other threads, the magazine to the next thread starting
+    void PageAllocator::releaseMagazine(void* owner, ThreadSlot* slot) {
+        PageAllocator* allocator = (PageAllocator*)owner;
+        Magazine* magazine = (Magazine*)slot;
+        if (!magazine->pages) return;
+
+        magazine->pages->count = magazine->count;
+        allocator->pushBatch(magazine->pages);
+        magazine->pages = nullptr;
+        magazine->count = 0;
     }
 
 
-    void PageAllocator::lock()
+    // nullptr when the thread already exited or uses too many page allocators
+    PageAllocator::Magazine* PageAllocator::getMagazine()
     {
-        mutex.enter();
+        return (Magazine*)magazines.get();
     }
 
 
-    void PageAllocator::unlock()
+    void PageAllocator::pushBatch(FreePage* batch)
     {
-        mutex.exit();
+        for (;;) {
+            const i64 top = free_batches;
+            batch->next_batch = getTopPage(top);
+            if (compareAndExchange64(&free_batches, packTop(batch, getTopCounter(top) + 1), top)) return;
+        }
     }
 
 
-    void* PageAllocator::allocate(bool lock)
+    // pages are never released while the allocator lives, reading next_batch of a page another thread
+    // popped meanwhile is harmless and the exchange fails
+    PageAllocator::FreePage* PageAllocator::popBatch()
     {
-        atomicIncrement(&allocated_count);
+        for (;;) {
+            const i64 top = free_batches;
+            FreePage* batch = getTopPage(top);
+            if (!batch) return nullptr;
+            if (compareAndExchange64(&free_batches, packStaleTop(batch->next_batch, getTopCounter(top)), top)) return batch;
+        }
+    }
 
-        void* p;
-        if (free_pages.pop(p)) return p;
 
-        if (lock) mutex.enter();
-        if (free_pages.popSecondary(p)) {
-            if (lock) mutex.exit();
-            return p;
+    void* PageAllocator::allocate()
+    {
+        Magazine* magazine = getMagazine();
+        if (!magazine) {
+            atomicIncrement(&allocated_count);
+            if (FreePage* batch = popBatch()) {
+                // keep the rest of the batch in the stack
+                if (batch->next) {
+                    batch->next->count = batch->count - 1;
+                    pushBatch(batch->next);
+                }
+                return batch;
+            }
+        }
+        else {
+            ++magazine->allocated;
+            if (!magazine->pages) {
+                if (FreePage* batch = popBatch()) {
+                    magazine->pages = batch;
+                    magazine->count = batch->count;
+                }
+            }
+            if (FreePage* page = magazine->pages) {
+                magazine->pages = page->next;
+                --magazine->count;
+                return page;
+            }
         }
 
-        ++reserved_count;
-        if (lock) mutex.exit();
+        atomicIncrement(&reserved_count);
         void* mem = platform::memReserve(PAGE_SIZE);
         ASSERT(uintptr(mem) % PAGE_SIZE == 0);
         platform::memCommit(mem, PAGE_SIZE);
@@ -59,10 +186,31 @@ namespace cal {
     }
 
 
-    void PageAllocator::deallocate(void* mem, bool lock)
+    void PageAllocator::deallocate(void* mem)
     {
-        atomicDecrement(&allocated_count);
-        free_pages.push(mem, lock ? &mutex : nullptr);
+        FreePage* page = (FreePage*)mem;
+        Magazine* magazine = getMagazine();
+        if (!magazine) {
+            atomicDecrement(&allocated_count);
+            page->next = nullptr;
+            page->count = 1;
+            pushBatch(page);
+            return;
+        }
+
+        --magazine->allocated;
+        page->next = magazine->pages;
+        magazine->pages = page;
+        if (++magazine->count < 2 * BATCH_SIZE) return;
+
+        // the newest half stays, it's still in the cache
+        FreePage* last = page;
+        for (u32 i = 1; i < BATCH_SIZE; ++i) last = last->next;
+        FreePage* batch = last->next;
+        last->next = nullptr;
+        batch->count = BATCH_SIZE;
+        magazine->count = BATCH_SIZE;
+        pushBatch(batch);
     }
 
 
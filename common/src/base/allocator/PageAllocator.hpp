@@ -1,32 +1,49 @@
 #pragma once
 
 #include "IAllocator.hpp"
+#include "ThreadSlots.hpp"
 #include "base/threading/Atomic.hpp"
-#include "base/types/RingBuffer.hpp"
+#include "base/threading/SyncMutex.hpp"
 
 namespace cal {
 
+    // 4 KiB pages, freed pages are kept for reuse until the allocator is destroyed
+    // every thread allocates from and frees into its own magazine of pages, a magazine that runs empty or
+    // full trades a batch of BATCH_SIZE pages with a lock-free stack. only a thread's first page takes a lock
     struct PageAllocator final
     {
     public:
         enum { PAGE_SIZE = 4096 };
+        static constexpr u32 BATCH_SIZE = 16;
+
+        struct FreePage;
+        struct Magazine;
 
         PageAllocator(IAllocator& fallback);
         ~PageAllocator();
 
-        void* allocate(bool lock);
-        void deallocate(void* mem, bool lock);
-        u32 getAllocatedCount() const { return allocated_count; }
-        u32 getReservedCount() const { return reserved_count; }
+        PageAllocator(const PageAllocator&) = delete;
+        void operator =(const PageAllocator&) = delete;
 
-        void lock();
-        void unlock();
+        void* allocate();
+        void deallocate(void* mem);
+        // exact only while no other thread allocates
+        u32 getAllocatedCount() const;
+        u32 getReservedCount() const { return reserved_count; }
 
     private:
-        volatile i32 allocated_count = 0;
-        u32 reserved_count = 0;
-        RingBuffer<void*, 512> free_pages;
-        Mutex mutex;
+        static ThreadSlot* createMagazine(void* owner);
+        static void releaseMagazine(void* owner, ThreadSlot* slot);
+        Magazine* getMagazine();
+        void pushBatch(FreePage* batch);
+        FreePage* popBatch();
+
+        IAllocator& fallback;
+        volatile i64 free_batches = 0;      // stack top, page number in the low 36 bits and a push counter above
+        volatile i32 allocated_count = 0;   // by threads without a magazine
+        volatile i32 reserved_count = 0;
+        mutable Mutex mutex;                // the magazine lists
+        ThreadSlotList magazines;           // a magazine per thread, the pages of an exited thread go to the stack
     };
 
 
@@ -50,6 +67,7 @@ namespace cal {
     };
 
 
+    // any thread can push, pages are linked in push order
     template <typename T>
     struct PagedList
     {
@@ -64,7 +82,7 @@ namespace cal {
             while (i) {
                 T* tmp = i;
                 i = i->header.next;
-                allocator.deallocate(tmp, true);
+                allocator.deallocate(tmp);
             }
         }
 
@@ -83,24 +101,22 @@ namespace cal {
 
         T* push()
         {
-            allocator.lock();
-            void* mem = allocator.allocate(false);
-            T* page = new (NewPlaceholder(), mem) T;
-            if (!begin) {
-                begin = end = page;
-            }
-            else {
-                end->header.next = page;
-                page->header.next = nullptr;
-                end = page;
+            T* page = new (NewPlaceholder(), allocator.allocate()) T;
+            page->header.next = nullptr;
+            // the end moves first and the previous end is linked after, a list walked meanwhile ends early
+            for (;;) {
+                T* prev = end;
+                if (!compareAndExchange64((volatile i64*)&end, (i64)page, (i64)prev)) continue;
+
+                if (prev) prev->header.next = page;
+                else begin = page;
+                return page;
             }
-            allocator.unlock();
-            return page;
         }
 
 
-        T* begin = nullptr;
-        T* end = nullptr;
+        T* volatile begin = nullptr;
+        T* volatile end = nullptr;
         PageAllocator& allocator;
     };
 
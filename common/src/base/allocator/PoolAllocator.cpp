@@ -0,0 +1,124 @@
+#include "PoolAllocator.hpp"
+
+#include "base/math/Math.hpp"
+
+namespace cal {
+
+    struct SlabAllocator::Page {
+        Page* next;
+    };
+
+
+    static u32 roundUp(u32 val, u32 align) {
+        ASSERT(isPowOfTwo(align));
+        return (val + align - 1) & ~(align - 1);
+    }
+
+
+    SlabAllocator::SlabAllocator(PageAllocator& pages, u32 item_size, u32 item_align, bool shared)
+        : m_pages(pages)
+        , m_shared(shared)
+    {
+        item_align = maximum(item_align, (u32)alignof(FreeSlot));
+        m_item_size = roundUp(maximum(item_size, (u32)sizeof(FreeSlot)), item_align);
+        m_first_offset = roundUp(sizeof(Page), item_align);
+        ASSERT(m_first_offset + m_item_size <= PageAllocator::PAGE_SIZE);
+        m_bump = PageAllocator::PAGE_SIZE;
+    }
+
+
+    SlabAllocator::~SlabAllocator() {
+        while (m_page) {
+            Page* next = m_page->next;
+            m_pages.deallocate(m_page);
+            m_page = next;
+        }
+    }
+
+
+    // the caller holds m_mutex when shared
+    SlabAllocator::FreeSlot* SlabAllocator::takeSlot() {
+        ++m_used_count;
+        if (FreeSlot* slot = m_free) {
+            m_free = slot->next;
+            return slot;
+        }
+
+        if (m_bump + m_item_size > PageAllocator::PAGE_SIZE) {
+            Page* page = (Page*)m_pages.allocate();
+            page->next = m_page;
+            m_page = page;
+            m_bump = m_first_offset;
+            ++m_page_count;
+        }
+        FreeSlot* slot = (FreeSlot*)((u8*)m_page + m_bump);
+        m_bump += m_item_size;
+        return slot;
+    }
+
+
+    void* SlabAllocator::allocate() {
+        if (!m_shared) return takeSlot();
+
+        MutexGuard guard(m_mutex);
+        return takeSlot();
+    }
+
+
+    void SlabAllocator::deallocate(void* ptr) {
+        if (!ptr) return;
+
+        FreeSlot* slot = (FreeSlot*)ptr;
+        deallocateChain(slot, slot, 1);
+    }
+
+
+    SlabAllocator::FreeSlot* SlabAllocator::allocateChain(u32 count) {
+        ASSERT(count > 0);
+        if (m_shared) m_mutex.enter();
+        FreeSlot* head = takeSlot();
+        FreeSlot* tail = head;
+        for (u32 i = 1; i < count; ++i) {
+            tail->next = takeSlot();
+            tail = tail->next;
+        }
+        if (m_shared) m_mutex.exit();
+        tail->next = nullptr;
+        return head;
+    }
+
+
+    void SlabAllocator::deallocateChain(FreeSlot* head, FreeSlot* tail, u32 count) {
+        if (m_shared) m_mutex.enter();
+        tail->next = m_free;
+        m_free = head;
+        ASSERT(m_used_count >= count);
+        m_used_count -= count;
+        if (m_shared) m_mutex.exit();
+    }
+
+
+    //////////////////////////////////////////////////////////////////////////////////////////
+
+
+    SlabCache::~SlabCache() {
+        if (m_count > 0) flush(m_count);
+    }
+
+
+    void SlabCache::refill() {
+        m_free = m_slab.allocateChain(BATCH_SIZE);
+        m_count = BATCH_SIZE;
+    }
+
+
+    void SlabCache::flush(u32 count) {
+        SlabAllocator::FreeSlot* head = m_free;
+        SlabAllocator::FreeSlot* tail = head;
+        for (u32 i = 1; i < count; ++i) tail = tail->next;
+
+        m_free = tail->next;
+        m_count -= count;
+        m_slab.deallocateChain(head, tail, count);
+    }
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "IAllocator.hpp"
+#include "PageAllocator.hpp"
+#include "base/threading/SyncMutex.hpp"
+
+namespace cal {
+
+    // slots of one size carved out of PageAllocator pages, a freed slot is linked into the free list through
+    // its own memory. no virtual call and no size lookup, pages go back to the page allocator on destruction
+    // use case: many small objects of one type, e.g. nodes
+    // a shared slab locks on every call, threads that allocate a lot put a SlabCache in front of it
+    struct SlabAllocator final {
+        struct Page;
+
+        struct FreeSlot {
+            FreeSlot* next;
+        };
+
+        SlabAllocator(PageAllocator& pages, u32 item_size, u32 item_align, bool shared);
+        ~SlabAllocator();
+
+        SlabAllocator(const SlabAllocator&) = delete;
+        void operator =(const SlabAllocator&) = delete;
+
+        void* allocate();
+        void deallocate(void* ptr);
+
+        // count slots linked through FreeSlot::next, with one lock for all of them
+        FreeSlot* allocateChain(u32 count);
+        void deallocateChain(FreeSlot* head, FreeSlot* tail, u32 count);
+
+        u32 getItemSize() const { return m_item_size; }
+        u32 getUsedCount() const { return m_used_count; }     // slots held by caches included
+        u32 getPageCount() const { return m_page_count; }
+
+    private:
+        FreeSlot* takeSlot();
+
+        PageAllocator& m_pages;
+        u32 m_item_size;
+        u32 m_first_offset;         // of the first slot in a page
+        bool m_shared;
+        Mutex m_mutex;
+        FreeSlot* m_free = nullptr;
+        Page* m_page = nullptr;     // the newest page, slots from m_bump on were never used
+        u32 m_bump = 0;
+        u32 m_page_count = 0;
+        u32 m_used_count = 0;
+    };
+
+
+    // one thread's front of a shared SlabAllocator : slots move from and to the slab in batches, allocate()
+    // and deallocate() touch nothing but the cache. slots freed here may come from any thread
+    // use case: a thread_local next to a shared slab
+    struct SlabCache final {
+        static constexpr u32 BATCH_SIZE = 32;
+
+        explicit SlabCache(SlabAllocator& slab) : m_slab(slab) {}
+        ~SlabCache();
+
+        SlabCache(const SlabCache&) = delete;
+        void operator =(const SlabCache&) = delete;
+
+        void* allocate() {
+            if (!m_free) refill();
+            SlabAllocator::FreeSlot* slot = m_free;
+            m_free = slot->next;
+            --m_count;
+            return slot;
+        }
+
+        void deallocate(void* ptr) {
+            if (!ptr) return;
+            SlabAllocator::FreeSlot* slot = (SlabAllocator::FreeSlot*)ptr;
+            slot->next = m_free;
+            m_free = slot;
+            if (++m_count == 2 * BATCH_SIZE) flush(BATCH_SIZE);
+        }
+
+    private:
+        void refill();
+        void flush(u32 count);
+
+        SlabAllocator& m_slab;
+        SlabAllocator::FreeSlot* m_free = nullptr;
+        u32 m_count = 0;
+    };
+
+
+    // typed SlabAllocator, constructs and destroys T in its slots
+    template <typename T>
+    struct PoolAllocator final {
+        explicit PoolAllocator(PageAllocator& pages, bool shared = false)
+            : m_slab(pages, sizeof(T), alignof(T), shared)
+        {}
+
+        template <typename... Args>
+        T* create(Args&&... args) {
+            return new (NewPlaceholder(), m_slab.allocate()) T(static_cast<Args&&>(args)...);
+        }
+
+        void destroy(T* obj) {
+            if (!obj) return;
+            obj->~T();
+            m_slab.deallocate(obj);
+        }
+
+        SlabAllocator& getSlab() { return m_slab; }
+
+    private:
+        SlabAllocator m_slab;
+    };
+}
@@ -0,0 +1,446 @@
+#include "ProfilingAllocator.hpp"
+
+#include "TagAllocator.hpp"
+#include "base/Logger.hpp"
+#include "base/threading/Atomic.hpp"
+#include "base/threading/Thread.hpp"
+#include "system/SysThreading.hpp"
+#include "utils/StringBuilder.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#include <intrin.h>
+#define CAL_RETURN_ADDRESS() _ReturnAddress()
+#else
+#define CAL_RETURN_ADDRESS() __builtin_return_address(0)
+#endif
+
+namespace cal {
+
+    static constexpr u32 SITE_CHUNK_SIZE = 256;
+    static constexpr u32 SITE_CACHE_SIZE = 256;
+    static constexpr u32 TAG_CACHE_SIZE = 16;
+    static constexpr u32 DUMP_SLICE_MS = 50;
+
+    struct AllocationHeader {
+        u64 size;
+        u32 site;
+        u16 tag;
+        u16 offset;         // from the source allocation to the user pointer
+    };
+
+    static_assert(sizeof(AllocationHeader) == 16);
+
+    struct SiteCounters {
+        i64 allocations;
+        i64 live_bytes;
+        u64 total_bytes;
+    };
+
+    struct ProfilingAllocator::ThreadData : ThreadSlot {
+        TagStats tags[MAX_TAGS];            // names and peaks are filled in by snapshots
+        i64 pending[MAX_TAGS];              // live bytes not added to the shared counters yet
+        SiteCounters* sites[MAX_SITES / SITE_CHUNK_SIZE];
+        struct { const void* address; u32 index; } site_cache[SITE_CACHE_SIZE];
+        struct { const char* tag; u32 index; } tag_cache[TAG_CACHE_SIZE];
+    };
+
+    struct ProfilingAllocator::DumpTask final : Thread {
+        DumpTask(ProfilingAllocator& profiler, u32 interval_ms)
+            : Thread(profiler.m_source)
+            , m_profiler(profiler)
+            , m_interval(interval_ms)
+        {}
+
+        int run() override {
+            u32 waited = 0;
+            while (!m_finish) {
+                platform::sleep(DUMP_SLICE_MS);
+                waited += DUMP_SLICE_MS;
+                if (waited < m_interval) continue;
+
+                waited = 0;
+                LogInfo(m_profiler.buildReport());
+            }
+            return 0;
+        }
+
+        ProfilingAllocator& m_profiler;
+        u32 m_interval;
+        volatile bool m_finish = false;
+    };
+
+
+    static ThreadSlot* createThreadData(void* owner) {
+        IAllocator& source = ((ProfilingAllocator*)owner)->m_source;
+        ProfilingAllocator::ThreadData* data = (ProfilingAllocator::ThreadData*)source.allocate(sizeof(ProfilingAllocator::ThreadData), alignof(ProfilingAllocator::ThreadData));
+        memset(data, 0, sizeof(*data));
+        return data;
+    }
+
+
+    // nullptr when the thread already exited or uses too many profilers
+    static ProfilingAllocator::ThreadData* getThreadData(ProfilingAllocator& profiler) {
+        return (ProfilingAllocator::ThreadData*)profiler.m_threads.get();
+    }
+
+
+    static u32 getHistogramBucket(u64 size) {
+        if (size <= 1) return 0;
+#ifdef _WIN32
+        unsigned long bucket;
+        _BitScanReverse64(&bucket, size);
+#else
+        const u32 bucket = 63 - __builtin_clzll(size);
+#endif
+        return std::min((u32)bucket, ProfilingAllocator::HISTOGRAM_SIZE - 1);
+    }
+
+
+    static void updatePeak(volatile i64* peak, i64 value) {
+        for (i64 current = *peak; value > current; current = *peak) {
+            if (compareAndExchange64(peak, value, current)) return;
+        }
+    }
+
+
+    static void flushPending(ProfilingAllocator& profiler, ProfilingAllocator::ThreadData& data, u32 tag) {
+        const i64 delta = data.pending[tag];
+        data.pending[tag] = 0;
+        const i64 tag_live = atomicAdd(&profiler.m_tag_live[tag], delta) + delta;
+        const i64 live = atomicAdd(&profiler.m_live_bytes, delta) + delta;
+        updatePeak(&profiler.m_tag_peak[tag], tag_live);
+        updatePeak(&profiler.m_peak_bytes, live);
+    }
+
+
+    static SiteCounters& getSiteCounters(ProfilingAllocator& profiler, ProfilingAllocator::ThreadData& data, u32 site) {
+        SiteCounters*& chunk = data.sites[site / SITE_CHUNK_SIZE];
+        if (!chunk) {
+            SiteCounters* counters = (SiteCounters*)profiler.m_source.allocate(sizeof(SiteCounters) * SITE_CHUNK_SIZE, alignof(SiteCounters));
+            memset(counters, 0, sizeof(SiteCounters) * SITE_CHUNK_SIZE);
+            // snapshots read the chunk from other threads
+            memoryBarrier();
+            chunk = counters;
+        }
+        return chunk[site % SITE_CHUNK_SIZE];
+    }
+
+
+    static u32 getTagIndex(ProfilingAllocator& profiler, ProfilingAllocator::ThreadData& data, const char* tag) {
+        if (!tag) return 0;
+
+        auto& entry = data.tag_cache[((uintptr)tag >> 3) % TAG_CACHE_SIZE];
+        if (entry.tag == tag) return entry.index;
+
+        u32 index = 0;
+        {
+            MutexGuard guard(profiler.m_registry_mutex);
+            for (u32 i = 1; i < profiler.m_tag_count; ++i) {
+                if (profiler.m_tags[i] == tag) index = i;
+            }
+            if (index == 0 && profiler.m_tag_count < ProfilingAllocator::MAX_TAGS) {
+                index = profiler.m_tag_count++;
+                profiler.m_tags[index] = tag;
+            }
+        }
+        entry.tag = tag;
+        entry.index = index;
+        return index;
+    }
+
+
+    static u32 getSiteIndex(ProfilingAllocator& profiler, ProfilingAllocator::ThreadData& data, const void* address) {
+        auto& entry = data.site_cache[(((uintptr)address >> 2) ^ ((uintptr)address >> 12)) % SITE_CACHE_SIZE];
+        if (entry.address == address) return entry.index;
+
+        u32 index = 0;
+        {
+            MutexGuard guard(profiler.m_registry_mutex);
+            auto iter = profiler.m_site_indices.find(address);
+            if (iter.isValid()) {
+                index = iter.value();
+            }
+            else if ((u32)profiler.m_sites.size() < ProfilingAllocator::MAX_SITES) {
+                index = (u32)profiler.m_sites.size();
+                profiler.m_sites.push(address);
+                profiler.m_site_indices.insert(address, index);
+            }
+        }
+        entry.address = address;
+        entry.index = index;
+        return index;
+    }
+
+
+    static void addAllocation(ProfilingAllocator& profiler, ProfilingAllocator::ThreadData& data, AllocationHeader& header, const char* tag, const void* site) {
+        header.tag = (u16)getTagIndex(profiler, data, tag);
+        header.site = getSiteIndex(profiler, data, site);
+
+        const i64 size = (i64)header.size;
+        ProfilingAllocator::TagStats& stats = data.tags[header.tag];
+        ++stats.allocations;
+        stats.live_bytes += size;
+        ++stats.histogram[getHistogramBucket(header.size)];
+
+        SiteCounters& site_counters = getSiteCounters(profiler, data, header.site);
+        ++site_counters.allocations;
+        site_counters.live_bytes += size;
+        site_counters.total_bytes += header.size;
+
+        data.pending[header.tag] += size;
+        if (data.pending[header.tag] >= ProfilingAllocator::FLUSH_BYTES) flushPending(profiler, data, header.tag);
+    }
+
+
+    static void addFree(ProfilingAllocator& profiler, ProfilingAllocator::ThreadData& data, const AllocationHeader& header) {
+        const i64 size = (i64)header.size;
+        ProfilingAllocator::TagStats& stats = data.tags[header.tag];
+        ++stats.frees;
+        stats.live_bytes -= size;
+        getSiteCounters(profiler, data, header.site).live_bytes -= size;
+
+        data.pending[header.tag] -= size;
+        if (data.pending[header.tag] <= -ProfilingAllocator::FLUSH_BYTES) flushPending(profiler, data, header.tag);
+    }
+
+
+    static void countAllocation(ProfilingAllocator& profiler, AllocationHeader& header, const char* tag, const void* site) {
+        if (ProfilingAllocator::ThreadData* data = getThreadData(profiler)) {
+            addAllocation(profiler, *data, header, tag, site);
+            return;
+        }
+        MutexGuard guard(profiler.m_mutex);
+        addAllocation(profiler, *profiler.m_shared_thread, header, tag, site);
+    }
+
+
+    static void countFree(ProfilingAllocator& profiler, const AllocationHeader& header) {
+        if (ProfilingAllocator::ThreadData* data = getThreadData(profiler)) {
+            addFree(profiler, *data, header);
+            return;
+        }
+        MutexGuard guard(profiler.m_mutex);
+        addFree(profiler, *profiler.m_shared_thread, header);
+    }
+
+
+    // TagAllocator sets its tag right before calling us, clearing it keeps untagged allocations untagged
+    static const char* takeTag(ProfilingAllocator& profiler) {
+        TagAllocator* active = TagAllocator::active_allocator;
+        if (!active) return nullptr;
+        TagAllocator::active_allocator = nullptr;
+        return active->m_effective_allocator == &profiler ? active->m_tag : nullptr;
+    }
+
+
+    static void* allocateProfiled(ProfilingAllocator& profiler, size_t size, size_t align, const char* tag, const void* site) {
+        const size_t offset = std::max(align, sizeof(AllocationHeader));
+        ASSERT(offset <= 0xffff);
+        u8* base = (u8*)profiler.m_source.allocate(size + offset, std::max(align, sizeof(AllocationHeader)));
+        if (!base) return nullptr;
+
+        u8* ptr = base + offset;
+        AllocationHeader* header = (AllocationHeader*)ptr - 1;
+        header->size = size;
+        header->offset = (u16)offset;
+        countAllocation(profiler, *header, tag, site);
+        return ptr;
+    }
+
+
+    ProfilingAllocator::ProfilingAllocator(IAllocator& source)
+        : m_source(source)
+        , m_site_indices(source)
+        , m_sites(source)
+        , m_threads(this, m_mutex, &createThreadData)
+    {
+        m_tags[0] = "untagged";
+        m_sites.push(nullptr);
+        m_shared_thread = (ThreadData*)m_threads.create();
+    }
+
+
+    ProfilingAllocator::~ProfilingAllocator() {
+        setDumpInterval(0);
+        // threads that still have a block here forget about it
+        ThreadSlot* slot = m_threads.detach();
+        while (slot) {
+            ThreadData* data = (ThreadData*)slot;
+            slot = slot->next;
+            for (SiteCounters* chunk : data->sites) {
+                if (chunk) m_source.deallocate(chunk);
+            }
+            m_source.deallocate(data);
+        }
+    }
+
+
+    void* ProfilingAllocator::allocate(size_t size, size_t align) {
+        return allocateProfiled(*this, size, align, takeTag(*this), CAL_RETURN_ADDRESS());
+    }
+
+
+    void ProfilingAllocator::deallocate(void* ptr) {
+        if (!ptr) return;
+
+        const AllocationHeader* header = (const AllocationHeader*)ptr - 1;
+        countFree(*this, *header);
+        m_source.deallocate((u8*)ptr - header->offset);
+    }
+
+
+    void* ProfilingAllocator::reallocate(void* ptr, size_t new_size, size_t old_size, size_t align) {
+        const void* site = CAL_RETURN_ADDRESS();
+        const char* tag = takeTag(*this);
+        if (!ptr) return new_size > 0 ? allocateProfiled(*this, new_size, align, tag, site) : nullptr;
+        if (new_size == 0) {
+            deallocate(ptr);
+            return nullptr;
+        }
+
+        // the header has the exact size, callers may pass 0 for old_size
+        (void)old_size;
+        const AllocationHeader old = *((const AllocationHeader*)ptr - 1);
+        if (old.offset != sizeof(AllocationHeader) || align > sizeof(AllocationHeader)) {
+            void* new_ptr = allocateProfiled(*this, new_size, align, tag, site);
+            if (!new_ptr) return nullptr;
+            memcpy(new_ptr, ptr, std::min(new_size, (size_t)old.size));
+            deallocate(ptr);
+            return new_ptr;
+        }
+
+        // counted as a free of the old block and an allocation of the new one
+        u8* base = (u8*)m_source.reallocate((u8*)ptr - old.offset, new_size + old.offset, old.size + old.offset, sizeof(AllocationHeader));
+        if (!base) return nullptr;
+        countFree(*this, old);
+
+        u8* new_ptr = base + old.offset;
+        AllocationHeader* header = (AllocationHeader*)new_ptr - 1;
+        header->size = new_size;
+        countAllocation(*this, *header, tag, site);
+        return new_ptr;
+    }
+
+
+    void ProfilingAllocator::getSnapshot(Snapshot& snapshot) {
+        snapshot.allocations = 0;
+        snapshot.frees = 0;
+        snapshot.live_bytes = 0;
+        snapshot.tags.clear();
+        snapshot.sites.clear();
+
+        {
+            MutexGuard guard(m_mutex);
+            MutexGuard registry_guard(m_registry_mutex);
+
+            for (u32 i = 0; i < m_tag_count; ++i) {
+                TagStats& stats = snapshot.tags.emplace();
+                memset(&stats, 0, sizeof(stats));
+                stats.tag = m_tags[i];
+                stats.peak_bytes = m_tag_peak[i];
+            }
+            const u32 site_count = (u32)m_sites.size();
+            for (u32 i = 0; i < site_count; ++i) {
+                snapshot.sites.push(SiteStats{ m_sites[i], 0, 0, 0 });
+            }
+
+            // the blocks are written without synchronization, a snapshot can be off by the allocations in flight
+            for (const ThreadSlot* slot = m_threads.getSlots(); slot; slot = slot->next) {
+                const ThreadData* data = (const ThreadData*)slot;
+                for (u32 i = 0; i < m_tag_count; ++i) {
+                    const TagStats& from = data->tags[i];
+                    TagStats& to = snapshot.tags[i];
+                    to.allocations += from.allocations;
+                    to.frees += from.frees;
+                    to.live_bytes += from.live_bytes;
+                    for (u32 j = 0; j < HISTOGRAM_SIZE; ++j) to.histogram[j] += from.histogram[j];
+                }
+                for (u32 chunk = 0; chunk * SITE_CHUNK_SIZE < site_count; ++chunk) {
+                    const SiteCounters* counters = data->sites[chunk];
+                    if (!counters) continue;
+                    for (u32 j = 0; j < SITE_CHUNK_SIZE && chunk * SITE_CHUNK_SIZE + j < site_count; ++j) {
+                        SiteStats& to = snapshot.sites[chunk * SITE_CHUNK_SIZE + j];
+                        to.allocations += counters[j].allocations;
+                        to.live_bytes += counters[j].live_bytes;
+                        to.total_bytes += counters[j].total_bytes;
+                    }
+                }
+            }
+        }
+
+        // exact live bytes raise the batched peaks, later snapshots never report less
+        for (u32 i = 0; i < (u32)snapshot.tags.size(); ++i) {
+            TagStats& stats = snapshot.tags[i];
+            updatePeak(&m_tag_peak[i], stats.live_bytes);
+            stats.peak_bytes = std::max(stats.peak_bytes, stats.live_bytes);
+            snapshot.allocations += stats.allocations;
+            snapshot.frees += stats.frees;
+            snapshot.live_bytes += stats.live_bytes;
+        }
+        updatePeak(&m_peak_bytes, snapshot.live_bytes);
+        snapshot.peak_bytes = m_peak_bytes;
+
+        snapshot.sites.eraseItems([](const SiteStats& stats) { return stats.live_bytes <= 0; });
+        std::sort(snapshot.tags.begin(), snapshot.tags.end(), [](const TagStats& lhs, const TagStats& rhs) { return lhs.live_bytes > rhs.live_bytes; });
+        std::sort(snapshot.sites.begin(), snapshot.sites.end(), [](const SiteStats& lhs, const SiteStats& rhs) { return lhs.live_bytes > rhs.live_bytes; });
+    }
+
+
+    std::string ProfilingAllocator::buildReport(u32 max_sites) {
+        Snapshot snapshot(m_source);
+        getSnapshot(snapshot);
+
+        StringBuilder builder{ "Memory Report: \n" };
+        char line[256];
+        snprintf(line, sizeof(line), "\tlive %.2f MiB, peak %.2f MiB, %lld allocations, %lld frees\n",
+            (double)snapshot.live_bytes / (1024 * 1024), (double)snapshot.peak_bytes / (1024 * 1024),
+            (long long)snapshot.allocations, (long long)snapshot.frees);
+        builder.append(line);
+
+        snprintf(line, sizeof(line), "\t%-24s %12s %12s %14s %14s\n", "tag", "allocs", "frees", "live", "peak");
+        builder.append(line);
+        u64 histogram[HISTOGRAM_SIZE] = {};
+        for (const TagStats& stats : snapshot.tags) {
+            snprintf(line, sizeof(line), "\t%-24s %12lld %12lld %14lld %14lld\n", stats.tag, (long long)stats.allocations,
+                (long long)stats.frees, (long long)stats.live_bytes, (long long)stats.peak_bytes);
+            builder.append(line);
+            for (u32 i = 0; i < HISTOGRAM_SIZE; ++i) histogram[i] += stats.histogram[i];
+        }
+
+        builder.append("\tallocation sizes :\n");
+        for (u32 i = 0; i < HISTOGRAM_SIZE; ++i) {
+            if (histogram[i] == 0) continue;
+            snprintf(line, sizeof(line), "\t\t%s%-12llu %12llu\n", i + 1 == HISTOGRAM_SIZE ? ">=" : "< ",
+                (unsigned long long)(i + 1 == HISTOGRAM_SIZE ? 1ull << i : 2ull << i), (unsigned long long)histogram[i]);
+            builder.append(line);
+        }
+
+        snprintf(line, sizeof(line), "\t%-24s %12s %14s %14s\n", "call site", "allocs", "live", "total");
+        builder.append(line);
+        for (u32 i = 0; i < (u32)snapshot.sites.size() && i < max_sites; ++i) {
+            const SiteStats& stats = snapshot.sites[i];
+            if (stats.address) snprintf(line, sizeof(line), "\t%-24p %12lld %14lld %14llu\n", stats.address, (long long)stats.allocations, (long long)stats.live_bytes, (unsigned long long)stats.total_bytes);
+            else snprintf(line, sizeof(line), "\t%-24s %12lld %14lld %14llu\n", "(other)", (long long)stats.allocations, (long long)stats.live_bytes, (unsigned long long)stats.total_bytes);
+            builder.append(line);
+        }
+        return builder;
+    }
+
+
+    void ProfilingAllocator::setDumpInterval(u32 interval_ms) {
+        if (m_dump_task) {
+            m_dump_task->m_finish = true;
+            m_dump_task->destroy();
+            CAL_DEL(m_source, m_dump_task);
+            m_dump_task = nullptr;
+        }
+        if (interval_ms == 0) return;
+
+        m_dump_task = CAL_NEW(m_source, DumpTask)(*this, interval_ms);
+        m_dump_task->create("MemoryReport", true);
+    }
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "IAllocator.hpp"
+#include "ThreadSlots.hpp"
+#include "base/threading/SyncMutex.hpp"
+#include "base/types/Array.hpp"
+#include "base/types/container/HashMap.hpp"
+
+#include <string>
+
+namespace cal {
+
+    // finds where memory goes : allocation counts, live / peak bytes and a size histogram per tag
+    // (see TagAllocator) and per call site. call sites are the return addresses of allocate(), resolve
+    // them with addr2line / atos. allocations made through a TagAllocator share its call site and are
+    // told apart by tag. every thread counts into its own block, snapshots sum the blocks, live bytes
+    // reach the shared totals (and peaks) in batches of FLUSH_BYTES per thread and tag.
+    // every allocation carries a 16 byte header
+    struct ProfilingAllocator final : IAllocator {
+        static constexpr u32 MAX_TAGS = 64;             // tag 0 counts untagged allocations and overflow
+        static constexpr u32 MAX_SITES = 16384;         // site 0 counts overflow
+        static constexpr u32 HISTOGRAM_SIZE = 24;       // bucket i counts sizes in [2^i, 2^(i+1)), the last one the rest
+        static constexpr i64 FLUSH_BYTES = 64 * 1024;
+
+        struct ThreadData;
+        struct DumpTask;
+
+        struct TagStats {
+            const char* tag;
+            i64 allocations;
+            i64 frees;
+            i64 live_bytes;
+            i64 peak_bytes;
+            u64 histogram[HISTOGRAM_SIZE];
+        };
+
+        struct SiteStats {
+            const void* address;
+            i64 allocations;
+            i64 live_bytes;
+            u64 total_bytes;
+        };
+
+        struct Snapshot {
+            explicit Snapshot(IAllocator& alloc) : tags(alloc), sites(alloc) {}
+
+            i64 allocations;
+            i64 frees;
+            i64 live_bytes;
+            i64 peak_bytes;
+            Array<TagStats> tags;       // sorted by live bytes
+            Array<SiteStats> sites;     // sorted by live bytes, sites with nothing live left out
+        };
+
+        explicit ProfilingAllocator(IAllocator& source);
+        ~ProfilingAllocator();
+
+        bool isDebug() const override { return true; }
+        IAllocator* getParent() const override { return &m_source; }
+
+        void* allocate(size_t size, size_t align) override;
+        void deallocate(void* ptr) override;
+        void* reallocate(void* ptr, size_t new_size, size_t old_size, size_t align) override;
+
+        void getSnapshot(Snapshot& snapshot);
+        // totals, every tag and the top sites by live bytes
+        std::string buildReport(u32 max_sites = 20);
+        // logs buildReport() every interval_ms from a background thread, 0 stops it
+        void setDumpInterval(u32 interval_ms);
+
+        IAllocator& m_source;
+        Mutex m_mutex;                      // thread blocks, taken before m_registry_mutex
+        Mutex m_registry_mutex;             // tags and sites
+        const char* m_tags[MAX_TAGS];
+        u32 m_tag_count = 1;
+        HashMap<const void*, u32> m_site_indices;
+        Array<const void*> m_sites;
+        ThreadSlotList m_threads;           // a block per thread, counters are cumulative so blocks are reused
+        ThreadData* m_shared_thread = nullptr;  // under m_mutex, for threads that have no block
+        DumpTask* m_dump_task = nullptr;
+
+        volatile i64 m_live_bytes = 0;
+        volatile i64 m_peak_bytes = 0;
+        volatile i64 m_tag_live[MAX_TAGS] = {};
+        volatile i64 m_tag_peak[MAX_TAGS] = {};
+    };
+}
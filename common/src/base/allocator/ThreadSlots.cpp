@@ -0,0 +1,121 @@
+#include "ThreadSlots.hpp"
+
+namespace cal {
+
+    thread_local ThreadSlotTable ThreadSlotList::s_table = {};
+
+
+    // guards the tables against lists destroyed while a thread still has a slot in them,
+    // never destroyed since threads can exit after static destructors ran
+    static Mutex& getTablesMutex() {
+        static Mutex* mutex = new Mutex();
+        return *mutex;
+    }
+
+
+    // hands the thread's slots back when it exits, the table itself has no destructor so get() stays a plain tls read
+    struct ThreadSlotExit {
+        ~ThreadSlotExit();
+        bool armed = false;
+    };
+
+    static thread_local ThreadSlotExit s_exit;
+
+
+    ThreadSlotExit::~ThreadSlotExit() {
+        ThreadSlotTable& table = ThreadSlotList::s_table;
+        MutexGuard tables_guard(getTablesMutex());
+        for (u32 i = 0; i < table.count; ++i) {
+            ThreadSlotList* list = table.lists[i];
+            if (!list) continue;
+
+            ThreadSlot* slot = table.slots[i];
+            MutexGuard guard(list->m_mutex);
+            if (list->m_release) list->m_release(list->m_owner, slot);
+            slot->table = nullptr;
+            slot->next_free = list->m_free;
+            list->m_free = slot;
+        }
+        // thread_local destructors running after this one still get here, they go without a slot
+        table.count = 0;
+        table.exited = true;
+    }
+
+
+    ThreadSlotList::ThreadSlotList(void* owner, Mutex& mutex, CreateFn create, ReleaseFn release)
+        : m_owner(owner)
+        , m_mutex(mutex)
+        , m_create(create)
+        , m_release(release)
+    {
+    }
+
+
+    ThreadSlotList::~ThreadSlotList() {
+        // the owner frees the slots, detach() must have run before
+        ASSERT(!m_slots);
+    }
+
+
+    ThreadSlot* ThreadSlotList::create() {
+        ThreadSlot* slot = m_create(m_owner);
+        MutexGuard guard(m_mutex);
+        slot->next = m_slots;
+        m_slots = slot;
+        return slot;
+    }
+
+
+    // a hole left by a destroyed list or the end, MAX_LISTS when the table is full
+    static u32 findFreeIndex(const ThreadSlotTable& table) {
+        u32 index = 0;
+        while (index < table.count && table.lists[index]) ++index;
+        return index;
+    }
+
+
+    ThreadSlot* ThreadSlotList::acquire() {
+        ThreadSlotTable& table = s_table;
+        if (table.exited || findFreeIndex(table) == ThreadSlotTable::MAX_LISTS) return nullptr;
+
+        s_exit.armed = true;
+        ThreadSlot* slot;
+        {
+            MutexGuard guard(m_mutex);
+            slot = m_free;
+            if (slot) m_free = slot->next_free;
+        }
+        if (!slot) slot = create();
+
+        // picked only now, create() may have given this thread a slot of another list meanwhile
+        MutexGuard tables_guard(getTablesMutex());
+        const u32 index = findFreeIndex(table);
+        if (index == ThreadSlotTable::MAX_LISTS) {
+            MutexGuard guard(m_mutex);
+            slot->next_free = m_free;
+            m_free = slot;
+            return nullptr;
+        }
+
+        slot->table = &table;
+        slot->table_index = index;
+        table.lists[index] = this;
+        table.slots[index] = slot;
+        if (index == table.count) ++table.count;
+        return slot;
+    }
+
+
+    ThreadSlot* ThreadSlotList::detach() {
+        MutexGuard tables_guard(getTablesMutex());
+        for (ThreadSlot* slot = m_slots; slot; slot = slot->next) {
+            if (slot->table) slot->table->lists[slot->table_index] = nullptr;
+            slot->table = nullptr;
+        }
+
+        ThreadSlot* slots = m_slots;
+        m_slots = nullptr;
+        m_free = nullptr;
+        return slots;
+    }
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "globals.hpp"
+#include "base/threading/SyncMutex.hpp"
+
+namespace cal {
+
+    struct ThreadSlotList;
+
+    // base of per-thread state (a heap, a magazine, counters), see ThreadSlotList
+    struct ThreadSlot {
+        ThreadSlot* next;                   // every slot of the list
+        ThreadSlot* next_free;              // left by an exited thread, the next thread starting takes it over
+        struct ThreadSlotTable* table;      // of the thread using the slot, nullptr when free
+        u32 table_index;
+    };
+
+    // slots of the calling thread, one per list it used
+    struct ThreadSlotTable {
+        static constexpr u32 MAX_LISTS = 16;
+
+        ThreadSlotList* lists[MAX_LISTS];
+        ThreadSlot* slots[MAX_LISTS];
+        u32 count;
+        bool exited;
+    };
+
+    // per-thread slots of one owner (an allocator, a profiler), a thread finds its slot without locking.
+    // slots outlive their thread and go to the next thread starting, only the owner frees them
+    struct ThreadSlotList {
+        using CreateFn = ThreadSlot* (*)(void* owner);                  // zeroed, the list links it
+        using ReleaseFn = void (*)(void* owner, ThreadSlot* slot);      // the thread using the slot exits
+
+        // mutex belongs to the owner, it's held while the slot lists change and while release runs.
+        // create runs without locks, it may allocate from another owner's list
+        ThreadSlotList(void* owner, Mutex& mutex, CreateFn create, ReleaseFn release = nullptr);
+        ~ThreadSlotList();
+
+        ThreadSlotList(const ThreadSlotList&) = delete;
+        void operator =(const ThreadSlotList&) = delete;
+
+        // nullptr when the thread already exited or uses too many lists
+        CAL_FORCE_INLINE ThreadSlot* get() {
+            if (ThreadSlot* slot = find()) return slot;
+            return acquire();
+        }
+
+        // the calling thread's slot if it has one already
+        CAL_FORCE_INLINE ThreadSlot* find() const {
+            const ThreadSlotTable& table = s_table;
+            for (u32 i = 0; i < table.count; ++i) {
+                if (table.lists[i] == this) return table.slots[i];
+            }
+            return nullptr;
+        }
+
+        // a slot no thread owns, e.g. a shared one for threads without a slot
+        ThreadSlot* create();
+        // threads still holding a slot forget about it, returns every slot for the owner to free
+        ThreadSlot* detach();
+        ThreadSlot* getSlots() const { return m_slots; }
+
+    private:
+        friend struct ThreadSlotExit;
+
+        ThreadSlot* acquire();
+
+        static thread_local ThreadSlotTable s_table;
+
+        void* m_owner;
+        Mutex& m_mutex;
+        CreateFn m_create;
+        ReleaseFn m_release;
+        ThreadSlot* m_slots = nullptr;
+        ThreadSlot* m_free = nullptr;
+    };
+}
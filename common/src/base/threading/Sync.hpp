@@ -11,6 +11,8 @@ namespace cal {
 
         void sleep(Mutex& cs);
         void wakeup();
+        // wakes every sleeping thread, for waiters that wait on different conditions
+        void wakeupAll();
     private:
 #ifdef _WIN32
         u8 data[64];
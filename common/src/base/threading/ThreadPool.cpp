@@ -0,0 +1,103 @@
+#include "ThreadPool.hpp"
+
+#include "base/threading/Thread.hpp"
+#include "system/SysThreading.hpp"
+
+namespace cal {
+
+    struct ThreadPoolWorker final : Thread {
+        ThreadPoolWorker(ThreadPool& pool, IAllocator& allocator)
+            : Thread(allocator)
+            , m_pool(pool)
+        {}
+
+        ~ThreadPoolWorker() = default;
+
+        int run() override;
+
+    private:
+        ThreadPool& m_pool;
+    };
+
+
+    int ThreadPoolWorker::run()
+    {
+        for (;;) {
+            m_pool.m_semaphore.wait();
+
+            ThreadPool::Job job;
+            {
+                MutexGuard lock(m_pool.m_mutex);
+                if (m_pool.m_jobs.empty()) {
+                    if (m_pool.m_finish) break;
+                    continue;
+                }
+                job = m_pool.m_jobs[0];
+                m_pool.m_jobs.erase(0);
+            }
+
+            job.function(job.data);
+
+            MutexGuard lock(m_pool.m_mutex);
+            ASSERT(m_pool.m_pending > 0);
+            --m_pool.m_pending;
+            if (m_pool.m_pending == 0) m_pool.m_idle.wakeup();
+        }
+        return 0;
+    }
+
+
+    ThreadPool::ThreadPool(IAllocator& allocator, u32 worker_count)
+        : m_allocator(allocator)
+        , m_workers(allocator)
+        , m_jobs(allocator)
+        , m_semaphore(0, 0x7fffFFFF)
+    {
+        if (worker_count == 0) worker_count = platform::getCPUsCount();
+        if (worker_count == 0) worker_count = 1;
+
+        for (u32 i = 0; i < worker_count; ++i) {
+            ThreadPoolWorker* worker = CAL_NEW(m_allocator, ThreadPoolWorker)(*this, m_allocator);
+            worker->create("ThreadPool", true);
+            m_workers.push(worker);
+        }
+    }
+
+
+    ThreadPool::~ThreadPool()
+    {
+        wait();
+        {
+            MutexGuard lock(m_mutex);
+            m_finish = true;
+        }
+        for (u32 i = 0; i < (u32)m_workers.size(); ++i) {
+            m_semaphore.signal();
+        }
+        for (ThreadPoolWorker* worker : m_workers) {
+            worker->destroy();
+            CAL_DEL(m_allocator, worker);
+        }
+    }
+
+
+    void ThreadPool::push(JobFunction function, void* data)
+    {
+        ASSERT(function);
+        {
+            MutexGuard lock(m_mutex);
+            m_jobs.push(Job{ function, data });
+            ++m_pending;
+        }
+        m_semaphore.signal();
+    }
+
+
+    void ThreadPool::wait()
+    {
+        MutexGuard lock(m_mutex);
+        while (m_pending > 0) {
+            m_idle.sleep(m_mutex);
+        }
+    }
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "globals.hpp"
+#include "base/threading/Sync.hpp"
+#include "base/threading/SyncSemaphore.hpp"
+#include "base/types/Array.hpp"
+
+namespace cal {
+
+    struct ThreadPoolWorker;
+
+    // fixed set of worker threads pulling jobs from one shared queue
+    // jobs run in push order but may finish in any order, wait() blocks until the queue is drained
+    struct ThreadPool {
+        using JobFunction = void(*)(void* data);
+
+        // worker_count == 0 uses one worker per cpu
+        ThreadPool(IAllocator& allocator, u32 worker_count);
+        ThreadPool(const ThreadPool&) = delete;
+        ~ThreadPool();
+
+        void push(JobFunction function, void* data);
+        void wait();
+
+        u32 getWorkerCount() const { return m_workers.size(); }
+
+    private:
+        friend struct ThreadPoolWorker;
+
+        struct Job {
+            JobFunction function;
+            void* data;
+        };
+
+        IAllocator& m_allocator;
+        Array<ThreadPoolWorker*> m_workers;
+        Array<Job> m_jobs;
+        Mutex m_mutex;
+        Semaphore m_semaphore;
+        ConditionVariable m_idle;
+        u32 m_pending = 0;
+        bool m_finish = false;
+    };
+}
@@ -14,11 +14,25 @@ namespace cal::platform {
     void abort();
     void logInfo();
 
+    enum class HugePages : u8 {
+        None,
+        Transparent,    // the kernel backs aligned ranges with huge pages when it can
+        Explicit,       // from the preallocated huge page pool, Transparent once the pool is empty
+    };
+
     void* memReserve(size_t size);
+    // huge pages need size to be a multiple of getHugePageSize(), numa_node < 0 lets the system place the
+    // pages. both are hints, platforms without them reserve normal memory
+    void* memReserve(size_t size, HugePages huge_pages, i32 numa_node);
     void memCommit(void* ptr, size_t size);
+    // gives the pages back to the system, the range stays reserved but its content is lost
+    // false when the system refused, e.g. part of an explicit huge page, the pages stay committed then
+    [[nodiscard]] bool memDecommit(void* ptr, size_t size);
     void memRelease(void* ptr, size_t size); // size must be full size used in reserve
     u32 getMemPageSize();
     u32 getMemPageAlignment();
+    u32 getHugePageSize();      // 0 without huge page support
+    i32 getNumaNodeCount();
     u64 getProcessMemory();
 
 
@@ -44,6 +44,13 @@ namespace cal::platform {
     };
 
 
+    // read only view of a whole file, valid until unmapFile()
+    struct MappedFile {
+        const u8* data = nullptr;
+        u64 size = 0;
+    };
+
+
     struct FileInfo {
         bool is_directory;
         char filename[MAX_PATH];
@@ -70,6 +77,8 @@ namespace cal::platform {
     CAL_API [[nodiscard]] bool makePath(const char* path); //DONE
 
     CAL_API [[nodiscard]] bool copyFile(StringView from, StringView to); //DONE
+    CAL_API [[nodiscard]] bool mapFile(const char* path, MappedFile& file);
+    CAL_API void unmapFile(MappedFile& file);
     CAL_API void getExecutablePath(Span<char> path); //DONE
     CAL_API [[nodiscard]] bool getAppDataDir(Span<char> path); //DONE
 }
\ No newline at end of file
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "globals.hpp"
+#include "base/types/Span.hpp"
+
+namespace cal::platform {
+
+    // "<runtime dir>/cal-<uid>/<name>", the runtime dir is $XDG_RUNTIME_DIR, else $TMPDIR, else /tmp
+    // the cal-<uid> directory is created private (0700), false when it exists with another owner or mode
+    CAL_API bool getUserSocketPath(Span<char> path, const char* name);
+
+
+    // blocking stream socket bound to a local (unix domain) path
+    struct CAL_API LocalSocket final {
+        LocalSocket();
+        ~LocalSocket();
+
+        // server side, fails while a server answers on path, a stale socket file left by a dead server
+        // is replaced. only the current user can connect (0600)
+        [[nodiscard]] bool listen(const char* path);
+        [[nodiscard]] bool accept(LocalSocket& client);
+        [[nodiscard]] bool connect(const char* path);
+        void close();
+
+        // both transfer exactly size bytes or fail
+        [[nodiscard]] bool send(const void* data, u64 size);
+        [[nodiscard]] bool receive(void* data, u64 size);
+
+        bool isOpen() const { return m_handle >= 0; }
+        // the process on the other end runs as the same user as this one
+        bool isPeerCurrentUser() const;
+
+    private:
+        LocalSocket(const LocalSocket&) = delete;
+        i32 m_handle;
+        char m_path[MAX_PATH];
+    };
+}
@@ -0,0 +1,199 @@
+#include "base/types/String.hpp"
+#ifdef __linux__
+
+#include "system/Sys.hpp"
+
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace cal::platform {
+
+    // mbind() without linking libnuma, values from <numaif.h>
+    static constexpr int NUMA_MPOL_PREFERRED = 1;
+    static constexpr u32 MAX_NUMA_NODES = 1024;
+
+    static struct {
+        int argc;
+        char** argv;
+    } G;
+
+    void setCommandLine(int a, char** b) {
+        G.argc = a;
+        G.argv = b;
+    }
+
+
+    bool getCommandLine(Span<char> output) {
+        string::copyString(output, "");
+        for (int i = 0; i < G.argc; ++i) {
+            string::catString(output, G.argv[i]);
+            string::catString(output, " ");
+        }
+        return true;
+    }
+
+
+    void abort() {
+        ::abort();
+    }
+
+
+    void* memReserve(size_t size) {
+        // overcommitted, pages are only backed once touched
+        void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        return mem == MAP_FAILED ? nullptr : mem;
+    }
+
+
+    // the kernel only uses transparent huge pages for aligned ranges, the slack around is unmapped again
+    static void* reserveAligned(size_t size, size_t alignment) {
+        u8* mem = (u8*)memReserve(size + alignment);
+        if (!mem) return nullptr;
+
+        u8* aligned = (u8*)(((uintptr)mem + alignment - 1) & ~uintptr(alignment - 1));
+        if (aligned != mem) munmap(mem, aligned - mem);
+        const size_t tail = mem + size + alignment - (aligned + size);
+        if (tail > 0) munmap(aligned + size, tail);
+        return aligned;
+    }
+
+
+    // preferred instead of bound : a full node spills over to the others instead of failing page faults
+    static void bindToNumaNode(void* ptr, size_t size, i32 numa_node) {
+        constexpr u32 BITS = sizeof(unsigned long) * 8;
+        if ((u32)numa_node >= MAX_NUMA_NODES) return;
+
+        unsigned long mask[MAX_NUMA_NODES / BITS] = {};
+        mask[numa_node / BITS] = 1ul << (numa_node % BITS);
+        syscall(SYS_mbind, ptr, size, NUMA_MPOL_PREFERRED, mask, MAX_NUMA_NODES + 1, 0);
+    }
+
+
+    void* memReserve(size_t size, HugePages huge_pages, i32 numa_node) {
+        const u32 huge_page_size = getHugePageSize();
+        void* mem = nullptr;
+        if (huge_pages == HugePages::None || huge_page_size == 0) {
+            mem = memReserve(size);
+        }
+        else {
+            ASSERT(size % huge_page_size == 0);
+            if (huge_pages == HugePages::Explicit) {
+                // without MAP_NORESERVE the pool pages are claimed now, an empty pool fails here instead of
+                // with a SIGBUS on first touch
+                mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+                if (mem == MAP_FAILED) mem = nullptr;
+            }
+            if (!mem) {
+                mem = reserveAligned(size, huge_page_size);
+                if (mem) madvise(mem, size, MADV_HUGEPAGE);
+            }
+        }
+
+        if (mem && numa_node >= 0) bindToNumaNode(mem, size, numa_node);
+        return mem;
+    }
+
+
+    void memCommit(void*, size_t) {
+        // noop, reservations are backed on first touch
+    }
+
+
+    bool memDecommit(void* ptr, size_t size) {
+        // fails with EINVAL on MAP_HUGETLB mappings unless the range covers whole huge pages
+        return madvise(ptr, size, MADV_DONTNEED) == 0;
+    }
+
+
+    void memRelease(void* ptr, size_t size) {
+        munmap(ptr, size);
+    }
+
+
+    u32 getMemPageSize() {
+        const u32 sz = sysconf(_SC_PAGESIZE);
+        return sz;
+    }
+
+    u32 getMemPageAlignment() {
+        return getMemPageSize();
+    }
+
+    u32 getHugePageSize() {
+        static const u32 size = []() -> u32 {
+            FILE* file = fopen("/proc/meminfo", "r");
+            if (!file) return 0;
+
+            char line[128];
+            unsigned long kib = 0;
+            while (fgets(line, sizeof(line), file)) {
+                if (sscanf(line, "Hugepagesize: %lu kB", &kib) == 1) break;
+            }
+            fclose(file);
+            return (u32)(kib * 1024);
+        }();
+        return size;
+    }
+
+    i32 getNumaNodeCount() {
+        static const i32 count = []() -> i32 {
+            // e.g. "0-3" or "0,2-3", the highest node decides
+            FILE* file = fopen("/sys/devices/system/node/online", "r");
+            if (!file) return 1;
+
+            char line[256] = {};
+            const bool read = fgets(line, sizeof(line), file) != nullptr;
+            fclose(file);
+            if (!read) return 1;
+
+            i32 last = 0;
+            for (const char* c = line; *c;) {
+                char* end;
+                const long value = strtol(c, &end, 10);
+                if (end == c) {
+                    ++c;
+                    continue;
+                }
+                last = (i32)value;
+                c = end;
+            }
+            return last + 1;
+        }();
+        return count;
+    }
+
+    u64 getProcessMemory()
+    {
+        FILE* file = fopen("/proc/self/statm", "r");
+        if (!file) return 0;
+
+        unsigned long size = 0;
+        unsigned long resident = 0;
+        const int read = fscanf(file, "%lu %lu", &size, &resident);
+        fclose(file);
+        return read == 2 ? (u64)resident * getMemPageSize() : 0;
+    }
+
+    void* loadLibrary(const char* path) {
+        return dlopen(path, RTLD_LOCAL | RTLD_LAZY);
+    }
+
+    void unloadLibrary(void* handle) {
+        if (handle != NULL) dlclose(handle);
+    }
+
+
+    void* getLibrarySymbol(void* handle, const char* name) {
+        return dlsym(handle, name);
+    }
+
+
+    float getTimeSinceProcessStart() { return -1; }
+
+}
+
+#endif
@@ -0,0 +1,165 @@
+#ifdef __linux__
+
+#include "system/SysSocket.hpp"
+#include "base/types/String.hpp"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace cal::platform {
+
+    static bool fillAddress(const char* path, sockaddr_un& addr) {
+        if ((size_t)string::stringLength(path) >= sizeof(addr.sun_path)) return false;
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        string::copyString(Span<char>(addr.sun_path, sizeof(addr.sun_path)), path);
+        return true;
+    }
+
+
+    bool getUserSocketPath(Span<char> path, const char* name) {
+        const char* base = getenv("XDG_RUNTIME_DIR");
+        if (!base || base[0] != '/') base = getenv("TMPDIR");
+        if (!base || base[0] != '/') base = "/tmp";
+
+        char dir[MAX_PATH];
+        const size_t base_length = (size_t)string::stringLength(base);
+        const char* separator = base[base_length - 1] == '/' ? "" : "/";
+        if (snprintf(dir, sizeof(dir), "%s%scal-%u", base, separator, (u32)::geteuid()) >= (int)sizeof(dir)) return false;
+        if (::mkdir(dir, 0700) != 0 && errno != EEXIST) return false;
+
+        // the directory may have been planted by someone else, only use it when it is ours and private
+        struct stat info;
+        if (::lstat(dir, &info) != 0 || !S_ISDIR(info.st_mode) || info.st_uid != ::geteuid() || (info.st_mode & 077) != 0) {
+            return false;
+        }
+        return snprintf(path.begin(), path.length(), "%s/%s", dir, name) < (int)path.length();
+    }
+
+
+    LocalSocket::LocalSocket() {
+        m_handle = -1;
+        m_path[0] = '\0';
+    }
+
+
+    LocalSocket::~LocalSocket() {
+        close();
+    }
+
+
+    bool LocalSocket::listen(const char* path) {
+        ASSERT(!isOpen());
+        sockaddr_un addr;
+        if (!fillAddress(path, addr)) return false;
+
+        // only a socket file nobody answers on is stale, a running server keeps its socket
+        {
+            LocalSocket probe;
+            if (probe.connect(path)) return false;
+        }
+
+        m_handle = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (m_handle < 0) return false;
+
+        // a client that disconnects mid reply must not kill the server
+        signal(SIGPIPE, SIG_IGN);
+
+        // created without group / other access, there is no window where another user could connect
+        ::unlink(path);
+        const mode_t mask = ::umask(0077);
+        const bool bound = ::bind(m_handle, (sockaddr*)&addr, sizeof(addr)) == 0;
+        ::umask(mask);
+        if (!bound) {
+            close();
+            return false;
+        }
+        string::copyString(m_path, path);
+
+        if (::chmod(path, 0600) != 0 || ::listen(m_handle, 16) != 0) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+
+    bool LocalSocket::accept(LocalSocket& client) {
+        ASSERT(isOpen() && !client.isOpen());
+        for (;;) {
+            const i32 handle = ::accept(m_handle, nullptr, nullptr);
+            if (handle >= 0) {
+                client.m_handle = handle;
+                return true;
+            }
+            if (errno != EINTR) return false;
+        }
+    }
+
+
+    bool LocalSocket::connect(const char* path) {
+        ASSERT(!isOpen());
+        sockaddr_un addr;
+        if (!fillAddress(path, addr)) return false;
+
+        m_handle = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (m_handle < 0) return false;
+
+        if (::connect(m_handle, (sockaddr*)&addr, sizeof(addr)) != 0) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+
+    bool LocalSocket::isPeerCurrentUser() const {
+        struct ucred cred;
+        socklen_t len = sizeof(cred);
+        return ::getsockopt(m_handle, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 && cred.uid == ::geteuid();
+    }
+
+
+    void LocalSocket::close() {
+        if (m_handle >= 0) ::close(m_handle);
+        m_handle = -1;
+
+        if (m_path[0] != '\0') ::unlink(m_path);
+        m_path[0] = '\0';
+    }
+
+
+    bool LocalSocket::send(const void* data, u64 size) {
+        const u8* ptr = (const u8*)data;
+        while (size > 0) {
+            const ssize_t written = ::send(m_handle, ptr, size, 0);
+            if (written < 0 && errno == EINTR) continue;
+            if (written <= 0) return false;
+            ptr += written;
+            size -= (u64)written;
+        }
+        return true;
+    }
+
+
+    bool LocalSocket::receive(void* data, u64 size) {
+        u8* ptr = (u8*)data;
+        while (size > 0) {
+            const ssize_t read = ::recv(m_handle, ptr, size, 0);
+            if (read < 0 && errno == EINTR) continue;
+            if (read <= 0) return false;
+            ptr += read;
+            size -= (u64)read;
+        }
+        return true;
+    }
+}
+
+#endif
@@ -31,6 +31,11 @@ namespace cal {
         ASSERT(res == 0);
     }
 
+    void ConditionVariable::wakeupAll() {
+        const int res = pthread_cond_broadcast(&cv);
+        ASSERT(res == 0);
+    }
+
     Semaphore::Semaphore(int init_count, int max_count)
     {
         m_id.count = init_count;
@@ -6,6 +6,7 @@
 #include <sys/stat.h>
 #include <sys/sysctl.h>
 #include <sys/mman.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <dlfcn.h>
 
@@ -32,6 +33,11 @@ namespace cal::platform {
     }
 
 
+    void abort() {
+        ::abort();
+    }
+
+
     void* memReserve(size_t size) {
         //TODO Test It MAP_ANON   :  MAP_ANONYMOUS |
         void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
@@ -40,11 +46,22 @@ namespace cal::platform {
     }
 
 
+    // superpages only exist on intel macs and can't be reserved lazily, numa doesn't exist at all
+    void* memReserve(size_t size, HugePages huge_pages, i32 numa_node) {
+        return memReserve(size);
+    }
+
+
     void memCommit(void* ptr, size_t size) {
         // noop on mach
     }
 
 
+    bool memDecommit(void* ptr, size_t size) {
+        return madvise(ptr, size, MADV_FREE) == 0;
+    }
+
+
     void memRelease(void* ptr, size_t size) {
         munmap(ptr, size);
     }
@@ -59,6 +76,14 @@ namespace cal::platform {
         return getMemPageSize();
     }
 
+    u32 getHugePageSize() {
+        return 0;
+    }
+
+    i32 getNumaNodeCount() {
+        return 1;
+    }
+
     u64 getProcessMemory()
     {
         return 0;
@@ -10,6 +10,7 @@
 #include <string>
 #include <sys/stat.h>
 #include <sys/fcntl.h>
+#include <sys/mman.h>
 
 namespace cal::platform {
 
@@ -256,6 +257,35 @@ namespace cal::platform {
     }
 
 
+    bool mapFile(const char* path, MappedFile& file) {
+        file = {};
+        const int handle = ::open(path, O_RDONLY);
+        if (handle < 0) return false;
+
+        struct stat tmp;
+        if (fstat(handle, &tmp) != 0 || tmp.st_size == 0) {
+            ::close(handle);
+            return false;
+        }
+
+        void* data = mmap(nullptr, tmp.st_size, PROT_READ, MAP_PRIVATE, handle, 0);
+        // the mapping keeps its own reference to the file
+        ::close(handle);
+        if (data == MAP_FAILED) return false;
+
+        file.data = (const u8*)data;
+        file.size = tmp.st_size;
+        return true;
+    }
+
+
+    void unmapFile(MappedFile& file) {
+        if (!file.data) return;
+        munmap((void*)file.data, file.size);
+        file = {};
+    }
+
+
     bool getAppDataDir(Span<char> path) {
         char* home = getenv("HOME");
         if (!home) return false;
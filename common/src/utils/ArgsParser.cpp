@@ -2,22 +2,65 @@
 
 #include "base/types/String.hpp"
 
+#include <cstring>
+
 namespace cal {
 
-    ArgsParser::ArgsParser(i32 argc, const char** argv, IAllocator& alloc)
-        
+    ArgsParser::ArgsParser(i32 argc, const char** argv, IAllocator& alloc, const char* value_keys)
+        : m_args(alloc),
+        m_positionals(alloc)
     {
         argc--;
         argv++;
 
-        for(size_t idx = argc; idx < argc; idx++) {
-            const char* arg = argv[idx];
-            if (!string::startsWith(arg, "-")) continue;
-            if (!string::find(arg, '=')) continue;
+        bool options_done = false;
+        for (i32 idx = 0; idx < argc; idx++) {
+            const std::string arg = argv[idx];
+            if (options_done || arg.size() < 2 || arg[0] != '-') {
+                m_positionals.push(arg);
+                continue;
+            }
+
+            if (arg == "--") {
+                options_done = true;
+                continue;
+            }
+
+            std::string key, value;
+            if (arg[1] == '-') {
+                const size_t split = arg.find('=');
+                key = arg.substr(2, split == std::string::npos ? std::string::npos : split - 2);
+                if (split != std::string::npos) value = arg.substr(split + 1);
+            }
+            else {
+                key = arg.substr(1, 1);
+                value = arg.substr(2);
+                // a flag must not swallow the positional after it
+                if (value.empty() && strchr(value_keys, arg[1]) && idx + 1 < argc) {
+                    value = argv[++idx];
+                }
+            }
 
-            //TODO
+            auto iter = m_args.find(key);
+            if (iter.isValid()) iter.value() = value;
+            else m_args.insert(key, value);
         }
     }
 
 
-}
\ No newline at end of file
+    bool ArgsParser::hasArg(const std::string& key) const {
+        return m_args.find(key).isValid();
+    }
+
+
+    std::string ArgsParser::getArg(const std::string& key, const std::string& defaultVal) const {
+        auto iter = m_args.find(key);
+        if (!iter.isValid()) return defaultVal;
+        return iter.value();
+    }
+
+
+    std::string ArgsParser::getArg(const std::string& key) const {
+        return getArg(key, "");
+    }
+}
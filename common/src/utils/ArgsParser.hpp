@@ -2,19 +2,32 @@
 
 #include "base/allocator/IAllocator.hpp"
 #include "globals.hpp"
+#include "base/types/Array.hpp"
 #include "base/types/container/HashMap.hpp"
 
+#include <string>
+
 namespace cal {
 
+    // accepted forms, keys are stored without the leading dashes :
+    //  --key=value     --flag
+    //  -Kvalue         -K value (K listed in value_keys, e.g. "jo")
+    //  -K              (any other K, a flag)
+    // everything else is a positional argument, "--" ends option parsing
     class ArgsParser 
     {
     public:
-        ArgsParser(i32 argc, const char** argv, IAllocator& alloc);
+        ArgsParser(i32 argc, const char** argv, IAllocator& alloc, const char* value_keys = "");
 
+        bool hasArg(const std::string& key) const;
         std::string getArg(const std::string& key, const std::string& defaultVal) const;
         std::string getArg(const std::string& key) const;
 
+        u32 getPositionalCount() const { return m_positionals.size(); }
+        const std::string& getPositional(u32 idx) const { return m_positionals[idx]; }
+
     private:
-        
+        HashMap<std::string, std::string> m_args;
+        Array<std::string> m_positionals;
     };
-}
\ No newline at end of file
+}
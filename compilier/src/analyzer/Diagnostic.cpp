@@ -0,0 +1,14 @@
+#include "Diagnostic.hpp"
+
+#include "analyzer/SourceMap.hpp"
+#include "utils/StringBuilder.hpp"
+
+namespace cal {
+
+    std::string formatDiagnostic(const SourceFile& file, const Diagnostic& diagnostic) {
+        const LineColumn position = file.lines.getLineColumn(diagnostic.begin);
+        StringBuilder builder{ file.path, ":", position.line + 1, ":", position.column + 1, ": " };
+        builder.appendAll(diagnostic.severity == DiagnosticSeverity::Error ? "error: " : "warning: ", diagnostic.message);
+        return builder;
+    }
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "globals.hpp"
+
+#include <string>
+
+namespace cal {
+
+    struct SourceFile;
+
+    enum class DiagnosticSeverity : u8 {
+        Error, Warning
+    };
+
+    // a problem in one source, [begin, end) is a byte range of that source
+    struct Diagnostic {
+        DiagnosticSeverity severity;
+        u32 begin;
+        u32 end;
+        std::string message;
+    };
+
+    // "file:line:column: error: message", line and column are 1 based, begin is an offset into file
+    std::string formatDiagnostic(const SourceFile& file, const Diagnostic& diagnostic);
+}
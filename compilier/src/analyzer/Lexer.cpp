@@ -2,12 +2,15 @@
 
 #include "base/Logger.hpp"
 #include "utils/StringBuilder.hpp"
+#include "base/math/Math.hpp"
+#include "utils/TimeReport.hpp"
 #include <cctype>
+#include <cstring>
 
 namespace cal {
 
 #define LEX_TK_ADD(TK_TYPE, TK_ITEM) \
-        m_tokens.push(Token {.tk_type = TK_TYPE, .tk_item = TK_ITEM })
+        m_tokens.push(Token {.tk_type = TK_TYPE, .tk_item = TK_ITEM, .tk_offset = locateToken(TK_ITEM) })
 #define LEX_TK_POPLAST() \
         m_tokens.
 
@@ -27,53 +30,28 @@ namespace cal {
     };
 
 
-    const Lexer::Token Lexer::UnknownToken = { Lexer::Token::TK_UNKNOWN, "" };
+    const Lexer::Token Lexer::UnknownToken = { Lexer::Token::TK_UNKNOWN, "", 0 };
 
 
     Lexer::Lexer(const std::string& source, IAllocator& alloc)
-        : m_src(source), m_pos(0), m_alloc(alloc), m_tokens(alloc)
+        : m_src(source), m_pos(0), m_alloc(alloc), m_tokens(alloc), m_diagnostics(alloc)
     {
-        if (m_src.length() == 0) {
-            LogError("[Lex] Empty source");
-            ASSERT(false);
-        }
     }
 
 
     void Lexer::analyze() {
+        CAL_TIME_SCOPE("lex");
         LogDebug("[Lex] Source code lenght : ", m_src.length());
         // int times = 0;
 
         while (m_pos < m_src.length()) {
             // times++;
-            goToNextNonSpace();
-
-            if (m_commentLineLock)
-            {
-            checkEOL:
-                if (m_src[m_pos] == '\n') {
-                    //  LEX_TK_ADD(Token::TK_EOL, ";");
-                    m_pos++;
-                    m_commentLineLock = false;
-                }
-                else if (m_src[m_pos] == '*' && m_src[m_pos + 1] == '/') {
-                    m_pos += 2;
-                    m_commentLineLock = false;
-                    m_use_multiline_comment = false;
-                }
-                else if (m_use_multiline_comment) {
-                    while (m_pos < m_src.length() && m_src[m_pos] != '*') {
-                        if (m_src[m_pos + 1] == '/') break;
-                        m_pos++;
-                    }
-                    goto checkEOL;
-                }
-                else {
-                    while (m_pos < m_src.length() && m_src[m_pos] != '\n')
-                        m_pos++;
-                    goto checkEOL;
-                }
+            if (m_cancel.isCancelled()) {
+                m_cancelled = true;
+                break;
             }
+            goToNextNonSpace();
+            if (m_pos >= m_src.length()) break;
 
             if (m_src[m_pos] == '=') {
                 if (m_src[m_pos + 1] == '=') {
@@ -141,7 +119,7 @@ namespace cal {
             else if (std::isdigit(m_src[m_pos]) || m_src[m_pos] == '-') {
                 parseNumber();
             }
-            else if (std::isalpha(m_src[m_pos]) || m_src[m_pos] == '\"') {
+            else if (m_src[m_pos] == '\"') {
                 parseText();
             }
             else if (m_src[m_pos] == '.') {
@@ -161,13 +139,22 @@ namespace cal {
                 m_pos++;
             }
             else if (m_src[m_pos] == '/' && m_src[m_pos + 1] == '/') {
-                m_commentLineLock = true;
-                m_pos += 2;
+                const size_t end = m_src.find('\n', m_pos);
+                m_pos = end == std::string::npos ? m_src.length() : end + 1;
             }
             else if (m_src[m_pos] == '/' && m_src[m_pos + 1] == '*') {
-                m_use_multiline_comment = true;
-                m_commentLineLock = true;
-                m_pos += 2;
+                const size_t end = m_src.find("*/", m_pos + 2);
+                if (end == std::string::npos) {
+                    reportError(m_pos, m_src.length(), "unterminated block comment");
+                    m_pos = m_src.length();
+                }
+                else {
+                    m_pos = end + 2;
+                }
+            }
+            else if (m_src[m_pos] == '/') {
+                LEX_TK_ADD(Token::TK_DIVID, "/");
+                m_pos++;
             }
             else if (m_src[m_pos] == '[') {
                 m_pos++;
@@ -193,18 +180,50 @@ namespace cal {
                 LEX_TK_ADD(Token::TokenType::TK_COMMA, ",");
                 m_pos++;
             }
-            else if (m_src[m_pos] == '\n') {
-                // LEX_TK_ADD(Token::TK_EOL, ";");
-                m_pos++;
-                m_commentLineLock = false;
-            }
             else {
+                // not part of the language (yet), dropped
+                reportWarning(m_pos, m_pos + 1, std::string("unexpected character '") + m_src[m_pos] + "'");
                 m_pos++;
             }
         }
     }
 
 
+    void Lexer::collectImports(Array<std::string>& imports) const {
+        for (auto& tk : m_tokens) {
+            if (tk.tk_type == Token::TK_MODULE_NAME) imports.push(tk.tk_item);
+        }
+    }
+
+
+    bool Lexer::hasErrors() const {
+        for (const Diagnostic& diagnostic : m_diagnostics) {
+            if (diagnostic.severity == DiagnosticSeverity::Error) return true;
+        }
+        return false;
+    }
+
+
+    StableHash Lexer::computeResultHash() const {
+        std::string buffer;
+        const auto appendU32 = [&buffer](u32 value) { buffer.append((const char*)&value, sizeof(value)); };
+        for (auto& tk : m_tokens) {
+            buffer.push_back((char)tk.tk_type);
+            appendU32(tk.tk_offset);
+            buffer.append(tk.tk_item);
+            buffer.push_back('\0');
+        }
+        for (const Diagnostic& diagnostic : m_diagnostics) {
+            buffer.push_back((char)diagnostic.severity);
+            appendU32(diagnostic.begin);
+            appendU32(diagnostic.end);
+            buffer.append(diagnostic.message);
+            buffer.push_back('\0');
+        }
+        return StableHash(buffer.data(), (u32)buffer.size());
+    }
+
+
     void Lexer::debugPrint() const {
         LogDebug("[LexResult] Tokens lexed : ", m_tokens.size());
         for (auto& tk : m_tokens) {
@@ -231,16 +250,57 @@ namespace cal {
     }
 
 
+    // tokens are pushed either right before m_pos moves past their text or right after it (keywords also
+    // skip one space), so the text starts within len + 1 bytes before m_pos, synthesized items ("void") fall back to m_pos
+    u32 Lexer::locateToken(const std::string& item) const {
+        const size_t pos = minimum(m_pos, m_src.length());
+        const size_t len = item.length();
+        for (size_t start = pos > len + 1 ? pos - len - 1 : 0; len > 0 && start <= pos; ++start) {
+            if (m_src.compare(start, len, item) == 0) return (u32)start;
+        }
+        return (u32)pos;
+    }
+
+
     bool Lexer::checkTokenMatched(const std::string& token) {
-        size_t start = m_pos;
-        bool result = false;
+        return m_src.compare(m_pos, token.length(), token) == 0;
+    }
+
+
+    void Lexer::reportError(size_t begin, size_t end, std::string message) {
+        m_diagnostics.push(Diagnostic{ DiagnosticSeverity::Error, (u32)begin, (u32)maximum(begin + 1, end), std::move(message) });
+    }
+
 
-        for (int i = 0; i < token.length(); i++) {
-            result = m_src[start + i] == token[i];
-            if (!result) break;
+    void Lexer::reportWarning(size_t begin, size_t end, std::string message) {
+        m_diagnostics.push(Diagnostic{ DiagnosticSeverity::Warning, (u32)begin, (u32)maximum(begin + 1, end), std::move(message) });
+    }
+
+
+    // panic mode, skips the rest of a broken construct up to a point the main loop can continue from :
+    // ';', '{', '}' (left in place so the braces stay balanced) or the next top level keyword
+    void Lexer::recover() {
+        static const char* const keywords[] = { "fun ", "struct ", "import ", "module ", "export ", "extern ", "val ", "var " };
+
+        while (m_pos < m_src.length()) {
+            const char c = m_src[m_pos];
+            if (c == ';' || c == '{' || c == '}') return;
+            if (m_pos == 0 || std::isspace(m_src[m_pos - 1])) {
+                for (const char* keyword : keywords) {
+                    if (checkTokenMatched(keyword)) return;
+                }
+            }
+            m_pos++;
         }
+    }
+
 
-        return result;
+    // local recovery inside a list, true when m_pos stopped on one of stops
+    bool Lexer::skipUntil(const char* stops) {
+        while (m_pos < m_src.length() && !strchr(stops, m_src[m_pos])) {
+            m_pos++;
+        }
+        return m_pos < m_src.length();
     }
 
 
@@ -271,6 +331,11 @@ namespace cal {
         size_t start = m_pos;
         while (m_pos < m_src.length() && (std::isalnum(m_src[m_pos]) || m_src[m_pos] == '_'))
             m_pos++;
+        if (m_pos == start) {
+            reportError(start, start + 1, std::string("expected a name after '") + (isConst ? "val" : "var") + "'");
+            recover();
+            return;
+        }
         std::string value = m_src.substr(start, m_pos - start);
         LEX_TK_ADD(Token::TK_IDENTIFIER, value);
 
@@ -294,7 +359,8 @@ namespace cal {
         while (m_pos < m_src.length() && (std::isalnum(m_src[m_pos]) || m_src[m_pos] == '_'))
             m_pos++;
         std::string value = m_src.substr(start, m_pos - start);
-        if (!std::isalpha(value[0])) {
+        if (value.empty() || !std::isalpha(value[0])) {
+            reportError(start, m_pos, "expected a type after ':'");
             m_pos = start;
             return;
         }
@@ -303,16 +369,18 @@ namespace cal {
 
 
     void Lexer::parseText() {
-        size_t start = m_pos + 1;
-        size_t len = 0;
-        while (true) {
-            len++;
+        const char quote = m_src[m_pos];
+        const size_t begin = m_pos++;
+        const size_t start = m_pos;
+        while (m_pos < m_src.length() && m_src[m_pos] != quote && m_src[m_pos] != '\n') {
+            if (m_src[m_pos] == '\\' && m_pos + 1 < m_src.length()) m_pos++;
             m_pos++;
-            if (m_src[m_pos] == '\'')
-                break;
         }
-        std::string value = m_src.substr(start, len - 1);
-        m_pos++; // Move 'pos' to skip the closing quotation mark
+
+        std::string value = m_src.substr(start, m_pos - start);
+        // strings end on their line, the lexer picks up right after the broken one
+        if (m_pos < m_src.length() && m_src[m_pos] == quote) m_pos++;
+        else reportError(begin, m_pos, "unterminated string literal");
         LEX_TK_ADD(Token::TK_TEXT, value);
     }
 
@@ -354,6 +422,7 @@ namespace cal {
 
 
     void Lexer::parseFunctionDeclear() {
+        const size_t decl_start = m_pos;
         m_pos += 4;
         LEX_TK_ADD(Token::TK_FUNC_DEF, "fun");
 
@@ -373,59 +442,78 @@ namespace cal {
         }
 
         goToNextNonSpace();
-        if (m_src[m_pos] != '(')
+        if (m_src[m_pos] != '(') {
+            reportError(m_pos, m_pos + 1, "expected '(' after the function name");
+            recover();
             return;
-        else
-            m_pos++;
-
-        size_t backup_point = m_pos;
-        while (m_src[m_pos] != ')') {
+        }
+        m_pos++;
 
+        goToNextNonSpace();
+        while (m_pos < m_src.length() && m_src[m_pos] != ')') {
+            // the body or the next statement, the list was never closed
+            if (strchr("{};", m_src[m_pos])) break;
             size_t start = m_pos;
-            do {
+            while (m_pos < m_src.length() && m_src[m_pos] != ',' && m_src[m_pos] != ':' && !std::isspace(m_src[m_pos]) && m_src[m_pos] != ')')
                 m_pos++;
-            } while (m_pos < m_src.length() && m_src[m_pos] != ',' && !std::isspace(m_src[m_pos]) && m_src[m_pos] != ')');
             std::string value = m_src.substr(start, m_pos - start);
 
-            LEX_TK_ADD(Token::TK_FUNC_ARG, value);
-
             goToNextNonSpace();
-            if (m_src[m_pos] != ':') {
-                m_pos = backup_point;
-                return;
+            if (value.empty() || m_src[m_pos] != ':') {
+                reportError(start, start + value.length(), value.empty() ? "expected a parameter name" : "expected ':' and a type after parameter '" + value + "'");
+                // drop this parameter, carry on with the next one
+                if (!skipUntil(",){};") || m_src[m_pos] == '{' || m_src[m_pos] == '}' || m_src[m_pos] == ';') break;
+                if (m_src[m_pos] == ',') m_pos++;
+                goToNextNonSpace();
+                continue;
             }
+            LEX_TK_ADD(Token::TK_FUNC_ARG, value);
 
             m_pos++;
+            goToNextNonSpace();
 
             start = m_pos;
-            do {
+            while (m_pos < m_src.length() && m_src[m_pos] != '[' && m_src[m_pos] != ',' && !std::isspace(m_src[m_pos]) && m_src[m_pos] != ')')
                 m_pos++;
-            } while (m_pos < m_src.length() && m_src[m_pos] != '[' && m_src[m_pos] != ',' && !std::isspace(m_src[m_pos]) && m_src[m_pos] != ')');
 
             if (m_src[m_pos] == '[') {
-                do {
+                while (m_pos < m_src.length() && m_src[m_pos] != ']' && !std::isspace(m_src[m_pos]) && m_src[m_pos] != ')')
                     m_pos++;
-                } while (m_pos < m_src.length() && m_src[m_pos] != ']' && !std::isspace(m_src[m_pos]) && m_src[m_pos] != ')');
-                m_pos++;
+                if (m_src[m_pos] == ']') m_pos++;
+                else reportError(start, m_pos, "expected ']' to close the array type");
             }
             value = m_src.substr(start, m_pos - start);
 
+            if (value.empty()) reportError(start, start + 1, "expected a type after ':'");
             LEX_TK_ADD(Token::TK_TYPE, value);
 
             while (m_pos < m_src.length() && (std::isspace(m_src[m_pos]) || m_src[m_pos] == ','))
                 m_pos++;
         }
 
+        if (m_pos >= m_src.length() || m_src[m_pos] != ')') {
+            size_t end = m_pos;
+            while (end > decl_start && std::isspace(m_src[end - 1]))
+                end--;
+            reportError(decl_start, end, "parameter list is never closed");
+            recover();
+            return;
+        }
         m_pos++;
         goToNextNonSpace();
 
         if (m_src[m_pos] == ':') {
             m_pos++;
+            goToNextNonSpace();
 
             size_t start = m_pos;
-            do {
+            while (m_pos < m_src.length() && m_src[m_pos] != '{' && !std::isspace(m_src[m_pos]) && m_src[m_pos] != ';')
                 m_pos++;
-            } while (m_pos < m_src.length() && m_src[m_pos] != '{' && !std::isspace(m_src[m_pos]) && m_src[m_pos] != ';');
+            if (m_pos == start) {
+                reportError(start, start + 1, "expected a return type after ':'");
+                LEX_TK_ADD(Token::TK_FUNC_RETURN, "void");
+                return;
+            }
             std::string value = m_src.substr(start, m_pos - start);
             LEX_TK_ADD(Token::TK_FUNC_RETURN, value);
         }
@@ -438,50 +526,53 @@ namespace cal {
 
 
     void Lexer::parseStructDeclear() {
+        const size_t decl_start = m_pos;
         m_pos += 7;
 
         goToNextNonSpace();
-        if (std::isalpha(m_src[m_pos])) {
-            size_t start = m_pos;
-            do {
-                m_pos++;
-            } while (m_pos < m_src.length() && m_src[m_pos] != '(' && !std::isspace(m_src[m_pos]));
-            std::string value = m_src.substr(start, m_pos - start);
-
-            LEX_TK_ADD(Token::TK_STRUCT, value);
-        }
-        else {
+        if (!std::isalpha(m_src[m_pos]) && m_src[m_pos] != '_') {
+            reportError(m_pos, m_pos + 1, "expected a name after 'struct'");
+            recover();
             return;
         }
 
+        size_t start = m_pos;
+        do {
+            m_pos++;
+        } while (m_pos < m_src.length() && m_src[m_pos] != '(' && m_src[m_pos] != '{' && !std::isspace(m_src[m_pos]));
+        const std::string name = m_src.substr(start, m_pos - start);
+        LEX_TK_ADD(Token::TK_STRUCT, name);
+
         goToNextNonSpace();
-        if (m_src[m_pos] != '{')
+        if (m_src[m_pos] != '{') {
+            reportError(m_pos, m_pos + 1, "expected '{' after struct '" + name + "'");
+            recover();
             return;
-        else
-            m_pos++;
+        }
+        m_pos++;
 
-        size_t backup_point = m_pos;
-        while (m_src[m_pos] != '}' && m_pos < m_src.size()) {
+        while (m_pos < m_src.length()) {
             goToNextNonSpace();
-            if (m_src[m_pos] == '}') break;
+            if (m_pos >= m_src.length() || m_src[m_pos] == '}') break;
 
-            size_t start = m_pos;
-            do {
+            start = m_pos;
+            while (m_pos < m_src.length() && (std::isalnum(m_src[m_pos]) || m_src[m_pos] == '_'))
                 m_pos++;
-            } while (m_pos < m_src.length() && m_src[m_pos] != ',' && !std::isspace(m_src[m_pos]) && m_src[m_pos] != '}');
-            std::string value = m_src.substr(start, m_pos - start);
-
-            LEX_TK_ADD(Token::TK_IDENTIFIER, value);
+            const std::string field = m_src.substr(start, m_pos - start);
 
             goToNextNonSpace();
-
-            if (m_src[m_pos] != ':') {
-                m_pos = backup_point;
-                return;
+            if (field.empty() || m_src[m_pos] != ':') {
+                reportError(start, start + field.length(), field.empty() ? "expected a field name" : "expected ':' and a type after field '" + field + "'");
+                // drop this field, carry on with the next one
+                if (!skipUntil(",}")) break;
+                if (m_src[m_pos] == ',') m_pos++;
+                continue;
             }
+            LEX_TK_ADD(Token::TK_IDENTIFIER, field);
 
             m_pos++;
 
+            bool has_type = false;
             do {
                 goToNextNonSpace();
 
@@ -503,23 +594,27 @@ namespace cal {
                 }
                 else {
                     start = m_pos;
-                    if (m_src[m_pos] == '}') {
-                        break;
-                    }
-                    do {
+                    while (m_pos < m_src.length() && m_src[m_pos] != ',' && !std::isspace(m_src[m_pos]) && m_src[m_pos] != '}')
                         m_pos++;
-                    } while (m_pos < m_src.length() && m_src[m_pos] != ',' && !std::isspace(m_src[m_pos]) && m_src[m_pos] != '}');
-                    value = m_src.substr(start, m_pos - start);
+                    if (m_pos == start) break;
 
+                    const std::string value = m_src.substr(start, m_pos - start);
                     LEX_TK_ADD(Token::TK_TYPE, value);
+                    has_type = true;
                 }
             } while (m_pos < m_src.length() && m_src[m_pos] != ',' && m_src[m_pos] != '}');
 
-            if (m_src[m_pos] == '}') {
+            if (!has_type) reportError(m_pos, m_pos + 1, "expected a type for field '" + field + "'");
+            if (m_pos >= m_src.length() || m_src[m_pos] == '}') {
                 break;
             }
             m_pos++;
         }
+
+        if (m_pos >= m_src.length()) {
+            reportError(decl_start, m_pos, "struct '" + name + "' is never closed");
+            return;
+        }
         m_pos++;
 
         goToNextNonSpace();
@@ -529,16 +624,22 @@ namespace cal {
     void Lexer::parseImport()
     {
         goToNextNonSpace();
-        size_t start = m_pos;
-        do {
+        const size_t start = m_pos;
+        while (m_pos < m_src.length() && m_src[m_pos] != ';' && m_src[m_pos] != '\n')
             m_pos++;
-        } while (m_src[m_pos] != ';' && m_pos < m_src.length());
-        if (m_pos == m_src.length())
-        {
-            m_pos = start;
+
+        size_t end = m_pos;
+        while (end > start && std::isspace(m_src[end - 1]))
+            end--;
+        if (end == start) {
+            reportError(start, start + 1, "expected a module name after 'import'");
             return;
         }
-        std::string moduleStr = m_src.substr(start, m_pos - start);
+        // a missing ';' still imports the module, the error is reported once
+        if (m_pos >= m_src.length() || m_src[m_pos] != ';') {
+            reportError(end, end + 1, "expected ';' after 'import " + m_src.substr(start, end - start) + "'");
+        }
+        std::string moduleStr = m_src.substr(start, end - start);
         LEX_TK_ADD(Token::TK_MODULE_NAME, moduleStr);
     }
 
@@ -546,7 +647,14 @@ namespace cal {
     void Lexer::parseExport()
     {
         goToNextNonSpace();
-        if (!checkTokenMatched("'c'") && !checkTokenMatched("'C'")) return;
+        if (m_src[m_pos] != '\'') return;
+        if (!checkTokenMatched("'c'") && !checkTokenMatched("'C'")) {
+            const size_t start = m_pos++;
+            skipUntil("'\n");
+            if (m_src[m_pos] == '\'') m_pos++;
+            reportError(start, m_pos, "unknown export target " + m_src.substr(start, m_pos - start) + ", only 'c' is supported");
+            return;
+        }
         m_pos += 3;
         LEX_TK_ADD(Token::TK_EXPORT_ARG, "Stander");
     }
@@ -555,6 +663,10 @@ namespace cal {
     void Lexer::parseCreateInstance()
     {
         goToNextNonSpace();
+        if (m_pos >= m_src.length() || !(std::isalpha(m_src[m_pos]) || m_src[m_pos] == '_')) {
+            reportError(m_pos, m_pos + 1, "expected a type after 'new'");
+            return;
+        }
         size_t start = m_pos;
         do {
             m_pos++;
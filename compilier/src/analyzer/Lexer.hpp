@@ -1,7 +1,10 @@
 #pragma once
 
+#include "analyzer/Diagnostic.hpp"
 #include "base/allocator/IAllocator.hpp"
 #include "base/types/Array.hpp"
+#include "base/types/Hash.hpp"
+#include "utils/Cancellation.hpp"
 #include "utils/CPrintable.hpp"
 #include "utils/StringBuilder.hpp"
 
@@ -11,20 +14,39 @@
 namespace cal {
 
     class Parser;
+    class ModuleInterfaceBuilder;
 
     class Lexer : public CPrintable
     {
         friend class Parser; 
+        friend class ModuleInterfaceBuilder;
+        friend class DocumentAnalyzer;
     public:
         Lexer(const std::string& source, IAllocator& alloc);
         ~Lexer() = default;
 
         void analyze();
+        // polled once per token, a cancelled lexer stops early and keeps the tokens lexed so far
+        void setCancellationToken(const CancellationToken& token) { m_cancel = token; }
+        bool wasCancelled() const { return m_cancelled; }
+        // every problem found by analyze(), malformed constructs are skipped so one run reports them all
+        const Array<Diagnostic>& getDiagnostics() const { return m_diagnostics; }
+        bool hasErrors() const;
+        // module names of every "import x.y;" in the source, in order
+        void collectImports(Array<std::string>& imports) const;
+        // hash of everything analyze() produced, tokens with their offsets and the diagnostics, two lexers
+        // with the same hash can be used interchangeably, including for reporting
+        StableHash computeResultHash() const;
         virtual void debugPrint() const override;
         virtual std::string buildOutput() const override;
 
     private:
         void goToNextNonSpace();
+        u32 locateToken(const std::string& item) const;
+        void reportError(size_t begin, size_t end, std::string message);
+        void reportWarning(size_t begin, size_t end, std::string message);
+        void recover();
+        bool skipUntil(const char* stops);
         bool checkTokenMatched(const std::string& token);
         
         void parseNumber();
@@ -57,15 +79,17 @@ namespace cal {
             };
             const TokenType tk_type;
             const std::string tk_item;
+            const u32 tk_offset;    // byte offset of the token text in the source
         };
 
         static const Token UnknownToken;
 
         Array<Token> m_tokens;
+        Array<Diagnostic> m_diagnostics;
         const std::string m_src;
         size_t m_pos;
-        bool m_commentLineLock = false;
-        bool m_use_multiline_comment = false;
+        bool m_cancelled = false;
+        CancellationToken m_cancel;
         IAllocator& m_alloc;
         StringBuilder m_builder;
     };
@@ -0,0 +1,144 @@
+#include "SourceMap.hpp"
+
+#include "base/Logger.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define CAL_SOURCE_SCAN_SSE2
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#include <arm_neon.h>
+#define CAL_SOURCE_SCAN_NEON
+#endif
+
+namespace cal {
+
+    static u32 scanNewlines(const char* text, u32 size, Array<u32>& line_starts) {
+        u32 i = 0;
+#if defined(CAL_SOURCE_SCAN_SSE2)
+        const __m128i newline = _mm_set1_epi8('\n');
+        for (; i + 16 <= size; i += 16) {
+            const __m128i block = _mm_loadu_si128((const __m128i*)(text + i));
+            u32 mask = (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(block, newline));
+            while (mask) {
+                line_starts.push(i + (u32)__builtin_ctz(mask) + 1);
+                mask &= mask - 1;
+            }
+        }
+#elif defined(CAL_SOURCE_SCAN_NEON)
+        const uint8x16_t newline = vdupq_n_u8('\n');
+        for (; i + 16 <= size; i += 16) {
+            const uint8x16_t matches = vceqq_u8(vld1q_u8((const u8*)(text + i)), newline);
+            // narrow every byte of the compare to a nibble, neon has no movemask
+            u64 mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(matches), 4)), 0);
+            while (mask) {
+                const u32 bit = (u32)__builtin_ctzll(mask);
+                line_starts.push(i + (bit >> 2) + 1);
+                mask &= ~((u64)0xf << bit);
+            }
+        }
+#endif
+        return i;
+    }
+
+
+    void LineTable::build(const char* text, u32 size) {
+        m_line_starts.clear();
+        // most sources average 25 - 40 bytes per line
+        m_line_starts.reserve(size / 32 + 1);
+        m_line_starts.push(0);
+
+        u32 i = scanNewlines(text, size, m_line_starts);
+        for (; i < size; ++i) {
+            if (text[i] == '\n') m_line_starts.push(i + 1);
+        }
+    }
+
+
+    LineColumn LineTable::getLineColumn(u32 offset) const {
+        if (m_line_starts.empty()) return LineColumn{ 0, offset };
+
+        // last line start <= offset
+        u32 low = 0, high = (u32)m_line_starts.size();
+        while (high - low > 1) {
+            const u32 mid = (low + high) / 2;
+            if (m_line_starts[mid] <= offset) low = mid;
+            else high = mid;
+        }
+        return LineColumn{ low, offset - m_line_starts[low] };
+    }
+
+
+    u32 LineTable::getLineStart(u32 line) const {
+        if (m_line_starts.empty()) return 0;
+        return m_line_starts[line < getLineCount() ? line : getLineCount() - 1];
+    }
+
+
+    SourceMap::SourceMap(IAllocator& alloc)
+        : m_alloc(alloc)
+        , m_files(alloc)
+    {
+    }
+
+
+    SourceMap::~SourceMap() {
+        clear();
+    }
+
+
+    const SourceFile* SourceMap::addFile(const std::string& path, const std::string& source) {
+        // the line table is built outside the lock, only the base is handed out under it
+        const u32 size = (u32)source.size();
+        if ((u64)source.size() > 0xffFFffFFull) {
+            LogError("[SourceMap] ", path, " is larger than 4 GiB");
+            return nullptr;
+        }
+
+        SourceFile* file = CAL_NEW(m_alloc, SourceFile)(path, 0, size, m_alloc);
+        file->lines.build(source.data(), size);
+
+        MutexGuard lock(m_mutex);
+        // +1 so the end of file position still belongs to the file
+        if ((u64)m_next_base + size + 1 > 0xffFFffFFull) {
+            LogError("[SourceMap] source locations exhausted, could not add ", path);
+            CAL_DEL(m_alloc, file);
+            return nullptr;
+        }
+        file->base = m_next_base;
+        m_next_base += size + 1;
+        m_files.push(file);
+        return file;
+    }
+
+
+    const SourceFile* SourceMap::getFile(SourceLocation location) const {
+        MutexGuard lock(m_mutex);
+        if (location == INVALID_SOURCE_LOCATION || location >= m_next_base) return nullptr;
+
+        // last base <= location
+        u32 low = 0, high = (u32)m_files.size();
+        while (high - low > 1) {
+            const u32 mid = (low + high) / 2;
+            if (m_files[mid]->base <= location) low = mid;
+            else high = mid;
+        }
+        return m_files.empty() ? nullptr : m_files[low];
+    }
+
+
+    LineColumn SourceMap::getLineColumn(SourceLocation location) const {
+        const SourceFile* file = getFile(location);
+        if (!file) return LineColumn{ 0, 0 };
+        return file->lines.getLineColumn(location - file->base);
+    }
+
+
+    void SourceMap::clear() {
+        MutexGuard lock(m_mutex);
+        for (SourceFile* file : m_files) {
+            CAL_DEL(m_alloc, file);
+        }
+        m_files.clear();
+        m_next_base = 1;
+    }
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "base/allocator/IAllocator.hpp"
+#include "base/threading/SyncMutex.hpp"
+#include "base/types/Array.hpp"
+#include "globals.hpp"
+
+#include <string>
+
+namespace cal {
+
+    // a byte position shared by every file of a build: each file owns the range [base, base + size],
+    // so one u32 names a file and an offset inside it, 0 is never handed out
+    using SourceLocation = u32;
+    static constexpr SourceLocation INVALID_SOURCE_LOCATION = 0;
+
+    // zero based, the column is counted in bytes
+    struct LineColumn {
+        u32 line;
+        u32 column;
+    };
+
+
+    // start offset of every line of one text, built once, then positions are resolved with a binary search
+    class LineTable
+    {
+    public:
+        explicit LineTable(IAllocator& alloc) : m_line_starts(alloc) {}
+
+        void build(const char* text, u32 size);
+        LineColumn getLineColumn(u32 offset) const;
+        // offset of the first byte of the line, clamped to the last line
+        u32 getLineStart(u32 line) const;
+        u32 getLineCount() const { return (u32)m_line_starts.size(); }
+
+    private:
+        Array<u32> m_line_starts;
+    };
+
+
+    struct SourceFile {
+        SourceFile(const std::string& path, u32 base, u32 size, IAllocator& alloc)
+            : path(path), base(base), size(size), lines(alloc) {}
+
+        SourceLocation getLocation(u32 offset) const { return base + offset; }
+
+        std::string path;
+        SourceLocation base;
+        u32 size;
+        LineTable lines;
+    };
+
+
+    // owns the line tables of every file of a build, tokens and diagnostics only keep offsets,
+    // line / column are computed when a diagnostic or debug info actually asks for them
+    class SourceMap
+    {
+    public:
+        explicit SourceMap(IAllocator& alloc);
+        ~SourceMap();
+
+        SourceMap(const SourceMap&) = delete;
+        void operator =(const SourceMap&) = delete;
+
+        // nullptr once the 32 bit location space is used up, the returned file lives as long as the map
+        const SourceFile* addFile(const std::string& path, const std::string& source);
+        // nullptr for a location no file owns
+        const SourceFile* getFile(SourceLocation location) const;
+        LineColumn getLineColumn(SourceLocation location) const;
+        void clear();
+
+    private:
+        IAllocator& m_alloc;
+        mutable Mutex m_mutex;
+        Array<SourceFile*> m_files;     // sorted by base, bases only ever grow
+        SourceLocation m_next_base = 1;
+    };
+}
@@ -15,6 +15,10 @@ namespace Json {
 
 namespace cal {
 
+    namespace vm {
+        class BytecodeEmitter;
+    }
+
     class SymbolManager;
     class Analyzer;
     class CodeGenerator;
@@ -35,6 +39,7 @@ namespace cal {
         virtual bool buildSymbol(SymbolManager& symbol) { return false; };
         virtual bool analyzeNode(Analyzer& analyzer) { return false; };
         virtual bool codeGen(CodeGenerator& gen) { return false; };
+        virtual bool emitBytecode(vm::BytecodeEmitter& emitter) { return false; };
 
     protected:
         IAllocator& m_alloc;
@@ -5,6 +5,8 @@
 #include "analyzer/ast/types/TypePool.hpp"
 #include "base/allocator/Allocators.hpp"
 #include "globals.hpp"
+#include "utils/TimeReport.hpp"
+#include "vm/BytecodeEmitter.hpp"
 
 #include <cctype>
 #include <cmath>
@@ -220,6 +222,47 @@ namespace cal {
         return val;
     }
 
+
+    bool ASTNumberNode::emitBytecode(vm::BytecodeEmitter& emitter)
+    {
+        if (!m_isVerified) {
+            ASTError("trying to emit an unverified number");
+            return false;
+        }
+
+        const u8 reg = emitter.allocRegister();
+        switch (m_currentPreferedType) {
+        case unknown:
+            emitter.freeRegister(reg);
+            return false;
+        case I8:
+        case I16:
+        case I32:
+            emitter.emitLoadInt(reg, m_numberStorge.i32);
+            break;
+        case U8:
+        case U16:
+        case U32:
+            emitter.emitLoadInt(reg, m_numberStorge.u32);
+            break;
+        case I64:
+        case U64:
+            emitter.emitLoadInt(reg, m_numberStorge.i64);
+            break;
+        case F32:
+            emitter.emitLoadFloat(reg, m_numberStorge.f32);
+            emitter.pushResult(reg, vm::ValueKind::Float);
+            return true;
+        case F64:
+            emitter.emitLoadFloat(reg, m_numberStorge.f64);
+            emitter.pushResult(reg, vm::ValueKind::Float);
+            return true;
+        }
+
+        emitter.pushResult(reg, vm::ValueKind::Int);
+        return true;
+    }
+
     //////////////////////////////////////////////
     // Number pool
     //////////////////////////////////////////////
@@ -243,6 +286,7 @@ namespace cal {
 
     ASTNumberNode* NumberPool::getNum(const std::string& number_string)
     {
+        CAL_TIME_SCOPE("parse number");
         if (number_string.empty())
             return nullptr;
 
@@ -37,6 +37,7 @@ namespace cal {
         virtual ASTNodeType* returnType() override;
         virtual ASTTypes nodeType() override { return TYPE_NUMBER; }
         virtual Json::Value buildOutput() override;
+        virtual bool emitBytecode(vm::BytecodeEmitter& emitter) override;
 
         inline bool isVerified() const { return m_isVerified; }
         
@@ -0,0 +1,191 @@
+#include "InstantiationCache.hpp"
+
+#include "base/Logger.hpp"
+#include "base/allocator/Allocators.hpp"
+#include "base/types/Hash.hpp"
+#include "utils/TimeReport.hpp"
+
+namespace cal {
+
+    static constexpr u32 MAX_TEMPLATE_ARGS = 16;
+
+    // its address tells threads apart, used to catch an instantiation waiting on itself
+    static thread_local u8 s_thread_marker = 0;
+
+
+    struct InstantiationCache::Entry {
+        Entry(IAllocator& alloc, GenericId generic, Span<const TypeId> args)
+            : generic(generic), args(alloc)
+        {
+            for (TypeId arg : args) this->args.push(arg);
+        }
+
+        bool matches(GenericId other, Span<const TypeId> other_args) const {
+            if (generic != other || (u32)args.size() != other_args.length()) return false;
+            for (u32 i = 0; i < other_args.length(); ++i) {
+                if (args[i] != other_args[i]) return false;
+            }
+            return true;
+        }
+
+        GenericId generic;
+        Array<TypeId> args;
+        void* value = nullptr;
+        const void* builder = nullptr;  // thread building it, nullptr once built
+        bool built = false;
+        Entry* next = nullptr;          // next entry with the same key
+    };
+
+
+    static u64 getEntryKey(GenericId generic, Span<const TypeId> args) {
+        TypeId buffer[MAX_TEMPLATE_ARGS + 1];
+        buffer[0] = generic;
+        for (u32 i = 0; i < args.length(); ++i) {
+            buffer[i + 1] = args[i];
+        }
+        return StableHash(buffer, (args.length() + 1) * sizeof(TypeId)).getHashValue();
+    }
+
+
+    InstantiationCache::InstantiationCache()
+        : m_alloc(getGlobalAllocator())
+        , m_generics(getGlobalAllocator())
+        , m_generic_names(getGlobalAllocator())
+        , m_entries(getGlobalAllocator())
+    {
+    }
+
+
+    InstantiationCache::~InstantiationCache() {
+        clear();
+    }
+
+
+    GenericId InstantiationCache::registerGeneric(const std::string& name, const GenericProvider& provider) {
+        MutexGuard lock(m_mutex);
+        auto iter = m_generic_names.find(name);
+        if (iter.isValid()) return iter.value();
+
+        m_generics.push(Generic{ name, provider });
+        const GenericId id = (GenericId)m_generics.size();
+        m_generic_names.insert(name, id);
+        return id;
+    }
+
+
+    GenericId InstantiationCache::findGeneric(const std::string& name) {
+        MutexGuard lock(m_mutex);
+        auto iter = m_generic_names.find(name);
+        return iter.isValid() ? iter.value() : INVALID_GENERIC_ID;
+    }
+
+
+    InstantiationCache::Entry* InstantiationCache::findEntry(u64 key, GenericId generic, Span<const TypeId> args) {
+        auto iter = m_entries.find(key);
+        for (Entry* entry = iter.isValid() ? iter.value() : nullptr; entry; entry = entry->next) {
+            if (entry->matches(generic, args)) return entry;
+        }
+        return nullptr;
+    }
+
+
+    const void* InstantiationCache::instantiate(GenericId generic, Span<ASTNodeType* const> args) {
+        TypeId ids[MAX_TEMPLATE_ARGS];
+        if (args.length() > MAX_TEMPLATE_ARGS) {
+            LogError("[Generic] more than ", MAX_TEMPLATE_ARGS, " template arguments");
+            return nullptr;
+        }
+        for (u32 i = 0; i < args.length(); ++i) {
+            ids[i] = args[i] ? args[i]->getTypeId() : INVALID_TYPE_ID;
+            if (ids[i] == INVALID_TYPE_ID) {
+                LogError("[Generic] template argument ", i, " is not a pooled type");
+                return nullptr;
+            }
+        }
+        return instantiate(generic, Span<const TypeId>(ids, args.length()));
+    }
+
+
+    const void* InstantiationCache::instantiate(GenericId generic, Span<const TypeId> args) {
+        if (args.length() > MAX_TEMPLATE_ARGS) {
+            LogError("[Generic] more than ", MAX_TEMPLATE_ARGS, " template arguments");
+            return nullptr;
+        }
+
+        const u64 key = getEntryKey(generic, args);
+        Entry* entry;
+        GenericProvider provider;
+        {
+            MutexGuard lock(m_mutex);
+            ++m_stats.requests;
+            if (generic == INVALID_GENERIC_ID || generic > (GenericId)m_generics.size()) {
+                LogError("[Generic] unknown generic ", generic);
+                return nullptr;
+            }
+
+            entry = findEntry(key, generic, args);
+            if (entry) {
+                if (entry->builder == &s_thread_marker) {
+                    LogError("[Generic] ", m_generics[generic - 1].name, " instantiates itself with the same arguments");
+                    return nullptr;
+                }
+                if (!entry->built) ++m_stats.waited;
+                while (!entry->built) {
+                    m_built.sleep(m_mutex);
+                }
+                return entry->value;
+            }
+
+            // claim the pair, the build runs without the lock so it can instantiate other pairs
+            entry = CAL_NEW(m_alloc, Entry)(m_alloc, generic, args);
+            entry->builder = &s_thread_marker;
+            auto iter = m_entries.find(key);
+            if (iter.isValid()) {
+                entry->next = iter.value();
+                iter.value() = entry;
+            }
+            else {
+                m_entries.insert(key, entry);
+            }
+            provider = m_generics[generic - 1].provider;
+        }
+
+        void* value;
+        {
+            CAL_TIME_SCOPE("instantiate generic");
+            value = provider.build(provider.user, generic, args);
+        }
+
+        MutexGuard lock(m_mutex);
+        ++m_stats.built;
+        entry->value = value;
+        entry->builder = nullptr;
+        entry->built = true;
+        m_built.wakeupAll();
+        return value;
+    }
+
+
+    InstantiationCache::Stats InstantiationCache::getStats() {
+        MutexGuard lock(m_mutex);
+        return m_stats;
+    }
+
+
+    void InstantiationCache::clear() {
+        MutexGuard lock(m_mutex);
+        for (auto iter = m_entries.begin(); iter.isValid(); ++iter) {
+            Entry* entry = iter.value();
+            while (entry) {
+                Entry* next = entry->next;
+                ASSERT(entry->built);
+                const GenericProvider& provider = m_generics[entry->generic - 1].provider;
+                if (entry->value && provider.destroy) provider.destroy(provider.user, entry->value);
+                CAL_DEL(m_alloc, entry);
+                entry = next;
+            }
+        }
+        m_entries.clear();
+        m_stats = {};
+    }
+}
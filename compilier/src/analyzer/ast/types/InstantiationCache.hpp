@@ -0,0 +1,73 @@
+#pragma once
+
+#include "analyzer/ast/types/NodeType.hpp"
+#include "base/allocator/IAllocator.hpp"
+#include "base/threading/Sync.hpp"
+#include "base/types/Array.hpp"
+#include "base/types/Span.hpp"
+#include "base/types/container/HashMap.hpp"
+
+#include <utils/TSingleton.hpp>
+
+#include <string>
+
+namespace cal {
+
+    using GenericId = u32;
+    static constexpr GenericId INVALID_GENERIC_ID = 0;
+
+    struct GenericProvider {
+        // builds the instantiation for args, nullptr on failure (failures are cached too)
+        void* (*build)(void* user, GenericId generic, Span<const TypeId> args);
+        void (*destroy)(void* user, void* value);
+        void* user;
+    };
+
+
+    // memoizes every (generic, type arguments) pair, keyed by the pool's type ids so equal types
+    // spelled differently still hit. every module and thread of the process shares one cache :
+    // the first request builds, concurrent requests for the same pair wait for it, later ones reuse it.
+    // an instantiation may request other instantiations while it builds, requesting itself is reported as a cycle
+    class InstantiationCache : public ThreadSafeSingleton<InstantiationCache>
+    {
+    public:
+        struct Stats {
+            u64 requests;
+            u64 built;          // distinct instantiations that ran their build
+            u64 waited;         // requests that blocked on another thread building the same pair
+        };
+
+        InstantiationCache();
+        ~InstantiationCache();
+
+        // the same qualified name ("module.name") returns the same id, the first provider wins
+        GenericId registerGeneric(const std::string& name, const GenericProvider& provider);
+        GenericId findGeneric(const std::string& name);
+
+        // types must come from the TypePool, nullptr when building failed
+        const void* instantiate(GenericId generic, Span<ASTNodeType* const> args);
+        const void* instantiate(GenericId generic, Span<const TypeId> args);
+
+        Stats getStats();
+        // destroys every instantiation, nothing handed out before may be used afterwards
+        void clear();
+
+    private:
+        struct Generic {
+            std::string name;
+            GenericProvider provider;
+        };
+
+        struct Entry;
+
+        Entry* findEntry(u64 key, GenericId generic, Span<const TypeId> args);
+
+        IAllocator& m_alloc;
+        Mutex m_mutex;
+        ConditionVariable m_built;
+        Array<Generic> m_generics;      // indexed by id - 1
+        HashMap<std::string, GenericId> m_generic_names;
+        HashMap<u64, Entry*> m_entries; // colliding keys are chained through the entries
+        Stats m_stats = {};
+    };
+}
@@ -161,9 +161,10 @@ namespace cal {
                     }
                     else {
                         m_array_length_parms.push(array_length_parm{
-                            .c = parm.c_str(),
+                            .name = (uint32_t)m_array_length_names.size(),
                             .type = array_length_parm::RefName
                             });
+                        m_array_length_names.push(parm);
                     }
 
                     ++dimension_count;
@@ -230,7 +231,7 @@ namespace cal {
             switch (item.type)
             {
             case array_length_parm::RefName:
-                arrayLen.append(item.RefName);
+                arrayLen.append(m_array_length_names[item.name]);
                 break;
             case array_length_parm::I32:
                 arrayLen.append(std::to_string(item.i));
@@ -273,6 +274,43 @@ namespace cal {
     }
 
 
+    bool ASTNodeType::getArrayLength(uint32_t dimension, uint64_t& length) const {
+        if (!m_isArray || dimension >= (uint32_t)m_array_length_parms.size()) return false;
+        const array_length_parm& parm = m_array_length_parms[dimension];
+        switch (parm.type) {
+        case array_length_parm::I32:
+            length = parm.i;
+            return true;
+        case array_length_parm::I64:
+            length = parm.l;
+            return true;
+        default:
+            return false;
+        }
+    }
+
+
+    uint64_t ASTNodeType::getStaticElementCount() const {
+        if (!m_isArray || m_array_length_parms.empty()) return 0;
+
+        uint64_t count = 1;
+        for (uint32_t i = 0; i < (uint32_t)m_array_length_parms.size(); ++i) {
+            uint64_t length;
+            if (!getArrayLength(i, length) || length == 0) return 0;
+            if (count > ~(uint64_t)0 / length) return 0;
+            count *= length;
+        }
+        return count;
+    }
+
+
+    ASTNodeType::ArrayStorage ASTNodeType::getArrayStorage() const {
+        if (!m_isArray) return ArrayStorage::None;
+        const uint64_t count = getStaticElementCount();
+        return count > 0 && count <= INLINE_ARRAY_LIMIT ? ArrayStorage::Inline : ArrayStorage::Heap;
+    }
+
+
     bool ASTNodeType::compareType(ASTNodeType* type) {
         //TODO
         return false;
@@ -281,7 +319,8 @@ namespace cal {
 
     ASTNodeType::ASTNodeType(IAllocator& alloc, const std::string& type)
         : ASTNodeBase(alloc),
-        m_array_length_parms(alloc)
+        m_array_length_parms(alloc),
+        m_array_length_names(alloc)
     {
         m_raw_type_str = type;
     }
@@ -289,7 +328,8 @@ namespace cal {
 
     ASTNodeType::ASTNodeType(IAllocator& alloc, Types type)
         : ASTNodeBase(alloc),
-        m_array_length_parms(alloc)
+        m_array_length_parms(alloc),
+        m_array_length_names(alloc)
     {
         //todo if(type != Types::custom || type != Types::custom) {
 
@@ -11,6 +11,14 @@ namespace cal {
 
     class TypePool;
 
+    // hash consed id of a pooled type, equal ids mean equal types, 0 is never handed out
+    using TypeId = u32;
+    static constexpr TypeId INVALID_TYPE_ID = 0;
+
+    // arrays whose element count is known from the type get their storage picked statically :
+    // small ones live inline (registers / stack), larger or runtime sized ones on the heap
+    static constexpr u64 INLINE_ARRAY_LIMIT = 64;
+
     class ASTNodeType : public ASTNodeBase
     {
         friend class TypePool;
@@ -29,6 +37,10 @@ namespace cal {
             custom
         };
 
+        enum class ArrayStorage : uint8_t {
+            None, Inline, Heap
+        };
+
     private:
         ASTNodeType(IAllocator& alloc, const std::string& type);
         ASTNodeType(IAllocator& alloc, Types type);
@@ -44,6 +56,14 @@ namespace cal {
         virtual std::string toString() override;
 
         bool isArray() { return m_isArray; }
+        // the enum above shadows the u32 / u64 aliases inside the class
+        uint32_t getArrayDimension() const { return (uint32_t)m_array_dimension; }
+        // false when the dimension is out of range or its length is only known at runtime
+        bool getArrayLength(uint32_t dimension, uint64_t& length) const;
+        // product of every dimension, 0 unless all of them are constants
+        uint64_t getStaticElementCount() const;
+        bool isFixedSizeArray() const { return getStaticElementCount() > 0; }
+        ArrayStorage getArrayStorage() const;
         bool isStanderType();
         bool isCustomType();
         bool isParsedSucceed() { return m_isVerified; }
@@ -51,6 +71,9 @@ namespace cal {
         std::string getRawTypeName() { return m_raw_type_str; }
         std::string getTypeName() { return m_type_str; }
         Types getType() { return m_type; }
+        TypeId getTypeId() const { return m_type_id; }
+        // the <...> argument, nullptr for non template types
+        ASTNodeType* getTemplateType() { return m_isTemplate ? m_template_type : nullptr; }
 
         virtual bool compareType(ASTNodeType* type);
 
@@ -59,17 +82,18 @@ namespace cal {
         std::string m_type_str;
 
         ASTNodeType* m_template_type = nullptr;
+        TypeId m_type_id = INVALID_TYPE_ID;
 
         Types m_type;
-        bool m_isArray;
-        bool m_isTemplate;
-        bool m_isVerified;
+        bool m_isArray = false;
+        bool m_isTemplate = false;
+        bool m_isVerified = false;
 
-        bool m_array_ref;
-        int m_array_dimension;
+        bool m_array_ref = false;
+        int m_array_dimension = 0;
         struct array_length_parm {
             union {
-                const char* c;
+                uint32_t name;      // index in m_array_length_names
                 uint32_t i;
                 uint64_t l;
             };
@@ -78,5 +102,6 @@ namespace cal {
             } type;
         };
         Array<array_length_parm> m_array_length_parms;
+        Array<std::string> m_array_length_names;
     };
 }
\ No newline at end of file
@@ -7,7 +7,8 @@ namespace cal {
 
     TypePool::TypePool()
         : m_alloc(getGlobalAllocator()),
-        m_pool(getGlobalAllocator())
+        m_pool(getGlobalAllocator()),
+        m_types(getGlobalAllocator())
     {
 
     }
@@ -18,6 +19,7 @@ namespace cal {
             CAL_DEL(m_alloc, item);
         }
         m_pool.clear();
+        m_types.clear();
     }
 
 
@@ -25,11 +27,15 @@ namespace cal {
         std::string raw = origin;
         raw.erase(std::remove_if(raw.begin(), raw.end(), [](unsigned char c) { return std::isspace(c); }), raw.end());
         
-        auto result = m_pool.find(raw);
-        if (result.isValid()) {
-            return result.value();
+        {
+            MutexGuard lock(m_mutex);
+            auto result = m_pool.find(raw);
+            if (result.isValid()) {
+                return result.value();
+            }
         }
 
+        // parsed without the lock, template arguments come back into the pool
         auto* ptr = CAL_NEW(m_alloc, ASTNodeType)(m_alloc, raw);
         bool rr = ptr->parse(raw);
         if (!rr) {
@@ -37,12 +43,29 @@ namespace cal {
             CAL_DEL(m_alloc, ptr);
             return nullptr;
         }
-        
+
+        MutexGuard lock(m_mutex);
+        auto result = m_pool.find(raw);
+        if (result.isValid()) {
+            // another thread parsed the same spelling first, the pooled node keeps the id
+            CAL_DEL(m_alloc, ptr);
+            return result.value();
+        }
+
+        m_types.push(ptr);
+        ptr->m_type_id = (TypeId)m_types.size();
         m_pool.insert(raw, ptr);
         return ptr;
     }
 
 
+    ASTNodeType* TypePool::findType(TypeId id) {
+        MutexGuard lock(m_mutex);
+        if (id == INVALID_TYPE_ID || id > (TypeId)m_types.size()) return nullptr;
+        return m_types[id - 1];
+    }
+
+
     ASTNodeType* TypePool::getType(ASTNodeType::Types type) {
         if(type == ASTNodeType::Types::custom || type == ASTNodeType::Types::unknown) {
             ASTWarn("pool : unsupport type!");
@@ -54,11 +77,14 @@ namespace cal {
 
 
     void TypePool::releaseType(ASTNodeType *node) {
+        MutexGuard lock(m_mutex);
         auto result = m_pool.find(node->getRawTypeName());
         if (!result.isValid()) {
             return;
         }
 
+        // ids are never reused, so a stale id can not alias a newer type
+        m_types[node->getTypeId() - 1] = nullptr;
         m_pool.erase(result);
         CAL_DEL(m_alloc, node);
     }
@@ -2,13 +2,16 @@
 
 #include "analyzer/ast/types/NodeType.hpp"
 #include "base/allocator/IAllocator.hpp"
+#include "base/threading/SyncMutex.hpp"
+#include "base/types/Array.hpp"
 #include "base/types/container/HashMap.hpp"
 
 #include <utils/TSingleton.hpp>
 
 namespace cal {
 
-    class TypePool : public TSingleton<TypePool>
+    // one ASTNodeType per spelling (whitespace ignored), shared by every module and thread of the process
+    class TypePool : public ThreadSafeSingleton<TypePool>
     {
     public:
         TypePool();
@@ -16,11 +19,15 @@ namespace cal {
 
         ASTNodeType* getType(const std::string& raw);
         ASTNodeType* getType(ASTNodeType::Types type);
+        // nullptr for released or unknown ids
+        ASTNodeType* findType(TypeId id);
 
         void releaseType(ASTNodeType* node);
 
     private:
         IAllocator& m_alloc;
+        Mutex m_mutex;
         HashMap<std::string, ASTNodeType*> m_pool;
+        Array<ASTNodeType*> m_types;    // indexed by id - 1
     };
 }
\ No newline at end of file
@@ -0,0 +1,444 @@
+#include "Driver.hpp"
+
+#include "analyzer/Lexer.hpp"
+#include "base/allocator/LinearAllocator.hpp"
+#include "base/Logger.hpp"
+#include "base/threading/ThreadPool.hpp"
+#include "base/math/Math.hpp"
+#include "base/types/Hash.hpp"
+#include "module/ModuleInterface.hpp"
+#include "module/ModuleResolver.hpp"
+#include "query/QueryEngine.hpp"
+#include "system/SysIO.hpp"
+#include "system/SysTimer.hpp"
+#include "utils/ArgsParser.hpp"
+#include "utils/TimeReport.hpp"
+
+#include <cstdlib>
+
+namespace cal {
+
+    static constexpr const char* SOURCE_EXTENSION = ".cal";
+    // the runtime library ships with the compiler, "import system.console;" has no interface file
+    static constexpr const char* BUILTIN_MODULE = "system";
+
+
+    static bool endsWith(const std::string& str, const char* suffix) {
+        const size_t len = strlen(suffix);
+        return str.size() >= len && str.compare(str.size() - len, len, suffix) == 0;
+    }
+
+
+    static const char* getEmitExtension(EmitKind kind) {
+        switch (kind) {
+        case EmitKind::Tokens: return ".tokens";
+        case EmitKind::Interface: return MODULE_INTERFACE_EXTENSION;
+        case EmitKind::Ast: return ".ast.json";
+        case EmitKind::Ir: return ".ll";
+        case EmitKind::Obj: return ".o";
+        }
+        return "";
+    }
+
+
+    // the compile server runs every request in the client's working directory, relative paths of two
+    // requests can name different files so caches and queries are keyed by absolute paths
+    static std::string getAbsolutePath(const std::string& path) {
+        if (!path.empty() && path[0] == '/') return path;
+
+        char cwd[MAX_PATH];
+        platform::getCurrentDirectory(Span<char>(cwd, sizeof(cwd)));
+        std::string relative = path;
+        while (relative.compare(0, 2, "./") == 0) relative.erase(0, 2);
+        return std::string(cwd) + (endsWith(cwd, "/") ? "" : "/") + relative;
+    }
+
+
+    static std::string getDirectory(const std::string& path) {
+        const size_t slash = path.find_last_of('/');
+        if (slash == std::string::npos) return ".";
+        return slash == 0 ? "/" : path.substr(0, slash);
+    }
+
+
+    static bool isBuiltinModule(const std::string& name) {
+        const size_t len = strlen(BUILTIN_MODULE);
+        return name.compare(0, len, BUILTIN_MODULE) == 0 && (name.size() == len || name[len] == '.');
+    }
+
+
+    static bool readSource(const std::string& path, std::string& source) {
+        platform::IFile file;
+        if (!file.open(path.c_str())) return false;
+
+        source.resize(file.size());
+        const bool result = source.empty() || file.read(source.data(), source.size());
+        file.close();
+        return result;
+    }
+
+
+    static bool writeOutput(const std::string& path, const std::string& content) {
+        platform::OFile file;
+        if (!file.open(path.c_str())) return false;
+
+        const bool result = file.write(content.data(), content.size());
+        file.close();
+        return result;
+    }
+
+
+    bool BuildCache::isUpToDate(const std::string& output, StableHash source) {
+        {
+            MutexGuard lock(m_mutex);
+            auto iter = m_entries.find(output);
+            if (!iter.isValid() || iter.value() != source) return false;
+        }
+        // the output may have been deleted behind our back
+        return platform::fileExists(output.c_str());
+    }
+
+
+    void BuildCache::update(const std::string& output, StableHash source) {
+        MutexGuard lock(m_mutex);
+        auto iter = m_entries.find(output);
+        if (iter.isValid()) iter.value() = source;
+        else m_entries.insert(output, source);
+    }
+
+
+    void BuildCache::clear() {
+        MutexGuard lock(m_mutex);
+        m_entries.clear();
+    }
+
+
+    Driver::Driver(IAllocator& alloc, BuildCache* cache, QueryEngine* engine)
+        : m_alloc(alloc)
+        , m_cache(cache)
+        , m_engine(engine)
+        , m_sources(alloc)
+        , m_build_modules(alloc)
+    {
+    }
+
+
+    void Driver::printUsage() {
+        LogInfo("usage : cal build <files|dirs> [-j N] [--emit=tokens|interface|ast|ir|obj] [-o dir] [-I dir[:dir]] [--server[=socket]] [--time-report[=trace.json]] [--memory-report[=interval_ms]]");
+        LogInfo("        cal server [--socket=path]");
+        LogInfo("        cal lsp");
+    }
+
+
+    bool Driver::parseBuildOptions(const ArgsParser& args, BuildOptions& options) {
+        if (args.getPositionalCount() == 0 || args.getPositional(0) != "build") {
+            printUsage();
+            return false;
+        }
+
+        for (u32 i = 1; i < args.getPositionalCount(); ++i) {
+            options.inputs.push(args.getPositional(i));
+        }
+        if (options.inputs.empty()) {
+            LogError("[Driver] no input files");
+            printUsage();
+            return false;
+        }
+
+        options.jobs = (u32)atoi(args.getArg("j", "0").c_str());
+        options.output_dir = args.getArg("o");
+        const std::string import_paths = args.getArg("I");
+        for (size_t begin = 0; begin < import_paths.size();) {
+            size_t end = import_paths.find(':', begin);
+            if (end == std::string::npos) end = import_paths.size();
+            if (end > begin) options.import_paths.push(import_paths.substr(begin, end - begin));
+            begin = end + 1;
+        }
+        // nothing is optimized before codegen exists, accepting -O2 would silently ignore it
+        if (args.hasArg("O") && args.getArg("O") != "0") {
+            LogError("[Driver] -O", args.getArg("O"), " is not supported, the driver has no codegen yet");
+            return false;
+        }
+
+        const std::string emit = args.getArg("emit", "tokens");
+        if (emit == "tokens") options.emit = EmitKind::Tokens;
+        else if (emit == "interface") options.emit = EmitKind::Interface;
+        else if (emit == "ast") options.emit = EmitKind::Ast;
+        else if (emit == "ir") options.emit = EmitKind::Ir;
+        else if (emit == "obj") options.emit = EmitKind::Obj;
+        else {
+            LogError("[Driver] unknown --emit kind ", emit);
+            return false;
+        }
+
+        // the tree has no parser / codegen for whole source files yet
+        if (options.emit == EmitKind::Ast || options.emit == EmitKind::Ir || options.emit == EmitKind::Obj) {
+            LogError("[Driver] --emit=", emit, " needs the parser, only tokens and interface are available");
+            return false;
+        }
+        return true;
+    }
+
+
+    bool Driver::collectInputs(const std::string& path, const std::string& relative, Array<InputFile>& files) {
+        if (platform::fileExists(path.c_str())) {
+            const size_t slash = path.find_last_of("/\\");
+            files.push(InputFile{ path, relative.empty() ? path.substr(slash == std::string::npos ? 0 : slash + 1) : relative });
+            return true;
+        }
+        if (!platform::dirExists(path.c_str())) {
+            LogError("[Driver] input not found : ", path);
+            return false;
+        }
+
+        platform::FileIterator* iter = platform::createFileIterator(path.c_str(), m_alloc);
+        platform::FileInfo info;
+        bool result = true;
+        while (platform::getNextFile(iter, &info)) {
+            const std::string name = info.filename;
+            if (name == "." || name == "..") continue;
+
+            const std::string child = path + (endsWith(path, "/") ? "" : "/") + name;
+            const std::string child_relative = relative.empty() ? name : relative + "/" + name;
+            if (info.is_directory) result &= collectInputs(child, child_relative, files);
+            else if (endsWith(name, SOURCE_EXTENSION)) files.push(InputFile{ child, child_relative });
+        }
+        platform::destroyFileIterator(iter);
+        return result;
+    }
+
+
+    // "-o out" keeps the layout below each input, "src/a/x.cal" of input "src" goes to "out/a/x.tokens"
+    // which is also where setupImports looks for module a.x
+    std::string Driver::getOutputPath(const InputFile& input) const {
+        std::string stem = m_options->output_dir.empty() ? input.path : m_options->output_dir + (endsWith(m_options->output_dir, "/") ? "" : "/") + input.relative;
+        if (endsWith(stem, SOURCE_EXTENSION)) stem.resize(stem.size() - strlen(SOURCE_EXTENSION));
+        return stem + getEmitExtension(m_options->emit);
+    }
+
+
+    bool Driver::writeInterface(const std::string& path, const MemoryOStream& exports, StableHash source_hash) {
+        // the query result leaves the source hash out so it only changes with the exported surface
+        MemoryOStream stream{ exports, m_alloc };
+        if (stream.size() < sizeof(ModuleInterfaceHeader)) return false;
+        ((ModuleInterfaceHeader*)stream.getMutableData())->source_hash = source_hash.getHashValue();
+
+        platform::OFile file;
+        if (!file.open(path.c_str())) return false;
+        const bool result = file.write(stream.data(), stream.size());
+        file.close();
+        return result;
+    }
+
+
+    bool Driver::reportDiagnostics(const CompileJob& job, const Lexer& lexer) {
+        for (const Diagnostic& diagnostic : lexer.getDiagnostics()) {
+            const std::string text = formatDiagnostic(*job.file, diagnostic);
+            if (diagnostic.severity == DiagnosticSeverity::Error) LogError(text);
+            else LogWarn(text);
+        }
+        return !lexer.hasErrors();
+    }
+
+
+    void Driver::setupImports(const Array<CompileJob>& jobs, ModuleResolver& resolver) {
+        Array<std::string> dirs(m_alloc);
+        auto addDir = [&dirs](const std::string& dir) {
+            for (const std::string& known : dirs) {
+                if (known == dir) return;
+            }
+            dirs.push(dir);
+        };
+        for (const std::string& dir : m_options->import_paths) {
+            addDir(getAbsolutePath(dir));
+        }
+        if (!m_options->output_dir.empty()) addDir(getAbsolutePath(m_options->output_dir));
+        for (const CompileJob& job : jobs) {
+            addDir(getDirectory(job.path));
+        }
+
+        m_build_modules.clear();
+        for (const std::string& dir : dirs) {
+            resolver.addSearchPath(dir);
+
+            // an input counts as the module whose interface path it sits at, "<dir>/a/b.cal" is a.b
+            const std::string prefix = endsWith(dir, "/") ? dir : dir + "/";
+            for (const CompileJob& job : jobs) {
+                if (job.path.compare(0, prefix.size(), prefix) != 0) continue;
+                std::string name = job.path.substr(prefix.size());
+                if (endsWith(name, SOURCE_EXTENSION)) name.resize(name.size() - strlen(SOURCE_EXTENSION));
+                for (char& c : name) {
+                    if (c == '/') c = '.';
+                }
+                if (!m_build_modules.find(name).isValid()) m_build_modules.insert(name, true);
+            }
+        }
+    }
+
+
+    bool Driver::resolveImports(const CompileJob& job, const Lexer& lexer) {
+        CAL_TIME_SCOPE("resolve imports");
+        Array<std::string> collected(m_alloc);
+        const Array<std::string>* imports = m_engine ? m_engine->imports(job.path) : nullptr;
+        if (!imports) {
+            lexer.collectImports(collected);
+            imports = &collected;
+        }
+
+        bool result = true;
+        for (const std::string& name : *imports) {
+            if (isBuiltinModule(name) || m_build_modules.find(name).isValid()) continue;
+
+            MutexGuard lock(m_resolver_mutex);
+            if (m_resolver->resolve(name)) continue;
+            LogError("[Driver] ", job.input, " : module ", name, " not found, no ", ModuleResolver::getInterfacePath("", name), " in the import paths");
+            result = false;
+        }
+        return result;
+    }
+
+
+    bool Driver::compileFile(const CompileJob& job) {
+        CAL_TIME_SCOPE("compile file");
+
+        if (!job.loaded) {
+            LogError("[Driver] could not read ", job.input);
+            return false;
+        }
+
+        const StableHash source_hash{ job.source.data(), (u32)job.source.size() };
+        if (m_cache && m_cache->isUpToDate(job.output, source_hash)) return true;
+
+        // everything below only lives until the output is written
+        LinearAllocator& scratch = getScratchAllocator();
+        LinearAllocatorScope scratch_scope(scratch);
+
+        Lexer* local = nullptr;
+        const Lexer* lexer = m_engine ? m_engine->tokens(job.path) : nullptr;
+        if (!lexer) {
+            local = CAL_NEW(scratch, Lexer)(job.source, scratch);
+            local->analyze();
+            lexer = local;
+        }
+
+        bool result = reportDiagnostics(job, *lexer) && resolveImports(job, *lexer);
+        if (result) {
+            switch (m_options->emit) {
+            case EmitKind::Tokens:
+                result = writeOutput(job.output, lexer->buildOutput());
+                break;
+            case EmitKind::Interface:
+                if (m_engine) {
+                    result = writeInterface(job.output, *m_engine->exports(job.path), source_hash);
+                }
+                else {
+                    ModuleInterfaceBuilder builder{ scratch };
+                    builder.setSourceHash(source_hash);
+                    builder.addFromLexer(*lexer);
+                    result = builder.save(job.output.c_str());
+                }
+                break;
+            default:
+                ASSERT(false);
+                break;
+            }
+            if (!result) LogError("[Driver] could not write ", job.output);
+        }
+
+        if (local) CAL_DEL(scratch, local);
+        if (result && m_cache) m_cache->update(job.output, source_hash);
+        return result;
+    }
+
+
+    void Driver::loadJob(void* data) {
+        auto* job = (CompileJob*)data;
+        job->loaded = readSource(job->input, job->source);
+        // line tables are built here, in parallel, so diagnostics only pay for a binary search
+        if (job->loaded) {
+            job->file = job->driver->m_sources.addFile(job->input, job->source);
+            job->loaded = job->file != nullptr;
+        }
+    }
+
+
+    void Driver::runJob(void* data) {
+        auto* job = (CompileJob*)data;
+        job->success = job->driver->compileFile(*job);
+    }
+
+
+    i32 Driver::build(const BuildOptions& options) {
+        platform::Timer timer;
+        m_options = &options;
+        m_sources.clear();
+
+        Array<InputFile> files(m_alloc);
+        bool result = true;
+        for (const std::string& input : options.inputs) {
+            result &= collectInputs(input, "", files);
+        }
+        if (!result) return 1;
+        if (files.empty()) {
+            LogError("[Driver] no ", SOURCE_EXTENSION, " files found");
+            return 1;
+        }
+        if (!options.output_dir.empty() && !platform::makePath(options.output_dir.c_str())) {
+            LogError("[Driver] could not create output directory ", options.output_dir);
+            return 1;
+        }
+
+        Array<CompileJob> jobs(m_alloc);
+        HashMap<std::string, u32> outputs(m_alloc);
+        for (const InputFile& file : files) {
+            const std::string output = getAbsolutePath(getOutputPath(file));
+            // two inputs of the same name given as files would overwrite each other's output
+            auto iter = outputs.find(output);
+            if (iter.isValid()) {
+                LogError("[Driver] ", file.path, " and ", jobs[iter.value()].input, " both write ", output);
+                return 1;
+            }
+            if (!platform::makePath(getDirectory(output).c_str())) {
+                LogError("[Driver] could not create output directory ", getDirectory(output));
+                return 1;
+            }
+            outputs.insert(output, (u32)jobs.size());
+            jobs.push(CompileJob{ this, file.path, getAbsolutePath(file.path), output });
+        }
+
+        // imports are mapped once per build, a later build sees interfaces written in between
+        ModuleResolver resolver{ m_alloc };
+        setupImports(jobs, resolver);
+        m_resolver = &resolver;
+
+        {
+            // one pool for the whole build, every job shares the process wide allocators and pools
+            ThreadPool pool{ m_alloc, options.jobs > 0 ? minimum(options.jobs, (u32)jobs.size()) : 0 };
+            for (CompileJob& job : jobs) {
+                pool.push(&Driver::loadJob, &job);
+            }
+            pool.wait();
+
+            // query inputs only change between the two passes, never while queries run
+            if (m_engine) {
+                for (const CompileJob& job : jobs) {
+                    if (job.loaded) m_engine->setSourceText(job.path, job.source);
+                }
+            }
+
+            for (CompileJob& job : jobs) {
+                pool.push(&Driver::runJob, &job);
+            }
+            pool.wait();
+        }
+
+        u32 failed = 0;
+        for (const CompileJob& job : jobs) {
+            if (!job.success) ++failed;
+        }
+        LogInfo("[Driver] ", (u32)jobs.size() - failed, " / ", (u32)jobs.size(), " files compiled in ", timer.getTimeSinceStart() * 1000.f, " ms");
+        m_options = nullptr;
+        m_resolver = nullptr;
+        return failed == 0 ? 0 : 1;
+    }
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include "analyzer/SourceMap.hpp"
+#include "base/allocator/IAllocator.hpp"
+#include "base/threading/SyncMutex.hpp"
+#include "base/types/Array.hpp"
+#include "base/types/Hash.hpp"
+#include "base/types/container/HashMap.hpp"
+#include "globals.hpp"
+
+#include <string>
+
+namespace cal {
+
+    class ArgsParser;
+    class Lexer;
+    class ModuleResolver;
+    class QueryEngine;
+    struct MemoryOStream;
+
+    enum class EmitKind {
+        Tokens, Interface, Ast, Ir, Obj
+    };
+
+    struct BuildOptions {
+        explicit BuildOptions(IAllocator& alloc) : inputs(alloc), import_paths(alloc) {}
+
+        Array<std::string> inputs;      // files or directories, directories are searched for *.cal
+        Array<std::string> import_paths; // searched for imported interfaces before the output and input directories
+        std::string output_dir;         // empty writes next to each input, else mirrors the inputs below it
+        u32 jobs = 0;                   // 0 uses one worker per cpu
+        EmitKind emit = EmitKind::Tokens;
+    };
+
+
+    // source hash every output (absolute path) was last written from, a long lived process (the compile
+    // server) keeps it across builds and skips inputs that did not change
+    struct BuildCache {
+        explicit BuildCache(IAllocator& alloc) : m_entries(alloc) {}
+
+        bool isUpToDate(const std::string& output, StableHash source);
+        void update(const std::string& output, StableHash source);
+        void clear();
+
+    private:
+        Mutex m_mutex;
+        HashMap<std::string, StableHash> m_entries;
+    };
+
+
+    // batch front end behind "cal build", every input is compiled inside this process on one shared
+    // thread pool, so allocators, pools and caches are set up once instead of once per file
+    class Driver
+    {
+    public:
+        // cache and engine are optional, a long lived process passes both so unchanged inputs are skipped
+        // and unchanged queries (tokens, exports) are reused across builds
+        Driver(IAllocator& alloc, BuildCache* cache = nullptr, QueryEngine* engine = nullptr);
+        ~Driver() = default;
+
+        // short options taking a separate value, the ArgsParser handed to parseBuildOptions needs them
+        static constexpr const char* VALUE_OPTIONS = "jOoI";
+
+        // reads "build <inputs> -j N --emit=kind -o dir -I dir[:dir]", reports unsupported values
+        [[nodiscard]] static bool parseBuildOptions(const ArgsParser& args, BuildOptions& options);
+        static void printUsage();
+
+        // returns the process exit code
+        i32 build(const BuildOptions& options);
+
+    private:
+        struct CompileJob {
+            CompileJob(Driver* driver, const std::string& input, const std::string& path, const std::string& output)
+                : driver(driver), input(input), path(path), output(output) {}
+
+            Driver* driver;
+            std::string input;          // as given, for messages
+            std::string path;           // absolute input, the query key
+            std::string output;         // absolute
+            std::string source;
+            const SourceFile* file = nullptr;
+            bool loaded = false;
+            bool success = false;
+        };
+
+        struct InputFile {
+            std::string path;           // as found
+            std::string relative;       // below the input it was found in, the file name for a file input
+        };
+
+        bool collectInputs(const std::string& path, const std::string& relative, Array<InputFile>& files);
+        std::string getOutputPath(const InputFile& input) const;
+        bool compileFile(const CompileJob& job);
+        void setupImports(const Array<CompileJob>& jobs, ModuleResolver& resolver);
+        // maps the interface of every import, false when one of them is missing
+        bool resolveImports(const CompileJob& job, const Lexer& lexer);
+        // prints every diagnostic of the file, false when one of them is an error
+        bool reportDiagnostics(const CompileJob& job, const Lexer& lexer);
+        bool writeInterface(const std::string& path, const MemoryOStream& exports, StableHash source_hash);
+        static void loadJob(void* data);
+        static void runJob(void* data);
+
+        IAllocator& m_alloc;
+        BuildCache* m_cache;
+        QueryEngine* m_engine;
+        const BuildOptions* m_options = nullptr;
+        SourceMap m_sources;
+
+        // valid during build(), resolved interfaces stay mapped until the build ends
+        ModuleResolver* m_resolver = nullptr;
+        Mutex m_resolver_mutex;
+        // module names of this build's own inputs, they need no interface on disk
+        HashMap<std::string, bool> m_build_modules;
+    };
+}
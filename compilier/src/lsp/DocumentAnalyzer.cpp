@@ -0,0 +1,137 @@
+#include "DocumentAnalyzer.hpp"
+
+#include "analyzer/Lexer.hpp"
+#include "base/math/Math.hpp"
+#include "utils/TimeReport.hpp"
+
+#include <cctype>
+
+namespace cal {
+
+    static bool isWordChar(char c) {
+        return std::isalnum((unsigned char)c) || c == '_';
+    }
+
+
+    const DocumentSymbol* DocumentAnalysis::findDefinition(const std::string& name, u32 offset) const {
+        const DocumentSymbol* result = nullptr;
+        for (const DocumentSymbol& symbol : symbols) {
+            if (symbol.name != name) continue;
+            if (!result || symbol.offset <= offset) result = &symbol;
+            if (symbol.offset > offset) break;
+        }
+        return result;
+    }
+
+
+    DocumentAnalysis* DocumentAnalyzer::analyze(const std::string& text, StableHash hash, IAllocator& alloc, const CancellationToken& token) {
+        CAL_TIME_SCOPE("lsp analyze");
+
+        DocumentAnalysis* analysis = CAL_NEW(alloc, DocumentAnalysis)(alloc);
+        analysis->hash = hash;
+        analysis->lines.build(text.data(), (u32)text.size());
+
+        Lexer lexer{ text, alloc };
+        lexer.setCancellationToken(token);
+        lexer.analyze();
+        if (lexer.wasCancelled()) {
+            CAL_DEL(alloc, analysis);
+            return nullptr;
+        }
+        for (const Diagnostic& diagnostic : lexer.getDiagnostics()) {
+            analysis->diagnostics.push(diagnostic);
+        }
+
+        using Token = Lexer::Token;
+        const Array<Token>& tokens = lexer.m_tokens;
+        auto addSymbol = [&](const Token& tk, DocumentSymbolKind kind, const std::string& container) {
+            analysis->symbols.push(DocumentSymbol{ tk.tk_item, container, kind, tk.tk_offset, (u32)tk.tk_item.size() });
+        };
+
+        std::string function;
+        Array<const Token*> brackets(alloc);
+        for (i32 i = 0; i < tokens.size(); ++i) {
+            const Token& tk = tokens[i];
+            const Token* next = i + 1 < tokens.size() ? &tokens[i + 1] : nullptr;
+
+            switch (tk.tk_type) {
+            case Token::TK_MODULE:
+                if (next && next->tk_type == Token::TK_IDENTIFIER) addSymbol(*next, DocumentSymbolKind::Module, "");
+                break;
+            case Token::TK_STRUCT:
+                addSymbol(tk, DocumentSymbolKind::Struct, "");
+                // fields are (identifier, modifiers..., type) groups right after the struct name
+                while (i + 1 < tokens.size()) {
+                    const Token& field = tokens[i + 1];
+                    if (field.tk_type == Token::TK_IDENTIFIER) addSymbol(field, DocumentSymbolKind::Field, tk.tk_item);
+                    else if (field.tk_type != Token::TK_TYPE && !(field.tk_type >= Token::TK_DECLEAR_CONST && field.tk_type <= Token::TK_DECLEAR_EXPORT)) break;
+                    ++i;
+                }
+                break;
+            case Token::TK_FUNC_NAME:
+                function = tk.tk_item;
+                addSymbol(tk, DocumentSymbolKind::Function, "");
+                break;
+            case Token::TK_FUNC_ARG:
+                addSymbol(tk, DocumentSymbolKind::Parameter, function);
+                break;
+            case Token::TK_VAR:
+            case Token::TK_VAL:
+                if (next && next->tk_type == Token::TK_IDENTIFIER) addSymbol(*next, DocumentSymbolKind::Variable, function);
+                break;
+            case Token::TK_LEFT_PAREN:
+            case Token::TK_LEFT_BRACES:
+            case Token::TK_LEFT_BRACKET:
+                brackets.push(&tk);
+                break;
+            case Token::TK_RIGHT_PAREN:
+            case Token::TK_RIGHT_BRACES:
+            case Token::TK_RIGHT_BRACKET: {
+                const Token::TokenType open = tk.tk_type == Token::TK_RIGHT_PAREN ? Token::TK_LEFT_PAREN
+                    : tk.tk_type == Token::TK_RIGHT_BRACES ? Token::TK_LEFT_BRACES : Token::TK_LEFT_BRACKET;
+                if (!brackets.empty() && brackets.last()->tk_type == open) {
+                    brackets.pop();
+                }
+                else {
+                    analysis->diagnostics.push(Diagnostic{ DiagnosticSeverity::Error, tk.tk_offset, tk.tk_offset + 1, "unmatched '" + tk.tk_item + "'" });
+                }
+                break;
+            }
+            default:
+                break;
+            }
+        }
+        for (const Token* tk : brackets) {
+            analysis->diagnostics.push(Diagnostic{ DiagnosticSeverity::Error, tk->tk_offset, tk->tk_offset + 1, "'" + tk->tk_item + "' is never closed" });
+        }
+        return analysis;
+    }
+
+
+    u32 DocumentAnalyzer::getOffset(const std::string& text, u32 line, u32 column) {
+        size_t pos = 0;
+        for (u32 i = 0; i < line; ++i) {
+            pos = text.find('\n', pos);
+            if (pos == std::string::npos) return (u32)text.size();
+            ++pos;
+        }
+        const size_t line_end = minimum(text.find('\n', pos), text.size());
+        return (u32)minimum(pos + column, line_end);
+    }
+
+
+    std::string DocumentAnalyzer::getWordAt(const std::string& text, u32 offset) {
+        size_t begin = minimum((size_t)offset, text.size());
+        size_t end = begin;
+        while (begin > 0 && isWordChar(text[begin - 1])) --begin;
+        while (end < text.size() && isWordChar(text[end])) ++end;
+        return text.substr(begin, end - begin);
+    }
+
+
+    void DocumentAnalyzer::applyChange(std::string& text, u32 start_line, u32 start_column, u32 end_line, u32 end_column, const std::string& replacement) {
+        const u32 begin = getOffset(text, start_line, start_column);
+        const u32 end = getOffset(text, end_line, end_column);
+        text.replace(begin, end > begin ? end - begin : 0, replacement);
+    }
+}
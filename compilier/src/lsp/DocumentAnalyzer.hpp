@@ -0,0 +1,56 @@
+#pragma once
+
+#include "analyzer/Diagnostic.hpp"
+#include "analyzer/SourceMap.hpp"
+#include "base/allocator/IAllocator.hpp"
+#include "base/types/Array.hpp"
+#include "base/types/Hash.hpp"
+#include "utils/Cancellation.hpp"
+#include "globals.hpp"
+
+#include <string>
+
+namespace cal {
+
+    enum class DocumentSymbolKind : u8 {
+        Module, Struct, Field, Function, Parameter, Variable
+    };
+
+    struct DocumentSymbol {
+        std::string name;
+        std::string container;      // enclosing struct / function, empty at top level
+        DocumentSymbolKind kind;
+        u32 offset;
+        u32 length;
+    };
+
+
+    // everything the language server knows about one version of a document
+    // immutable once built, so request handlers read it while newer versions are being analyzed
+    struct DocumentAnalysis {
+        explicit DocumentAnalysis(IAllocator& alloc)
+            : lines(alloc), symbols(alloc), diagnostics(alloc) {}
+
+        // the definition visible from offset, falls back to the first one with that name
+        const DocumentSymbol* findDefinition(const std::string& name, u32 offset) const;
+
+        StableHash hash;
+        LineTable lines;
+        Array<DocumentSymbol> symbols;
+        Array<Diagnostic> diagnostics;
+    };
+
+
+    class DocumentAnalyzer
+    {
+    public:
+        // nullptr when the token got cancelled half way
+        static DocumentAnalysis* analyze(const std::string& text, StableHash hash, IAllocator& alloc, const CancellationToken& token);
+
+        // lsp positions are zero based lines and columns (columns counted in bytes)
+        static u32 getOffset(const std::string& text, u32 line, u32 column);
+        static std::string getWordAt(const std::string& text, u32 offset);
+        // one range of an incremental didChange, start and end are positions in the text before the edit
+        static void applyChange(std::string& text, u32 start_line, u32 start_column, u32 end_line, u32 end_column, const std::string& replacement);
+    };
+}
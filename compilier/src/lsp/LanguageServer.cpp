@@ -0,0 +1,357 @@
+#include "LanguageServer.hpp"
+
+#include "base/Logger.hpp"
+#include "base/threading/ThreadPool.hpp"
+#include "utils/TimeReport.hpp"
+
+#include <json/json.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace cal {
+
+    // json-rpc / lsp error codes
+    static constexpr i32 LSP_METHOD_NOT_FOUND = -32601;
+    static constexpr i32 LSP_INVALID_REQUEST = -32600;
+
+    // lsp SymbolKind values
+    static i32 getLspSymbolKind(DocumentSymbolKind kind) {
+        switch (kind) {
+        case DocumentSymbolKind::Module: return 2;
+        case DocumentSymbolKind::Struct: return 23;
+        case DocumentSymbolKind::Field: return 8;
+        case DocumentSymbolKind::Function: return 12;
+        case DocumentSymbolKind::Parameter: return 13;
+        case DocumentSymbolKind::Variable: return 13;
+        }
+        return 13;
+    }
+
+
+    LanguageServer::LanguageServer(IAllocator& alloc)
+        : m_alloc(alloc)
+        , m_documents(alloc)
+    {
+        m_pool = CAL_NEW(m_alloc, ThreadPool)(m_alloc, 0);
+    }
+
+
+    LanguageServer::~LanguageServer() {
+        // running jobs still point at the documents
+        CAL_DEL(m_alloc, m_pool);
+        for (auto iter = m_documents.begin(); iter.isValid(); ++iter) {
+            Document* document = iter.value();
+            if (document->analysis) CAL_DEL(m_alloc, document->analysis);
+            CAL_DEL(m_alloc, document);
+        }
+    }
+
+
+    i32 LanguageServer::run() {
+        LogInfo("[LSP] started");
+
+        Json::Value message;
+        while (readMessage(message)) {
+            if (message.isObject() && message["method"].asString() == "exit") {
+                return m_shutdown ? 0 : 1;
+            }
+            handleMessage(message);
+        }
+        // stdin closed without "exit"
+        return 1;
+    }
+
+
+    void LanguageServer::handleMessage(const Json::Value& message) {
+        CAL_TIME_SCOPE("lsp message");
+
+        const Json::Value& id = message["id"];
+        const bool is_request = message.isMember("id");
+        if (!message.isObject() || !message["method"].isString()) {
+            if (is_request) sendError(id, LSP_INVALID_REQUEST, "invalid request");
+            return;
+        }
+
+        const std::string method = message["method"].asString();
+        const Json::Value& params = message["params"];
+        if (method == "initialize") handleInitialize(id);
+        else if (method == "shutdown") {
+            m_shutdown = true;
+            sendResult(id, Json::Value{});
+        }
+        else if (method == "textDocument/didOpen") handleDidOpen(params);
+        else if (method == "textDocument/didChange") handleDidChange(params);
+        else if (method == "textDocument/didClose") handleDidClose(params);
+        else if (method == "textDocument/definition") handleDefinition(id, params);
+        else if (method == "textDocument/documentSymbol") handleDocumentSymbol(id, params);
+        // requests are answered in order before the next one is read, nothing is left to cancel
+        else if (method == "$/cancelRequest" || method == "initialized") {}
+        else if (is_request) sendError(id, LSP_METHOD_NOT_FOUND, "method not supported");
+    }
+
+
+    void LanguageServer::handleInitialize(const Json::Value& id) {
+        Json::Value result;
+        Json::Value& capabilities = result["capabilities"];
+        capabilities["textDocumentSync"]["openClose"] = true;
+        capabilities["textDocumentSync"]["change"] = 2; // incremental
+        capabilities["definitionProvider"] = true;
+        capabilities["documentSymbolProvider"] = true;
+        result["serverInfo"]["name"] = "cal";
+        sendResult(id, result);
+    }
+
+
+    void LanguageServer::handleDidOpen(const Json::Value& params) {
+        const Json::Value& item = params["textDocument"];
+        Document* document = getDocument(item["uri"].asString(), true);
+        document->text = item["text"].asString();
+        document->version = item["version"].asInt();
+        document->open = true;
+        scheduleAnalysis(*document);
+    }
+
+
+    void LanguageServer::handleDidChange(const Json::Value& params) {
+        Document* document = getDocument(params["textDocument"]["uri"].asString(), false);
+        if (!document || !document->open) {
+            LogWarn("[LSP] change for a document that is not open");
+            return;
+        }
+
+        for (const Json::Value& change : params["contentChanges"]) {
+            if (!change.isMember("range")) {
+                document->text = change["text"].asString();
+                continue;
+            }
+            const Json::Value& range = change["range"];
+            DocumentAnalyzer::applyChange(document->text, range["start"]["line"].asUInt(), range["start"]["character"].asUInt(),
+                range["end"]["line"].asUInt(), range["end"]["character"].asUInt(), change["text"].asString());
+        }
+        document->version = params["textDocument"]["version"].asInt();
+        scheduleAnalysis(*document);
+    }
+
+
+    void LanguageServer::handleDidClose(const Json::Value& params) {
+        Document* document = getDocument(params["textDocument"]["uri"].asString(), false);
+        if (!document) return;
+
+        // the document object stays alive, jobs may still point at it
+        document->cancel.cancel();
+        document->open = false;
+        document->text.clear();
+        {
+            // a reopen starts over, even with the same text its diagnostics have to be published again
+            MutexGuard lock(m_mutex);
+            if (document->analysis) CAL_DEL(m_alloc, document->analysis);
+            document->analysis = nullptr;
+            document->analysis_version = -1;
+        }
+        publishDiagnostics(*document, nullptr);
+    }
+
+
+    void LanguageServer::handleDefinition(const Json::Value& id, const Json::Value& params) {
+        CAL_TIME_SCOPE("lsp definition");
+
+        Document* document = getDocument(params["textDocument"]["uri"].asString(), false);
+        if (!document || !document->open) {
+            sendResult(id, Json::Value{});
+            return;
+        }
+
+        const Json::Value& position = params["position"];
+        const u32 offset = DocumentAnalyzer::getOffset(document->text, position["line"].asUInt(), position["character"].asUInt());
+        const std::string word = DocumentAnalyzer::getWordAt(document->text, offset);
+
+        Json::Value result{ Json::ValueType::arrayValue };
+        if (!word.empty()) {
+            MutexGuard lock(m_mutex);
+            // the current document first, then every other open one
+            const DocumentSymbol* symbol = document->analysis ? document->analysis->findDefinition(word, offset) : nullptr;
+            if (symbol) {
+                makeLocation(*document, *document->analysis, symbol->offset, symbol->length, result.append(Json::Value{}));
+            }
+            else {
+                for (auto iter = m_documents.begin(); iter.isValid(); ++iter) {
+                    const Document* other = iter.value();
+                    if (other == document || !other->open || !other->analysis) continue;
+                    symbol = other->analysis->findDefinition(word, 0);
+                    if (symbol) makeLocation(*other, *other->analysis, symbol->offset, symbol->length, result.append(Json::Value{}));
+                }
+            }
+        }
+        sendResult(id, result);
+    }
+
+
+    void LanguageServer::handleDocumentSymbol(const Json::Value& id, const Json::Value& params) {
+        Document* document = getDocument(params["textDocument"]["uri"].asString(), false);
+
+        Json::Value result{ Json::ValueType::arrayValue };
+        MutexGuard lock(m_mutex);
+        if (document && document->open && document->analysis) {
+            for (const DocumentSymbol& symbol : document->analysis->symbols) {
+                Json::Value& item = result.append(Json::Value{});
+                item["name"] = symbol.name;
+                item["kind"] = getLspSymbolKind(symbol.kind);
+                if (!symbol.container.empty()) item["containerName"] = symbol.container;
+                makeLocation(*document, *document->analysis, symbol.offset, symbol.length, item["location"]);
+            }
+        }
+        sendResult(id, result);
+    }
+
+
+    LanguageServer::Document* LanguageServer::getDocument(const std::string& uri, bool create) {
+        auto iter = m_documents.find(uri);
+        if (iter.isValid()) return iter.value();
+        if (!create) return nullptr;
+
+        Document* document = CAL_NEW(m_alloc, Document)(uri);
+        m_documents.insert(uri, document);
+        return document;
+    }
+
+
+    void LanguageServer::scheduleAnalysis(Document& document) {
+        // stale analyses of this document stop at their next poll
+        document.cancel.cancel();
+
+        const StableHash hash{ document.text.data(), (u32)document.text.size() };
+        {
+            // same content as the last analysis (undo, save, no-op edit), nothing to recompute
+            MutexGuard lock(m_mutex);
+            if (document.analysis && document.analysis->hash == hash) {
+                document.analysis_version = document.version;
+                return;
+            }
+        }
+
+        AnalysisJob* job = CAL_NEW(m_alloc, AnalysisJob)(AnalysisJob{
+            this, &document, document.text, hash, document.version, document.cancel.getToken() });
+        m_pool->push(&LanguageServer::runAnalysis, job);
+    }
+
+
+    void LanguageServer::runAnalysis(void* data) {
+        AnalysisJob* job = (AnalysisJob*)data;
+        LanguageServer& server = *job->server;
+        Document& document = *job->document;
+
+        DocumentAnalysis* analysis = job->token.isCancelled() ? nullptr
+            : DocumentAnalyzer::analyze(job->text, job->hash, server.m_alloc, job->token);
+
+        if (analysis) {
+            bool publish = false;
+            {
+                MutexGuard lock(server.m_mutex);
+                // a newer version may have finished first
+                if (!job->token.isCancelled() && job->version > document.analysis_version) {
+                    if (document.analysis) CAL_DEL(server.m_alloc, document.analysis);
+                    document.analysis = analysis;
+                    document.analysis_version = job->version;
+                    publish = true;
+                }
+            }
+            if (publish) server.publishDiagnostics(document, analysis);
+            else CAL_DEL(server.m_alloc, analysis);
+        }
+        CAL_DEL(server.m_alloc, job);
+    }
+
+
+    void LanguageServer::publishDiagnostics(const Document& document, const DocumentAnalysis* analysis) {
+        Json::Value message;
+        message["jsonrpc"] = "2.0";
+        message["method"] = "textDocument/publishDiagnostics";
+        Json::Value& params = message["params"];
+        params["uri"] = document.uri;
+        params["diagnostics"] = Json::Value{ Json::ValueType::arrayValue };
+
+        if (analysis) {
+            for (const Diagnostic& diagnostic : analysis->diagnostics) {
+                Json::Value& item = params["diagnostics"].append(Json::Value{});
+                Json::Value location;
+                makeLocation(document, *analysis, diagnostic.begin, diagnostic.end - diagnostic.begin, location);
+                item["range"] = location["range"];
+                item["severity"] = diagnostic.severity == DiagnosticSeverity::Error ? 1 : 2;
+                item["source"] = "cal";
+                item["message"] = diagnostic.message;
+            }
+        }
+        writeMessage(message);
+    }
+
+
+    void LanguageServer::makeLocation(const Document& document, const DocumentAnalysis& analysis, u32 offset, u32 length, Json::Value& location) const {
+        const LineColumn start = analysis.lines.getLineColumn(offset);
+        const LineColumn end = analysis.lines.getLineColumn(offset + length);
+
+        location["uri"] = document.uri;
+        location["range"]["start"]["line"] = start.line;
+        location["range"]["start"]["character"] = start.column;
+        location["range"]["end"]["line"] = end.line;
+        location["range"]["end"]["character"] = end.column;
+    }
+
+
+    bool LanguageServer::readMessage(Json::Value& message) {
+        // "Content-Length: n" header, other headers are ignored, an empty line ends the block
+        char line[256];
+        u64 length = 0;
+        while (length == 0) {
+            for (;;) {
+                if (!fgets(line, sizeof(line), stdin)) return false;
+                if (strcmp(line, "\r\n") == 0 || strcmp(line, "\n") == 0) break;
+                if (strncmp(line, "Content-Length:", 15) == 0) length = strtoull(line + 15, nullptr, 10);
+            }
+        }
+
+        std::string body(length, '\0');
+        if (fread(body.data(), 1, length, stdin) != length) return false;
+
+        Json::CharReaderBuilder builder;
+        std::unique_ptr<Json::CharReader> reader{ builder.newCharReader() };
+        std::string errors;
+        message = Json::Value{};
+        if (!reader->parse(body.data(), body.data() + body.size(), &message, &errors)) {
+            LogWarn("[LSP] dropped malformed message : ", errors);
+        }
+        return true;
+    }
+
+
+    void LanguageServer::writeMessage(const Json::Value& message) {
+        Json::StreamWriterBuilder writer;
+        writer["indentation"] = "";
+        const std::string body = Json::writeString(writer, message);
+
+        MutexGuard lock(m_output_mutex);
+        fprintf(stdout, "Content-Length: %zu\r\n\r\n", body.size());
+        fwrite(body.data(), 1, body.size(), stdout);
+        fflush(stdout);
+    }
+
+
+    void LanguageServer::sendResult(const Json::Value& id, const Json::Value& result) {
+        Json::Value message;
+        message["jsonrpc"] = "2.0";
+        message["id"] = id;
+        message["result"] = result;
+        writeMessage(message);
+    }
+
+
+    void LanguageServer::sendError(const Json::Value& id, i32 code, const char* text) {
+        Json::Value message;
+        message["jsonrpc"] = "2.0";
+        message["id"] = id;
+        message["error"]["code"] = code;
+        message["error"]["message"] = text;
+        writeMessage(message);
+    }
+}
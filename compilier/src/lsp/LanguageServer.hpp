@@ -0,0 +1,82 @@
+#pragma once
+
+#include "base/allocator/IAllocator.hpp"
+#include "base/threading/SyncMutex.hpp"
+#include "base/types/Array.hpp"
+#include "base/types/container/HashMap.hpp"
+#include "lsp/DocumentAnalyzer.hpp"
+#include "utils/Cancellation.hpp"
+#include "globals.hpp"
+
+#include <string>
+
+namespace Json {
+    class Value;
+}
+
+namespace cal {
+
+    struct ThreadPool;
+
+    // "cal lsp", language server protocol over stdin / stdout
+    // edits are applied on the reader thread and only the touched document is re-analyzed on the pool,
+    // a newer edit cancels the analysis still running for the previous version
+    // requests are answered from the latest finished analysis and never wait for the pool
+    class LanguageServer
+    {
+    public:
+        LanguageServer(IAllocator& alloc);
+        ~LanguageServer();
+
+        // returns the process exit code once the client sent "exit"
+        i32 run();
+
+    private:
+        struct Document {
+            explicit Document(const std::string& uri) : uri(uri) {}
+
+            const std::string uri;
+            std::string text;               // reader thread only
+            i32 version = 0;
+            bool open = false;
+            CancellationSource cancel;
+            DocumentAnalysis* analysis = nullptr;   // guarded by m_mutex
+            i32 analysis_version = -1;              // guarded by m_mutex
+        };
+
+        struct AnalysisJob {
+            LanguageServer* server;
+            Document* document;
+            std::string text;
+            StableHash hash;
+            i32 version;
+            CancellationToken token;
+        };
+
+        void handleMessage(const Json::Value& message);
+        void handleInitialize(const Json::Value& id);
+        void handleDidOpen(const Json::Value& params);
+        void handleDidChange(const Json::Value& params);
+        void handleDidClose(const Json::Value& params);
+        void handleDefinition(const Json::Value& id, const Json::Value& params);
+        void handleDocumentSymbol(const Json::Value& id, const Json::Value& params);
+
+        Document* getDocument(const std::string& uri, bool create);
+        void scheduleAnalysis(Document& document);
+        static void runAnalysis(void* data);
+        void publishDiagnostics(const Document& document, const DocumentAnalysis* analysis);
+        void makeLocation(const Document& document, const DocumentAnalysis& analysis, u32 offset, u32 length, Json::Value& location) const;
+
+        bool readMessage(Json::Value& message);
+        void writeMessage(const Json::Value& message);
+        void sendResult(const Json::Value& id, const Json::Value& result);
+        void sendError(const Json::Value& id, i32 code, const char* message);
+
+        IAllocator& m_alloc;
+        ThreadPool* m_pool;
+        Mutex m_mutex;          // document analyses
+        Mutex m_output_mutex;   // stdout, diagnostics are published from the pool
+        HashMap<std::string, Document*> m_documents;
+        bool m_shutdown = false;
+    };
+}
@@ -1,73 +1,191 @@
 #include <iostream>
-#include <fstream>
 
 #include "analyzer/Lexer.hpp"
 #include "analyzer/ast/NodeBase.hpp"
 #include "analyzer/ast/expr/NumberNode.hpp"
 #include "analyzer/ast/types/NodeType.hpp"
 #include "base/allocator/Allocator.hpp"
+#include "base/allocator/ProfilingAllocator.hpp"
+#include "driver/Driver.hpp"
+#include "lsp/LanguageServer.hpp"
+#include "server/CompileServer.hpp"
 
 #include "analyzer/ast/types/TypePool.hpp"
+#include "vm/BytecodeEmitter.hpp"
+#include "vm/TieredRuntime.hpp"
+#include "utils/TimeReport.hpp"
+#include "utils/ArgsParser.hpp"
 
 #include <globals.hpp>
 #include <base/Logger.hpp>
+#include <system/SysThreading.hpp>
+#include <system/SysTimer.hpp>
 #include <ostream>
+#include <cstdlib>
+#include <cstring>
 
 namespace cal {
 
-    i32 compilier_main(i32 argc, char** argv) {
-        InitLogger();
+    // parse -> emit -> interpret, hot functions tier up to the jit in the background.
+    // every line becomes a new function of the session's module, the runtime and its compile thread stay
+    static void evalOnVM(ASTNumberNode* node, vm::BytecodeModule& module, vm::TieredRuntime& runtime) {
+        platform::Timer timer;
+
+        // the compile thread reads the module, it can not grow meanwhile
+        while (runtime.hasPendingWork()) platform::sleep(1);
+
+        vm::ValueKind kind = vm::ValueKind::Void;
+        u32 func_idx;
+        {
+            CAL_TIME_SCOPE("emit bytecode");
+            vm::BytecodeEmitter emitter{ module };
+            func_idx = emitter.beginFunction("repl" + std::to_string(module.getFunctionCount()), 0).index;
+            if (!node->emitBytecode(emitter)) {
+                emitter.endFunction();
+                return;
+            }
+            kind = emitter.lastResultKind();
+            emitter.emitReturn(emitter.popResult(), kind);
+            emitter.endFunction();
+        }
 
-        static Allocator global{};
+        vm::Value result;
+        {
+            CAL_TIME_SCOPE("interpret");
+            if (!runtime.run(func_idx, {}, result)) return;
+        }
 
-        while (true) {
-            LogInfo("> Input number to parse (exit for quit):");
-            std::cin.clear();
-            std::string val;
-            std::getline(std::cin, val);
+        const float elapsed = timer.getTimeSinceStart() * 1000.f;
+        if (kind == vm::ValueKind::Float) {
+            LogInfo("[VM] result : ", result.f, " (", elapsed, " ms)");
+        }
+        else {
+            LogInfo("[VM] result : ", result.i, " (", elapsed, " ms)");
+        }
+    }
 
-            if (val == "exit") {
-                LogInfo("Exiting...");
-                break;
-            }
+    // --time-report[=trace.json] prints per phase timings on exit and writes a chrome trace
+    static const char* parseTimeReportFlag(i32 argc, char** argv) {
+        static const char FLAG[] = "--time-report";
+        for (i32 i = 1; i < argc; ++i) {
+            if (strncmp(argv[i], FLAG, sizeof(FLAG) - 1) != 0) continue;
+            const char* rest = argv[i] + sizeof(FLAG) - 1;
+            if (*rest == '\0') return "cal-trace.json";
+            if (*rest == '=') return rest + 1;
+        }
+        return nullptr;
+    }
 
-            auto* node = NumberPool::get().getNum(val);
-            if (node == nullptr) continue;
-            std::string output = ASTNodeBase::buildOutputJson(node);
-            LogInfo(output, "\n");
+
+    // --memory-report[=interval_ms] counts every allocation and prints where memory went on exit,
+    // with an interval the report is also logged while running. -1 without the flag
+    static i32 parseMemoryReportFlag(i32 argc, char** argv) {
+        static const char FLAG[] = "--memory-report";
+        for (i32 i = 1; i < argc; ++i) {
+            if (strncmp(argv[i], FLAG, sizeof(FLAG) - 1) != 0) continue;
+            const char* rest = argv[i] + sizeof(FLAG) - 1;
+            if (*rest == '\0') return 0;
+            if (*rest == '=') return atoi(rest + 1);
         }
+        return -1;
+    }
 
-        return 0;
 
-        const char* code = R"(
-            import std.io;
+    static void finishReports(const char* trace_path, ProfilingAllocator* profiler) {
+        if (profiler) {
+            profiler->setDumpInterval(0);
+            LogInfo(profiler->buildReport());
+        }
+        if (!trace_path) return;
+        TimeReport::get().printTable();
+        if (TimeReport::get().writeChromeTrace(trace_path)) {
+            LogInfo("[TimeReport] trace written to ", trace_path);
+        }
+    }
 
-            struct test {
-                a : i32
-            }
 
-            fun main() {
-                val tt = test();
-                tt.a = 10;
-                console.println(tt.a);
-            }
-        )";
+    i32 compilier_main(i32 argc, char** argv) {
+        // stdout carries the protocol in lsp mode
+        const bool lsp_mode = argc > 1 && strcmp(argv[1], "lsp") == 0;
+        if (lsp_mode) InitStderrLogger();
+        else InitLogger();
+
+        // created before any worker thread can record into it
+        const char* trace_path = parseTimeReportFlag(argc, argv);
+        TimeReport::get().setEnabled(trace_path != nullptr);
+
+        // huge pages where the kernel has them, fewer tlb misses walking big syntax trees
+        static Allocator global{ platform::HugePages::Transparent };
+        // declared before everything allocating from it
+        ProfilingAllocator profiler{ global };
+        const i32 memory_report = parseMemoryReportFlag(argc, argv);
+        if (memory_report > 0) profiler.setDumpInterval((u32)memory_report);
+        ProfilingAllocator* report = memory_report >= 0 ? &profiler : nullptr;
+        IAllocator& alloc = report ? (IAllocator&)profiler : global;
+
+        if (lsp_mode) {
+            LanguageServer server{ alloc };
+            const i32 result = server.run();
+            finishReports(trace_path, report);
+            return result;
+        }
 
-        Lexer lex{ code, global };
-        lex.analyze();
-        lex.debugPrint();
+        ArgsParser args{ argc, (const char**)argv, alloc, Driver::VALUE_OPTIONS };
+        if (args.getPositionalCount() > 0 && args.getPositional(0) == "server") {
+            std::string socket = args.getArg("socket");
+            if (socket.empty() && !CompileServer::getDefaultSocketPath(socket)) {
+                LogError("[Server] no private socket directory, pass --socket=path");
+                return 1;
+            }
 
-        std::string output = lex.buildOutput();
+            CompileServer server{ alloc };
+            const i32 result = server.run(socket.c_str());
+            finishReports(trace_path, report);
+            return result;
+        }
+        if (args.hasArg("server")) {
+            // --server[=socket] hands the build to a running "cal server", without one we build in process
+            std::string socket = args.getArg("server");
+            i32 result = 0;
+            if ((!socket.empty() || CompileServer::getDefaultSocketPath(socket)) && CompileServer::sendRequest(socket.c_str(), argc, argv, result)) {
+                return result;
+            }
+            LogWarn("[Server] no compile server running, building in process");
+        }
+        if (args.getPositionalCount() > 0) {
+            BuildOptions options{ alloc };
+            if (!Driver::parseBuildOptions(args, options)) return 1;
+
+            Driver driver{ alloc };
+            const i32 result = driver.build(options);
+            finishReports(trace_path, report);
+            return result;
+        }
 
-        std::ofstream stream("lexer_output.txt");
-        if (!stream.is_open()) {
-            LogError("Failed to write lexer output");
-            return -1;
+        {
+            // the session's functions and the jit stay until the loop ends, the reports come after them
+            vm::BytecodeModule repl_module{ alloc };
+            vm::TieredRuntime runtime{ repl_module, alloc };
+            while (true) {
+                LogInfo("> Input number to parse (exit for quit):");
+                std::cin.clear();
+                std::string val;
+                std::getline(std::cin, val);
+
+                if (val == "exit") {
+                    LogInfo("Exiting...");
+                    break;
+                }
+
+                auto* node = NumberPool::get().getNum(val);
+                if (node == nullptr) continue;
+                std::string output = ASTNodeBase::buildOutputJson(node);
+                LogInfo(output, "\n");
+                evalOnVM(node, repl_module, runtime);
+            }
         }
-        stream << output;
-        stream.flush();
-        stream.close();
 
+        finishReports(trace_path, report);
         return 0;
     }
 }
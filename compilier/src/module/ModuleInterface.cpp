@@ -0,0 +1,623 @@
+#include "ModuleInterface.hpp"
+
+#include "analyzer/Lexer.hpp"
+#include "base/Logger.hpp"
+#include "base/types/container/HashMap.hpp"
+#include "system/io/Stream.hpp"
+#include "utils/TimeReport.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace cal {
+
+    static u32 alignOffset(u32 offset) {
+        return (offset + 7) & ~7u;
+    }
+
+    // the lexer keeps surrounding blanks on some type names
+    static std::string trimType(const std::string& type) {
+        const size_t begin = type.find_first_not_of(" \t\r\n");
+        if (begin == std::string::npos) return {};
+        const size_t end = type.find_last_not_of(" \t\r\n");
+        return type.substr(begin, end - begin + 1);
+    }
+
+    // appends every CALL target of func that is not in callees[first..] yet
+    static void collectCallees(const vm::BytecodeFunction& func, Array<u32>& callees, u32 first) {
+        const auto& code = func.code;
+        for (i32 pc = 0; pc < code.size(); pc += vm::getOpCodeLength(vm::decodeOp(code[pc]))) {
+            if (vm::decodeOp(code[pc]) != vm::OpCode::CALL || pc + 1 >= code.size()) continue;
+
+            u32 slot = first;
+            while (slot < (u32)callees.size() && callees[slot] != code[pc + 1]) ++slot;
+            if (slot == (u32)callees.size()) callees.push(code[pc + 1]);
+        }
+    }
+
+    //////////////////////////////////////////////
+    // Builder
+    //////////////////////////////////////////////
+
+    ModuleInterfaceBuilder::ModuleInterfaceBuilder(IAllocator& alloc)
+        : m_alloc(alloc),
+        m_symbols(alloc),
+        m_fields(alloc),
+        m_imports(alloc)
+    {
+    }
+
+
+    void ModuleInterfaceBuilder::addFromLexer(const Lexer& lexer) {
+        using Token = Lexer::Token;
+        const auto& tokens = lexer.m_tokens;
+
+        i32 depth = 0;
+        bool c_abi = false;
+        for (i32 i = 0; i < tokens.size(); ++i) {
+            const Token& tk = tokens[i];
+            switch (tk.tk_type) {
+            case Token::TK_LEFT_BRACES:
+                ++depth;
+                break;
+            case Token::TK_RIGHT_BRACES:
+                if (depth > 0) --depth;
+                break;
+            case Token::TK_MODULE: {
+                std::string name;
+                while (i + 1 < tokens.size() && (tokens[i + 1].tk_type == Token::TK_IDENTIFIER || tokens[i + 1].tk_type == Token::TK_DOT)) {
+                    name += tokens[++i].tk_item;
+                }
+                if (!name.empty()) m_name = name;
+                break;
+            }
+            case Token::TK_MODULE_NAME:
+                addImport(tk.tk_item);
+                break;
+            case Token::TK_EXPORT_ARG:
+                c_abi = true;
+                break;
+            case Token::TK_FUNC_DEF: {
+                if (depth != 0 || i + 1 >= tokens.size() || tokens[i + 1].tk_type != Token::TK_FUNC_NAME) break;
+                const std::string& name = tokens[++i].tk_item;
+
+                // params come as (TK_FUNC_ARG, TK_TYPE) pairs, the return type closes the signature
+                const u32 first_field = m_fields.size();
+                while (i + 2 < tokens.size() && tokens[i + 1].tk_type == Token::TK_FUNC_ARG && tokens[i + 2].tk_type == Token::TK_TYPE) {
+                    m_fields.push(PendingField{ tokens[i + 1].tk_item, trimType(tokens[i + 2].tk_item), 0 });
+                    i += 2;
+                }
+                std::string return_type = "void";
+                if (i + 1 < tokens.size() && tokens[i + 1].tk_type == Token::TK_FUNC_RETURN) {
+                    return_type = trimType(tokens[++i].tk_item);
+                }
+
+                m_symbols.push(PendingSymbol{ name, return_type, "", InterfaceSymbolKind::Function,
+                    (u8)(c_abi ? InterfaceFlags::C_ABI : InterfaceFlags::NONE), first_field, m_fields.size() - first_field, nullptr, nullptr });
+                c_abi = false;
+                break;
+            }
+            case Token::TK_STRUCT: {
+                if (depth != 0) break;
+                beginStruct(tk.tk_item);
+
+                // members : TK_IDENTIFIER, modifiers, TK_TYPE
+                while (i + 1 < tokens.size() && tokens[i + 1].tk_type == Token::TK_IDENTIFIER) {
+                    const std::string& name = tokens[++i].tk_item;
+                    u32 flags = 0;
+                    while (i + 1 < tokens.size()) {
+                        const auto type = tokens[i + 1].tk_type;
+                        if (type == Token::TK_DECLEAR_CONST) flags |= (u32)InterfaceFlags::CONST;
+                        else if (type == Token::TK_DECLEAR_PRIVATE || type == Token::TK_DECLEAR_INTERNAL) flags |= (u32)InterfaceFlags::PRIVATE;
+                        else if (type != Token::TK_DECLEAR_EXPORT && type != Token::TK_DECLEAR_PUBLIC) break;
+                        ++i;
+                    }
+                    if (i + 1 >= tokens.size() || tokens[i + 1].tk_type != Token::TK_TYPE) break;
+                    addField(name, trimType(tokens[++i].tk_item), flags);
+                }
+                break;
+            }
+            case Token::TK_VAR:
+            case Token::TK_VAL: {
+                if (depth != 0 || i + 1 >= tokens.size() || tokens[i + 1].tk_type != Token::TK_IDENTIFIER) break;
+                const bool is_const = tk.tk_type == Token::TK_VAL;
+                const std::string& name = tokens[++i].tk_item;
+                std::string type, value;
+                if (i + 1 < tokens.size() && tokens[i + 1].tk_type == Token::TK_TYPE) type = trimType(tokens[++i].tk_item);
+                if (is_const && i + 1 < tokens.size() && tokens[i + 1].tk_type == Token::TK_NUMBER) value = tokens[++i].tk_item;
+                addVariable(name, type, value, is_const);
+                break;
+            }
+            default:
+                break;
+            }
+        }
+    }
+
+
+    void ModuleInterfaceBuilder::beginFunction(const std::string& name, const std::string& return_type, bool c_abi) {
+        m_symbols.push(PendingSymbol{ name, return_type, "", InterfaceSymbolKind::Function,
+            (u8)(c_abi ? InterfaceFlags::C_ABI : InterfaceFlags::NONE), (u32)m_fields.size(), 0, nullptr, nullptr });
+    }
+
+
+    void ModuleInterfaceBuilder::beginStruct(const std::string& name) {
+        m_symbols.push(PendingSymbol{ name, "", "", InterfaceSymbolKind::Struct, 0, (u32)m_fields.size(), 0, nullptr, nullptr });
+    }
+
+
+    void ModuleInterfaceBuilder::addField(const std::string& name, const std::string& type, u32 flags) {
+        ASSERT(!m_symbols.empty());
+        ASSERT(m_symbols.last().kind == InterfaceSymbolKind::Function || m_symbols.last().kind == InterfaceSymbolKind::Struct);
+        m_fields.push(PendingField{ name, type, flags });
+        ++m_symbols.last().field_count;
+    }
+
+
+    void ModuleInterfaceBuilder::addVariable(const std::string& name, const std::string& type, const std::string& value, bool is_const) {
+        m_symbols.push(PendingSymbol{ name, type, value, is_const ? InterfaceSymbolKind::Constant : InterfaceSymbolKind::Variable,
+            (u8)(is_const ? InterfaceFlags::CONST : InterfaceFlags::NONE), (u32)m_fields.size(), 0, nullptr, nullptr });
+    }
+
+
+    bool ModuleInterfaceBuilder::addInlineBody(const std::string& name, const vm::BytecodeModule& module, const vm::BytecodeFunction& func) {
+        if (func.code.size() > 0xffff || func.constants.size() > 0xffff) return false;
+        // formats, layouts and string literals belong to the exporting module and reference maps are not
+        // serialized, a body that prints, loads a literal or handles objects across a call can not be copied out of it
+        if (!func.reference_maps.empty()) return false;
+        for (i32 pc = 0; pc < func.code.size(); pc += vm::getOpCodeLength(vm::decodeOp(func.code[pc]))) {
+            const vm::OpCode op = vm::decodeOp(func.code[pc]);
+            if (op == vm::OpCode::PRINTF || op == vm::OpCode::NEW || op == vm::OpCode::SLIT) return false;
+        }
+
+        for (auto& symbol : m_symbols) {
+            if (symbol.kind != InterfaceSymbolKind::Function || symbol.name != name) continue;
+            symbol.body = &func;
+            symbol.body_module = &module;
+            symbol.flags |= (u8)InterfaceFlags::INLINEABLE;
+            return true;
+        }
+        return false;
+    }
+
+
+    void ModuleInterfaceBuilder::write(MemoryOStream& stream) const {
+        CAL_TIME_SCOPE("write interface");
+        // strings are deduplicated, type names repeat a lot
+        std::string strings;
+        HashMap<std::string, InterfaceString> string_map(m_alloc);
+        auto addString = [&](const std::string& str) {
+            auto iter = string_map.find(str);
+            if (iter.isValid()) return iter.value();
+            const InterfaceString result{ (u32)strings.size(), (u32)str.size() };
+            strings += str;
+            string_map.insert(str, result);
+            return result;
+        };
+
+        Array<u32> order(m_alloc);
+        Array<u64> hashes(m_alloc);
+        for (i32 i = 0; i < m_symbols.size(); ++i) {
+            order.push((u32)i);
+            hashes.push(StableHash(m_symbols[i].name.c_str()).getHashValue());
+        }
+        std::stable_sort(order.begin(), order.end(), [&](u32 lhs, u32 rhs) { return hashes[lhs] < hashes[rhs]; });
+
+        // callee table of every body, by pending symbol, CALL ext words become indices into it
+        Array<u32> callees(m_alloc);
+        Array<u32> first_callee(m_alloc);
+        for (const PendingSymbol& symbol : m_symbols) {
+            first_callee.push((u32)callees.size());
+            if (symbol.body) collectCallees(*symbol.body, callees, first_callee.last());
+        }
+        first_callee.push((u32)callees.size());
+
+        u32 body_size = 0;
+        for (i32 i = 0; i < m_symbols.size(); ++i) {
+            const PendingSymbol& symbol = m_symbols[i];
+            if (!symbol.body) continue;
+            body_size = alignOffset(body_size + symbol.body->code.size() * sizeof(vm::Instruction));
+            body_size += symbol.body->constants.size() * sizeof(vm::Value);
+            body_size += (first_callee[i + 1] - first_callee[i]) * sizeof(InterfaceString);
+        }
+
+        ModuleInterfaceHeader header = {};
+        header.magic = MODULE_INTERFACE_MAGIC;
+        header.version = MODULE_INTERFACE_VERSION;
+        header.source_hash = m_source_hash.getHashValue();
+        header.name = addString(m_name);
+        header.symbol_count = m_symbols.size();
+        header.symbol_offset = alignOffset(sizeof(ModuleInterfaceHeader));
+        header.field_count = m_fields.size();
+        header.field_offset = alignOffset(header.symbol_offset + header.symbol_count * sizeof(InterfaceSymbol));
+        header.import_count = m_imports.size();
+        header.import_offset = alignOffset(header.field_offset + header.field_count * sizeof(InterfaceField));
+        header.body_size = body_size;
+        header.body_offset = alignOffset(header.import_offset + header.import_count * sizeof(InterfaceString));
+
+        Array<InterfaceSymbol> symbols(m_alloc);
+        Array<InterfaceField> fields(m_alloc);
+        Array<InterfaceString> imports(m_alloc);
+        Array<u8> bodies(m_alloc);
+        bodies.resize(body_size);
+        if (body_size > 0) memset(bodies.begin(), 0, body_size);
+
+        u32 body_offset = 0;
+        for (u32 idx : order) {
+            const PendingSymbol& pending = m_symbols[idx];
+            InterfaceSymbol symbol = {};
+            symbol.name_hash = hashes[idx];
+            symbol.name = addString(pending.name);
+            symbol.type = addString(pending.type);
+            symbol.value = addString(pending.value);
+            symbol.kind = pending.kind;
+            symbol.flags = pending.flags;
+            symbol.first_field = pending.first_field;
+            symbol.field_count = (u16)pending.field_count;
+
+            if (pending.body) {
+                const vm::BytecodeFunction& body = *pending.body;
+                const u32 code_bytes = body.code.size() * sizeof(vm::Instruction);
+                const u32 first = first_callee[idx];
+                const u32 callee_count = first_callee[idx + 1] - first;
+                symbol.body_offset = body_offset;
+                symbol.body_code_size = (u16)body.code.size();
+                symbol.body_constant_count = (u16)body.constants.size();
+                symbol.body_param_count = body.param_count;
+                symbol.body_register_count = body.register_count;
+                symbol.body_callee_count = (u16)callee_count;
+                if (code_bytes > 0) memcpy(bodies.begin() + body_offset, body.code.begin(), code_bytes);
+
+                vm::Instruction* code = (vm::Instruction*)(bodies.begin() + body_offset);
+                for (i32 pc = 0; pc < body.code.size(); pc += vm::getOpCodeLength(vm::decodeOp(code[pc]))) {
+                    if (vm::decodeOp(code[pc]) != vm::OpCode::CALL || pc + 1 >= body.code.size()) continue;
+                    u32 slot = first;
+                    while (callees[slot] != code[pc + 1]) ++slot;
+                    code[pc + 1] = slot - first;
+                }
+                body_offset = alignOffset(body_offset + code_bytes);
+                if (body.constants.size() > 0) memcpy(bodies.begin() + body_offset, body.constants.begin(), body.constants.size() * sizeof(vm::Value));
+                body_offset += body.constants.size() * sizeof(vm::Value);
+
+                for (u32 i = 0; i < callee_count; ++i) {
+                    const u32 callee = callees[first + i];
+                    // an out of range target gets an empty name, importing the body fails on it
+                    const InterfaceString name = callee < pending.body_module->getFunctionCount()
+                        ? addString(pending.body_module->getFunction(callee).name)
+                        : InterfaceString{};
+                    memcpy(bodies.begin() + body_offset, &name, sizeof(name));
+                    body_offset += sizeof(name);
+                }
+            }
+            symbols.push(symbol);
+        }
+
+        for (const PendingField& pending : m_fields) {
+            fields.push(InterfaceField{ addString(pending.name), addString(pending.type), pending.flags });
+        }
+        for (const std::string& import : m_imports) {
+            imports.push(addString(import));
+        }
+
+        header.string_size = strings.size();
+        header.string_offset = alignOffset(header.body_offset + header.body_size);
+
+        const u32 total_size = header.string_offset + header.string_size;
+        stream.clear();
+        stream.resize(total_size);
+        u8* data = stream.getMutableData();
+        memset(data, 0, total_size);
+        memcpy(data, &header, sizeof(header));
+        if (symbols.size() > 0) memcpy(data + header.symbol_offset, symbols.begin(), symbols.size() * sizeof(InterfaceSymbol));
+        if (fields.size() > 0) memcpy(data + header.field_offset, fields.begin(), fields.size() * sizeof(InterfaceField));
+        if (imports.size() > 0) memcpy(data + header.import_offset, imports.begin(), imports.size() * sizeof(InterfaceString));
+        if (body_size > 0) memcpy(data + header.body_offset, bodies.begin(), body_size);
+        if (!strings.empty()) memcpy(data + header.string_offset, strings.data(), strings.size());
+    }
+
+
+    bool ModuleInterfaceBuilder::save(const char* path) const {
+        MemoryOStream stream(m_alloc);
+        write(stream);
+
+        platform::OFile file;
+        if (!file.open(path)) {
+            LogError("[Module] could not write interface ", path);
+            return false;
+        }
+        const bool result = file.write(stream.data(), stream.size());
+        file.close();
+        return result;
+    }
+
+    //////////////////////////////////////////////
+    // Interface
+    //////////////////////////////////////////////
+
+    ModuleInterface::~ModuleInterface() {
+        close();
+    }
+
+
+    bool ModuleInterface::open(const char* path) {
+        CAL_TIME_SCOPE("open interface");
+        close();
+        if (!platform::mapFile(path, m_file)) return false;
+        // every offset in the file is 32 bit
+        if (m_file.size > 0xffFFffFF) {
+            LogError("[Module] interface file too large ", path);
+            close();
+            return false;
+        }
+        if (!load(Span<const u8>(m_file.data, (u32)m_file.size))) {
+            LogError("[Module] invalid interface file ", path);
+            close();
+            return false;
+        }
+        return true;
+    }
+
+
+    bool ModuleInterface::load(Span<const u8> data) {
+        m_data = data;
+        m_header = nullptr;
+        if (!validate()) {
+            m_data = {};
+            return false;
+        }
+
+        const u8* base = m_data.begin();
+        m_header = (const ModuleInterfaceHeader*)base;
+        m_symbols = (const InterfaceSymbol*)(base + m_header->symbol_offset);
+        m_fields = (const InterfaceField*)(base + m_header->field_offset);
+        m_imports = (const InterfaceString*)(base + m_header->import_offset);
+        return true;
+    }
+
+
+    void ModuleInterface::close() {
+        platform::unmapFile(m_file);
+        m_data = {};
+        m_header = nullptr;
+        m_symbols = nullptr;
+        m_fields = nullptr;
+        m_imports = nullptr;
+    }
+
+
+    bool ModuleInterface::validate() {
+        // only section bounds are checked here, so opening stays independent of the symbol count
+        const u64 size = m_data.length();
+        if (size < sizeof(ModuleInterfaceHeader) || ((uintptr)m_data.begin() & 7) != 0) return false;
+
+        const auto* header = (const ModuleInterfaceHeader*)m_data.begin();
+        if (header->magic != MODULE_INTERFACE_MAGIC || header->version != MODULE_INTERFACE_VERSION) return false;
+
+        auto inBounds = [size](u32 offset, u64 bytes) {
+            return (offset & 7) == 0 && (u64)offset + bytes <= size;
+        };
+        return inBounds(header->symbol_offset, (u64)header->symbol_count * sizeof(InterfaceSymbol))
+            && inBounds(header->field_offset, (u64)header->field_count * sizeof(InterfaceField))
+            && inBounds(header->import_offset, (u64)header->import_count * sizeof(InterfaceString))
+            && inBounds(header->body_offset, header->body_size)
+            && inBounds(header->string_offset, header->string_size)
+            && (u64)header->name.offset + header->name.length <= header->string_size;
+    }
+
+
+    const InterfaceSymbol* ModuleInterface::findSymbol(StringView name) const {
+        if (!m_header) return nullptr;
+
+        const u64 hash = StableHash(name.begin, name.size()).getHashValue();
+        const InterfaceSymbol* end = m_symbols + m_header->symbol_count;
+        const InterfaceSymbol* iter = std::lower_bound(m_symbols, end, hash,
+            [](const InterfaceSymbol& symbol, u64 value) { return symbol.name_hash < value; });
+
+        for (; iter != end && iter->name_hash == hash; ++iter) {
+            if (string::equalStrings(getString(iter->name), name)) return iter;
+        }
+        return nullptr;
+    }
+
+
+    Span<const InterfaceField> ModuleInterface::getFields(const InterfaceSymbol& symbol) const {
+        if ((u64)symbol.first_field + symbol.field_count > m_header->field_count) return {};
+        return Span<const InterfaceField>(m_fields + symbol.first_field, symbol.field_count);
+    }
+
+
+    Span<const vm::Instruction> ModuleInterface::getInlineCode(const InterfaceSymbol& symbol) const {
+        const u64 bytes = (u64)symbol.body_code_size * sizeof(vm::Instruction);
+        if (!(symbol.flags & (u8)InterfaceFlags::INLINEABLE) || (u64)symbol.body_offset + bytes > m_header->body_size) return {};
+        return Span<const vm::Instruction>((const vm::Instruction*)(m_data.begin() + m_header->body_offset + symbol.body_offset), symbol.body_code_size);
+    }
+
+
+    // constants start at the first aligned offset after the code, callee names right after them.
+    // 64 bit math, the counts and offsets come from the file
+    static u64 getInlineDataOffset(const InterfaceSymbol& symbol) {
+        const u64 code_end = (u64)symbol.body_offset + (u64)symbol.body_code_size * sizeof(vm::Instruction);
+        return (code_end + 7) & ~(u64)7;
+    }
+
+
+    Span<const vm::Value> ModuleInterface::getInlineConstants(const InterfaceSymbol& symbol) const {
+        const u64 offset = getInlineDataOffset(symbol);
+        const u64 bytes = (u64)symbol.body_constant_count * sizeof(vm::Value);
+        if (!(symbol.flags & (u8)InterfaceFlags::INLINEABLE) || offset + bytes > m_header->body_size) return {};
+        return Span<const vm::Value>((const vm::Value*)(m_data.begin() + m_header->body_offset + offset), symbol.body_constant_count);
+    }
+
+
+    Span<const InterfaceString> ModuleInterface::getInlineCallees(const InterfaceSymbol& symbol) const {
+        const u64 offset = getInlineDataOffset(symbol) + (u64)symbol.body_constant_count * sizeof(vm::Value);
+        const u64 bytes = (u64)symbol.body_callee_count * sizeof(InterfaceString);
+        if (!(symbol.flags & (u8)InterfaceFlags::INLINEABLE) || offset + bytes > m_header->body_size) return {};
+        return Span<const InterfaceString>((const InterfaceString*)(m_data.begin() + m_header->body_offset + offset), symbol.body_callee_count);
+    }
+
+
+    // the interpreter and the jit trust their code, a body read from a file is checked before it gets near them :
+    // every register operand below register_count, constants and callees in their tables, jumps landing on
+    // an instruction and no falling off the end
+    static bool isValidInlineCode(Span<const vm::Instruction> code, u32 register_count, u32 constant_count, u32 callee_count, IAllocator& alloc) {
+        using vm::OpCode;
+        Array<bool> starts(alloc);
+        starts.resize(code.length());
+        for (bool& start : starts) start = false;
+
+        auto isRegister = [register_count](u32 reg) { return reg < register_count; };
+        OpCode last = OpCode::NOP;
+        for (u32 pc = 0; pc < code.length();) {
+            const vm::Instruction ins = code[pc];
+            const OpCode op = vm::decodeOp(ins);
+            if (op >= OpCode::COUNT) return false;
+            const u32 length = vm::getOpCodeLength(op);
+            if (pc + length > code.length()) return false;
+            starts[pc] = true;
+
+            const u32 a = vm::decodeA(ins), b = vm::decodeB(ins), c = vm::decodeC(ins);
+            bool valid = true;
+            switch (op) {
+            case OpCode::NOP:
+            case OpCode::JMP:
+                break;
+            case OpCode::LOADI:
+            case OpCode::JMP_IF:
+            case OpCode::JMP_IF_NOT:
+            case OpCode::RET:
+            case OpCode::FREE:
+                valid = isRegister(a);
+                break;
+            case OpCode::LOADK:
+                valid = isRegister(a) && vm::decodeBx(ins) < constant_count;
+                break;
+            case OpCode::RETK:
+                valid = vm::decodeBx(ins) < constant_count;
+                break;
+            case OpCode::MOVE:
+            case OpCode::NEG_I:
+            case OpCode::NEG_F:
+            case OpCode::I2F:
+            case OpCode::F2I:
+            case OpCode::ADDI:
+            case OpCode::JLT_I:
+            case OpCode::JLE_I:
+            case OpCode::JEQ_I:
+            case OpCode::JNE_I:
+            case OpCode::INCLT_I:
+            case OpCode::ALLOC:
+            case OpCode::GETF:
+            case OpCode::SETF:
+            case OpCode::SETR:
+            case OpCode::SLEN:
+            case OpCode::SDATA:
+                valid = isRegister(a) && isRegister(b);
+                break;
+            case OpCode::PLOAD:
+            case OpCode::PSTORE:
+                valid = isRegister(a) && isRegister(b) && (c == 1 || c == 2 || c == 4 || c == 8);
+                break;
+            case OpCode::CALL:
+                valid = isRegister(a) && a + c <= register_count && code[pc + 1] < callee_count;
+                break;
+            case OpCode::GETX:
+            case OpCode::SETX:
+            case OpCode::GETXU:
+            case OpCode::SETXU:
+                valid = isRegister(a) && isRegister(c) && (u64)b + code[pc + 1] <= register_count;
+                break;
+            case OpCode::PRINTF:
+            case OpCode::NEW:
+            case OpCode::SLIT:
+                // module tables (formats, layouts, literals) don't travel with the body
+                valid = false;
+                break;
+            default:
+                // three registers
+                valid = isRegister(a) && isRegister(b) && isRegister(c);
+                break;
+            }
+            if (!valid) return false;
+            last = op;
+            pc += length;
+        }
+        if (last != OpCode::RET && last != OpCode::RETK && last != OpCode::JMP) return false;
+
+        for (u32 pc = 0; pc < code.length(); pc += vm::getOpCodeLength(vm::decodeOp(code[pc]))) {
+            const OpCode op = vm::decodeOp(code[pc]);
+            const u32 next = pc + vm::getOpCodeLength(op);
+            i64 target = -1;
+            switch (op) {
+            case OpCode::JMP:
+            case OpCode::JMP_IF:
+            case OpCode::JMP_IF_NOT:
+                target = (i64)next + vm::decodeSBx(code[pc]);
+                break;
+            case OpCode::JLT_I:
+            case OpCode::JLE_I:
+            case OpCode::JEQ_I:
+            case OpCode::JNE_I:
+            case OpCode::INCLT_I:
+                target = (i64)next + (i32)code[pc + 1];
+                break;
+            default:
+                continue;
+            }
+            if (target < 0 || target >= (i64)code.length() || !starts[(u32)target]) return false;
+        }
+        return true;
+    }
+
+
+    vm::BytecodeFunction* ModuleInterface::importInlineBody(const InterfaceSymbol& symbol, vm::BytecodeModule& module) const {
+        const Span<const vm::Instruction> code = getInlineCode(symbol);
+        const Span<const vm::Value> constants = getInlineConstants(symbol);
+        const Span<const InterfaceString> callees = getInlineCallees(symbol);
+        const std::string name = getString(symbol.name).toStdString();
+        if (code.length() == 0 || callees.length() != symbol.body_callee_count || module.findFunction(name) >= 0) return nullptr;
+
+        Array<u32> targets(module.getAllocator());
+        for (const InterfaceString& callee : callees) {
+            const i32 target = module.findFunction(getString(callee).toStdString());
+            if (target < 0) {
+                LogError("[Module] ", name, " calls ", getString(callee).toStdString(), " which is not imported");
+                return nullptr;
+            }
+            targets.push((u32)target);
+        }
+        if (symbol.body_param_count > symbol.body_register_count || constants.length() != symbol.body_constant_count
+            || !isValidInlineCode(code, symbol.body_register_count, symbol.body_constant_count, (u32)targets.size(), module.getAllocator())) {
+            LogError("[Module] invalid inline body of ", name);
+            return nullptr;
+        }
+
+        vm::BytecodeFunction& func = module.addFunction(name, symbol.body_param_count);
+        func.register_count = symbol.body_register_count;
+        for (const vm::Value& value : constants) {
+            func.constants.push(value);
+        }
+        for (u32 pc = 0; pc < code.length();) {
+            const u32 length = vm::getOpCodeLength(vm::decodeOp(code[pc]));
+            for (u32 i = 0; i < length; ++i) {
+                func.code.push(code[pc + i]);
+            }
+            const vm::OpCode op = vm::decodeOp(code[pc]);
+            if (op == vm::OpCode::CALL) func.code[pc + 1] = targets[code[pc + 1]];
+            // the in bounds proof does not travel with the file, the accesses are checked again
+            if (op == vm::OpCode::GETXU || op == vm::OpCode::SETXU) {
+                const vm::OpCode checked = op == vm::OpCode::GETXU ? vm::OpCode::GETX : vm::OpCode::SETX;
+                func.code[pc] = vm::encodeABC(checked, vm::decodeA(code[pc]), vm::decodeB(code[pc]), vm::decodeC(code[pc]));
+            }
+            pc += length;
+        }
+        return &func;
+    }
+
+
+    StringView ModuleInterface::getString(InterfaceString str) const {
+        if ((u64)str.offset + str.length > m_header->string_size) return {};
+        const char* begin = (const char*)m_data.begin() + m_header->string_offset + str.offset;
+        return StringView(begin, str.length);
+    }
+}
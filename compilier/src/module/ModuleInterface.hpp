@@ -0,0 +1,180 @@
+#pragma once
+
+#include "base/allocator/IAllocator.hpp"
+#include "base/types/Array.hpp"
+#include "base/types/Hash.hpp"
+#include "base/types/Span.hpp"
+#include "base/types/String.hpp"
+#include "system/SysIO.hpp"
+#include "vm/Bytecode.hpp"
+
+#include <string>
+
+namespace cal {
+
+    class Lexer;
+    struct MemoryOStream;
+
+    // on disk layout of a module interface (.cali), every offset is relative to the start of the file
+    //  header | symbols (sorted by name hash) | fields | imports | bodies | strings
+    // sections are 8 byte aligned so the file can be used straight from a read only mapping
+    static constexpr u32 MODULE_INTERFACE_MAGIC = 0x494c4143; // "CALI"
+    static constexpr u16 MODULE_INTERFACE_VERSION = 2;
+    static constexpr const char* MODULE_INTERFACE_EXTENSION = ".cali";
+
+    struct InterfaceString {
+        u32 offset = 0;
+        u32 length = 0;
+    };
+
+    enum class InterfaceSymbolKind : u8 {
+        Function, Struct, Variable, Constant
+    };
+
+    enum class InterfaceFlags : u8 {
+        NONE = 0,
+        C_ABI = 1 << 0,         // export 'c'
+        INLINEABLE = 1 << 1,    // carries a bytecode body
+        PRIVATE = 1 << 2,       // struct member, kept for the layout only
+        CONST = 1 << 3,
+    };
+
+    struct ModuleInterfaceHeader {
+        u32 magic;
+        u16 version;
+        u16 reserved;
+        u64 source_hash;
+        InterfaceString name;
+        u32 symbol_count;
+        u32 symbol_offset;
+        u32 field_count;
+        u32 field_offset;
+        u32 import_count;
+        u32 import_offset;
+        u32 body_size;
+        u32 body_offset;
+        u32 string_size;
+        u32 string_offset;
+    };
+
+    struct InterfaceSymbol {
+        u64 name_hash;
+        InterfaceString name;
+        InterfaceString type;       // return type for functions, declared type for variables
+        InterfaceString value;      // literal initializer of constants
+        InterfaceSymbolKind kind;
+        u8 flags;
+        u16 field_count;            // params for functions, members for structs
+        u32 first_field;
+        u32 body_offset;            // code words, constants then callee names, inside the body section
+        u16 body_code_size;
+        u16 body_constant_count;
+        u8 body_param_count;
+        u8 body_register_count;
+        u16 body_callee_count;      // CALL targets in the body index this table instead of the module's functions
+    };
+
+    struct InterfaceField {
+        InterfaceString name;
+        InterfaceString type;
+        u32 flags;
+    };
+
+
+    // collects the exported surface of a module and serializes it
+    class ModuleInterfaceBuilder
+    {
+    public:
+        ModuleInterfaceBuilder(IAllocator& alloc);
+        ~ModuleInterfaceBuilder() = default;
+
+        // module name, imports, top level functions, structs and variables of a lexed source
+        void addFromLexer(const Lexer& lexer);
+
+        void setModuleName(const std::string& name) { m_name = name; }
+        void setSourceHash(StableHash hash) { m_source_hash = hash; }
+        void addImport(const std::string& module) { m_imports.push(module); }
+
+        void beginFunction(const std::string& name, const std::string& return_type, bool c_abi);
+        void beginStruct(const std::string& name);
+        void addField(const std::string& name, const std::string& type, u32 flags);
+        void addVariable(const std::string& name, const std::string& type, const std::string& value, bool is_const);
+        // attaches a bytecode body so importers can inline the function without its source,
+        // the callees are stored by name since their indices only mean something inside module
+        bool addInlineBody(const std::string& name, const vm::BytecodeModule& module, const vm::BytecodeFunction& func);
+
+        void write(MemoryOStream& stream) const;
+        [[nodiscard]] bool save(const char* path) const;
+
+    private:
+        struct PendingSymbol {
+            std::string name;
+            std::string type;
+            std::string value;
+            InterfaceSymbolKind kind;
+            u8 flags;
+            u32 first_field;
+            u32 field_count;
+            const vm::BytecodeFunction* body;
+            const vm::BytecodeModule* body_module;
+        };
+
+        struct PendingField {
+            std::string name;
+            std::string type;
+            u32 flags;
+        };
+
+        IAllocator& m_alloc;
+        std::string m_name;
+        StableHash m_source_hash;
+        Array<PendingSymbol> m_symbols;
+        Array<PendingField> m_fields;
+        Array<std::string> m_imports;
+    };
+
+
+    // read only view over a serialized interface, either mapped from disk or borrowed from memory
+    // lookups never copy, returned views stay valid until close()
+    class ModuleInterface
+    {
+    public:
+        ModuleInterface() = default;
+        ~ModuleInterface();
+
+        [[nodiscard]] bool open(const char* path);
+        [[nodiscard]] bool load(Span<const u8> data);
+        void close();
+
+        bool isValid() const { return m_header != nullptr; }
+        StringView getName() const { return getString(m_header->name); }
+        StableHash getSourceHash() const { return StableHash::fromU64(m_header->source_hash); }
+
+        u32 getSymbolCount() const { return m_header->symbol_count; }
+        const InterfaceSymbol& getSymbol(u32 idx) const { return m_symbols[idx]; }
+        // binary search on the name hash, nullptr when the module does not export the name
+        const InterfaceSymbol* findSymbol(StringView name) const;
+
+        Span<const InterfaceField> getFields(const InterfaceSymbol& symbol) const;
+        Span<const vm::Instruction> getInlineCode(const InterfaceSymbol& symbol) const;
+        Span<const vm::Value> getInlineConstants(const InterfaceSymbol& symbol) const;
+        Span<const InterfaceString> getInlineCallees(const InterfaceSymbol& symbol) const;
+        // copies an inline body into module under the symbol's name, CALL targets are looked up there by name
+        // so callees have to be imported first. nullptr when one is missing or the body is invalid
+        vm::BytecodeFunction* importInlineBody(const InterfaceSymbol& symbol, vm::BytecodeModule& module) const;
+
+        u32 getImportCount() const { return m_header->import_count; }
+        StringView getImport(u32 idx) const { return getString(m_imports[idx]); }
+        StringView getString(InterfaceString str) const;
+
+    private:
+        bool validate();
+
+        platform::MappedFile m_file;
+        Span<const u8> m_data;
+        const ModuleInterfaceHeader* m_header = nullptr;
+        const InterfaceSymbol* m_symbols = nullptr;
+        const InterfaceField* m_fields = nullptr;
+        const InterfaceString* m_imports = nullptr;
+    };
+}
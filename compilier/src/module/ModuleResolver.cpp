@@ -0,0 +1,57 @@
+#include "ModuleResolver.hpp"
+
+#include "base/Logger.hpp"
+
+namespace cal {
+
+    ModuleResolver::ModuleResolver(IAllocator& alloc)
+        : m_alloc(alloc),
+        m_search_paths(alloc),
+        m_modules(alloc)
+    {
+    }
+
+
+    ModuleResolver::~ModuleResolver() {
+        for (auto iter = m_modules.begin(); iter.isValid(); ++iter) {
+            // failed lookups are cached as nullptr
+            if (iter.value()) CAL_DEL(m_alloc, iter.value());
+        }
+        m_modules.clear();
+    }
+
+
+    void ModuleResolver::addSearchPath(const std::string& dir) {
+        m_search_paths.push(dir);
+    }
+
+
+    std::string ModuleResolver::getInterfacePath(const std::string& dir, const std::string& module_name) {
+        std::string path = dir;
+        if (!path.empty() && path.back() != '/') path += '/';
+        for (char c : module_name) {
+            path += c == '.' ? '/' : c;
+        }
+        return path + MODULE_INTERFACE_EXTENSION;
+    }
+
+
+    const ModuleInterface* ModuleResolver::resolve(const std::string& module_name) {
+        auto cached = m_modules.find(module_name);
+        if (cached.isValid()) return cached.value();
+
+        ModuleInterface* module = CAL_NEW(m_alloc, ModuleInterface)();
+        for (const std::string& dir : m_search_paths) {
+            const std::string path = getInterfacePath(dir, module_name);
+            if (!module->open(path.c_str())) continue;
+
+            LogDebug("[Module] ", module_name, " resolved to ", path);
+            m_modules.insert(module_name, module);
+            return module;
+        }
+
+        CAL_DEL(m_alloc, module);
+        m_modules.insert(module_name, nullptr);
+        return nullptr;
+    }
+}
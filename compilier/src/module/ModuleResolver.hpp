@@ -0,0 +1,30 @@
+#pragma once
+
+#include "ModuleInterface.hpp"
+#include "base/types/container/HashMap.hpp"
+
+#include <string>
+
+namespace cal {
+
+    // maps "import a.b;" to <search path>/a/b.cali and keeps every interface mapped until destruction
+    // a module is opened once no matter how many files import it, not thread safe
+    class ModuleResolver
+    {
+    public:
+        ModuleResolver(IAllocator& alloc);
+        ~ModuleResolver();
+
+        void addSearchPath(const std::string& dir);
+
+        // nullptr when no search path has an interface for the module
+        const ModuleInterface* resolve(const std::string& module_name);
+
+        static std::string getInterfacePath(const std::string& dir, const std::string& module_name);
+
+    private:
+        IAllocator& m_alloc;
+        Array<std::string> m_search_paths;
+        HashMap<std::string, ModuleInterface*> m_modules;
+    };
+}
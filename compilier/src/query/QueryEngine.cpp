@@ -0,0 +1,318 @@
+#include "QueryEngine.hpp"
+
+#include "analyzer/Lexer.hpp"
+#include "base/Logger.hpp"
+#include "module/ModuleInterface.hpp"
+#include "utils/TimeReport.hpp"
+
+namespace cal {
+
+    struct QueryEngine::Node {
+        Node(IAllocator& alloc, QueryKind kind, const std::string& arg)
+            : kind(kind), arg(arg), dependencies(alloc) {}
+
+        const QueryKind kind;
+        const std::string arg;
+        void* value = nullptr;
+        StableHash fingerprint;
+        bool has_value = false;
+        bool computing = false;
+        u64 verified_at = 0;            // last revision the value was known to be current
+        u64 changed_at = 0;             // last revision the value actually changed
+        Array<Node*> dependencies;      // in the order they were read
+    };
+
+
+    // queries running on this thread, innermost last, their dependency lists are being recorded
+    struct QueryFrame {
+        QueryEngine::Node* node;
+        Array<QueryEngine::Node*>* dependencies;
+    };
+
+    static constexpr u32 MAX_QUERY_DEPTH = 64;
+    static thread_local QueryFrame s_frames[MAX_QUERY_DEPTH];
+    static thread_local u32 s_depth = 0;
+
+
+    static u64 getNodeKey(QueryKind kind, const std::string& arg) {
+        return StableHash((std::to_string((u32)kind) + ':' + arg).c_str());
+    }
+
+
+    static StableHash fingerprintSource(const void* value) {
+        const std::string* text = (const std::string*)value;
+        return StableHash(text->data(), (u32)text->size());
+    }
+
+
+    static void destroySource(IAllocator& alloc, void* value) {
+        CAL_DEL(alloc, (std::string*)value);
+    }
+
+
+    // offsets and diagnostics count, a cut off node keeps its old value and the driver reports from it
+    static StableHash fingerprintTokens(const void* value) {
+        return ((const Lexer*)value)->computeResultHash();
+    }
+
+
+    static void destroyTokens(IAllocator& alloc, void* value) {
+        CAL_DEL(alloc, (Lexer*)value);
+    }
+
+
+    static StableHash fingerprintImports(const void* value) {
+        std::string buffer;
+        for (const std::string& name : *(const Array<std::string>*)value) {
+            buffer.append(name);
+            buffer.push_back('\0');
+        }
+        return StableHash(buffer.data(), (u32)buffer.size());
+    }
+
+
+    static void destroyImports(IAllocator& alloc, void* value) {
+        CAL_DEL(alloc, (Array<std::string>*)value);
+    }
+
+
+    static StableHash fingerprintExports(const void* value) {
+        const MemoryOStream* stream = (const MemoryOStream*)value;
+        return StableHash(stream->data(), (u32)stream->size());
+    }
+
+
+    static void destroyExports(IAllocator& alloc, void* value) {
+        CAL_DEL(alloc, (MemoryOStream*)value);
+    }
+
+
+    const QueryEngine::Provider QueryEngine::s_providers[(u32)QueryKind::COUNT] = {
+        { nullptr, &destroySource, &fingerprintSource },
+        { &QueryEngine::computeTokens, &destroyTokens, &fingerprintTokens },
+        { &QueryEngine::computeImports, &destroyImports, &fingerprintImports },
+        { &QueryEngine::computeExports, &destroyExports, &fingerprintExports },
+    };
+
+
+    QueryEngine::QueryEngine(IAllocator& alloc)
+        : m_alloc(alloc)
+        , m_pages(alloc)
+        , m_node_pool(m_pages)
+        , m_nodes(alloc)
+    {
+    }
+
+
+    QueryEngine::~QueryEngine() {
+        for (auto iter = m_nodes.begin(); iter.isValid(); ++iter) {
+            Node* node = iter.value();
+            destroyValue(node);
+            m_node_pool.destroy(node);
+        }
+    }
+
+
+    void QueryEngine::setSourceText(const std::string& file, const std::string& text) {
+        MutexGuard lock(m_mutex);
+        ASSERT(s_depth == 0);
+
+        Node* node = getNode(QueryKind::SourceText, file);
+        const StableHash fingerprint{ text.data(), (u32)text.size() };
+        if (node->value && node->fingerprint == fingerprint) return;
+
+        ++m_revision;
+        destroyValue(node);
+        node->value = CAL_NEW(m_alloc, std::string)(text);
+        node->fingerprint = fingerprint;
+        node->changed_at = m_revision;
+    }
+
+
+    void QueryEngine::removeSourceText(const std::string& file) {
+        MutexGuard lock(m_mutex);
+        ASSERT(s_depth == 0);
+
+        auto iter = m_nodes.find(getNodeKey(QueryKind::SourceText, file));
+        if (!iter.isValid() || !iter.value()->value) return;
+
+        ++m_revision;
+        destroyValue(iter.value());
+        iter.value()->fingerprint = StableHash();
+        iter.value()->changed_at = m_revision;
+    }
+
+
+    const std::string* QueryEngine::sourceText(const std::string& file) {
+        return (const std::string*)fetch(QueryKind::SourceText, file);
+    }
+
+
+    const Lexer* QueryEngine::tokens(const std::string& file) {
+        return (const Lexer*)fetch(QueryKind::Tokens, file);
+    }
+
+
+    const Array<std::string>* QueryEngine::imports(const std::string& file) {
+        return (const Array<std::string>*)fetch(QueryKind::Imports, file);
+    }
+
+
+    const MemoryOStream* QueryEngine::exports(const std::string& file) {
+        return (const MemoryOStream*)fetch(QueryKind::Exports, file);
+    }
+
+
+    QueryEngine::Stats QueryEngine::getStats() const {
+        MutexGuard lock(m_mutex);
+        return m_stats;
+    }
+
+
+    const void* QueryEngine::fetch(QueryKind kind, const std::string& arg) {
+        Node* node;
+        {
+            MutexGuard lock(m_mutex);
+            node = getNode(kind, arg);
+        }
+
+        // the running query (if any) now depends on this one
+        if (s_depth > 0) {
+            Array<Node*>& dependencies = *s_frames[s_depth - 1].dependencies;
+            if (dependencies.indexOf(node) < 0) dependencies.push(node);
+        }
+
+        update(node);
+
+        MutexGuard lock(m_mutex);
+        return node->value;
+    }
+
+
+    QueryEngine::Node* QueryEngine::getNode(QueryKind kind, const std::string& arg) {
+        const u64 key = getNodeKey(kind, arg);
+        auto iter = m_nodes.find(key);
+        if (iter.isValid()) {
+            ASSERT(iter.value()->kind == kind && iter.value()->arg == arg);
+            return iter.value();
+        }
+
+        Node* node = m_node_pool.create(m_alloc, kind, arg);
+        m_nodes.insert(key, node);
+        return node;
+    }
+
+
+    void QueryEngine::update(Node* node) {
+        // inputs are always current
+        if (node->kind == QueryKind::SourceText) return;
+
+        {
+            MutexGuard lock(m_mutex);
+            for (;;) {
+                if (node->verified_at == m_revision) return;
+                if (!node->computing) break;
+
+                for (u32 i = 0; i < s_depth; ++i) {
+                    if (s_frames[i].node != node) continue;
+                    LogError("[Query] cycle while computing ", node->arg);
+                    return;
+                }
+                // another thread is on it
+                m_done.sleep(m_mutex);
+            }
+            node->computing = true;
+        }
+
+        // the node is ours until computing is cleared, its dependency list can be read without the lock
+        bool dirty = !node->has_value;
+        for (Node* dependency : node->dependencies) {
+            if (dirty) break;
+            update(dependency);
+
+            MutexGuard lock(m_mutex);
+            dirty = dependency->changed_at > node->verified_at;
+        }
+
+        if (dirty) {
+            execute(node);
+        }
+
+        MutexGuard lock(m_mutex);
+        if (!dirty) ++m_stats.green;
+        node->verified_at = m_revision;
+        node->computing = false;
+        m_done.wakeupAll();
+    }
+
+
+    void QueryEngine::execute(Node* node) {
+        CAL_TIME_SCOPE("query");
+        ASSERT(s_depth < MAX_QUERY_DEPTH);
+
+        Array<Node*> dependencies(m_alloc);
+        s_frames[s_depth++] = QueryFrame{ node, &dependencies };
+        void* value = s_providers[(u32)node->kind].compute(*this, node->arg);
+        --s_depth;
+
+        const StableHash fingerprint = value ? s_providers[(u32)node->kind].fingerprint(value) : StableHash();
+
+        MutexGuard lock(m_mutex);
+        ++m_stats.executed;
+        node->dependencies = static_cast<Array<Node*>&&>(dependencies);
+
+        const bool unchanged = node->has_value && (value != nullptr) == (node->value != nullptr) && fingerprint == node->fingerprint;
+        if (unchanged) {
+            // keep the old value, pointers handed out earlier stay valid
+            ++m_stats.cutoffs;
+            if (value) s_providers[(u32)node->kind].destroy(m_alloc, value);
+            return;
+        }
+
+        destroyValue(node);
+        node->value = value;
+        node->fingerprint = fingerprint;
+        node->has_value = true;
+        node->changed_at = m_revision;
+    }
+
+
+    void QueryEngine::destroyValue(Node* node) {
+        if (node->value) s_providers[(u32)node->kind].destroy(m_alloc, node->value);
+        node->value = nullptr;
+    }
+
+
+    void* QueryEngine::computeTokens(QueryEngine& engine, const std::string& file) {
+        const std::string* source = engine.sourceText(file);
+        if (!source) return nullptr;
+
+        Lexer* lexer = CAL_NEW(engine.m_alloc, Lexer)(*source, engine.m_alloc);
+        lexer->analyze();
+        return lexer;
+    }
+
+
+    void* QueryEngine::computeImports(QueryEngine& engine, const std::string& file) {
+        const Lexer* lexer = engine.tokens(file);
+        if (!lexer) return nullptr;
+
+        Array<std::string>* imports = CAL_NEW(engine.m_alloc, Array<std::string>)(engine.m_alloc);
+        lexer->collectImports(*imports);
+        return imports;
+    }
+
+
+    void* QueryEngine::computeExports(QueryEngine& engine, const std::string& file) {
+        const Lexer* lexer = engine.tokens(file);
+        if (!lexer) return nullptr;
+
+        // no source hash, the bytes (and the fingerprint) only change with the exported surface
+        ModuleInterfaceBuilder builder{ engine.m_alloc };
+        builder.addFromLexer(*lexer);
+
+        MemoryOStream* stream = CAL_NEW(engine.m_alloc, MemoryOStream)(engine.m_alloc);
+        builder.write(*stream);
+        return stream;
+    }
+}
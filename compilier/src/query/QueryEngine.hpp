@@ -0,0 +1,95 @@
+#pragma once
+
+#include "base/allocator/IAllocator.hpp"
+#include "base/allocator/PageAllocator.hpp"
+#include "base/allocator/PoolAllocator.hpp"
+#include "base/threading/Sync.hpp"
+#include "base/types/Array.hpp"
+#include "base/types/Hash.hpp"
+#include "base/types/container/HashMap.hpp"
+#include "system/io/Stream.hpp"
+#include "globals.hpp"
+
+#include <string>
+
+namespace cal {
+
+    class Lexer;
+
+    enum class QueryKind : u8 {
+        SourceText,     // input
+        Tokens,         // Lexer of the source
+        Imports,        // module names the file imports
+        Exports,        // serialized module interface (.cali bytes)
+        COUNT
+    };
+
+
+    // demand driven, memoized compiler queries with red / green invalidation
+    //
+    // every query result remembers the queries it read. changing an input starts a new revision,
+    // a query asked for in a later revision first re-validates its dependencies : when none of them
+    // changed it turns green and keeps its value without running, otherwise it runs again.
+    // a re-run producing the same fingerprint as before keeps its "changed at" revision (early cutoff),
+    // so e.g. a whitespace edit re-lexes one file and re-derives its imports / exports, which come out
+    // unchanged and stop it there : nothing depending on them runs again.
+    //
+    // queries may run on any number of threads, a query being computed by one thread is waited for
+    // by the others. inputs must not change while queries run, results stay valid until the next input change
+    class QueryEngine
+    {
+    public:
+        struct Stats {
+            u64 executed;       // query bodies run
+            u64 green;          // results reused after checking their dependencies
+            u64 cutoffs;        // re-runs that produced an unchanged value
+        };
+
+        QueryEngine(IAllocator& alloc);
+        ~QueryEngine();
+
+        // inputs, setting identical text keeps the revision
+        void setSourceText(const std::string& file, const std::string& text);
+        void removeSourceText(const std::string& file);
+        u64 getRevision() const { return m_revision; }
+
+        // nullptr when the file is unknown
+        const std::string* sourceText(const std::string& file);
+        const Lexer* tokens(const std::string& file);
+        const Array<std::string>* imports(const std::string& file);
+        const MemoryOStream* exports(const std::string& file);
+
+        Stats getStats() const;
+
+    private:
+        struct Node;
+        friend struct QueryFrame;
+
+        struct Provider {
+            void* (*compute)(QueryEngine& engine, const std::string& arg);
+            void (*destroy)(IAllocator& alloc, void* value);
+            StableHash (*fingerprint)(const void* value);
+        };
+
+        static const Provider s_providers[(u32)QueryKind::COUNT];
+
+        const void* fetch(QueryKind kind, const std::string& arg);
+        Node* getNode(QueryKind kind, const std::string& arg);
+        void update(Node* node);
+        void execute(Node* node);
+        void destroyValue(Node* node);
+
+        static void* computeTokens(QueryEngine& engine, const std::string& file);
+        static void* computeImports(QueryEngine& engine, const std::string& file);
+        static void* computeExports(QueryEngine& engine, const std::string& file);
+
+        IAllocator& m_alloc;
+        PageAllocator m_pages;
+        PoolAllocator<Node> m_node_pool;    // created under m_mutex, one per (kind, arg) for the engine's lifetime
+        mutable Mutex m_mutex;
+        ConditionVariable m_done;       // a node finished computing
+        HashMap<u64, Node*> m_nodes;
+        u64 m_revision = 1;
+        Stats m_stats = {};
+    };
+}
@@ -0,0 +1,132 @@
+#include "Console.hpp"
+
+#include "system/io/Stream.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+namespace cal::runtime {
+
+    struct StdOutput final : IOStream {
+        using IOStream::write;
+        bool write(const void* data, u64 size) override {
+            const bool written = fwrite(data, 1, size, stdout) == size;
+            fflush(stdout);
+            return written;
+        }
+    };
+
+    static StdOutput s_stdout;
+
+
+    struct ConsoleBuffer final : IOStream {
+        ~ConsoleBuffer() {
+            // the thread is gone, whatever it printed last still has to come out
+            flush();
+        }
+
+        using IOStream::write;
+        bool write(const void* data, u64 size) override {
+            if (m_size + size > Console::BUFFER_SIZE) {
+                flush();
+                if (size >= Console::BUFFER_SIZE) {
+                    Console::get().submit(data, size);
+                    return true;
+                }
+            }
+            memcpy(m_data + m_size, data, size);
+            m_size += (u32)size;
+            return true;
+        }
+
+        void flush() {
+            if (m_size == 0) return;
+            Console::get().submit(m_data, m_size);
+            m_size = 0;
+        }
+
+    private:
+        u32 m_size = 0;
+        char m_data[Console::BUFFER_SIZE];
+    };
+
+    static thread_local ConsoleBuffer s_buffer;
+
+
+    Console::Console()
+        : m_output(&s_stdout)
+    {
+    }
+
+
+    Console::~Console() {
+        s_buffer.flush();
+    }
+
+
+    void Console::setOutput(IOStream* output) {
+        s_buffer.flush();
+        MutexGuard lock(m_mutex);
+        m_output = output ? output : &s_stdout;
+    }
+
+
+    void Console::submit(const void* data, u64 size) {
+        MutexGuard lock(m_mutex);
+        m_output->write(data, size);
+        m_stats.bytes += size;
+        ++m_stats.batches;
+    }
+
+
+    void Console::write(StringView text) {
+        s_buffer.write(text.begin, text.size());
+        if (m_line_buffered) s_buffer.flush();
+    }
+
+
+    void Console::writeLine(StringView text) {
+        s_buffer.write(text.begin, text.size());
+        s_buffer.write("\n", 1);
+        if (m_line_buffered) s_buffer.flush();
+    }
+
+
+    void Console::writeLine(i64 value) {
+        char number[24];
+        const u32 length = formatInt(value, number);
+        number[length] = '\n';
+        s_buffer.write(number, length + 1);
+        if (m_line_buffered) s_buffer.flush();
+    }
+
+
+    void Console::writeLine(double value) {
+        char number[64];
+        const int length = snprintf(number, sizeof(number), "%g\n", value);
+        s_buffer.write(number, length > 0 && length < (int)sizeof(number) ? (u64)length : 0);
+        if (m_line_buffered) s_buffer.flush();
+    }
+
+
+    void Console::writeLine(bool value) {
+        writeLine(StringView(value ? "true" : "false"));
+    }
+
+
+    void Console::writeFormat(const FormatProgram& format, Span<const FormatArg> args) {
+        format.run(args, s_buffer);
+        if (m_line_buffered) s_buffer.flush();
+    }
+
+
+    void Console::flush() {
+        s_buffer.flush();
+    }
+
+
+    Console::Stats Console::getStats() {
+        MutexGuard lock(m_mutex);
+        return m_stats;
+    }
+}
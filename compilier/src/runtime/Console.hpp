@@ -0,0 +1,58 @@
+#pragma once
+
+#include "Format.hpp"
+#include "base/threading/SyncMutex.hpp"
+#include "base/types/String.hpp"
+#include "globals.hpp"
+
+#include <utils/TSingleton.hpp>
+
+namespace cal::runtime {
+
+    // runtime side of system.console. every thread prints into its own buffer, a buffer reaches the
+    // output in one write when it fills up, on flush() and when its thread exits, so a print heavy
+    // program makes one write per few KiB instead of one per call. output of different threads
+    // interleaves per batch, not per call
+    class Console : public ThreadSafeSingleton<Console>
+    {
+    public:
+        static constexpr u32 BUFFER_SIZE = 8 * 1024;
+
+        struct Stats {
+            u64 bytes;
+            u64 batches;        // writes that reached the output
+        };
+
+        Console();
+        ~Console();
+
+        // nullptr restores stdout, the stream has to outlive every thread that prints
+        void setOutput(IOStream* output);
+        // also flush after every line, for interactive output
+        void setLineBuffered(bool enabled) { m_line_buffered = enabled; }
+
+        void write(StringView text);
+        void writeLine(StringView text);
+        // otherwise string literals would pick the bool overload
+        void writeLine(const char* text) { writeLine(StringView(text)); }
+        void writeLine(i64 value);
+        void writeLine(double value);
+        void writeLine(bool value);
+        // format is compiled once by the compiler, see FormatProgram
+        void writeFormat(const FormatProgram& format, Span<const FormatArg> args);
+
+        // hands the calling thread's buffer to the output
+        void flush();
+        Stats getStats();
+
+    private:
+        friend struct ConsoleBuffer;
+
+        void submit(const void* data, u64 size);
+
+        Mutex m_mutex;
+        IOStream* m_output;
+        volatile bool m_line_buffered = false;
+        Stats m_stats = {};
+    };
+}
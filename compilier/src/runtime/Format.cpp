@@ -0,0 +1,222 @@
+#include "Format.hpp"
+
+#include "system/io/Stream.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+namespace cal::runtime {
+
+    // "00" .. "99", two digits per division
+    static const char DIGIT_PAIRS[] =
+        "00010203040506070809"
+        "10111213141516171819"
+        "20212223242526272829"
+        "30313233343536373839"
+        "40414243444546474849"
+        "50515253545556575859"
+        "60616263646566676869"
+        "70717273747576777879"
+        "80818283848586878889"
+        "90919293949596979899";
+
+
+    u32 formatUInt(u64 value, char* out) {
+        char buffer[20];
+        char* end = buffer + sizeof(buffer);
+        char* begin = end;
+        while (value >= 100) {
+            const u32 pair = (u32)(value % 100) * 2;
+            value /= 100;
+            *--begin = DIGIT_PAIRS[pair + 1];
+            *--begin = DIGIT_PAIRS[pair];
+        }
+        if (value >= 10) {
+            *--begin = DIGIT_PAIRS[value * 2 + 1];
+            *--begin = DIGIT_PAIRS[value * 2];
+        }
+        else {
+            *--begin = (char)('0' + value);
+        }
+        const u32 length = (u32)(end - begin);
+        memcpy(out, begin, length);
+        return length;
+    }
+
+
+    u32 formatInt(i64 value, char* out) {
+        if (value >= 0) return formatUInt((u64)value, out);
+        *out = '-';
+        // negated as unsigned so INT64_MIN stays representable
+        return 1 + formatUInt(0 - (u64)value, out + 1);
+    }
+
+
+    static u32 formatHex(u64 value, char* out) {
+        static const char HEX_DIGITS[] = "0123456789abcdef";
+        char buffer[16];
+        u32 length = 0;
+        do {
+            buffer[15 - length++] = HEX_DIGITS[value & 0xf];
+            value >>= 4;
+        } while (value);
+        memcpy(out, buffer + 16 - length, length);
+        return length;
+    }
+
+
+    FormatProgram::FormatProgram(IAllocator& alloc)
+        : m_ops(alloc)
+    {
+    }
+
+
+    void FormatProgram::pushLiteral(u32 offset, u32 size) {
+        if (size == 0) return;
+        // "%%" splits the text, glue the pieces back together
+        if (!m_ops.empty() && m_ops.last().kind == FormatOpKind::Literal && m_ops.last().offset + m_ops.last().size == offset) {
+            m_ops.last().size += size;
+            return;
+        }
+        m_ops.push(FormatOp{ FormatOpKind::Literal, 0, 0, offset, size });
+    }
+
+
+    bool FormatProgram::compile(StringView format, std::string& error) {
+        m_ops.clear();
+        m_text.clear();
+        m_arg_count = 0;
+
+        const u32 size = format.size();
+        u32 literal_begin = 0;
+        for (u32 i = 0; i < size; ++i) {
+            if (format.begin[i] != '%') continue;
+
+            m_text.append(format.begin + literal_begin, i - literal_begin);
+            pushLiteral((u32)m_text.size() - (i - literal_begin), i - literal_begin);
+            if (i + 1 >= size) {
+                error = "format string ends inside a specifier";
+                return false;
+            }
+
+            u32 spec = i + 1;
+            if (format.begin[spec] == '%') {
+                m_text.push_back('%');
+                pushLiteral((u32)m_text.size() - 1, 1);
+                i = spec;
+                literal_begin = spec + 1;
+                continue;
+            }
+
+            u8 precision = DEFAULT_PRECISION;
+            bool has_precision = false;
+            if (format.begin[spec] == '.') {
+                u32 digits = 0;
+                ++spec;
+                while (spec < size && format.begin[spec] >= '0' && format.begin[spec] <= '9') {
+                    digits = digits * 10 + (u32)(format.begin[spec] - '0');
+                    if (digits > 32) {
+                        error = "format precision larger than 32";
+                        return false;
+                    }
+                    ++spec;
+                }
+                precision = (u8)digits;
+                has_precision = true;
+                if (spec >= size) {
+                    error = "format string ends inside a specifier";
+                    return false;
+                }
+            }
+
+            FormatOpKind kind;
+            switch (format.begin[spec]) {
+            case 'i':
+            case 'd': kind = FormatOpKind::Int; break;
+            case 'u': kind = FormatOpKind::UInt; break;
+            case 'x': kind = FormatOpKind::Hex; break;
+            case 'f': kind = FormatOpKind::Float; break;
+            case 's': kind = FormatOpKind::String; break;
+            case 'c': kind = FormatOpKind::Char; break;
+            case 'b': kind = FormatOpKind::Bool; break;
+            default:
+                error = std::string("unknown format specifier %") + format.begin[spec];
+                return false;
+            }
+            if (has_precision && kind != FormatOpKind::Float) {
+                error = "only %f takes a precision";
+                return false;
+            }
+            if (m_arg_count >= MAX_ARGS) {
+                error = "too many format arguments";
+                return false;
+            }
+
+            m_ops.push(FormatOp{ kind, precision, (u16)m_arg_count++, 0, 0 });
+            i = spec;
+            literal_begin = spec + 1;
+        }
+
+        m_text.append(format.begin + literal_begin, size - literal_begin);
+        pushLiteral((u32)m_text.size() - (size - literal_begin), size - literal_begin);
+        return true;
+    }
+
+
+    FormatArgKind FormatProgram::getArgKind(u32 arg) const {
+        for (const FormatOp& op : m_ops) {
+            if (op.kind == FormatOpKind::Literal || op.arg != arg) continue;
+            switch (op.kind) {
+            case FormatOpKind::UInt:
+            case FormatOpKind::Hex: return FormatArgKind::UInt;
+            case FormatOpKind::Float: return FormatArgKind::Float;
+            case FormatOpKind::String: return FormatArgKind::String;
+            case FormatOpKind::Char: return FormatArgKind::Char;
+            case FormatOpKind::Bool: return FormatArgKind::Bool;
+            default: return FormatArgKind::Int;
+            }
+        }
+        ASSERT(false);
+        return FormatArgKind::Int;
+    }
+
+
+    void FormatProgram::run(Span<const FormatArg> args, IOStream& out) const {
+        ASSERT(args.length() >= m_arg_count);
+        char number[64];
+        for (const FormatOp& op : m_ops) {
+            switch (op.kind) {
+            case FormatOpKind::Literal:
+                out.write(m_text.data() + op.offset, op.size);
+                break;
+            case FormatOpKind::Int:
+                out.write(number, formatInt(args[op.arg].i, number));
+                break;
+            case FormatOpKind::UInt:
+                out.write(number, formatUInt(args[op.arg].u, number));
+                break;
+            case FormatOpKind::Hex:
+                out.write(number, formatHex(args[op.arg].u, number));
+                break;
+            case FormatOpKind::Float: {
+                const int length = snprintf(number, sizeof(number), "%.*f", (int)op.precision, args[op.arg].f);
+                // values too large for the buffer fall back to the exponent form
+                if (length > 0 && length < (int)sizeof(number)) out.write(number, (u64)length);
+                else out.write(number, (u64)snprintf(number, sizeof(number), "%g", args[op.arg].f));
+                break;
+            }
+            case FormatOpKind::String:
+                out.write(args[op.arg].s.data, args[op.arg].s.size);
+                break;
+            case FormatOpKind::Char:
+                number[0] = (char)args[op.arg].i;
+                out.write(number, 1);
+                break;
+            case FormatOpKind::Bool:
+                if (args[op.arg].i) out.write("true", 4);
+                else out.write("false", 5);
+                break;
+            }
+        }
+    }
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "base/allocator/IAllocator.hpp"
+#include "base/types/Array.hpp"
+#include "base/types/Span.hpp"
+#include "base/types/String.hpp"
+#include "globals.hpp"
+
+#include <string>
+
+namespace cal {
+    struct IOStream;
+}
+
+namespace cal::runtime {
+
+    // what a format operation consumes, the compiler checks the arguments of a call site against it
+    enum class FormatArgKind : u8 {
+        Int, UInt, Float, String, Char, Bool
+    };
+
+    enum class FormatOpKind : u8 {
+        Literal,    // text between two specifiers, %% included
+        Int,        // %i %d
+        UInt,       // %u
+        Hex,        // %x
+        Float,      // %f %.Nf
+        String,     // %s
+        Char,       // %c
+        Bool        // %b
+    };
+
+    struct FormatOp {
+        FormatOpKind kind;
+        u8 precision;       // Float only, digits after the point
+        u16 arg;            // index of the consumed argument, unused by Literal
+        u32 offset;         // Literal only, range of the program's text
+        u32 size;
+    };
+
+    struct FormatString {
+        const char* data;
+        u32 size;
+    };
+
+    // one argument as the runtime receives it, the kind comes from the op that reads it
+    union FormatArg {
+        i64 i;
+        u64 u;
+        double f;
+        FormatString s;
+
+        static FormatArg fromInt(i64 v) { FormatArg r; r.i = v; return r; }
+        static FormatArg fromFloat(double v) { FormatArg r; r.f = v; return r; }
+        static FormatArg fromString(StringView v) { FormatArg r; r.s = FormatString{ v.begin, v.size() }; return r; }
+    };
+
+
+    // a format string parsed once, at compile time, into a sequence of typed operations.
+    // printing only walks the operations, the format string itself is never scanned again
+    class FormatProgram
+    {
+    public:
+        static constexpr u32 MAX_ARGS = 0xffff;
+        static constexpr u8 DEFAULT_PRECISION = 6;
+
+        explicit FormatProgram(IAllocator& alloc);
+
+        // false with error set on an unknown or unterminated specifier
+        [[nodiscard]] bool compile(StringView format, std::string& error);
+
+        u32 getArgCount() const { return m_arg_count; }
+        FormatArgKind getArgKind(u32 arg) const;
+        Span<const FormatOp> getOps() const { return Span<const FormatOp>(m_ops.begin(), (u32)m_ops.size()); }
+        // size of the output without the arguments, a hint for sizing buffers
+        u32 getLiteralSize() const { return (u32)m_text.size(); }
+
+        // args must match getArgCount() / getArgKind(), the compiler guarantees it for generated calls
+        void run(Span<const FormatArg> args, IOStream& out) const;
+
+    private:
+        void pushLiteral(u32 offset, u32 size);
+
+        Array<FormatOp> m_ops;
+        std::string m_text;     // literal text of every op, %% already collapsed
+        u32 m_arg_count = 0;
+    };
+
+    // writes value in decimal into out (at least 20 bytes), returns the length
+    u32 formatInt(i64 value, char* out);
+    u32 formatUInt(u64 value, char* out);
+}
@@ -0,0 +1,460 @@
+#include "Heap.hpp"
+
+#include "base/Logger.hpp"
+#include "base/threading/Atomic.hpp"
+#include "base/threading/ThreadPool.hpp"
+#include "system/Sys.hpp"
+#include "system/SysTimer.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace cal::runtime {
+
+    static constexpr u32 MAX_MARK_JOBS = 64;
+
+
+    static u64 getMicroseconds(u64 from) {
+        return (platform::Timer::getRawTimestamp() - from) * 1000000 / platform::Timer::getFrequency();
+    }
+
+
+    struct Heap::MarkJob {
+        explicit MarkJob(IAllocator& alloc) : stack(alloc) {}
+
+        Heap* heap;
+        Array<void*> stack;
+    };
+
+
+    Heap::Heap(IAllocator& alloc, const Config& config)
+        : m_alloc(alloc)
+        , m_config(config)
+        , m_regions(alloc)
+        , m_free_regions(alloc)
+        , m_large(alloc)
+        , m_remembered(alloc)
+        , m_roots(alloc)
+        , m_scan(alloc)
+        , m_mutators(alloc)
+    {
+        m_config.buffer_size = (m_config.buffer_size + 15) & ~15u;
+        m_config.old_size -= m_config.old_size % REGION_SIZE;
+        if (m_config.buffer_size == 0 || m_config.nursery_size < m_config.buffer_size || m_config.old_size == 0) {
+            LogError("[Heap] invalid configuration");
+            return;
+        }
+
+        m_nursery = (u8*)platform::memReserve(m_config.nursery_size);
+        m_old = (u8*)platform::memReserve(m_config.old_size);
+        if (!m_nursery || !m_old) {
+            LogError("[Heap] could not reserve ", m_config.nursery_size + m_config.old_size, " bytes");
+            if (m_nursery) platform::memRelease(m_nursery, m_config.nursery_size);
+            if (m_old) platform::memRelease(m_old, m_config.old_size);
+            m_nursery = m_old = nullptr;
+            return;
+        }
+        platform::memCommit(m_nursery, m_config.nursery_size);
+        m_nursery_end = m_nursery + m_config.nursery_size;
+
+        // regions are committed the first time they are used, the array never grows afterwards
+        m_regions.resize((i32)(m_config.old_size / REGION_SIZE));
+        for (Region& region : m_regions) {
+            region.base = nullptr;
+            region.cursor = nullptr;
+            region.live_bytes = 0;
+        }
+    }
+
+
+    Heap::~Heap() {
+        ASSERT(m_mutators.empty());
+        for (const LargeObject& large : m_large) {
+            platform::memRelease(large.header, large.reserved);
+        }
+        if (m_nursery) platform::memRelease(m_nursery, m_config.nursery_size);
+        if (m_old) platform::memRelease(m_old, m_config.old_size);
+    }
+
+
+    Mutator* Heap::attachThread() {
+        Mutator* mutator = CAL_NEW(m_alloc, Mutator)();
+        MutexGuard lock(m_mutex);
+        m_mutators.push(mutator);
+        return mutator;
+    }
+
+
+    void Heap::detachThread(Mutator* mutator) {
+        {
+            MutexGuard lock(m_mutex);
+            m_mutators.erase(m_mutators.indexOf(mutator));
+            // a collector may be waiting for this thread
+            m_parked_changed.wakeupAll();
+        }
+        CAL_DEL(m_alloc, mutator);
+    }
+
+
+    void Heap::addRoot(void** slot) {
+        MutexGuard lock(m_mutex);
+        m_roots.push(slot);
+    }
+
+
+    void Heap::removeRoot(void** slot) {
+        MutexGuard lock(m_mutex);
+        m_roots.erase(m_roots.indexOf(slot));
+    }
+
+
+    void Heap::remember(void* holder) {
+        ObjectHeader* header = getHeader(holder);
+        for (;;) {
+            const i32 flags = header->flags;
+            if (flags & ObjectHeader::REMEMBERED) return;
+            if (compareAndExchange(&header->flags, flags | ObjectHeader::REMEMBERED, flags)) break;
+        }
+        MutexGuard lock(m_remembered_mutex);
+        m_remembered.push(holder);
+    }
+
+
+    void* Heap::allocateSlow(Mutator& mutator, u32 size) {
+        if (size >= LARGE_OBJECT_SIZE || size > m_config.nursery_size / 2) {
+            safepoint(mutator);
+            return allocateLarge(size);
+        }
+
+        // objects bigger than half a buffer go straight to the nursery, the buffer stays for small ones
+        const u32 take = size > m_config.buffer_size / 2 ? size : m_config.buffer_size;
+        // a collection always empties the nursery, only other threads can fill it up again before we retry
+        for (;;) {
+            safepoint(mutator);
+            const i64 offset = atomicAdd(&m_nursery_top, (i64)take);
+            if (offset + take <= m_config.nursery_size) {
+                atomicAdd(&m_allocated, (i64)take);
+                u8* memory = m_nursery + offset;
+                memset(memory, 0, take);
+                if (take != size) {
+                    mutator.cursor = memory + size;
+                    mutator.end = memory + take;
+                }
+                return memory;
+            }
+            collect(mutator, false);
+        }
+    }
+
+
+    void* Heap::allocateLarge(u32 size) {
+        const u32 page = platform::getMemPageSize();
+        const u64 reserved = ((u64)size + page - 1) / page * page;
+        void* memory = platform::memReserve(reserved);
+        if (!memory) {
+            LogError("[Heap] could not reserve a large object of ", size, " bytes");
+            return nullptr;
+        }
+        platform::memCommit(memory, reserved);
+        memset(memory, 0, size);
+
+        ObjectHeader* header = (ObjectHeader*)memory;
+        MutexGuard lock(m_large_mutex);
+        m_large.push(LargeObject{ header, reserved });
+        m_large_bytes += reserved;
+        atomicAdd(&m_allocated, (i64)size);
+        // allocate() fills in the rest of the header
+        return memory;
+    }
+
+
+    bool Heap::takeRegion() {
+        u32 index;
+        if (!m_free_regions.empty()) {
+            index = m_free_regions.last();
+            m_free_regions.pop();
+        }
+        else {
+            index = (u32)m_regions.size();
+            for (u32 i = 0; i < (u32)m_regions.size(); ++i) {
+                if (!m_regions[i].base) {
+                    index = i;
+                    break;
+                }
+            }
+            if (index == (u32)m_regions.size()) return false;
+            m_regions[index].base = m_old + (u64)index * REGION_SIZE;
+            platform::memCommit(m_regions[index].base, REGION_SIZE);
+        }
+
+        m_current = &m_regions[index];
+        m_current->cursor = m_current->base;
+        m_current->live_bytes = 0;
+        return true;
+    }
+
+
+    void* Heap::allocateOld(u32 size) {
+        if (!m_current || m_current->cursor + size > m_current->base + REGION_SIZE) {
+            if (!takeRegion()) return nullptr;
+        }
+        void* memory = m_current->cursor;
+        m_current->cursor += size;
+        return memory;
+    }
+
+
+    Heap::Region* Heap::getRegion(const void* object) {
+        const u64 offset = (u64)((const u8*)object - m_old);
+        return offset < m_config.old_size ? &m_regions[(i32)(offset / REGION_SIZE)] : nullptr;
+    }
+
+    //////////////////////////////////////////////
+    // Stop the world
+    //////////////////////////////////////////////
+
+    void Heap::park(Mutator& mutator) {
+        MutexGuard lock(m_mutex);
+        // a detached thread is not counted by stopTheWorld(), it must not wait for the collection
+        ASSERT(m_mutators.indexOf(&mutator) >= 0);
+        ++m_parked;
+        m_parked_changed.wakeupAll();
+        while (m_stop_requested) {
+            m_resumed.sleep(m_mutex);
+        }
+        --m_parked;
+    }
+
+
+    void Heap::stopTheWorld() {
+        // m_mutex is held
+        m_stop_requested = true;
+        while (m_parked + 1 < (u32)m_mutators.size()) {
+            m_parked_changed.sleep(m_mutex);
+        }
+    }
+
+
+    void Heap::resumeTheWorld() {
+        m_stop_requested = false;
+        m_resumed.wakeupAll();
+    }
+
+
+    void Heap::collect(Mutator& mutator, bool major) {
+        m_mutex.enter();
+        if (m_stop_requested) {
+            // another thread is collecting, its collection frees the nursery for us too
+            m_mutex.exit();
+            park(mutator);
+            return;
+        }
+
+        stopTheWorld();
+
+        u64 start = platform::Timer::getRawTimestamp();
+        collectMinor();
+        u64 pause = getMicroseconds(start);
+        ++m_stats.minor_collections;
+        m_stats.minor_pause_total += pause;
+        if (pause > m_stats.minor_pause_max) m_stats.minor_pause_max = pause;
+
+        // every other thread is parked, the large object list can be read without its lock
+        if (major || m_stats.old_bytes + m_large_bytes >= m_config.major_threshold) {
+            start = platform::Timer::getRawTimestamp();
+            collectMajor();
+            pause = getMicroseconds(start);
+            ++m_stats.major_collections;
+            m_stats.major_pause_total += pause;
+            if (pause > m_stats.major_pause_max) m_stats.major_pause_max = pause;
+        }
+
+        resumeTheWorld();
+        m_mutex.exit();
+    }
+
+    //////////////////////////////////////////////
+    // Minor collection
+    //////////////////////////////////////////////
+
+    void Heap::forward(void** slot) {
+        void* object = *slot;
+        if (!object || !isYoung(object)) return;
+
+        ObjectHeader* header = getHeader(object);
+        if (header->flags & ObjectHeader::FORWARDED) {
+            *slot = (void*)header->layout;
+            return;
+        }
+
+        ObjectHeader* copy = (ObjectHeader*)allocateOld(header->size);
+        if (!copy) {
+            LogError("[Heap] old generation exhausted, ", m_config.old_size, " bytes reserved");
+            platform::abort();
+            return;
+        }
+        memcpy(copy, header, header->size);
+        copy->flags = m_mark_bit;
+        m_stats.promoted_bytes += header->size;
+        m_stats.old_bytes += header->size;
+
+        header->flags |= ObjectHeader::FORWARDED;
+        header->layout = (const ObjectLayout*)(copy + 1);
+        *slot = copy + 1;
+        m_scan.push(copy + 1);
+    }
+
+
+    void Heap::collectMinor() {
+        m_scan.clear();
+
+        for (Mutator* mutator : m_mutators) {
+            for (RootFrame* frame = mutator->roots; frame; frame = frame->next) {
+                void** roots = frame->getRoots();
+                for (i32 i = 0; i < frame->map->root_count; ++i) {
+                    forward(&roots[i]);
+                }
+            }
+            if (mutator->scanner) {
+                mutator->scanner->scanRoots([](void** slot, void* heap) { ((Heap*)heap)->forward(slot); }, this);
+            }
+        }
+        for (void** slot : m_roots) {
+            forward(slot);
+        }
+        for (void* holder : m_remembered) {
+            ObjectHeader* header = getHeader(holder);
+            header->flags &= ~ObjectHeader::REMEMBERED;
+            for (u32 i = 0; i < header->layout->reference_count; ++i) {
+                forward((void**)((u8*)holder + header->layout->reference_offsets[i]));
+            }
+        }
+        m_remembered.clear();
+
+        // breadth first, m_scan grows while it is walked
+        for (i32 i = 0; i < m_scan.size(); ++i) {
+            void* object = m_scan[i];
+            const ObjectLayout* layout = getHeader(object)->layout;
+            for (u32 r = 0; r < layout->reference_count; ++r) {
+                forward((void**)((u8*)object + layout->reference_offsets[r]));
+            }
+        }
+        m_scan.clear();
+
+        // everything alive left the nursery
+        m_nursery_top = 0;
+        for (Mutator* mutator : m_mutators) {
+            mutator->cursor = mutator->end = nullptr;
+        }
+    }
+
+    //////////////////////////////////////////////
+    // Major collection
+    //////////////////////////////////////////////
+
+    bool Heap::mark(void* object) {
+        ObjectHeader* header = getHeader(object);
+        const i32 marked = m_mark_bit ^ ObjectHeader::MARK;
+        for (;;) {
+            const i32 flags = header->flags;
+            if ((flags & ObjectHeader::MARK) == marked) return false;
+            if (compareAndExchange(&header->flags, flags ^ ObjectHeader::MARK, flags)) break;
+        }
+        if (Region* region = getRegion(header)) atomicAdd(&region->live_bytes, (i64)header->size);
+        return true;
+    }
+
+
+    void Heap::markJob(void* data) {
+        MarkJob* job = (MarkJob*)data;
+        while (!job->stack.empty()) {
+            void* object = job->stack.last();
+            job->stack.pop();
+            const ObjectLayout* layout = getHeader(object)->layout;
+            for (u32 r = 0; r < layout->reference_count; ++r) {
+                void* field = *(void**)((u8*)object + layout->reference_offsets[r]);
+                if (field && job->heap->mark(field)) job->stack.push(field);
+            }
+        }
+    }
+
+
+    void Heap::collectMajor() {
+        // runs right after a minor collection, every object is old
+        for (Region& region : m_regions) {
+            region.live_bytes = 0;
+        }
+
+        const u32 job_count = m_config.pool ? std::min(m_config.pool->getWorkerCount(), MAX_MARK_JOBS) : 1;
+        Array<MarkJob*> jobs(m_alloc);
+        for (u32 i = 0; i < job_count; ++i) {
+            MarkJob* job = CAL_NEW(m_alloc, MarkJob)(m_alloc);
+            job->heap = this;
+            jobs.push(job);
+        }
+
+        // roots are dealt round robin, every job then marks what it reaches from its own roots
+        u32 next = 0;
+        auto addRoot = [&](void* object) {
+            if (object && mark(object)) {
+                jobs[next]->stack.push(object);
+                next = (next + 1) % job_count;
+            }
+        };
+        for (Mutator* mutator : m_mutators) {
+            for (RootFrame* frame = mutator->roots; frame; frame = frame->next) {
+                void** roots = frame->getRoots();
+                for (i32 i = 0; i < frame->map->root_count; ++i) addRoot(roots[i]);
+            }
+            if (mutator->scanner) {
+                mutator->scanner->scanRoots([](void** slot, void* add) { (*(decltype(addRoot)*)add)(*slot); }, &addRoot);
+            }
+        }
+        for (void** slot : m_roots) addRoot(*slot);
+
+        if (m_config.pool && job_count > 1) {
+            for (MarkJob* job : jobs) m_config.pool->push(markJob, job);
+            m_config.pool->wait();
+        }
+        else {
+            markJob(jobs[0]);
+        }
+        for (MarkJob* job : jobs) CAL_DEL(m_alloc, job);
+
+        const i32 marked = m_mark_bit ^ ObjectHeader::MARK;
+        u64 old_bytes = 0;
+        m_large_bytes = 0;
+        for (u32 i = 0; i < (u32)m_regions.size(); ++i) {
+            Region& region = m_regions[i];
+            if (!region.base || !region.cursor) continue;
+            if (region.live_bytes == 0 && &region != m_current) {
+                region.cursor = nullptr;
+                m_free_regions.push(i);
+                continue;
+            }
+            old_bytes += (u64)(region.cursor - region.base);
+        }
+        for (i32 i = m_large.size() - 1; i >= 0; --i) {
+            if ((m_large[i].header->flags & ObjectHeader::MARK) == marked) {
+                m_large_bytes += m_large[i].reserved;
+                continue;
+            }
+            platform::memRelease(m_large[i].header, m_large[i].reserved);
+            m_large[i] = m_large.last();
+            m_large.pop();
+        }
+
+        // marked objects become the unmarked ones of the next collection, nothing has to be cleared
+        m_mark_bit = marked;
+        m_stats.old_bytes = old_bytes;
+        m_config.major_threshold = std::max(m_config.major_threshold, (old_bytes + m_large_bytes) * 2);
+    }
+
+
+    Heap::Stats Heap::getStats() {
+        MutexGuard lock(m_mutex);
+        Stats stats = m_stats;
+        stats.allocated_bytes = (u64)m_allocated;
+        return stats;
+    }
+}
@@ -0,0 +1,218 @@
+#pragma once
+
+#include "base/allocator/IAllocator.hpp"
+#include "base/threading/Sync.hpp"
+#include "base/types/Array.hpp"
+#include "globals.hpp"
+
+namespace cal {
+    struct ThreadPool;
+}
+
+namespace cal::runtime {
+
+    // emitted by codegen once per class, where the references of an instance are
+    struct ObjectLayout {
+        const char* name;
+        u32 size;                       // instance size, header excluded
+        u32 reference_count;
+        const u32* reference_offsets;   // byte offset of every reference field
+    };
+
+    // in front of every object, references point right after it
+    struct ObjectHeader {
+        enum : i32 {
+            FORWARDED = 1 << 0,     // copied out of the nursery, layout holds the new address
+            REMEMBERED = 1 << 1,    // old object in the remembered set
+            MARK = 1 << 2           // compared against the heap's mark bit, see Heap::collectMajor()
+        };
+
+        const ObjectLayout* layout;
+        volatile i32 flags;
+        u32 size;                   // allocation size, header included
+    };
+
+    static_assert(sizeof(ObjectHeader) == 16, "object header must keep payloads 16 byte aligned");
+
+    // same layout as llvm's "shadow-stack" gc strategy, so the jit can emit its precise stack maps
+    // through llvm.gcroot : every function with live references pushes a frame on entry and pops it on exit
+    struct FrameMap {
+        i32 root_count;
+        i32 meta_count;
+    };
+
+    struct RootFrame {
+        RootFrame* next;
+        const FrameMap* map;
+        // root_count reference slots follow
+
+        void** getRoots() { return (void**)(this + 1); }
+    };
+
+    // reference slots the heap can not find on its own (the interpreter's registers), called with the world stopped.
+    // visit may update the slot, the object moved
+    struct RootScanner {
+        using Visitor = void(*)(void** slot, void* context);
+
+        virtual ~RootScanner() {}
+        virtual void scanRoots(Visitor visit, void* context) = 0;
+    };
+
+    // one per thread running cal code, generated code keeps it in a register
+    struct Mutator {
+        RootFrame* roots = nullptr;     // top of the shadow stack
+        RootScanner* scanner = nullptr; // roots outside the shadow stack
+        u8* cursor = nullptr;           // thread local allocation buffer in the nursery
+        u8* end = nullptr;
+    };
+
+
+    // heap for class instances : a bump pointer nursery handed out to threads in small buffers, survivors
+    // of a minor collection are copied (promoted) into the old generation, a region heap collected by a
+    // parallel mark phase. regions with nothing live are reused as a whole, partly live regions keep their
+    // holes until they empty out, large objects get their own reservation.
+    // collections stop the world : every other attached thread has to reach safepoint() (or allocate)
+    class Heap
+    {
+    public:
+        static constexpr u32 REGION_SIZE = 1024 * 1024;
+        static constexpr u32 LARGE_OBJECT_SIZE = REGION_SIZE / 4;
+
+        struct Config {
+            u32 nursery_size = 8 * 1024 * 1024;
+            u32 buffer_size = 32 * 1024;            // allocation buffer a thread takes from the nursery
+            u64 old_size = 4ull * 1024 * 1024 * 1024;   // address space reserved for regions
+            u64 major_threshold = 64 * 1024 * 1024;  // old bytes that trigger the first major collection
+            ThreadPool* pool = nullptr;             // marks on the collecting thread when null
+        };
+
+        // pause times in microseconds
+        struct Stats {
+            u64 allocated_bytes;        // buffers count whole when they are handed out
+            u64 promoted_bytes;
+            u64 old_bytes;              // regions in use, large objects excluded
+            u32 minor_collections;
+            u32 major_collections;
+            u64 minor_pause_total;
+            u64 minor_pause_max;
+            u64 major_pause_total;
+            u64 major_pause_max;
+        };
+
+        Heap(IAllocator& alloc, const Config& config);
+        ~Heap();
+
+        Heap(const Heap&) = delete;
+        void operator =(const Heap&) = delete;
+
+        bool isValid() const { return m_nursery != nullptr; }
+
+        // the returned mutator belongs to the calling thread until detachThread()
+        Mutator* attachThread();
+        void detachThread(Mutator* mutator);
+
+        // zeroed, never nullptr unless the old generation ran out of address space
+        void* allocate(Mutator& mutator, const ObjectLayout& layout);
+        // every store of a reference into an object goes through it
+        void writeReference(void* holder, void** slot, void* value);
+        void safepoint(Mutator& mutator) { if (m_stop_requested) park(mutator); }
+
+        // references held outside the shadow stacks (globals, runtime tables)
+        void addRoot(void** slot);
+        void removeRoot(void** slot);
+
+        // major also runs a minor collection first
+        void collect(Mutator& mutator, bool major);
+        Stats getStats();
+
+        static ObjectHeader* getHeader(void* object) { return (ObjectHeader*)object - 1; }
+        bool isYoung(const void* object) const { return (const u8*)object >= m_nursery && (const u8*)object < m_nursery_end; }
+
+    private:
+        struct Region {
+            u8* base;
+            u8* cursor;
+            volatile i64 live_bytes;
+        };
+
+        struct LargeObject {
+            ObjectHeader* header;
+            u64 reserved;
+        };
+
+        struct MarkJob;
+
+        void* allocateSlow(Mutator& mutator, u32 size);
+        void* allocateLarge(u32 size);
+        void* allocateOld(u32 size);
+        Region* getRegion(const void* object);
+        bool takeRegion();
+        void remember(void* holder);
+        void park(Mutator& mutator);
+
+        void stopTheWorld();
+        void resumeTheWorld();
+        void collectMinor();
+        void collectMajor();
+        void forward(void** slot);
+        bool mark(void* object);
+        static void markJob(void* data);
+
+        IAllocator& m_alloc;
+        Config m_config;
+
+        u8* m_nursery = nullptr;
+        u8* m_nursery_end = nullptr;
+        volatile i64 m_nursery_top = 0;     // offset of the next free buffer
+
+        u8* m_old = nullptr;                // config.old_size reserved, regions committed on first use
+        Array<Region> m_regions;
+        Array<u32> m_free_regions;
+        Region* m_current = nullptr;        // promotion target
+        Array<LargeObject> m_large;
+        u64 m_large_bytes = 0;
+        Mutex m_large_mutex;
+        i32 m_mark_bit = 0;                 // MARK value of objects not marked by the next major collection
+
+        Array<void*> m_remembered;
+        Mutex m_remembered_mutex;
+        Array<void**> m_roots;
+        Array<void*> m_scan;                // promoted objects whose fields are not forwarded yet
+
+        Mutex m_mutex;                      // mutators, stop the world and collections
+        ConditionVariable m_parked_changed;
+        ConditionVariable m_resumed;
+        Array<Mutator*> m_mutators;
+        u32 m_parked = 0;
+        volatile bool m_stop_requested = false;
+
+        volatile i64 m_allocated = 0;       // bytes handed to threads, buffers count whole
+        Stats m_stats = {};
+    };
+
+
+    inline void* Heap::allocate(Mutator& mutator, const ObjectLayout& layout) {
+        const u32 size = ((layout.size + 15) & ~15u) + (u32)sizeof(ObjectHeader);
+        u8* object = mutator.cursor;
+        if (size > (u64)(mutator.end - object)) {
+            object = (u8*)allocateSlow(mutator, size);
+            if (!object) return nullptr;
+        }
+        else {
+            mutator.cursor = object + size;
+        }
+
+        // buffers are zeroed when handed out, only the header is left to fill
+        ObjectHeader* header = (ObjectHeader*)object;
+        header->layout = &layout;
+        header->flags = m_mark_bit;
+        header->size = size;
+        return header + 1;
+    }
+
+
+    inline void Heap::writeReference(void* holder, void** slot, void* value) {
+        *slot = value;
+        if (value && isYoung(value) && !isYoung(holder)) remember(holder);
+    }
+}
@@ -0,0 +1,333 @@
+#include "StringValue.hpp"
+
+#include "base/allocator/Allocators.hpp"
+#include "base/allocator/PoolAllocator.hpp"
+#include "base/threading/Atomic.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace cal::runtime {
+
+    struct StringNode {
+        volatile i32 refs;
+        u32 depth;          // 0 for flat buffers
+    };
+
+    // size + 1 chars follow
+    struct FlatNode : StringNode {
+        char* getData() { return (char*)(this + 1); }
+    };
+
+    struct RopeNode : StringNode {
+        StringValue left;
+        StringValue right;
+        volatile i64 flat = 0;  // FlatNode* holding the whole text, once someone read it
+    };
+
+
+    // rope nodes all have the same size and come and go with every long concatenation, never destroyed
+    // since values can be released by static destructors
+    static SlabAllocator& getRopeSlab() {
+        static SlabAllocator* slab = new SlabAllocator(*new PageAllocator(getGlobalAllocator()), sizeof(RopeNode), alignof(RopeNode), true);
+        return *slab;
+    }
+
+    static thread_local SlabCache s_rope_cache(getRopeSlab());
+
+
+    static FlatNode* allocateFlat(u32 size) {
+        FlatNode* node = (FlatNode*)getGlobalAllocator().allocate(sizeof(FlatNode) + size + 1, alignof(FlatNode));
+        node->refs = 1;
+        node->depth = 0;
+        node->getData()[size] = '\0';
+        return node;
+    }
+
+
+    static void releaseNode(StringNode* node) {
+        if (atomicDecrement(&node->refs) != 0) return;
+
+        if (node->depth == 0) {
+            getGlobalAllocator().deallocate(node);
+            return;
+        }
+
+        RopeNode* rope = (RopeNode*)node;
+        if (rope->flat) releaseNode((FlatNode*)rope->flat);
+        rope->~RopeNode();
+        s_rope_cache.deallocate(rope);
+    }
+
+
+    StringValue::StringValue(StringView text) {
+        const u32 size = text.size();
+        if (size <= SMALL_CAPACITY) {
+            memset(m_small, 0, sizeof(m_small));
+            memcpy(m_small, text.begin, size);
+            setSmallSize(size);
+            return;
+        }
+
+        FlatNode* node = allocateFlat(size);
+        memcpy(node->getData(), text.begin, size);
+        setHeap(FLAT, node, size);
+    }
+
+
+    StringValue::StringValue(const StringValue& rhs) {
+        memcpy(m_small, rhs.m_small, sizeof(m_small));
+        retain();
+    }
+
+
+    StringValue::StringValue(StringValue&& rhs) {
+        memcpy(m_small, rhs.m_small, sizeof(m_small));
+        rhs.setSmallSize(0);
+        rhs.m_small[0] = '\0';
+    }
+
+
+    void StringValue::operator =(const StringValue& rhs) {
+        if (this == &rhs) return;
+        rhs.retain();
+        release();
+        memcpy(m_small, rhs.m_small, sizeof(m_small));
+    }
+
+
+    void StringValue::operator =(StringValue&& rhs) {
+        if (this == &rhs) return;
+        release();
+        memcpy(m_small, rhs.m_small, sizeof(m_small));
+        rhs.setSmallSize(0);
+        rhs.m_small[0] = '\0';
+    }
+
+
+    StringValue StringValue::fromLiteral(const char* data, u32 size) {
+        ASSERT(data[size] == '\0');
+        StringValue result;
+        result.setHeap(LITERAL, data, size);
+        return result;
+    }
+
+
+    void StringValue::setHeap(u8 tag, const void* ptr, u32 size) {
+        m_heap.ptr = ptr;
+        m_heap.size = size;
+        m_small[SMALL_CAPACITY] = (char)tag;
+    }
+
+
+    StringNode* StringValue::getNode() const {
+        const u8 tag = getTag();
+        return tag == FLAT || tag == ROPE ? (StringNode*)m_heap.ptr : nullptr;
+    }
+
+
+    u32 StringValue::getDepth() const {
+        return isRope() ? ((RopeNode*)m_heap.ptr)->depth : 0;
+    }
+
+
+    void StringValue::retain() const {
+        if (StringNode* node = getNode()) atomicIncrement(&node->refs);
+    }
+
+
+    void StringValue::release() {
+        if (StringNode* node = getNode()) releaseNode(node);
+    }
+
+
+    void StringValue::copyTo(char* out) const {
+        switch (getTag()) {
+        case LITERAL:
+            memcpy(out, m_heap.ptr, m_heap.size);
+            return;
+        case FLAT:
+            memcpy(out, ((FlatNode*)m_heap.ptr)->getData(), m_heap.size);
+            return;
+        case ROPE: {
+            RopeNode* rope = (RopeNode*)m_heap.ptr;
+            if (rope->flat) {
+                memcpy(out, ((FlatNode*)rope->flat)->getData(), m_heap.size);
+                return;
+            }
+            rope->left.copyTo(out);
+            rope->right.copyTo(out + rope->left.size());
+            return;
+        }
+        default:
+            memcpy(out, m_small, size());
+            return;
+        }
+    }
+
+
+    StringView StringValue::view() const {
+        switch (getTag()) {
+        case LITERAL:
+            return StringView((const char*)m_heap.ptr, m_heap.size);
+        case FLAT:
+            return StringView(((FlatNode*)m_heap.ptr)->getData(), m_heap.size);
+        case ROPE: {
+            RopeNode* rope = (RopeNode*)m_heap.ptr;
+            FlatNode* flat = (FlatNode*)rope->flat;
+            if (!flat) {
+                // every copy of this rope shares the flattened text, when two threads race the loser drops its copy
+                flat = allocateFlat(m_heap.size);
+                copyTo(flat->getData());
+                if (!compareAndExchange64(&rope->flat, (i64)flat, 0)) {
+                    releaseNode(flat);
+                    flat = (FlatNode*)rope->flat;
+                }
+            }
+            return StringView(flat->getData(), m_heap.size);
+        }
+        default:
+            return StringView(m_small, size());
+        }
+    }
+
+
+    StringView StringValue::slice(u32 begin, u32 length) const {
+        ASSERT((u64)begin + length <= size());
+        return StringView(view().begin + begin, length);
+    }
+
+
+    bool StringValue::operator ==(const StringValue& rhs) const {
+        const u32 length = size();
+        if (length != rhs.size()) return false;
+        if (!isSmall() && getTag() == rhs.getTag() && m_heap.ptr == rhs.m_heap.ptr) return true;
+        return memcmp(view().begin, rhs.view().begin, length) == 0;
+    }
+
+
+    StringValue StringValue::concat(const StringValue& lhs, const StringValue& rhs) {
+        const u32 lhs_size = lhs.size();
+        const u32 rhs_size = rhs.size();
+        if (rhs_size == 0) return lhs;
+        if (lhs_size == 0) return rhs;
+        ASSERT((u64)lhs_size + rhs_size <= 0xFFFFFFFFull);
+
+        const u32 size = lhs_size + rhs_size;
+        if (size < ROPE_MIN_SIZE) {
+            StringValue result;
+            if (size <= SMALL_CAPACITY) {
+                lhs.copyTo(result.m_small);
+                rhs.copyTo(result.m_small + lhs_size);
+                result.setSmallSize(size);
+                return result;
+            }
+
+            FlatNode* node = allocateFlat(size);
+            lhs.copyTo(node->getData());
+            rhs.copyTo(node->getData() + lhs_size);
+            result.setHeap(FLAT, node, size);
+            return result;
+        }
+
+        return join(lhs, rhs);
+    }
+
+
+    // concatenation of balanced ropes, keeps the result balanced (same rules as an avl tree join) : only
+    // the nodes along one edge of the deeper side are copied, the rest is shared with both operands
+    StringValue StringValue::join(const StringValue& lhs, const StringValue& rhs) {
+        if (lhs.size() + rhs.size() < ROPE_MIN_SIZE) return concat(lhs, rhs);
+
+        const u32 lhs_depth = lhs.getDepth();
+        const u32 rhs_depth = rhs.getDepth();
+        if (lhs_depth > rhs_depth + 1) {
+            const RopeNode* rope = (const RopeNode*)lhs.m_heap.ptr;
+            StringValue right = join(rope->right, rhs);
+            if (right.getDepth() <= rope->left.getDepth() + 1) return makeRope(rope->left, right);
+
+            const RopeNode* inner = (const RopeNode*)right.m_heap.ptr;
+            if (inner->left.getDepth() > inner->right.getDepth()) {
+                const RopeNode* middle = (const RopeNode*)inner->left.m_heap.ptr;
+                return makeRope(makeRope(rope->left, middle->left), makeRope(middle->right, inner->right));
+            }
+            return makeRope(makeRope(rope->left, inner->left), inner->right);
+        }
+
+        if (rhs_depth > lhs_depth + 1) {
+            const RopeNode* rope = (const RopeNode*)rhs.m_heap.ptr;
+            StringValue left = join(lhs, rope->left);
+            if (left.getDepth() <= rope->right.getDepth() + 1) return makeRope(left, rope->right);
+
+            const RopeNode* inner = (const RopeNode*)left.m_heap.ptr;
+            if (inner->right.getDepth() > inner->left.getDepth()) {
+                const RopeNode* middle = (const RopeNode*)inner->right.m_heap.ptr;
+                return makeRope(makeRope(inner->left, middle->left), makeRope(middle->right, rope->right));
+            }
+            return makeRope(inner->left, makeRope(inner->right, rope->right));
+        }
+
+        return makeRope(lhs, rhs);
+    }
+
+
+    StringValue StringValue::makeRope(const StringValue& lhs, const StringValue& rhs) {
+        RopeNode* rope = new (NewPlaceholder(), s_rope_cache.allocate()) RopeNode();
+        rope->refs = 1;
+        rope->depth = std::max(lhs.getDepth(), rhs.getDepth()) + 1;
+        rope->left = lhs;
+        rope->right = rhs;
+
+        StringValue result;
+        result.setHeap(ROPE, rope, lhs.size() + rhs.size());
+        return result;
+    }
+
+
+    //////////////////////////////////////////////////////////////////////////////////////////
+
+
+    StringLiterals::StringLiterals(IAllocator& alloc)
+        : m_alloc(alloc)
+        , m_indices(alloc)
+        , m_offsets(alloc)
+        , m_sizes(alloc)
+    {
+    }
+
+
+    StringLiterals::~StringLiterals() {
+        if (m_block) m_alloc.deallocate(m_block);
+    }
+
+
+    u32 StringLiterals::intern(StringView text) {
+        ASSERT(!m_block);
+        std::string key(text.begin, text.size());
+        auto iter = m_indices.find(key);
+        if (iter.isValid()) return iter.value();
+
+        const u32 index = (u32)m_offsets.size();
+        m_offsets.push((u32)m_pending.size());
+        m_sizes.push(text.size());
+        m_pending.append(key);
+        m_pending.push_back('\0');
+        m_indices.insert(key, index);
+        return index;
+    }
+
+
+    void StringLiterals::seal() {
+        ASSERT(!m_block);
+        m_block = (char*)m_alloc.allocate(m_pending.size() + 1, 16);
+        memcpy(m_block, m_pending.data(), m_pending.size());
+        m_pending.clear();
+        m_pending.shrink_to_fit();
+    }
+
+
+    StringValue StringLiterals::get(u32 index) const {
+        ASSERT(m_block && index < (u32)m_offsets.size());
+        return StringValue::fromLiteral(m_block + m_offsets[index], m_sizes[index]);
+    }
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "base/allocator/IAllocator.hpp"
+#include "base/types/Array.hpp"
+#include "base/types/String.hpp"
+#include "base/types/container/HashMap.hpp"
+#include "globals.hpp"
+
+#include <string>
+
+namespace cal::runtime {
+
+    struct StringNode;
+
+    // value of a cal "string", 16 bytes and immutable :
+    //  - up to 15 bytes are stored inline
+    //  - literals point into the module's literal block, nothing is copied or counted
+    //  - longer text lives in a reference counted buffer shared by every copy
+    //  - long concatenations build balanced rope nodes, flattened once (and cached) the first time the text is read
+    // copies and assignments only touch a reference count, every value can be shared between threads
+    class StringValue
+    {
+    public:
+        static constexpr u32 SMALL_CAPACITY = 15;
+        static constexpr u32 ROPE_MIN_SIZE = 256;   // shorter concatenations are copied
+
+        StringValue() { setSmallSize(0); m_small[0] = '\0'; }
+        explicit StringValue(StringView text);
+        StringValue(const StringValue& rhs);
+        StringValue(StringValue&& rhs);
+        ~StringValue() { release(); }
+
+        void operator =(const StringValue& rhs);
+        void operator =(StringValue&& rhs);
+
+        // data has to outlive every value made from it and end with a '\0'
+        static StringValue fromLiteral(const char* data, u32 size);
+        static StringValue concat(const StringValue& lhs, const StringValue& rhs);
+        StringValue operator +(const StringValue& rhs) const { return concat(*this, rhs); }
+
+        u32 size() const { return isSmall() ? SMALL_CAPACITY - (u8)m_small[SMALL_CAPACITY] : m_heap.size; }
+        bool empty() const { return size() == 0; }
+
+        // '\0' terminated, flattens a rope, valid as long as this value
+        StringView view() const;
+        const char* c_str() const { return view().begin; }
+        // zero copy, valid as long as this value
+        StringView slice(u32 begin, u32 length) const;
+        // shares nothing with this value, short results end up inline
+        StringValue substring(u32 begin, u32 length) const { return StringValue(slice(begin, length)); }
+        char operator[](u32 index) const { ASSERT(index < size()); return view().begin[index]; }
+
+        bool operator ==(const StringValue& rhs) const;
+        bool operator !=(const StringValue& rhs) const { return !(*this == rhs); }
+
+        bool isSmall() const { return (u8)m_small[SMALL_CAPACITY] <= SMALL_CAPACITY; }
+        bool isLiteral() const { return (u8)m_small[SMALL_CAPACITY] == LITERAL; }
+        bool isRope() const { return (u8)m_small[SMALL_CAPACITY] == ROPE; }
+
+    private:
+        enum : u8 {
+            LITERAL = 0x80, FLAT, ROPE
+        };
+
+        u8 getTag() const { return (u8)m_small[SMALL_CAPACITY]; }
+        void setSmallSize(u32 size) { m_small[SMALL_CAPACITY] = (char)(SMALL_CAPACITY - size); }
+        void setHeap(u8 tag, const void* ptr, u32 size);
+        StringNode* getNode() const;
+        u32 getDepth() const;
+        void copyTo(char* out) const;
+        void retain() const;
+        void release();
+
+        static StringValue makeRope(const StringValue& lhs, const StringValue& rhs);
+        static StringValue join(const StringValue& lhs, const StringValue& rhs);
+
+        union {
+            char m_small[16];   // the last byte is the tag : SMALL_CAPACITY - size for inline text
+            struct {
+                const void* ptr;
+                u32 size;
+            } m_heap;
+        };
+    };
+
+    static_assert(sizeof(StringValue) == 16, "string values must stay 16 bytes");
+
+
+    // the literals of one module, deduplicated while compiling and laid out in one block that is
+    // never written again once sealed : equal literals share their bytes and compare by address
+    class StringLiterals
+    {
+    public:
+        explicit StringLiterals(IAllocator& alloc);
+        ~StringLiterals();
+
+        StringLiterals(const StringLiterals&) = delete;
+        void operator =(const StringLiterals&) = delete;
+
+        // equal text returns the same index, only before seal()
+        u32 intern(StringView text);
+        void seal();
+        bool isSealed() const { return m_block != nullptr; }
+
+        u32 getCount() const { return (u32)m_offsets.size(); }
+        StringValue get(u32 index) const;
+
+    private:
+        IAllocator& m_alloc;
+        HashMap<std::string, u32> m_indices;
+        Array<u32> m_offsets;
+        Array<u32> m_sizes;
+        std::string m_pending;      // text of every literal before seal(), each ends with a '\0'
+        char* m_block = nullptr;
+    };
+}
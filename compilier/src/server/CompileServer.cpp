@@ -0,0 +1,194 @@
+#include "CompileServer.hpp"
+
+#include "base/Logger.hpp"
+#include "system/SysIO.hpp"
+#include "system/SysSocket.hpp"
+#include "system/SysTimer.hpp"
+#include "utils/ArgsParser.hpp"
+
+#include <string>
+
+namespace cal {
+
+    // a request is a command line, anything bigger is garbage on the socket
+    static constexpr u32 MAX_REQUEST_ARGS = 4096;
+    static constexpr u32 MAX_REQUEST_ARG_LENGTH = 64 * 1024;
+    static constexpr u32 MAX_LOG_LENGTH = 1024 * 1024;
+
+    static constexpr u32 RESPONSE_LOG = 0;
+    static constexpr u32 RESPONSE_DONE = 1;
+
+
+    static bool sendString(platform::LocalSocket& socket, const char* str) {
+        const u32 len = (u32)strlen(str);
+        return socket.send(&len, sizeof(len)) && socket.send(str, len);
+    }
+
+
+    static bool receiveString(platform::LocalSocket& socket, std::string& str, u32 max_length = MAX_REQUEST_ARG_LENGTH) {
+        u32 len = 0;
+        if (!socket.receive(&len, sizeof(len)) || len > max_length) return false;
+
+        str.resize(len);
+        return len == 0 || socket.receive(str.data(), len);
+    }
+
+
+    // prints a message of the server at the level it was logged with
+    static void printLog(u32 level, const std::string& message) {
+        switch (level) {
+        case LogWarn: LogWarn(message); break;
+        case LogError: LogError(message); break;
+        case LogDebug: LogDebug(message); break;
+        case LogTrace: LogTrace(message); break;
+        default: LogInfo(message); break;
+        }
+    }
+
+
+    CompileServer::CompileServer(IAllocator& alloc)
+        : m_alloc(alloc)
+        , m_cache(alloc)
+        , m_engine(alloc)
+    {
+    }
+
+
+    bool CompileServer::getDefaultSocketPath(std::string& path) {
+        char buffer[MAX_PATH];
+        if (!platform::getUserSocketPath(Span<char>(buffer, sizeof(buffer)), COMPILE_SERVER_SOCKET_NAME)) return false;
+        path = buffer;
+        return true;
+    }
+
+
+    i32 CompileServer::run(const char* socket_path) {
+        platform::LocalSocket listener;
+        if (!listener.listen(socket_path)) {
+            LogError("[Server] could not listen on ", socket_path, ", is another server running?");
+            return 1;
+        }
+        LogInfo("[Server] listening on ", socket_path);
+
+        for (;;) {
+            platform::LocalSocket client;
+            if (!listener.accept(client)) {
+                LogError("[Server] accept failed");
+                return 1;
+            }
+            if (!client.isPeerCurrentUser()) {
+                LogWarn("[Server] rejected a client running as another user");
+                continue;
+            }
+            if (!serve(client)) break;
+        }
+
+        LogInfo("[Server] shutting down after ", m_requests, " requests");
+        return 0;
+    }
+
+
+    bool CompileServer::serve(platform::LocalSocket& client) {
+        u32 count = 0;
+        if (!client.receive(&count, sizeof(count)) || count == 0 || count > MAX_REQUEST_ARGS) {
+            LogWarn("[Server] dropped malformed request");
+            return true;
+        }
+
+        Array<std::string> args(m_alloc);
+        for (u32 i = 0; i < count; ++i) {
+            std::string& arg = args.emplace();
+            if (!receiveString(client, arg)) {
+                LogWarn("[Server] dropped truncated request");
+                return true;
+            }
+        }
+
+        // ArgsParser skips argv[0], the working directory takes its place
+        Array<const char*> argv(m_alloc);
+        for (const std::string& arg : args) argv.push(arg.c_str());
+        ArgsParser parser{ (i32)argv.size(), argv.begin(), m_alloc, Driver::VALUE_OPTIONS };
+
+        platform::Timer timer;
+        i32 exit_code = 1;
+        const bool shutdown = parser.getPositionalCount() > 0 && parser.getPositional(0) == "shutdown";
+        if (shutdown) {
+            exit_code = 0;
+        }
+        else {
+            platform::setCurrentDirectory(args[0].c_str());
+            // workers log too, the callback sees their messages one at a time under the logger lock
+            LoggerManager::getLogger()->setCallback(&CompileServer::forwardLog, &client);
+
+            BuildOptions options{ m_alloc };
+            if (Driver::parseBuildOptions(parser, options)) {
+                Driver driver{ m_alloc, &m_cache, &m_engine };
+                exit_code = driver.build(options);
+
+                const QueryEngine::Stats stats = m_engine.getStats();
+                LogDebug("[Server] queries executed ", stats.executed, ", green ", stats.green, ", cut off ", stats.cutoffs);
+            }
+            LoggerManager::getLogger()->setCallback(nullptr, nullptr);
+        }
+
+        const u64 elapsed_us = (u64)(timer.getTimeSinceStart() * 1000000.f);
+        ++m_requests;
+        LogInfo("[Server] request ", m_requests, " served in ", elapsed_us / 1000.f, " ms");
+
+        const u32 tag = RESPONSE_DONE;
+        if (!client.send(&tag, sizeof(tag)) || !client.send(&exit_code, sizeof(exit_code)) || !client.send(&elapsed_us, sizeof(elapsed_us))) {
+            LogWarn("[Server] client went away before the reply");
+        }
+        return !shutdown;
+    }
+
+
+    void CompileServer::forwardLog(LogLevel level, const char* message, void* user) {
+        // a client that went away fails every send, the build still runs to the end
+        auto* client = (platform::LocalSocket*)user;
+        const u32 tag = RESPONSE_LOG;
+        const u32 level_value = (u32)level;
+        (void)(client->send(&tag, sizeof(tag)) && client->send(&level_value, sizeof(level_value)) && sendString(*client, message));
+    }
+
+
+    bool CompileServer::sendRequest(const char* socket_path, i32 argc, char** argv, i32& exit_code) {
+        platform::LocalSocket socket;
+        if (!socket.connect(socket_path)) return false;
+        if (!socket.isPeerCurrentUser()) {
+            LogError("[Server] ", socket_path, " is served by another user, ignoring it");
+            return false;
+        }
+
+        char cwd[MAX_PATH];
+        platform::getCurrentDirectory(Span<char>(cwd, sizeof(cwd)));
+
+        const u32 count = (u32)argc;
+        bool result = socket.send(&count, sizeof(count)) && sendString(socket, cwd);
+        for (i32 i = 1; result && i < argc; ++i) {
+            result = sendString(socket, argv[i]);
+        }
+
+        // messages arrive while the server builds, the exit code after the last of them
+        u64 elapsed_us = 0;
+        u32 tag = RESPONSE_LOG;
+        std::string message;
+        while (result && tag == RESPONSE_LOG) {
+            result = socket.receive(&tag, sizeof(tag));
+            if (!result || tag == RESPONSE_DONE) continue;
+
+            u32 level = 0;
+            result = tag == RESPONSE_LOG && socket.receive(&level, sizeof(level)) && receiveString(socket, message, MAX_LOG_LENGTH);
+            if (result) printLog(level, message);
+        }
+        result = result && socket.receive(&exit_code, sizeof(exit_code)) && socket.receive(&elapsed_us, sizeof(elapsed_us));
+        if (!result) {
+            LogError("[Server] lost connection to ", socket_path);
+            exit_code = 1;
+            return true;
+        }
+
+        LogInfo("[Server] done in ", elapsed_us / 1000.f, " ms on the server");
+        return true;
+    }
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "base/Logger.hpp"
+#include "base/allocator/IAllocator.hpp"
+#include "driver/Driver.hpp"
+#include "query/QueryEngine.hpp"
+#include "globals.hpp"
+
+namespace cal {
+
+    namespace platform { struct LocalSocket; }
+
+    static constexpr const char* COMPILE_SERVER_SOCKET_NAME = "compile-server.sock";
+
+    // long lived "cal server" process, build requests arrive over a local socket and run on warm state :
+    // allocators, TypePool / NumberPool, the build cache, the query engine and every singleton are set up once
+    //
+    // wire format (native endian) :
+    //  request  : u32 argument count, then u32 length + bytes per argument, argument 0 is the client working directory
+    //  response : records, each starting with a u32 tag
+    //      RESPONSE_LOG  : u32 log level, u32 length + bytes, a message logged while the request ran
+    //      RESPONSE_DONE : i32 exit code, u64 server side build time in microseconds, ends the response
+    //  the client prints every message as it arrives, diagnostics show up as if it had built in process
+    //
+    // the socket lives in a directory only the current user can enter, and both ends check that the other
+    // one runs as the same user : a request runs with the server's rights in the client's directory
+    class CompileServer
+    {
+    public:
+        CompileServer(IAllocator& alloc);
+        ~CompileServer() = default;
+
+        // COMPILE_SERVER_SOCKET_NAME in the private per-user socket directory, false when there is none
+        [[nodiscard]] static bool getDefaultSocketPath(std::string& path);
+
+        // serves requests one after another until a "shutdown" request arrives, returns the process exit code
+        i32 run(const char* socket_path);
+
+        // client side, forwards argv to the server
+        // returns false when no server is reachable so the caller can build in process instead
+        [[nodiscard]] static bool sendRequest(const char* socket_path, i32 argc, char** argv, i32& exit_code);
+
+    private:
+        // returns false once the server should stop
+        bool serve(platform::LocalSocket& client);
+        static void forwardLog(LogLevel level, const char* message, void* user);
+
+        IAllocator& m_alloc;
+        BuildCache m_cache;
+        QueryEngine m_engine;
+        u32 m_requests = 0;
+    };
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "base/threading/Atomic.hpp"
+#include "globals.hpp"
+
+namespace cal {
+
+    class CancellationSource;
+
+    // cooperative cancellation, long running passes poll isCancelled() inside their loops and bail out early
+    // a default constructed token is never cancelled
+    class CancellationToken
+    {
+    public:
+        CancellationToken() = default;
+
+        inline bool isCancelled() const;
+
+    private:
+        friend class CancellationSource;
+        CancellationToken(const CancellationSource* source, i32 generation) : m_source(source), m_generation(generation) {}
+
+        const CancellationSource* m_source = nullptr;
+        i32 m_generation = 0;
+    };
+
+
+    // hands out tokens, cancel() invalidates every token handed out so far
+    // the source must outlive its tokens
+    class CancellationSource
+    {
+    public:
+        CancellationToken getToken() const { return CancellationToken{ this, m_generation }; }
+        void cancel() { atomicIncrement(&m_generation); }
+
+    private:
+        friend class CancellationToken;
+        volatile i32 m_generation = 0;
+    };
+
+
+    inline bool CancellationToken::isCancelled() const {
+        return m_source && m_source->m_generation != m_generation;
+    }
+}
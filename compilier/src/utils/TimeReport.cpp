@@ -0,0 +1,181 @@
+#include "TimeReport.hpp"
+
+#include "base/Logger.hpp"
+#include "base/allocator/Allocators.hpp"
+#include "base/threading/Atomic.hpp"
+#include "base/types/container/HashMap.hpp"
+#include "system/SysIO.hpp"
+#include "system/SysTimer.hpp"
+#include "utils/StringBuilder.hpp"
+
+#include <json/json.h>
+
+#include <algorithm>
+#include <cstdio>
+
+namespace cal {
+
+    static volatile i32 s_thread_counter = 0;
+    static thread_local u32 s_thread_index = 0;
+    static thread_local u32 s_depth = 0;
+
+
+    static u32 getThreadIndex() {
+        if (s_thread_index == 0) s_thread_index = (u32)atomicIncrement(&s_thread_counter);
+        return s_thread_index;
+    }
+
+
+    TimeReport::TimeReport()
+        : m_events(getGlobalAllocator())
+    {
+        m_start = platform::Timer::getRawTimestamp();
+        m_frequency = platform::Timer::getFrequency();
+    }
+
+
+    u64 TimeReport::getTimestamp() const {
+        const u64 ticks = platform::Timer::getRawTimestamp() - m_start;
+        return (u64)((double)ticks * 1000000.0 / (double)m_frequency);
+    }
+
+
+    void TimeReport::record(const Event& event) {
+        MutexGuard lock(m_mutex);
+        m_events.push(event);
+    }
+
+
+    void TimeReport::clear() {
+        MutexGuard lock(m_mutex);
+        m_events.clear();
+    }
+
+
+    std::string TimeReport::buildTable() {
+        struct Row {
+            const char* name;
+            u32 calls;
+            u64 duration_us;
+            u64 alloc_count;
+            u64 alloc_bytes;
+        };
+
+        Array<Row> rows(getGlobalAllocator());
+        u64 total_us = 0;
+        {
+            MutexGuard lock(m_mutex);
+            HashMap<std::string, u32> lookup(getGlobalAllocator());
+            for (const Event& event : m_events) {
+                if (event.depth == 0) total_us += event.duration_us;
+
+                auto iter = lookup.find(event.name);
+                if (!iter.isValid()) {
+                    lookup.insert(event.name, (u32)rows.size());
+                    rows.push(Row{ event.name, 0, 0, 0, 0 });
+                    iter = lookup.find(event.name);
+                }
+                Row& row = rows[iter.value()];
+                ++row.calls;
+                row.duration_us += event.duration_us;
+                row.alloc_count += event.alloc_count;
+                row.alloc_bytes += event.alloc_bytes;
+            }
+        }
+        std::sort(rows.begin(), rows.end(), [](const Row& lhs, const Row& rhs) { return lhs.duration_us > rhs.duration_us; });
+
+        StringBuilder builder{ "Time Report: \n" };
+        char line[256];
+        snprintf(line, sizeof(line), "\t%-28s %8s %12s %7s %12s %14s\n", "phase", "calls", "wall (ms)", "%", "allocs", "bytes");
+        builder.append(line);
+        for (const Row& row : rows) {
+            const double percent = total_us > 0 ? 100.0 * (double)row.duration_us / (double)total_us : 0.0;
+            snprintf(line, sizeof(line), "\t%-28s %8u %12.3f %6.1f%% %12llu %14llu\n", row.name, row.calls,
+                (double)row.duration_us / 1000.0, percent, (unsigned long long)row.alloc_count, (unsigned long long)row.alloc_bytes);
+            builder.append(line);
+        }
+        snprintf(line, sizeof(line), "\t%-28s %8s %12.3f\n", "total (top level)", "", (double)total_us / 1000.0);
+        builder.append(line);
+        return builder;
+    }
+
+
+    void TimeReport::printTable() {
+        LogInfo(buildTable());
+    }
+
+
+    bool TimeReport::writeChromeTrace(const char* path) {
+        Json::Value events{ Json::ValueType::arrayValue };
+        {
+            MutexGuard lock(m_mutex);
+            for (const Event& event : m_events) {
+                Json::Value item;
+                item["name"] = event.name;
+                item["cat"] = "compiler";
+                item["ph"] = "X";
+                item["ts"] = (Json::UInt64)event.start_us;
+                item["dur"] = (Json::UInt64)event.duration_us;
+                item["pid"] = 1;
+                item["tid"] = event.thread;
+                item["args"]["allocs"] = (Json::UInt64)event.alloc_count;
+                item["args"]["bytes"] = (Json::UInt64)event.alloc_bytes;
+                events.append(item);
+            }
+        }
+
+        Json::Value root;
+        root["traceEvents"] = events;
+        root["displayTimeUnit"] = "ms";
+
+        Json::StreamWriterBuilder writer;
+        writer["indentation"] = "";
+        const std::string output = Json::writeString(writer, root);
+
+        platform::OFile file;
+        if (!file.open(path)) {
+            LogError("[TimeReport] could not write trace ", path);
+            return false;
+        }
+        const bool result = file.write(output.data(), output.size());
+        file.close();
+        return result;
+    }
+
+    //////////////////////////////////////////////
+    // Scope
+    //////////////////////////////////////////////
+
+    TimeScope::TimeScope(const char* name)
+        : m_name(nullptr)
+    {
+        TimeReport& report = TimeReport::get();
+        if (!report.isEnabled()) return;
+
+        const AllocationCounters counters = getThreadAllocationCounters();
+        m_name = name;
+        m_alloc_count = counters.count;
+        m_alloc_bytes = counters.bytes;
+        m_start = report.getTimestamp();
+        ++s_depth;
+    }
+
+
+    TimeScope::~TimeScope() {
+        if (!m_name) return;
+
+        TimeReport& report = TimeReport::get();
+        const u64 end = report.getTimestamp();
+        const AllocationCounters counters = getThreadAllocationCounters();
+        --s_depth;
+        report.record(TimeReport::Event{
+            .name = m_name,
+            .start_us = m_start,
+            .duration_us = end - m_start,
+            .alloc_count = counters.count - m_alloc_count,
+            .alloc_bytes = counters.bytes - m_alloc_bytes,
+            .thread = getThreadIndex(),
+            .depth = s_depth
+            });
+    }
+}
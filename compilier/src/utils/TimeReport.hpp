@@ -0,0 +1,70 @@
+#pragma once
+
+#include "base/types/Array.hpp"
+#include "base/threading/SyncMutex.hpp"
+#include "utils/TSingleton.hpp"
+#include "globals.hpp"
+
+#include <string>
+
+namespace cal {
+
+    // -ftime-report style instrumentation of the compiler phases
+    // every scope records wall time plus allocation count / bytes of its thread (nested scopes are inclusive)
+    // recording is off until setEnabled(true), a disabled scope costs one branch
+    class TimeReport : public TSingleton<TimeReport>
+    {
+    public:
+        struct Event {
+            const char* name;
+            u64 start_us;
+            u64 duration_us;
+            u64 alloc_count;
+            u64 alloc_bytes;
+            u32 thread;
+            u32 depth;
+        };
+
+        TimeReport();
+        ~TimeReport() = default;
+
+        void setEnabled(bool enabled) { m_enabled = enabled; }
+        bool isEnabled() const { return m_enabled; }
+
+        void record(const Event& event);
+        void clear();
+        u64 getTimestamp() const;
+
+        // per phase totals, sorted by wall time
+        std::string buildTable();
+        void printTable();
+        // chrome trace event format, open with perfetto or chrome://tracing
+        [[nodiscard]] bool writeChromeTrace(const char* path);
+
+    private:
+        bool m_enabled = false;
+        u64 m_start;
+        u64 m_frequency;
+        Mutex m_mutex;
+        Array<Event> m_events;
+    };
+
+
+    struct TimeScope {
+        explicit TimeScope(const char* name);
+        ~TimeScope();
+
+        TimeScope(const TimeScope&) = delete;
+        void operator =(const TimeScope&) = delete;
+
+    private:
+        const char* m_name;
+        u64 m_start;
+        u64 m_alloc_count;
+        u64 m_alloc_bytes;
+    };
+}
+
+#define CAL_TIME_SCOPE_CONCAT2(a, b) a##b
+#define CAL_TIME_SCOPE_CONCAT(a, b) CAL_TIME_SCOPE_CONCAT2(a, b)
+#define CAL_TIME_SCOPE(name) ::cal::TimeScope CAL_TIME_SCOPE_CONCAT(time_scope_, __LINE__)(name)
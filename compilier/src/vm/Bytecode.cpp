@@ -0,0 +1,194 @@
+#include "Bytecode.hpp"
+
+#include "base/Logger.hpp"
+#include "runtime/Console.hpp"
+#include "runtime/StringValue.hpp"
+#include "utils/StringBuilder.hpp"
+
+#include <algorithm>
+
+namespace cal::vm {
+
+    static const char* OPCODE_NAMES[] = {
+#define CAL_VM_OPCODE_NAME(name) #name,
+        CAL_VM_OPCODES(CAL_VM_OPCODE_NAME)
+#undef CAL_VM_OPCODE_NAME
+    };
+
+    static_assert(lengthOf(OPCODE_NAMES) == (u32)OpCode::COUNT, "opcode name table out of sync");
+
+
+    const char* getOpCodeName(OpCode op) {
+        if (op >= OpCode::COUNT) return "INVALID";
+        return OPCODE_NAMES[(u32)op];
+    }
+
+
+    u32 getOpCodeLength(OpCode op) {
+        switch (op) {
+        case OpCode::CALL:
+        case OpCode::JLT_I:
+        case OpCode::JLE_I:
+        case OpCode::JEQ_I:
+        case OpCode::JNE_I:
+        case OpCode::INCLT_I:
+        case OpCode::GETX:
+        case OpCode::SETX:
+        case OpCode::GETXU:
+        case OpCode::SETXU:
+        case OpCode::PRINTF:
+        case OpCode::NEW:
+        case OpCode::SLIT:
+            return 2;
+        default:
+            return 1;
+        }
+    }
+
+
+    static void disassemble(const BytecodeFunction& func, StringBuilder& builder) {
+        builder.appendAll("fun ", func.name, " (params: ", (u32)func.param_count, ", registers: ", (u32)func.register_count, ")\n");
+
+        for (i32 idx = 0; idx < func.constants.size(); ++idx) {
+            builder.appendAll("\tK[", idx, "] = ", func.constants[idx].i, " / ", func.constants[idx].f, "\n");
+        }
+
+        for (i32 pc = 0; pc < func.code.size();) {
+            const Instruction ins = func.code[pc];
+            const OpCode op = decodeOp(ins);
+            builder.appendAll("\t", pc, "\t", getOpCodeName(op), "\t");
+
+            switch (op) {
+            case OpCode::LOADK:
+            case OpCode::RETK:
+                builder.appendAll((u32)decodeA(ins), ", K[", (u32)decodeBx(ins), "]");
+                break;
+            case OpCode::LOADI:
+            case OpCode::JMP:
+            case OpCode::JMP_IF:
+            case OpCode::JMP_IF_NOT:
+                builder.appendAll((u32)decodeA(ins), ", ", (i32)decodeSBx(ins));
+                break;
+            case OpCode::ADDI:
+                builder.appendAll((u32)decodeA(ins), ", ", (u32)decodeB(ins), ", ", (i32)decodeSC(ins));
+                break;
+            default:
+                builder.appendAll((u32)decodeA(ins), ", ", (u32)decodeB(ins), ", ", (u32)decodeC(ins));
+                break;
+            }
+
+            if (getOpCodeLength(op) == 2 && pc + 1 < func.code.size()) {
+                builder.appendAll(" ; ext ", (i32)func.code[pc + 1]);
+            }
+            builder.append("\n");
+            pc += getOpCodeLength(op);
+        }
+    }
+
+    //////////////////////////////////////////////
+    // Bytecode module
+    //////////////////////////////////////////////
+
+    BytecodeModule::BytecodeModule(IAllocator& alloc)
+        : m_alloc(alloc),
+        m_functions(alloc),
+        m_function_map(alloc),
+        m_formats(alloc),
+        m_layouts(alloc),
+        m_strings(CAL_NEW(alloc, runtime::StringLiterals)(alloc))
+    {
+    }
+
+
+    BytecodeModule::~BytecodeModule() {
+        for (auto* func : m_functions) {
+            CAL_DEL(m_alloc, func);
+        }
+        m_functions.clear();
+        for (auto* format : m_formats) {
+            CAL_DEL(m_alloc, format);
+        }
+        m_formats.clear();
+        CAL_DEL(m_alloc, m_strings);
+    }
+
+
+    BytecodeFunction& BytecodeModule::addFunction(const std::string& name, u8 param_count) {
+        ASSERT(!m_function_map.find(name).isValid());
+
+        auto* func = CAL_NEW(m_alloc, BytecodeFunction)(m_alloc, name, (u32)m_functions.size(), param_count);
+        m_function_map.insert(name, (u32)m_functions.size());
+        m_functions.push(func);
+        return *func;
+    }
+
+
+    i32 BytecodeModule::findFunction(const std::string& name) const {
+        auto result = m_function_map.find(name);
+        if (!result.isValid()) return -1;
+        return (i32)result.value();
+    }
+
+
+    const ReferenceMap* BytecodeFunction::findReferenceMap(u32 pc) const {
+        const ReferenceMap* map = std::lower_bound(reference_maps.begin(), reference_maps.end(), pc,
+            [](const ReferenceMap& lhs, u32 rhs) { return lhs.pc < rhs; });
+        return map != reference_maps.end() && map->pc == pc ? map : nullptr;
+    }
+
+
+    u32 BytecodeModule::addLayout(const runtime::ObjectLayout& layout) {
+        m_layouts.push(&layout);
+        return m_layouts.size() - 1;
+    }
+
+
+    u32 BytecodeModule::addString(StringView text) {
+        return m_strings->intern(text);
+    }
+
+
+    void BytecodeModule::sealStrings() {
+        m_strings->seal();
+    }
+
+
+    u32 BytecodeModule::addFormat(runtime::FormatProgram* format) {
+        m_formats.push(format);
+        return m_formats.size() - 1;
+    }
+
+
+    void printFormat(const runtime::FormatProgram& format, const Value* args) {
+        using namespace runtime;
+        // PRINTF has at most 255 args
+        FormatArg converted[255];
+        const u32 count = format.getArgCount();
+        ASSERT(count <= lengthOf(converted));
+        for (u32 i = 0; i < count; ++i) {
+            if (format.getArgKind(i) == FormatArgKind::String) {
+                const char* text = (const char*)(uintptr)args[i].i;
+                converted[i] = FormatArg::fromString(text ? StringView(text) : StringView());
+            }
+            else {
+                // ints, chars and bools read .i, floats .f, both alias the register bits
+                converted[i].i = args[i].i;
+            }
+        }
+        Console::get().writeFormat(format, Span<const FormatArg>(converted, count));
+    }
+
+
+    void BytecodeModule::debugPrint() const {
+        LogDebug("[VM] ", buildOutput());
+    }
+
+
+    std::string BytecodeModule::buildOutput() const {
+        StringBuilder builder{ "Bytecode Module: \n" };
+        for (auto* func : m_functions) {
+            disassemble(*func, builder);
+        }
+        return builder;
+    }
+}
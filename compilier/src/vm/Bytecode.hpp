@@ -0,0 +1,266 @@
+#pragma once
+
+#include "analyzer/SourceMap.hpp"
+#include "base/allocator/IAllocator.hpp"
+#include "base/types/Array.hpp"
+#include "base/types/String.hpp"
+#include "base/types/container/HashMap.hpp"
+#include "utils/CPrintable.hpp"
+#include "globals.hpp"
+
+#include <string>
+
+namespace cal::runtime {
+    class FormatProgram;
+    struct ObjectLayout;
+    class StringLiterals;
+}
+
+namespace cal::vm {
+
+    // register based instruction set, every instruction is one 32bit word
+    //  [ op : 8 ][ A : 8 ][ B : 8 ][ C : 8 ]
+    //  [ op : 8 ][ A : 8 ][    Bx / sBx : 16 ]
+    // instructions marked with "ext" are followed by one extra word (jump offset, function index or array length)
+#define CAL_VM_OPCODES(X)                                                           \
+        X(NOP)          /* */                                                       \
+        X(MOVE)         /* R[A] = R[B] */                                           \
+        X(LOADK)        /* R[A] = K[Bx] */                                          \
+        X(LOADI)        /* R[A] = sBx */                                            \
+        X(ADD_I)        /* R[A] = R[B] + R[C] */                                    \
+        X(SUB_I)        /* R[A] = R[B] - R[C] */                                    \
+        X(MUL_I)        /* R[A] = R[B] * R[C] */                                    \
+        X(DIV_I)        /* R[A] = R[B] / R[C] */                                    \
+        X(MOD_I)        /* R[A] = R[B] % R[C] */                                    \
+        X(NEG_I)        /* R[A] = -R[B] */                                          \
+        X(ADD_F)        /* R[A] = R[B] + R[C] */                                    \
+        X(SUB_F)        /* R[A] = R[B] - R[C] */                                    \
+        X(MUL_F)        /* R[A] = R[B] * R[C] */                                    \
+        X(DIV_F)        /* R[A] = R[B] / R[C] */                                    \
+        X(NEG_F)        /* R[A] = -R[B] */                                          \
+        X(I2F)          /* R[A] = (f64)R[B] */                                      \
+        X(F2I)          /* R[A] = (i64)R[B] */                                      \
+        X(EQ_I)         /* R[A] = R[B] == R[C] */                                   \
+        X(LT_I)         /* R[A] = R[B] < R[C] */                                    \
+        X(LE_I)         /* R[A] = R[B] <= R[C] */                                   \
+        X(JMP)          /* pc += sBx */                                             \
+        X(JMP_IF)       /* if (R[A]) pc += sBx */                                   \
+        X(JMP_IF_NOT)   /* if (!R[A]) pc += sBx */                                  \
+        X(CALL)         /* R[A] = F[ext](R[A] .. R[A + C - 1]) */                   \
+        X(RET)          /* return R[A] */                                           \
+        /* superinstructions, produced by the emitter for common pairs */           \
+        X(ADDI)         /* R[A] = R[B] + sC                  (LOADI + ADD_I) */     \
+        X(JLT_I)        /* if (R[A] < R[B]) pc += ext        (LT_I + JMP_IF) */     \
+        X(JLE_I)        /* if (R[A] <= R[B]) pc += ext       (LE_I + JMP_IF) */     \
+        X(JEQ_I)        /* if (R[A] == R[B]) pc += ext       (EQ_I + JMP_IF) */     \
+        X(JNE_I)        /* if (R[A] != R[B]) pc += ext       (EQ_I + JMP_IF_NOT) */ \
+        X(INCLT_I)      /* if (++R[A] < R[B]) pc += ext      (loop back edge) */    \
+        X(RETK)         /* return K[Bx]                      (LOADK + RET) */       \
+        /* fixed size arrays inline in R[B] .. R[B + ext - 1], ext = length */      \
+        X(GETX)         /* R[A] = R[B + R[C]]                (bounds checked) */    \
+        X(SETX)         /* R[B + R[C]] = R[A]                (bounds checked) */    \
+        X(GETXU)        /* R[A] = R[B + R[C]]                (proven in bounds) */  \
+        X(SETXU)        /* R[B + R[C]] = R[A]                (proven in bounds) */  \
+        /* unsafe raw memory, pointers are plain addresses held in registers */     \
+        X(ALLOC)        /* R[A] = malloc(R[B]) */                                   \
+        X(FREE)         /* free(R[A]) */                                            \
+        X(MEMCPY)       /* copy R[C] bytes from R[B] to R[A] */                     \
+        X(PLOAD)        /* R[A] = *(iC*)R[B]    C = 1, 2, 4, 8 (sign extended) */   \
+        X(PSTORE)       /* *(iC*)R[A] = R[B]    C = 1, 2, 4, 8 */                \
+        /* system.console, P = the module's compiled formats */                     \
+        X(PRINTF)       /* print P[ext] with R[A] .. R[A + C - 1] */             \
+        /* class instances on the gc heap, L = the module's layouts */              \
+        X(NEW)          /* R[A] = new object of L[ext] */                           \
+        X(GETF)         /* R[A] = R[B].slot[C]                (8 byte slots) */     \
+        X(SETF)         /* R[A].slot[C] = R[B] */                                   \
+        X(SETR)         /* R[A].slot[C] = R[B]                (reference, barrier) */     \
+        /* immutable strings, a string register holds an index into the strings */ \
+        /* of the interpreter's current run, S = the module's literals */           \
+        X(SLIT)         /* R[A] = S[ext] */                                         \
+        X(SCAT)         /* R[A] = R[B] + R[C] */                                    \
+        X(SLEN)         /* R[A] = length of R[B] */                                 \
+        X(SEQ)          /* R[A] = R[B] == R[C] */                                   \
+        X(SDATA)        /* R[A] = address of the text of R[B]   ('\0' terminated) */
+
+    enum class OpCode : u8 {
+#define CAL_VM_OPCODE_ENUM(name) name,
+        CAL_VM_OPCODES(CAL_VM_OPCODE_ENUM)
+#undef CAL_VM_OPCODE_ENUM
+        COUNT
+    };
+
+    const char* getOpCodeName(OpCode op);
+    // number of words the instruction takes, including the extension word
+    u32 getOpCodeLength(OpCode op);
+
+    using Instruction = u32;
+
+    inline Instruction encodeABC(OpCode op, u8 a, u8 b, u8 c) {
+        return u32(op) | (u32(a) << 8) | (u32(b) << 16) | (u32(c) << 24);
+    }
+
+    inline Instruction encodeABx(OpCode op, u8 a, u16 bx) {
+        return u32(op) | (u32(a) << 8) | (u32(bx) << 16);
+    }
+
+    inline Instruction encodeAsBx(OpCode op, u8 a, i16 sbx) {
+        return encodeABx(op, a, u16(sbx));
+    }
+
+    inline OpCode decodeOp(Instruction i) { return OpCode(i & 0xff); }
+    inline u8 decodeA(Instruction i) { return u8(i >> 8); }
+    inline u8 decodeB(Instruction i) { return u8(i >> 16); }
+    inline u8 decodeC(Instruction i) { return u8(i >> 24); }
+    inline i8 decodeSC(Instruction i) { return i8(i >> 24); }
+    inline u16 decodeBx(Instruction i) { return u16(i >> 16); }
+    inline i16 decodeSBx(Instruction i) { return i16(i >> 16); }
+
+    union Value {
+        i64 i;
+        double f;
+
+        static Value fromInt(i64 v) { Value r; r.i = v; return r; }
+        static Value fromFloat(double v) { Value r; r.f = v; return r; }
+    };
+
+    static_assert(sizeof(Value) == 8, "vm value must stay 8 bytes");
+
+    // PRINTF of the interpreter and of tiered-up code, args holds one register per format argument.
+    // %s takes the address of a nul terminated string
+    void printFormat(const runtime::FormatProgram& format, const Value* args);
+
+    enum class ValueKind : u8 {
+        Void, Int, Float
+    };
+
+    // signature of tiered-up functions : args point at param_count values, a non zero status means the call failed
+    using NativeEntry = u64(*)(const u64* args, u32* status);
+
+    // nested calls allowed per run, shared by the interpreter and tiered-up code
+    static constexpr u32 MAX_CALL_DEPTH = 1024;
+
+    enum class TierState : i32 {
+        Interpreted = 0, Queued, Compiled, Failed
+    };
+
+    // written by the interpreter (counters) and the compile thread (state / native entry)
+    // counters are only hints, updates lost between concurrent interpreters are harmless
+    struct TierProfile {
+        u32 invocations = 0;
+        u32 backedges = 0;
+        volatile i32 state = (i32)TierState::Interpreted;
+        NativeEntry volatile native_entry = nullptr;
+    };
+
+
+    // how much the emitter records for the jit's dwarf output, nothing is recorded with None
+    enum class DebugInfoLevel : u8 {
+        None, LineTables, Full
+    };
+
+    // the source of every instruction from pc up to the next entry
+    struct DebugLine {
+        u32 pc;
+        SourceLocation location;
+    };
+
+    // a named register, live in [begin_pc, end_pc)
+    struct DebugVariable {
+        std::string name;
+        SourceLocation location;
+        u32 begin_pc;
+        u32 end_pc;
+        u8 reg;
+        ValueKind kind;
+    };
+
+
+    // reference registers live at a safepoint (NEW, and CALL for the frames below the callee),
+    // the gc reads and updates exactly these, every other register may hold anything
+    struct ReferenceMap {
+        u32 pc;
+        u32 first;      // in BytecodeFunction::reference_registers
+        u32 count;
+    };
+
+
+    struct BytecodeFunction {
+        BytecodeFunction(IAllocator& alloc, const std::string& name, u32 index, u8 param_count)
+            : name(name), index(index), param_count(param_count), code(alloc), constants(alloc), reference_maps(alloc), reference_registers(alloc),
+            debug_lines(alloc), debug_variables(alloc), c_params(alloc) {}
+
+        // nullptr when no reference is live at pc
+        const ReferenceMap* findReferenceMap(u32 pc) const;
+
+        std::string name;
+        u32 index;
+        u8 param_count;
+        u8 register_count = 0;
+        ValueKind return_kind = ValueKind::Void;
+        Array<Instruction> code;
+        Array<Value> constants;
+        mutable TierProfile profile;
+
+        // sorted by pc, empty for functions without references
+        Array<ReferenceMap> reference_maps;
+        Array<u8> reference_registers;
+
+        // only filled when the module has debug info, line / column are resolved by the jit for the
+        // functions it actually compiles, cold code never pays for more than these offsets
+        SourceLocation location = INVALID_SOURCE_LOCATION;
+        Array<DebugLine> debug_lines;
+        Array<DebugVariable> debug_variables;
+
+        // export 'c' : the jit also emits c_symbol with the platform c calling convention,
+        // c_params holds the kind of every param (floats go in fp registers), empty symbol for internal functions
+        std::string c_symbol;
+        Array<ValueKind> c_params;
+    };
+
+
+    class BytecodeModule : public CPrintable
+    {
+    public:
+        BytecodeModule(IAllocator& alloc);
+        ~BytecodeModule();
+
+        BytecodeFunction& addFunction(const std::string& name, u8 param_count);
+        // returns -1 when not found
+        i32 findFunction(const std::string& name) const;
+
+        BytecodeFunction& getFunction(u32 idx) const { return *m_functions[idx]; }
+        u32 getFunctionCount() const { return m_functions.size(); }
+        // formats are compiled once by the emitter, the module owns them and PRINTF names them by index
+        u32 addFormat(runtime::FormatProgram* format);
+        const runtime::FormatProgram& getFormat(u32 idx) const { return *m_formats[idx]; }
+        u32 getFormatCount() const { return m_formats.size(); }
+        // layouts of the classes NEW creates, they have to outlive the module
+        u32 addLayout(const runtime::ObjectLayout& layout);
+        const runtime::ObjectLayout& getLayout(u32 idx) const { return *m_layouts[idx]; }
+        u32 getLayoutCount() const { return m_layouts.size(); }
+        // literals SLIT loads, equal text shares one index. sealed once every function is emitted,
+        // a module with unsealed literals does not run
+        u32 addString(StringView text);
+        void sealStrings();
+        const runtime::StringLiterals& getStrings() const { return *m_strings; }
+        IAllocator& getAllocator() const { return m_alloc; }
+
+        // sources has to outlive the module and every function compiled from it
+        void setDebugInfo(DebugInfoLevel level, const SourceMap* sources) { m_debug_level = level; m_sources = sources; }
+        DebugInfoLevel getDebugInfoLevel() const { return m_sources ? m_debug_level : DebugInfoLevel::None; }
+        const SourceMap* getSourceMap() const { return m_sources; }
+
+        virtual void debugPrint() const override;
+        virtual std::string buildOutput() const override;
+
+    private:
+        IAllocator& m_alloc;
+        Array<BytecodeFunction*> m_functions;
+        HashMap<std::string, u32> m_function_map;
+        Array<runtime::FormatProgram*> m_formats;
+        Array<const runtime::ObjectLayout*> m_layouts;
+        runtime::StringLiterals* m_strings;
+        DebugInfoLevel m_debug_level = DebugInfoLevel::None;
+        const SourceMap* m_sources = nullptr;
+    };
+}
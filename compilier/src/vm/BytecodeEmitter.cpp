@@ -0,0 +1,510 @@
+#include "BytecodeEmitter.hpp"
+
+#include "base/Logger.hpp"
+#include "runtime/Format.hpp"
+
+#include <cstring>
+
+namespace cal::vm {
+
+    static constexpr u32 OPEN_VARIABLE = 0xffFFffFF;
+
+
+    BytecodeEmitter::BytecodeEmitter(BytecodeModule& module)
+        : m_module(module),
+        m_results(module.getAllocator()),
+        m_labels(module.getAllocator()),
+        m_fixups(module.getAllocator()),
+        m_constant_map(module.getAllocator())
+    {
+    }
+
+
+    BytecodeEmitter::~BytecodeEmitter() {
+        ASSERT(m_function == nullptr);
+    }
+
+
+    BytecodeFunction& BytecodeEmitter::beginFunction(const std::string& name, u8 param_count, SourceLocation location) {
+        ASSERT(m_function == nullptr);
+        m_function = &m_module.addFunction(name, param_count);
+        m_debug_level = m_module.getDebugInfoLevel();
+        m_open_variables = 0;
+        if (m_debug_level != DebugInfoLevel::None) {
+            m_function->location = location;
+            setLocation(location);
+        }
+        m_next_register = param_count;
+        m_max_register = param_count;
+        m_last_kind = ValueKind::Void;
+        m_last_is_ext = false;
+        memset(m_live_references, 0, sizeof(m_live_references));
+        m_has_references = false;
+        m_results.clear();
+        m_labels.clear();
+        m_fixups.clear();
+        m_constant_map.clear();
+        return *m_function;
+    }
+
+
+    void BytecodeEmitter::endFunction() {
+        ASSERT(m_function);
+        ASSERT(m_results.empty());
+
+        auto& code = m_function->code;
+        const bool is_target = m_labels.indexOf((i32)code.size()) >= 0;
+        if (code.empty() || m_last_is_ext || decodeOp(code.last()) != OpCode::RET || is_target) {
+            // implicit "return 0" for functions falling off their end
+            const u8 reg = allocRegister();
+            emitLoadInt(reg, 0);
+            emit(encodeABC(OpCode::RET, reg, 0, 0));
+            freeRegister(reg);
+        }
+
+        resolveFixups();
+        endVariables(0);
+        m_function->register_count = (u8)(m_max_register == 0 ? 1 : m_max_register);
+        m_function = nullptr;
+    }
+
+
+    u8 BytecodeEmitter::allocRegister() {
+        ASSERT(m_function);
+        if (m_next_register >= MAX_REGISTERS) {
+            LogError("[VM] register limit reached in function ", m_function->name);
+            ASSERT(false);
+            return MAX_REGISTERS - 1;
+        }
+        const u8 reg = (u8)m_next_register++;
+        if (m_next_register > m_max_register) m_max_register = m_next_register;
+        return reg;
+    }
+
+
+    void BytecodeEmitter::freeRegister(u8 reg) {
+        // params are never released, temporaries must be released in reverse order
+        if (reg < m_function->param_count) return;
+        ASSERT(reg + 1u == m_next_register);
+        m_next_register = reg;
+        m_live_references[reg / 64] &= ~(1ull << (reg % 64));
+        if (m_debug_level == DebugInfoLevel::Full) endVariables(reg);
+    }
+
+
+    u8 BytecodeEmitter::allocReference() {
+        const u8 reg = allocRegister();
+        // whatever the register held before is not a reference
+        emitLoadInt(reg, 0);
+        m_live_references[reg / 64] |= 1ull << (reg % 64);
+        m_has_references = true;
+        return reg;
+    }
+
+
+    void BytecodeEmitter::markReferenceParam(u8 idx) {
+        ASSERT(idx < m_function->param_count);
+        m_live_references[idx / 64] |= 1ull << (idx % 64);
+        m_has_references = true;
+    }
+
+
+    void BytecodeEmitter::recordReferences(u32 limit) {
+        if (!m_has_references) return;
+
+        auto& registers = m_function->reference_registers;
+        const u32 first = registers.size();
+        for (u32 reg = 0; reg < limit; ++reg) {
+            if (m_live_references[reg / 64] & (1ull << (reg % 64))) registers.push((u8)reg);
+        }
+        if ((u32)registers.size() == first) return;
+        m_function->reference_maps.push(ReferenceMap{ (u32)m_function->code.size(), first, registers.size() - first });
+    }
+
+
+    u8 BytecodeEmitter::allocRegisterBlock(u32 count) {
+        ASSERT(count > 0);
+        const u8 first = allocRegister();
+        for (u32 i = 1; i < count; ++i) {
+            allocRegister();
+        }
+        return first;
+    }
+
+
+    void BytecodeEmitter::freeRegisterBlock(u8 first, u32 count) {
+        for (u32 i = count; i > 0; --i) {
+            freeRegister((u8)(first + i - 1));
+        }
+    }
+
+
+    void BytecodeEmitter::setLocation(SourceLocation location) {
+        if (m_debug_level == DebugInfoLevel::None || location == INVALID_SOURCE_LOCATION) return;
+
+        auto& lines = m_function->debug_lines;
+        const u32 pc = m_function->code.size();
+        if (!lines.empty() && lines.last().location == location) return;
+        if (!lines.empty() && lines.last().pc == pc) lines.last().location = location;
+        else lines.push(DebugLine{ pc, location });
+    }
+
+
+    void BytecodeEmitter::declareVariable(const std::string& name, u8 reg, ValueKind kind, SourceLocation location) {
+        if (m_debug_level != DebugInfoLevel::Full) return;
+
+        m_function->debug_variables.push(DebugVariable{ name, location, (u32)m_function->code.size(), OPEN_VARIABLE, reg, kind });
+    }
+
+
+    void BytecodeEmitter::endVariables(u8 from_reg) {
+        // registers are freed like a stack, so the open variables living in them are at the back
+        auto& variables = m_function->debug_variables;
+        const u32 pc = m_function->code.size();
+        for (u32 i = m_open_variables; i < (u32)variables.size(); ++i) {
+            DebugVariable& variable = variables[i];
+            if (variable.end_pc == OPEN_VARIABLE && variable.reg >= from_reg) variable.end_pc = pc;
+        }
+        while (m_open_variables < (u32)variables.size() && variables[m_open_variables].end_pc != OPEN_VARIABLE) ++m_open_variables;
+    }
+
+
+    void BytecodeEmitter::pushResult(u8 reg, ValueKind kind) {
+        m_results.push(reg);
+        m_last_kind = kind;
+    }
+
+
+    u8 BytecodeEmitter::popResult() {
+        ASSERT(!m_results.empty());
+        const u8 reg = m_results.last();
+        m_results.pop();
+        return reg;
+    }
+
+
+    u16 BytecodeEmitter::addConstant(Value value) {
+        auto iter = m_constant_map.find((u64)value.i);
+        if (iter.isValid()) return iter.value();
+
+        ASSERT(m_function->constants.size() < 0xffff);
+        const u16 idx = (u16)m_function->constants.size();
+        m_function->constants.push(value);
+        m_constant_map.insert((u64)value.i, idx);
+        return idx;
+    }
+
+
+    void BytecodeEmitter::emitLoadInt(u8 dst, i64 value) {
+        if (value >= kMinI16 && value <= kMaxI16) {
+            emit(encodeAsBx(OpCode::LOADI, dst, (i16)value));
+            return;
+        }
+        emit(encodeABx(OpCode::LOADK, dst, addConstant(Value::fromInt(value))));
+    }
+
+
+    void BytecodeEmitter::emitLoadFloat(u8 dst, double value) {
+        emit(encodeABx(OpCode::LOADK, dst, addConstant(Value::fromFloat(value))));
+    }
+
+
+    void BytecodeEmitter::emitMove(u8 dst, u8 src) {
+        if (dst == src) return;
+        emit(encodeABC(OpCode::MOVE, dst, src, 0));
+    }
+
+
+    void BytecodeEmitter::emitUnary(OpCode op, u8 dst, u8 src) {
+        emit(encodeABC(op, dst, src, 0));
+    }
+
+
+    void BytecodeEmitter::emitBinary(OpCode op, u8 dst, u8 lhs, u8 rhs) {
+        // fold "LOADI tmp, k; ADD_I dst, lhs, tmp" into ADDI when the constant fits into sC
+        auto& code = m_function->code;
+        if ((op == OpCode::ADD_I || op == OpCode::SUB_I) && !code.empty() && !m_last_is_ext) {
+            const Instruction prev = code.last();
+            const bool is_tmp = rhs + 1u == m_next_register && rhs >= m_function->param_count;
+            const bool is_target = m_labels.indexOf((i32)code.size()) >= 0;
+            if (decodeOp(prev) == OpCode::LOADI && decodeA(prev) == rhs && is_tmp && !is_target && lhs != rhs) {
+                const i32 imm = op == OpCode::ADD_I ? decodeSBx(prev) : -(i32)decodeSBx(prev);
+                if (imm >= kMinI8 && imm <= kMaxI8) {
+                    code.pop();
+                    emitAddImmediate(dst, lhs, imm);
+                    return;
+                }
+            }
+        }
+        emit(encodeABC(op, dst, lhs, rhs));
+    }
+
+
+    void BytecodeEmitter::emitAddImmediate(u8 dst, u8 src, i32 value) {
+        ASSERT(value >= kMinI8 && value <= kMaxI8);
+        emit(encodeABC(OpCode::ADDI, dst, src, (u8)(i8)value));
+    }
+
+
+    BytecodeEmitter::Label BytecodeEmitter::newLabel() {
+        Label label;
+        label.id = m_labels.size();
+        m_labels.push(-1);
+        return label;
+    }
+
+
+    void BytecodeEmitter::bindLabel(Label label) {
+        ASSERT(label.isValid());
+        ASSERT(m_labels[label.id] == -1);
+        m_labels[label.id] = m_function->code.size();
+    }
+
+
+    void BytecodeEmitter::emitBranch(Instruction ins, Label target, bool has_ext) {
+        ASSERT(target.isValid());
+        const u32 at = m_function->code.size();
+        emit(ins);
+        if (has_ext) emitExt(0);
+        m_fixups.push(Fixup{ has_ext ? at + 1 : at, (u32)m_function->code.size(), target.id, has_ext });
+    }
+
+
+    void BytecodeEmitter::emitJump(Label target) {
+        emitBranch(encodeAsBx(OpCode::JMP, 0, 0), target, false);
+    }
+
+
+    void BytecodeEmitter::emitJumpIf(u8 cond, Label target, bool expected) {
+        emitBranch(encodeAsBx(expected ? OpCode::JMP_IF : OpCode::JMP_IF_NOT, cond, 0), target, false);
+    }
+
+
+    void BytecodeEmitter::emitCompareJump(OpCode op, u8 lhs, u8 rhs, Label target, bool expected) {
+        switch (op) {
+        case OpCode::EQ_I:
+            emitBranch(encodeABC(expected ? OpCode::JEQ_I : OpCode::JNE_I, lhs, rhs, 0), target, true);
+            break;
+        case OpCode::LT_I:
+            // !(a < b) == (b <= a)
+            if (expected) emitBranch(encodeABC(OpCode::JLT_I, lhs, rhs, 0), target, true);
+            else emitBranch(encodeABC(OpCode::JLE_I, rhs, lhs, 0), target, true);
+            break;
+        case OpCode::LE_I:
+            if (expected) emitBranch(encodeABC(OpCode::JLE_I, lhs, rhs, 0), target, true);
+            else emitBranch(encodeABC(OpCode::JLT_I, rhs, lhs, 0), target, true);
+            break;
+        default:
+            LogError("[VM] unsupported compare opcode : ", getOpCodeName(op));
+            ASSERT(false);
+            break;
+        }
+    }
+
+
+    void BytecodeEmitter::emitLoopBackEdge(u8 counter, u8 limit, Label loop_head) {
+        emitBranch(encodeABC(OpCode::INCLT_I, counter, limit, 0), loop_head, true);
+    }
+
+
+    void BytecodeEmitter::emitArrayGet(u8 dst, u8 array, u32 length, u8 index, bool in_bounds) {
+        emit(encodeABC(in_bounds ? OpCode::GETXU : OpCode::GETX, dst, array, index));
+        emitExt(length);
+    }
+
+
+    void BytecodeEmitter::emitArraySet(u8 array, u32 length, u8 index, u8 src, bool in_bounds) {
+        emit(encodeABC(in_bounds ? OpCode::SETXU : OpCode::SETX, src, array, index));
+        emitExt(length);
+    }
+
+
+    bool BytecodeEmitter::emitArrayGetConstant(u8 dst, u8 array, u32 length, i64 index) {
+        if (index < 0 || (u64)index >= length) {
+            LogError("[VM] index ", index, " is out of bounds of an array of ", length, " in ", m_function->name);
+            return false;
+        }
+        emitMove(dst, (u8)(array + index));
+        return true;
+    }
+
+
+    bool BytecodeEmitter::emitArraySetConstant(u8 array, u32 length, i64 index, u8 src) {
+        if (index < 0 || (u64)index >= length) {
+            LogError("[VM] index ", index, " is out of bounds of an array of ", length, " in ", m_function->name);
+            return false;
+        }
+        emitMove((u8)(array + index), src);
+        return true;
+    }
+
+
+    void BytecodeEmitter::emitAlloc(u8 dst, u8 size) {
+        emit(encodeABC(OpCode::ALLOC, dst, size, 0));
+    }
+
+
+    void BytecodeEmitter::emitFree(u8 ptr) {
+        emit(encodeABC(OpCode::FREE, ptr, 0, 0));
+    }
+
+
+    void BytecodeEmitter::emitMemCopy(u8 dst, u8 src, u8 size) {
+        emit(encodeABC(OpCode::MEMCPY, dst, src, size));
+    }
+
+
+    void BytecodeEmitter::emitPointerLoad(u8 dst, u8 ptr, u8 width) {
+        ASSERT(width == 1 || width == 2 || width == 4 || width == 8);
+        emit(encodeABC(OpCode::PLOAD, dst, ptr, width));
+    }
+
+
+    void BytecodeEmitter::emitPointerStore(u8 ptr, u8 src, u8 width) {
+        ASSERT(width == 1 || width == 2 || width == 4 || width == 8);
+        emit(encodeABC(OpCode::PSTORE, ptr, src, width));
+    }
+
+
+    void BytecodeEmitter::setExportC(const std::string& symbol, Span<const ValueKind> params) {
+        ASSERT(params.length() == m_function->param_count);
+        m_function->c_symbol = symbol;
+        m_function->c_params.clear();
+        for (u32 i = 0; i < params.length(); ++i) {
+            m_function->c_params.push(params[i]);
+        }
+    }
+
+
+    void BytecodeEmitter::emitNew(u8 dst, u32 layout_idx) {
+        ASSERT(layout_idx < m_module.getLayoutCount());
+        recordReferences(MAX_REGISTERS);
+        emit(encodeABC(OpCode::NEW, dst, 0, 0));
+        emitExt(layout_idx);
+    }
+
+
+    void BytecodeEmitter::emitGetField(u8 dst, u8 object, u8 slot) {
+        emit(encodeABC(OpCode::GETF, dst, object, slot));
+    }
+
+
+    void BytecodeEmitter::emitSetField(u8 object, u8 slot, u8 src, bool is_reference) {
+        emit(encodeABC(is_reference ? OpCode::SETR : OpCode::SETF, object, src, slot));
+    }
+
+
+    void BytecodeEmitter::emitStringLiteral(u8 dst, StringView text) {
+        emit(encodeABC(OpCode::SLIT, dst, 0, 0));
+        emitExt(m_module.addString(text));
+    }
+
+
+    void BytecodeEmitter::emitStringConcat(u8 dst, u8 lhs, u8 rhs) {
+        emit(encodeABC(OpCode::SCAT, dst, lhs, rhs));
+    }
+
+
+    void BytecodeEmitter::emitStringLength(u8 dst, u8 src) {
+        emit(encodeABC(OpCode::SLEN, dst, src, 0));
+    }
+
+
+    void BytecodeEmitter::emitStringEqual(u8 dst, u8 lhs, u8 rhs) {
+        emit(encodeABC(OpCode::SEQ, dst, lhs, rhs));
+    }
+
+
+    void BytecodeEmitter::emitStringData(u8 dst, u8 src) {
+        emit(encodeABC(OpCode::SDATA, dst, src, 0));
+    }
+
+
+    void BytecodeEmitter::emitCall(u8 base, u32 func_idx, u8 arg_count) {
+        // args are handed over to the callee, it may reuse their registers for anything
+        recordReferences(base);
+        emit(encodeABC(OpCode::CALL, base, 0, arg_count));
+        emitExt(func_idx);
+    }
+
+
+    void BytecodeEmitter::emitReturn(u8 reg, ValueKind kind) {
+        m_function->return_kind = kind;
+        auto& code = m_function->code;
+        if (!code.empty() && !m_last_is_ext) {
+            const Instruction prev = code.last();
+            if (decodeOp(prev) == OpCode::LOADK && decodeA(prev) == reg) {
+                code.last() = encodeABx(OpCode::RETK, 0, decodeBx(prev));
+                // keep the trailing RET so endFunction() sees a terminated body
+                emit(encodeABC(OpCode::RET, reg, 0, 0));
+                return;
+            }
+        }
+        emit(encodeABC(OpCode::RET, reg, 0, 0));
+    }
+
+
+    i32 BytecodeEmitter::instantiateFunction(GenericId generic, Span<ASTNodeType* const> args) {
+        const auto* shared = (const BytecodeModule*)InstantiationCache::get().instantiate(generic, args);
+        if (!shared) return -1;
+
+        const BytecodeFunction& source = shared->getFunction(0);
+        const i32 existing = m_module.findFunction(source.name);
+        if (existing >= 0) return existing;
+
+        // instantiations are leaf functions, their code does not depend on the module they land in
+        BytecodeFunction& func = m_module.addFunction(source.name, source.param_count);
+        func.register_count = source.register_count;
+        func.return_kind = source.return_kind;
+        for (Instruction ins : source.code) func.code.push(ins);
+        for (Value value : source.constants) func.constants.push(value);
+        return (i32)func.index;
+    }
+
+
+    bool BytecodeEmitter::emitPrint(u8 base, StringView format, u8 arg_count) {
+        IAllocator& alloc = m_module.getAllocator();
+        auto* program = CAL_NEW(alloc, runtime::FormatProgram)(alloc);
+        std::string error;
+        if (!program->compile(format, error) || program->getArgCount() != arg_count) {
+            if (error.empty()) error = "takes " + std::to_string(program->getArgCount()) + " arguments, got " + std::to_string(arg_count);
+            LogError("[VM] print format in ", m_function->name, " : ", error);
+            CAL_DEL(alloc, program);
+            return false;
+        }
+
+        emit(encodeABC(OpCode::PRINTF, base, 0, arg_count));
+        emitExt(m_module.addFormat(program));
+        return true;
+    }
+
+
+    void BytecodeEmitter::emitReturnConstant(Value value, ValueKind kind) {
+        m_function->return_kind = kind;
+        emit(encodeABx(OpCode::RETK, 0, addConstant(value)));
+        emit(encodeABC(OpCode::RET, 0, 0, 0));
+    }
+
+
+    void BytecodeEmitter::resolveFixups() {
+        auto& code = m_function->code;
+        for (const Fixup& fixup : m_fixups) {
+            const i32 target = m_labels[fixup.label];
+            if (target < 0) {
+                LogError("[VM] unbound label in function ", m_function->name);
+                ASSERT(false);
+                continue;
+            }
+
+            const i32 offset = target - (i32)fixup.from;
+            if (fixup.is_ext) {
+                code[fixup.at] = (u32)offset;
+            }
+            else {
+                ASSERT(offset >= kMinI16 && offset <= kMaxI16);
+                code[fixup.at] = encodeAsBx(decodeOp(code[fixup.at]), decodeA(code[fixup.at]), (i16)offset);
+            }
+        }
+        m_fixups.clear();
+    }
+}
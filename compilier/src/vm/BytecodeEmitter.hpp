@@ -0,0 +1,146 @@
+#pragma once
+
+#include "Bytecode.hpp"
+#include "analyzer/ast/types/InstantiationCache.hpp"
+#include "base/types/Array.hpp"
+#include "base/types/Span.hpp"
+#include "base/types/container/HashMap.hpp"
+
+namespace cal::vm {
+
+    // builds bytecode for one function at a time, ast nodes call into it from emitBytecode()
+    // registers are handed out like a stack : params first, then locals, then temporaries
+    class BytecodeEmitter
+    {
+    public:
+        struct Label {
+            i32 id = -1;
+            bool isValid() const { return id >= 0; }
+        };
+
+        // registers 0 .. 254, BytecodeFunction::register_count has to hold the count
+        static constexpr u32 MAX_REGISTERS = 255;
+
+        BytecodeEmitter(BytecodeModule& module);
+        ~BytecodeEmitter();
+
+        BytecodeFunction& beginFunction(const std::string& name, u8 param_count, SourceLocation location = INVALID_SOURCE_LOCATION);
+        void endFunction();
+
+        // debug info, no-ops unless the module asks for it
+        // every instruction emitted from here on maps back to location
+        void setLocation(SourceLocation location);
+        // reg holds the variable until it is freed (or the function ends), params never end early
+        void declareVariable(const std::string& name, u8 reg, ValueKind kind, SourceLocation location);
+
+        u8 allocRegister();
+        void freeRegister(u8 reg);
+        // fixed size arrays live inline in a block of registers, released like registers (last allocated first)
+        u8 allocRegisterBlock(u32 count);
+        void freeRegisterBlock(u8 first, u32 count);
+        u8 getParamRegister(u8 idx) const { ASSERT(idx < m_function->param_count); return idx; }
+        // a register holding a class instance (or null) until it is freed, the gc finds it through
+        // the reference maps of the NEW and CALL instructions emitted meanwhile. starts out null
+        u8 allocReference();
+        // the caller passes a reference (or null) in this param
+        void markReferenceParam(u8 idx);
+
+        // expression results are passed between nodes through this stack
+        void pushResult(u8 reg, ValueKind kind);
+        u8 popResult();
+        ValueKind lastResultKind() const { return m_last_kind; }
+
+        void emitLoadInt(u8 dst, i64 value);
+        void emitLoadFloat(u8 dst, double value);
+        void emitMove(u8 dst, u8 src);
+        void emitUnary(OpCode op, u8 dst, u8 src);
+        void emitBinary(OpCode op, u8 dst, u8 lhs, u8 rhs);
+        void emitAddImmediate(u8 dst, u8 src, i32 value);
+
+        Label newLabel();
+        void bindLabel(Label label);
+        void emitJump(Label target);
+        void emitJumpIf(u8 cond, Label target, bool expected);
+        // op is one of EQ_I / LT_I / LE_I, lowered to the fused compare-and-branch form
+        void emitCompareJump(OpCode op, u8 lhs, u8 rhs, Label target, bool expected = true);
+        void emitLoopBackEdge(u8 counter, u8 limit, Label loop_head);
+
+        // element access of an inline array of length elements starting at array
+        // in_bounds : the analyzer proved index < length (e.g. the induction variable of "for i in 0..length"),
+        // the check is dropped. a constant index is checked here and becomes a plain MOVE
+        void emitArrayGet(u8 dst, u8 array, u32 length, u8 index, bool in_bounds);
+        void emitArraySet(u8 array, u32 length, u8 index, u8 src, bool in_bounds);
+        [[nodiscard]] bool emitArrayGetConstant(u8 dst, u8 array, u32 length, i64 index);
+        [[nodiscard]] bool emitArraySetConstant(u8 array, u32 length, i64 index, u8 src);
+
+        // unsafe memory (Unsafe.alloc / free / memcpy and ptr<T> access), width is the element size in bytes.
+        // a size known at compile time is simply loaded into the size register, the jit folds it into an inline copy
+        void emitAlloc(u8 dst, u8 size);
+        void emitFree(u8 ptr);
+        void emitMemCopy(u8 dst, u8 src, u8 size);
+        void emitPointerLoad(u8 dst, u8 ptr, u8 width);
+        void emitPointerStore(u8 ptr, u8 src, u8 width);
+
+        // index of the instantiation of generic for args in this module, copied from the process wide
+        // InstantiationCache on first use, -1 when it can not be built. may be called inside a function
+        i32 instantiateFunction(GenericId generic, Span<ASTNodeType* const> args);
+        // class instances, fields are 8 byte slots. is_reference stores go through the write barrier
+        void emitNew(u8 dst, u32 layout_idx);
+        void emitGetField(u8 dst, u8 object, u8 slot);
+        void emitSetField(u8 object, u8 slot, u8 src, bool is_reference);
+        // strings, text is interned in the module's literals (see BytecodeModule::sealStrings()).
+        // string data is the address of the '\0' terminated text, for %s and ptr<u8> access
+        void emitStringLiteral(u8 dst, StringView text);
+        void emitStringConcat(u8 dst, u8 lhs, u8 rhs);
+        void emitStringLength(u8 dst, u8 src);
+        void emitStringEqual(u8 dst, u8 lhs, u8 rhs);
+        void emitStringData(u8 dst, u8 src);
+
+        void emitCall(u8 base, u32 func_idx, u8 arg_count);
+        // system.console print, the format is compiled here and its args sit in base .. base + arg_count - 1 like
+        // call args. false on a bad format or when arg_count does not match it
+        [[nodiscard]] bool emitPrint(u8 base, StringView format, u8 arg_count);
+        void emitReturn(u8 reg, ValueKind kind);
+        void emitReturnConstant(Value value, ValueKind kind);
+
+        BytecodeModule& getModule() { return m_module; }
+        BytecodeFunction* getCurrentFunction() { return m_function; }
+        // marks the current function export 'c', params must list the kind of every param
+        void setExportC(const std::string& symbol, Span<const ValueKind> params);
+
+    private:
+        u16 addConstant(Value value);
+        void emit(Instruction ins) { m_function->code.push(ins); m_last_is_ext = false; }
+        // extension words are data, peephole folds must never decode them as an instruction
+        void emitExt(u32 word) { m_function->code.push(word); m_last_is_ext = true; }
+        void emitBranch(Instruction ins, Label target, bool has_ext);
+        void resolveFixups();
+        void endVariables(u8 from_reg);
+        // the live references below limit become the reference map of the instruction at the current pc
+        void recordReferences(u32 limit);
+
+        struct Fixup {
+            u32 at;       // word to patch
+            u32 from;     // pc the offset is relative to
+            i32 label;
+            bool is_ext;  // patch the whole extension word instead of sBx
+        };
+
+        BytecodeModule& m_module;
+        BytecodeFunction* m_function = nullptr;
+
+        u32 m_next_register = 0;
+        u32 m_max_register = 0;
+        Array<u8> m_results;
+        ValueKind m_last_kind = ValueKind::Void;
+        bool m_last_is_ext = false;
+
+        Array<i32> m_labels;
+        Array<Fixup> m_fixups;
+        HashMap<u64, u16> m_constant_map;
+        DebugInfoLevel m_debug_level = DebugInfoLevel::None;
+        u32 m_open_variables = 0;   // debug_variables before this index are closed
+        u64 m_live_references[4] = {};  // one bit per register
+        bool m_has_references = false;
+    };
+}
@@ -0,0 +1,113 @@
+#include "Generics.hpp"
+
+#include "BytecodeEmitter.hpp"
+#include "analyzer/ast/types/TypePool.hpp"
+#include "base/Logger.hpp"
+#include "base/allocator/Allocators.hpp"
+
+namespace cal::vm {
+
+    static const char* UNSAFE_GENERIC_NAMES[] = { "Unsafe.alloc", "Unsafe.load", "Unsafe.store" };
+    static_assert(sizeof(UNSAFE_GENERIC_NAMES) / sizeof(UNSAFE_GENERIC_NAMES[0]) == (u32)UnsafeGeneric::COUNT);
+
+
+    // bytes per element, 0 for types raw memory can not hold yet (floats, arrays, templates)
+    static u32 getElementWidth(ASTNodeType* type, bool& is_unsigned) {
+        is_unsigned = false;
+        if (!type || type->isArray() || type->getTemplateType()) return 0;
+
+        switch (type->getType()) {
+        case ASTNodeType::Types::i8:
+        case ASTNodeType::Types::boolean: return 1;
+        case ASTNodeType::Types::i16: return 2;
+        case ASTNodeType::Types::i32: return 4;
+        case ASTNodeType::Types::i64: return 8;
+        case ASTNodeType::Types::u8: is_unsigned = true; return 1;
+        case ASTNodeType::Types::u16: is_unsigned = true; return 2;
+        case ASTNodeType::Types::u32: is_unsigned = true; return 4;
+        case ASTNodeType::Types::u64: is_unsigned = true; return 8;
+        default: return 0;
+        }
+    }
+
+
+    // addr = ptr (R0) + index (R1) * width
+    static u8 emitElementAddress(BytecodeEmitter& emitter, u32 width) {
+        const u8 addr = emitter.allocRegister();
+        emitter.emitLoadInt(addr, width);
+        emitter.emitBinary(OpCode::MUL_I, addr, 1, addr);
+        emitter.emitBinary(OpCode::ADD_I, addr, 0, addr);
+        return addr;
+    }
+
+
+    static void* buildUnsafeFunction(void* user, GenericId generic, Span<const TypeId> args) {
+        (void)generic;
+        const UnsafeGeneric kind = (UnsafeGeneric)(uintptr)user;
+        const char* name = UNSAFE_GENERIC_NAMES[(u32)kind];
+
+        ASTNodeType* type = args.length() == 1 ? TypePool::get().findType(args[0]) : nullptr;
+        bool is_unsigned;
+        const u32 width = getElementWidth(type, is_unsigned);
+        if (width == 0) {
+            LogError("[VM] ", name, " takes one integer type argument");
+            return nullptr;
+        }
+
+        IAllocator& alloc = getGlobalAllocator();
+        auto* module = CAL_NEW(alloc, BytecodeModule)(alloc);
+        BytecodeEmitter emitter{ *module };
+        const std::string instance = std::string(name) + "<" + type->getRawTypeName() + ">";
+        switch (kind) {
+        case UnsafeGeneric::Alloc: {
+            emitter.beginFunction(instance, 1);
+            const u8 ptr = emitter.allocRegister();
+            emitter.emitLoadInt(ptr, width);
+            emitter.emitBinary(OpCode::MUL_I, ptr, 0, ptr);
+            emitter.emitAlloc(ptr, ptr);
+            emitter.emitReturn(ptr, ValueKind::Int);
+            break;
+        }
+        case UnsafeGeneric::Load: {
+            emitter.beginFunction(instance, 2);
+            const u8 value = emitElementAddress(emitter, width);
+            emitter.emitPointerLoad(value, value, (u8)width);
+            if (is_unsigned && width < 8) {
+                // PLOAD sign extends, wrap back into [0, 2^bits)
+                const u8 range = emitter.allocRegister();
+                emitter.emitLoadInt(range, (i64)1 << (width * 8));
+                emitter.emitBinary(OpCode::ADD_I, value, value, range);
+                emitter.emitBinary(OpCode::MOD_I, value, value, range);
+                emitter.freeRegister(range);
+            }
+            emitter.emitReturn(value, ValueKind::Int);
+            break;
+        }
+        case UnsafeGeneric::Store: {
+            emitter.beginFunction(instance, 3);
+            const u8 addr = emitElementAddress(emitter, width);
+            emitter.emitPointerStore(addr, 2, (u8)width);
+            emitter.emitReturnConstant(Value::fromInt(0), ValueKind::Void);
+            break;
+        }
+        default:
+            ASSERT(false);
+            break;
+        }
+        emitter.endFunction();
+        return module;
+    }
+
+
+    static void destroyUnsafeFunction(void* user, void* value) {
+        (void)user;
+        CAL_DEL(getGlobalAllocator(), (BytecodeModule*)value);
+    }
+
+
+    GenericId getUnsafeGeneric(UnsafeGeneric generic) {
+        ASSERT(generic < UnsafeGeneric::COUNT);
+        const GenericProvider provider{ buildUnsafeFunction, destroyUnsafeFunction, (void*)(uintptr)generic };
+        return InstantiationCache::get().registerGeneric(UNSAFE_GENERIC_NAMES[(u32)generic], provider);
+    }
+}
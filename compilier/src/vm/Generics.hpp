@@ -0,0 +1,17 @@
+#pragma once
+
+#include "analyzer/ast/types/InstantiationCache.hpp"
+
+namespace cal::vm {
+
+    // generic functions of the Unsafe module, T is an integer type (or bool) and picks the element width :
+    //  alloc<T>(count) -> ptr<T>, load<T>(ptr, index) -> T, store<T>(ptr, index, value)
+    // every instantiation is built once per process through the InstantiationCache,
+    // BytecodeEmitter::instantiateFunction() copies it into the module calling it
+    enum class UnsafeGeneric : u8 {
+        Alloc, Load, Store, COUNT
+    };
+
+    // registered on first use, every module gets the same id
+    GenericId getUnsafeGeneric(UnsafeGeneric generic);
+}
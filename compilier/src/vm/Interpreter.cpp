@@ -0,0 +1,509 @@
+#include "Interpreter.hpp"
+
+#include "base/Logger.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__GNUC__) || defined(__clang__)
+#define CAL_VM_COMPUTED_GOTO 1
+#endif
+
+namespace cal::vm {
+
+    // unsafe pointers carry no alignment, memcpy compiles to a plain move where the target allows it
+    template <typename T>
+    static i64 loadUnaligned(const void* ptr) {
+        T value;
+        memcpy(&value, ptr, sizeof(T));
+        return value;
+    }
+
+
+    template <typename T>
+    static void storeUnaligned(void* ptr, i64 value) {
+        const T narrowed = (T)value;
+        memcpy(ptr, &narrowed, sizeof(T));
+    }
+
+
+    // object is a class instance with at least slot + 1 slots
+    static bool isField(const void* object, u8 slot) {
+        return object && (u32)slot * 8 + 8 <= runtime::Heap::getHeader((void*)object)->layout->size;
+    }
+
+
+    Interpreter::Interpreter(IAllocator& alloc)
+        : m_registers(alloc),
+        m_frames(alloc),
+        m_depth(&m_own_depth),
+        m_strings(alloc),
+        m_string_data(64 * 1024, false)
+    {
+    }
+
+
+    Interpreter::~Interpreter() {
+        setHeap(nullptr, nullptr);
+        m_string_data.reset();
+    }
+
+
+    void Interpreter::setTierListener(TierListener* listener, u32 invocation_threshold, u32 backedge_threshold) {
+        m_listener = listener;
+        m_invocation_threshold = invocation_threshold;
+        m_backedge_threshold = backedge_threshold;
+    }
+
+
+    void Interpreter::setCallDepth(u32* depth) {
+        m_depth = depth ? depth : &m_own_depth;
+    }
+
+
+    void Interpreter::setHeap(runtime::Heap* heap, runtime::Mutator* mutator) {
+        if (m_mutator && m_mutator->scanner == this) m_mutator->scanner = nullptr;
+        m_heap = heap;
+        m_mutator = heap ? mutator : nullptr;
+        if (m_mutator) m_mutator->scanner = this;
+    }
+
+
+    void Interpreter::scanRoots(Visitor visit, void* context) {
+        if (!m_safepoint_func) return;
+
+        auto scanFrame = [&](const BytecodeFunction& func, u32 pc, u32 base) {
+            const ReferenceMap* map = func.findReferenceMap(pc);
+            if (!map) return;
+            for (u32 i = 0; i < map->count; ++i) {
+                visit((void**)&m_registers[base + func.reference_registers[map->first + i]], context);
+            }
+        };
+        scanFrame(*m_safepoint_func, m_safepoint_pc, m_safepoint_base);
+        // every other frame waits in a CALL, its pc already points past it
+        for (const Frame& frame : m_frames) {
+            scanFrame(*frame.func, (u32)(frame.pc - frame.func->code.begin()) - getOpCodeLength(OpCode::CALL), frame.base);
+        }
+    }
+
+
+    const runtime::StringValue* Interpreter::getString(Value value) const {
+        return (u64)value.i < (u64)m_strings.size() ? &m_strings[(u32)value.i] : nullptr;
+    }
+
+
+    bool Interpreter::fail(const std::string& message) {
+        m_error = message;
+        LogError("[VM] ", message);
+        m_frames.clear();
+        *m_depth = m_entry_depth;
+        return false;
+    }
+
+
+    void Interpreter::ensureRegisters(u32 count) {
+        if ((u32)m_registers.size() >= count) return;
+        m_registers.resize(count);
+    }
+
+
+    bool Interpreter::run(const BytecodeModule& module, u32 func_idx, Span<const Value> args, Value& result) {
+        m_entry_depth = *m_depth;
+        if (func_idx >= module.getFunctionCount()) {
+            return fail("invalid function index");
+        }
+
+        const BytecodeFunction* func = &module.getFunction(func_idx);
+        if (args.length() != func->param_count) {
+            return fail("argument count mismatch calling " + func->name);
+        }
+
+        m_error.clear();
+        m_frames.clear();
+        m_strings.clear();
+        m_string_data.reset();
+        ensureRegisters(func->register_count);
+        for (u32 i = 0; i < args.length(); ++i) {
+            m_registers[i] = args[i];
+        }
+
+        const Instruction* pc = func->code.begin();
+        const Value* K = func->constants.begin();
+        Value* R = m_registers.begin();
+        u32 base = 0;
+        Instruction ins;
+        Value ret_value;
+
+#define VM_COUNT_INVOCATION() \
+        if (m_listener && ++func->profile.invocations == m_invocation_threshold) m_listener->onHotFunction(module, *func)
+#define VM_COUNT_BACKEDGE() \
+        if (m_listener && ++func->profile.backedges == m_backedge_threshold) m_listener->onHotFunction(module, *func)
+
+        VM_COUNT_INVOCATION();
+
+#ifdef CAL_VM_COMPUTED_GOTO
+        // one slot per opcode plus the invalid one every byte past the last opcode maps to
+        static void* const DISPATCH[(u32)OpCode::COUNT + 1] = {
+#define CAL_VM_OPCODE_LABEL(name) &&L_##name,
+            CAL_VM_OPCODES(CAL_VM_OPCODE_LABEL)
+#undef CAL_VM_OPCODE_LABEL
+            &&L_INVALID
+        };
+#define VM_CASE(name) L_##name:
+#define VM_DISPATCH() do { ins = *pc++; goto *DISPATCH[std::min<u32>(ins & 0xff, (u32)OpCode::COUNT)]; } while (false)
+        VM_DISPATCH();
+#else
+#define VM_CASE(name) case OpCode::name:
+#define VM_DISPATCH() continue
+        for (;;) {
+            ins = *pc++;
+            switch (decodeOp(ins)) {
+#endif
+
+        VM_CASE(NOP) {
+            VM_DISPATCH();
+        }
+        VM_CASE(MOVE) {
+            R[decodeA(ins)] = R[decodeB(ins)];
+            VM_DISPATCH();
+        }
+        VM_CASE(LOADK) {
+            R[decodeA(ins)] = K[decodeBx(ins)];
+            VM_DISPATCH();
+        }
+        VM_CASE(LOADI) {
+            R[decodeA(ins)].i = decodeSBx(ins);
+            VM_DISPATCH();
+        }
+        VM_CASE(ADD_I) {
+            R[decodeA(ins)].i = R[decodeB(ins)].i + R[decodeC(ins)].i;
+            VM_DISPATCH();
+        }
+        VM_CASE(SUB_I) {
+            R[decodeA(ins)].i = R[decodeB(ins)].i - R[decodeC(ins)].i;
+            VM_DISPATCH();
+        }
+        VM_CASE(MUL_I) {
+            R[decodeA(ins)].i = R[decodeB(ins)].i * R[decodeC(ins)].i;
+            VM_DISPATCH();
+        }
+        VM_CASE(DIV_I) {
+            const i64 rhs = R[decodeC(ins)].i;
+            const i64 lhs = R[decodeB(ins)].i;
+            if (rhs == 0) return fail("integer division by zero");
+            if (rhs == -1 && lhs == INT64_MIN) return fail("integer division overflow");
+            R[decodeA(ins)].i = lhs / rhs;
+            VM_DISPATCH();
+        }
+        VM_CASE(MOD_I) {
+            const i64 rhs = R[decodeC(ins)].i;
+            if (rhs == 0) return fail("integer division by zero");
+            // INT64_MIN % -1 traps on x86 although the result is 0
+            R[decodeA(ins)].i = rhs == -1 ? 0 : R[decodeB(ins)].i % rhs;
+            VM_DISPATCH();
+        }
+        VM_CASE(NEG_I) {
+            R[decodeA(ins)].i = -R[decodeB(ins)].i;
+            VM_DISPATCH();
+        }
+        VM_CASE(ADD_F) {
+            R[decodeA(ins)].f = R[decodeB(ins)].f + R[decodeC(ins)].f;
+            VM_DISPATCH();
+        }
+        VM_CASE(SUB_F) {
+            R[decodeA(ins)].f = R[decodeB(ins)].f - R[decodeC(ins)].f;
+            VM_DISPATCH();
+        }
+        VM_CASE(MUL_F) {
+            R[decodeA(ins)].f = R[decodeB(ins)].f * R[decodeC(ins)].f;
+            VM_DISPATCH();
+        }
+        VM_CASE(DIV_F) {
+            R[decodeA(ins)].f = R[decodeB(ins)].f / R[decodeC(ins)].f;
+            VM_DISPATCH();
+        }
+        VM_CASE(NEG_F) {
+            R[decodeA(ins)].f = -R[decodeB(ins)].f;
+            VM_DISPATCH();
+        }
+        VM_CASE(I2F) {
+            R[decodeA(ins)].f = (double)R[decodeB(ins)].i;
+            VM_DISPATCH();
+        }
+        VM_CASE(F2I) {
+            R[decodeA(ins)].i = (i64)R[decodeB(ins)].f;
+            VM_DISPATCH();
+        }
+        VM_CASE(EQ_I) {
+            R[decodeA(ins)].i = R[decodeB(ins)].i == R[decodeC(ins)].i;
+            VM_DISPATCH();
+        }
+        VM_CASE(LT_I) {
+            R[decodeA(ins)].i = R[decodeB(ins)].i < R[decodeC(ins)].i;
+            VM_DISPATCH();
+        }
+        VM_CASE(LE_I) {
+            R[decodeA(ins)].i = R[decodeB(ins)].i <= R[decodeC(ins)].i;
+            VM_DISPATCH();
+        }
+        VM_CASE(JMP) {
+            const i16 offset = decodeSBx(ins);
+            if (offset < 0) VM_COUNT_BACKEDGE();
+            pc += offset;
+            VM_DISPATCH();
+        }
+        VM_CASE(JMP_IF) {
+            if (R[decodeA(ins)].i) pc += decodeSBx(ins);
+            VM_DISPATCH();
+        }
+        VM_CASE(JMP_IF_NOT) {
+            if (!R[decodeA(ins)].i) pc += decodeSBx(ins);
+            VM_DISPATCH();
+        }
+        VM_CASE(CALL) {
+            const u32 callee_idx = *pc++;
+            if (callee_idx >= module.getFunctionCount()) return fail("invalid call target in " + func->name);
+            if (*m_depth >= MAX_CALL_DEPTH) return fail("call stack overflow in " + func->name);
+
+            const BytecodeFunction& callee = module.getFunction(callee_idx);
+            const NativeEntry native = callee.profile.native_entry;
+            if (native) {
+                u32 status = 0;
+                const u64 value = native((const u64*)&R[decodeA(ins)], &status);
+                if (status != 0) return fail("native call failed in " + callee.name);
+                R[decodeA(ins)].i = (i64)value;
+                VM_DISPATCH();
+            }
+
+            // arguments already sit in R[A] .. R[A + C - 1], they become the callee's params
+            m_frames.push(Frame{ func, pc, base });
+            ++*m_depth;
+            base += decodeA(ins);
+            func = &callee;
+            ASSERT(decodeC(ins) == func->param_count);
+            VM_COUNT_INVOCATION();
+
+            ensureRegisters(base + func->register_count);
+            R = m_registers.begin() + base;
+            K = func->constants.begin();
+            pc = func->code.begin();
+            VM_DISPATCH();
+        }
+        VM_CASE(RET) {
+            ret_value = R[decodeA(ins)];
+            goto do_return;
+        }
+        VM_CASE(RETK) {
+            ret_value = K[decodeBx(ins)];
+            goto do_return;
+        }
+        VM_CASE(ADDI) {
+            R[decodeA(ins)].i = R[decodeB(ins)].i + decodeSC(ins);
+            VM_DISPATCH();
+        }
+        VM_CASE(JLT_I) {
+            const i32 offset = (i32)*pc++;
+            if (R[decodeA(ins)].i < R[decodeB(ins)].i) pc += offset;
+            VM_DISPATCH();
+        }
+        VM_CASE(JLE_I) {
+            const i32 offset = (i32)*pc++;
+            if (R[decodeA(ins)].i <= R[decodeB(ins)].i) pc += offset;
+            VM_DISPATCH();
+        }
+        VM_CASE(JEQ_I) {
+            const i32 offset = (i32)*pc++;
+            if (R[decodeA(ins)].i == R[decodeB(ins)].i) pc += offset;
+            VM_DISPATCH();
+        }
+        VM_CASE(JNE_I) {
+            const i32 offset = (i32)*pc++;
+            if (R[decodeA(ins)].i != R[decodeB(ins)].i) pc += offset;
+            VM_DISPATCH();
+        }
+        VM_CASE(INCLT_I) {
+            const i32 offset = (i32)*pc++;
+            if (++R[decodeA(ins)].i < R[decodeB(ins)].i) {
+                VM_COUNT_BACKEDGE();
+                pc += offset;
+            }
+            VM_DISPATCH();
+        }
+
+        VM_CASE(GETX) {
+            const u64 index = (u64)R[decodeC(ins)].i;
+            if (index >= *pc++) return fail("array index out of bounds in " + func->name);
+            R[decodeA(ins)] = R[decodeB(ins) + index];
+            VM_DISPATCH();
+        }
+        VM_CASE(SETX) {
+            const u64 index = (u64)R[decodeC(ins)].i;
+            if (index >= *pc++) return fail("array index out of bounds in " + func->name);
+            R[decodeB(ins) + index] = R[decodeA(ins)];
+            VM_DISPATCH();
+        }
+        VM_CASE(GETXU) {
+            ASSERT((u64)R[decodeC(ins)].i < *pc);
+            ++pc;
+            R[decodeA(ins)] = R[decodeB(ins) + R[decodeC(ins)].i];
+            VM_DISPATCH();
+        }
+        VM_CASE(SETXU) {
+            ASSERT((u64)R[decodeC(ins)].i < *pc);
+            ++pc;
+            R[decodeB(ins) + R[decodeC(ins)].i] = R[decodeA(ins)];
+            VM_DISPATCH();
+        }
+
+        VM_CASE(ALLOC) {
+            R[decodeA(ins)].i = (i64)(uintptr)std::malloc((size_t)R[decodeB(ins)].i);
+            VM_DISPATCH();
+        }
+        VM_CASE(FREE) {
+            std::free((void*)(uintptr)R[decodeA(ins)].i);
+            VM_DISPATCH();
+        }
+        VM_CASE(MEMCPY) {
+            std::memcpy((void*)(uintptr)R[decodeA(ins)].i, (const void*)(uintptr)R[decodeB(ins)].i, (size_t)R[decodeC(ins)].i);
+            VM_DISPATCH();
+        }
+        VM_CASE(PLOAD) {
+            const void* ptr = (const void*)(uintptr)R[decodeB(ins)].i;
+            Value& dst = R[decodeA(ins)];
+            switch (decodeC(ins)) {
+            // i8 is plain char, its signedness depends on the target
+            case 1: dst.i = loadUnaligned<signed char>(ptr); break;
+            case 2: dst.i = loadUnaligned<i16>(ptr); break;
+            case 4: dst.i = loadUnaligned<i32>(ptr); break;
+            default: dst.i = loadUnaligned<i64>(ptr); break;
+            }
+            VM_DISPATCH();
+        }
+        VM_CASE(PSTORE) {
+            void* ptr = (void*)(uintptr)R[decodeA(ins)].i;
+            const i64 value = R[decodeB(ins)].i;
+            switch (decodeC(ins)) {
+            case 1: storeUnaligned<i8>(ptr, value); break;
+            case 2: storeUnaligned<i16>(ptr, value); break;
+            case 4: storeUnaligned<i32>(ptr, value); break;
+            default: storeUnaligned<i64>(ptr, value); break;
+            }
+            VM_DISPATCH();
+        }
+        VM_CASE(PRINTF) {
+            printFormat(module.getFormat(*pc++), &R[decodeA(ins)]);
+            VM_DISPATCH();
+        }
+        VM_CASE(NEW) {
+            const u32 layout_idx = *pc++;
+            if (!m_heap) return fail("new without a heap in " + func->name);
+            m_safepoint_func = func;
+            m_safepoint_pc = (u32)(pc - 2 - func->code.begin());
+            m_safepoint_base = base;
+            void* object = m_heap->allocate(*m_mutator, module.getLayout(layout_idx));
+            m_safepoint_func = nullptr;
+            if (!object) return fail("heap exhausted in " + func->name);
+            R[decodeA(ins)].i = (i64)(uintptr)object;
+            VM_DISPATCH();
+        }
+        VM_CASE(GETF) {
+            const i64* object = (const i64*)(uintptr)R[decodeB(ins)].i;
+            if (!isField(object, decodeC(ins))) return fail("null reference or unknown field in " + func->name);
+            R[decodeA(ins)].i = object[decodeC(ins)];
+            VM_DISPATCH();
+        }
+        VM_CASE(SETF) {
+            i64* object = (i64*)(uintptr)R[decodeA(ins)].i;
+            if (!isField(object, decodeC(ins))) return fail("null reference or unknown field in " + func->name);
+            object[decodeC(ins)] = R[decodeB(ins)].i;
+            VM_DISPATCH();
+        }
+        VM_CASE(SETR) {
+            i64* object = (i64*)(uintptr)R[decodeA(ins)].i;
+            if (!m_heap) return fail("reference store without a heap in " + func->name);
+            if (!isField(object, decodeC(ins))) return fail("null reference or unknown field in " + func->name);
+            m_heap->writeReference(object, (void**)&object[decodeC(ins)], (void*)(uintptr)R[decodeB(ins)].i);
+            VM_DISPATCH();
+        }
+
+        VM_CASE(SLIT) {
+            const u32 literal = *pc++;
+            if (!module.getStrings().isSealed()) return fail("string literals of the module are not sealed in " + func->name);
+            R[decodeA(ins)].i = m_strings.size();
+            m_strings.push(module.getStrings().get(literal));
+            VM_DISPATCH();
+        }
+        VM_CASE(SCAT) {
+            const runtime::StringValue* lhs = getString(R[decodeB(ins)]);
+            const runtime::StringValue* rhs = getString(R[decodeC(ins)]);
+            if (!lhs || !rhs) return fail("invalid string in " + func->name);
+            R[decodeA(ins)].i = m_strings.size();
+            m_strings.push(*lhs + *rhs);
+            VM_DISPATCH();
+        }
+        VM_CASE(SLEN) {
+            const runtime::StringValue* str = getString(R[decodeB(ins)]);
+            if (!str) return fail("invalid string in " + func->name);
+            R[decodeA(ins)].i = str->size();
+            VM_DISPATCH();
+        }
+        VM_CASE(SEQ) {
+            const runtime::StringValue* lhs = getString(R[decodeB(ins)]);
+            const runtime::StringValue* rhs = getString(R[decodeC(ins)]);
+            if (!lhs || !rhs) return fail("invalid string in " + func->name);
+            R[decodeA(ins)].i = *lhs == *rhs;
+            VM_DISPATCH();
+        }
+        VM_CASE(SDATA) {
+            const runtime::StringValue* str = getString(R[decodeB(ins)]);
+            if (!str) return fail("invalid string in " + func->name);
+            const StringView text = str->view();
+            const char* data = text.begin;
+            if (str->isSmall()) {
+                char* copy = (char*)m_string_data.allocate(text.size() + 1, 1);
+                memcpy(copy, text.begin, text.size());
+                copy[text.size()] = '\0';
+                data = copy;
+            }
+            R[decodeA(ins)].i = (i64)(uintptr)data;
+            VM_DISPATCH();
+        }
+
+        do_return: {
+            if (m_frames.empty()) {
+                result = ret_value;
+                return true;
+            }
+
+            // the callee window starts at the caller's R[A], so the result lands there
+            m_registers[base] = ret_value;
+            const Frame frame = m_frames.last();
+            m_frames.pop();
+            --*m_depth;
+            func = frame.func;
+            pc = frame.pc;
+            base = frame.base;
+            R = m_registers.begin() + base;
+            K = func->constants.begin();
+            VM_DISPATCH();
+        }
+
+#ifdef CAL_VM_COMPUTED_GOTO
+        L_INVALID:
+            return fail("invalid opcode in " + func->name);
+#else
+            default:
+                return fail("invalid opcode in " + func->name);
+            }
+        }
+#endif
+
+#undef VM_CASE
+#undef VM_DISPATCH
+#undef VM_COUNT_INVOCATION
+#undef VM_COUNT_BACKEDGE
+        return fail("unreachable");
+    }
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "Bytecode.hpp"
+#include "runtime/Heap.hpp"
+#include "runtime/StringValue.hpp"
+#include "base/allocator/LinearAllocator.hpp"
+#include "base/types/Array.hpp"
+#include "base/types/Span.hpp"
+
+#include <string>
+
+namespace cal::vm {
+
+    // notified once a function crosses one of the hotness thresholds
+    struct TierListener {
+        virtual ~TierListener() {}
+        virtual void onHotFunction(const BytecodeModule& module, const BytecodeFunction& func) = 0;
+    };
+
+    // executes bytecode produced by BytecodeEmitter
+    // dispatch uses computed goto on gcc / clang and falls back to a switch elsewhere
+    // bytecode must come from the emitter (or a verified loader) : register operands and indices are not
+    // range checked, an unknown opcode fails the run
+    class Interpreter : public runtime::RootScanner
+    {
+    public:
+        Interpreter(IAllocator& alloc);
+        ~Interpreter();
+
+        [[nodiscard]] bool run(const BytecodeModule& module, u32 func_idx, Span<const Value> args, Value& result);
+        const std::string& getError() const { return m_error; }
+
+        // enables invocation / back edge counting, calls into functions with a native entry go straight to it
+        void setTierListener(TierListener* listener, u32 invocation_threshold, u32 backedge_threshold);
+        // counts frames against MAX_CALL_DEPTH, shared with nested interpreters and native code of the same run.
+        // nullptr goes back to counting this interpreter's frames only
+        void setCallDepth(u32* depth);
+        // NEW allocates on heap, mutator has to be attached by the calling thread. the interpreter becomes the
+        // mutator's root scanner, collections update the references its frames hold (see ReferenceMap).
+        // NEW is the only safepoint : a collection another thread asks for waits until this one allocates
+        void setHeap(runtime::Heap* heap, runtime::Mutator* mutator);
+        void scanRoots(Visitor visit, void* context) override;
+        // string registers index the strings of the current run, they are dropped when the next one starts.
+        // the string a run returned, nullptr when value is not one
+        const runtime::StringValue* getString(Value value) const;
+
+    private:
+        struct Frame {
+            const BytecodeFunction* func;
+            const Instruction* pc;
+            u32 base;
+        };
+
+        bool fail(const std::string& message);
+        void ensureRegisters(u32 count);
+
+        TierListener* m_listener = nullptr;
+        u32 m_invocation_threshold = 0;
+        u32 m_backedge_threshold = 0;
+
+        Array<Value> m_registers;
+        Array<Frame> m_frames;
+        u32 m_own_depth = 0;
+        u32 m_entry_depth = 0;
+        u32* m_depth;
+        std::string m_error;
+
+        runtime::Heap* m_heap = nullptr;
+        runtime::Mutator* m_mutator = nullptr;
+        // the frame executing NEW, the only place a collection can happen
+        const BytecodeFunction* m_safepoint_func = nullptr;
+        u32 m_safepoint_pc = 0;
+        u32 m_safepoint_base = 0;
+
+        Array<runtime::StringValue> m_strings;
+        // SDATA copies of inline strings, m_strings moves them around as it grows
+        LinearAllocator m_string_data;
+    };
+}
@@ -0,0 +1,979 @@
+#include "JitCompiler.hpp"
+
+#include "base/Logger.hpp"
+#include "base/allocator/Allocators.hpp"
+#include "utils/TimeReport.hpp"
+
+#include <llvm/BinaryFormat/Dwarf.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/ExecutionEngine/JITEventListener.h>
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/ObjectTransformLayer.h>
+#include <llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <llvm/IR/DIBuilder.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Intrinsics.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
+#if LLVM_VERSION_MAJOR >= 17
+#include <llvm/ExecutionEngine/Orc/Debugging/DebuggerSupport.h>
+#endif
+
+#include <mutex>
+
+namespace cal::vm {
+
+    // thin-lto style import, callees up to this many words are lowered into their caller's module
+    static constexpr u32 IMPORT_SIZE_LIMIT = 48;
+    static constexpr u32 IMPORT_DEPTH_LIMIT = 3;
+    static constexpr u32 IMPORT_COUNT_LIMIT = 16;
+
+
+    static void initializeNativeTarget() {
+        static std::once_flag flag;
+        std::call_once(flag, [] {
+            llvm::InitializeNativeTarget();
+            llvm::InitializeNativeTargetAsmPrinter();
+        });
+    }
+
+
+    static void optimizeModule(llvm::Module& module) {
+        llvm::LoopAnalysisManager lam;
+        llvm::FunctionAnalysisManager fam;
+        llvm::CGSCCAnalysisManager cgam;
+        llvm::ModuleAnalysisManager mam;
+
+        llvm::PassBuilder builder;
+        builder.registerModuleAnalyses(mam);
+        builder.registerCGSCCAnalyses(cgam);
+        builder.registerFunctionAnalyses(fam);
+        builder.registerLoopAnalyses(lam);
+        builder.crossRegisterProxies(lam, fam, cgam, mam);
+
+        llvm::ModulePassManager passes = builder.buildPerModuleDefaultPipeline(llvm::OptimizationLevel::O2);
+        passes.run(module, mam);
+    }
+
+    //////////////////////////////////////////////
+    // Debug info
+    //////////////////////////////////////////////
+
+    // dwarf for one jitted function, every function gets its own llvm module and context, so the
+    // metadata is built without touching anything shared and only for code that actually got hot
+    struct FunctionDebugInfo {
+        FunctionDebugInfo(llvm::Module& module, const BytecodeModule& bytecode, const BytecodeFunction& func)
+            : builder(module),
+            module(module),
+            level(bytecode.getDebugInfoLevel()),
+            sources(*bytecode.getSourceMap()),
+            func(func)
+        {}
+
+        bool begin(llvm::Function* function, llvm::IRBuilder<>& ir);
+        void setPc(u32 pc, llvm::IRBuilder<>& ir);
+        void declareVariables(const Array<llvm::Value*>& registers, llvm::BasicBlock* block);
+        void finish();
+
+        llvm::DILocation* getLocation(SourceLocation location) const;
+        llvm::DIType* getType(ValueKind kind);
+
+        llvm::DIBuilder builder;
+        llvm::Module& module;
+        DebugInfoLevel level;
+        const SourceMap& sources;
+        const BytecodeFunction& func;
+
+        const SourceFile* source = nullptr;
+        llvm::DIFile* file = nullptr;
+        llvm::DISubprogram* subprogram = nullptr;
+        llvm::DIType* int_type = nullptr;
+        llvm::DIType* float_type = nullptr;
+        u32 next_line = 0;      // next debug_lines entry to apply
+    };
+
+
+    bool FunctionDebugInfo::begin(llvm::Function* function, llvm::IRBuilder<>& ir) {
+        // functions from other files of the build (or without any location) stay without dwarf
+        source = sources.getFile(func.location);
+        if (!source) return false;
+
+        const size_t slash = source->path.find_last_of("/\\");
+        const std::string name = slash == std::string::npos ? source->path : source->path.substr(slash + 1);
+        const std::string dir = slash == std::string::npos ? "." : source->path.substr(0, slash);
+        file = builder.createFile(name, dir);
+
+        const auto emission = level == DebugInfoLevel::Full ? llvm::DICompileUnit::FullDebug : llvm::DICompileUnit::LineTablesOnly;
+        builder.createCompileUnit(llvm::dwarf::DW_LANG_C, file, "cal", true, "", 0, llvm::StringRef(), emission);
+        module.addModuleFlag(llvm::Module::Warning, "Debug Info Version", llvm::DEBUG_METADATA_VERSION);
+        module.addModuleFlag(llvm::Module::Warning, "Dwarf Version", 4);
+
+        llvm::SmallVector<llvm::Metadata*, 8> signature;
+        signature.push_back(getType(func.return_kind == ValueKind::Float ? ValueKind::Float : ValueKind::Int));
+        for (u8 i = 0; i < func.param_count; ++i) {
+            signature.push_back(getType(ValueKind::Int));
+        }
+
+        const LineColumn position = source->lines.getLineColumn(func.location - source->base);
+        subprogram = builder.createFunction(file, func.name, function->getName(), file, position.line + 1,
+            builder.createSubroutineType(builder.getOrCreateTypeArray(signature)), position.line + 1,
+            llvm::DINode::FlagPrototyped, llvm::DISubprogram::toSPFlags(false, true, true));
+        function->setSubprogram(subprogram);
+
+        // the prologue (register allocas, param loads) belongs to the declaration
+        ir.SetCurrentDebugLocation(llvm::DILocation::get(module.getContext(), position.line + 1, position.column + 1, subprogram));
+        return true;
+    }
+
+
+    llvm::DILocation* FunctionDebugInfo::getLocation(SourceLocation location) const {
+        // a location outside the function's file points at the function itself
+        if (location < source->base || location > source->base + source->size) location = func.location;
+        const LineColumn position = source->lines.getLineColumn(location - source->base);
+        return llvm::DILocation::get(module.getContext(), position.line + 1, position.column + 1, subprogram);
+    }
+
+
+    llvm::DIType* FunctionDebugInfo::getType(ValueKind kind) {
+        if (kind == ValueKind::Float) {
+            if (!float_type) float_type = builder.createBasicType("f64", 64, llvm::dwarf::DW_ATE_float);
+            return float_type;
+        }
+        if (!int_type) int_type = builder.createBasicType("i64", 64, llvm::dwarf::DW_ATE_signed);
+        return int_type;
+    }
+
+
+    void FunctionDebugInfo::setPc(u32 pc, llvm::IRBuilder<>& ir) {
+        // pcs only grow while lowering, so the table is walked once
+        const auto& lines = func.debug_lines;
+        if (next_line >= (u32)lines.size() || lines[next_line].pc > pc) return;
+        while (next_line + 1 < (u32)lines.size() && lines[next_line + 1].pc <= pc) ++next_line;
+        ir.SetCurrentDebugLocation(getLocation(lines[next_line].location));
+        ++next_line;
+    }
+
+
+    void FunctionDebugInfo::declareVariables(const Array<llvm::Value*>& registers, llvm::BasicBlock* block) {
+        if (level != DebugInfoLevel::Full) return;
+
+        // declared over the whole function, a register reused by a later variable is described by both
+        for (const DebugVariable& variable : func.debug_variables) {
+            if (variable.reg >= (u32)registers.size()) continue;
+
+            llvm::DILocation* location = getLocation(variable.location);
+            llvm::DILocalVariable* info = variable.reg < func.param_count
+                ? builder.createParameterVariable(subprogram, variable.name, variable.reg + 1, file, location->getLine(), getType(variable.kind), true)
+                : builder.createAutoVariable(subprogram, variable.name, file, location->getLine(), getType(variable.kind), true);
+            builder.insertDeclare(registers[variable.reg], info, builder.createExpression(), location, block);
+        }
+    }
+
+
+    void FunctionDebugInfo::finish() {
+        CAL_TIME_SCOPE("jit debug info");
+        builder.finalizeSubprogram(subprogram);
+        builder.finalize();
+    }
+
+    //////////////////////////////////////////////
+    // Bytecode lowering
+    //////////////////////////////////////////////
+
+    // one llvm function per bytecode function, every register gets its own alloca which the
+    // optimizer promotes, basic blocks start at jump targets and after every branch / return.
+    // functions indexing registers (GETX / SETX) get one register array instead, so b + index stays addressable
+    struct FunctionLowering {
+        FunctionLowering(llvm::LLVMContext& ctx, llvm::Module& module, const BytecodeModule& bytecode, const BytecodeFunction& func)
+            : ctx(ctx),
+            builder(ctx),
+            module(module),
+            bytecode(bytecode),
+            func(func),
+            registers(bytecode.getAllocator()),
+            blocks(bytecode.getAllocator())
+        {
+            i64_type = builder.getInt64Ty();
+            i32_type = builder.getInt32Ty();
+            f64_type = builder.getDoubleTy();
+            i64_ptr_type = llvm::PointerType::getUnqual(i64_type);
+            i32_ptr_type = llvm::PointerType::getUnqual(i32_type);
+            entry_type = llvm::FunctionType::get(i64_type, { i64_ptr_type, i32_ptr_type }, false);
+            trampoline_type = llvm::FunctionType::get(i64_type, { builder.getInt8PtrTy(), i32_type, i64_ptr_type, i32_ptr_type }, false);
+        }
+
+        bool lower(const std::string& symbol, TierTrampoline trampoline, void* runtime, FunctionDebugInfo* debug,
+            llvm::GlobalValue::LinkageTypes linkage = llvm::Function::ExternalLinkage);
+
+        llvm::BasicBlock* blockAt(i32 pc);
+        bool collectBlocks();
+        llvm::BasicBlock* getErrorBlock();
+        llvm::BasicBlock* getPropagateBlock();
+        // every return leaves the frame counted by the prologue, see call_depth
+        void ret(llvm::Value* value);
+        void enterFrame();
+
+        llvm::Value* load(u8 reg) { return builder.CreateLoad(i64_type, registers[reg]); }
+        void store(u8 reg, llvm::Value* value) { builder.CreateStore(value, registers[reg]); }
+        llvm::Value* loadFloat(u8 reg) { return builder.CreateBitCast(load(reg), f64_type); }
+        void storeFloat(u8 reg, llvm::Value* value) { store(reg, builder.CreateBitCast(value, i64_type)); }
+
+        void branch(llvm::Value* cond, i32 target, i32 next);
+        void divide(u8 dst, u8 lhs, u8 rhs, bool is_mod);
+        void call(u8 base, u32 callee_idx, u8 arg_count, TierTrampoline trampoline, void* runtime);
+        llvm::Value* element(u8 array, u32 length, u8 index, bool checked);
+        llvm::Value* pointer(u8 reg, u8 width);
+        void print(u8 base, const runtime::FormatProgram& format, u8 arg_count);
+        // the export 'c' entry point, forwards to function
+        bool lowerExportC();
+
+        llvm::LLVMContext& ctx;
+        llvm::IRBuilder<> builder;
+        llvm::Module& module;
+        const BytecodeModule& bytecode;
+        const BytecodeFunction& func;
+
+        llvm::Type* i64_type;
+        llvm::Type* i32_type;
+        llvm::Type* f64_type;
+        llvm::Type* i64_ptr_type;
+        llvm::Type* i32_ptr_type;
+        llvm::FunctionType* entry_type;
+        llvm::FunctionType* trampoline_type;
+
+        llvm::Function* function = nullptr;
+        llvm::Value* status = nullptr;
+        llvm::Value* call_args = nullptr;
+        llvm::Type* register_array_type = nullptr;
+        llvm::Value* register_array = nullptr;
+        llvm::BasicBlock* error_block = nullptr;
+        llvm::BasicBlock* propagate_block = nullptr;
+
+        Array<llvm::Value*> registers;
+        Array<llvm::BasicBlock*> blocks;
+        const Array<llvm::Function*>* imports = nullptr;   // by function index, callees lowered into this module
+        u32* call_depth = nullptr;                          // shared with the runtime's interpreters, nullptr skips the limit
+        std::string error;
+    };
+
+
+    llvm::BasicBlock* FunctionLowering::blockAt(i32 pc) {
+        if (pc < 0 || pc >= blocks.size()) return nullptr;
+        if (!blocks[pc]) {
+            blocks[pc] = llvm::BasicBlock::Create(ctx, "pc" + std::to_string(pc), function);
+        }
+        return blocks[pc];
+    }
+
+
+    bool FunctionLowering::collectBlocks() {
+        const auto& code = func.code;
+        blocks.resize(code.size());
+        for (auto& block : blocks) block = nullptr;
+
+        blockAt(0);
+        for (i32 pc = 0; pc < code.size();) {
+            const Instruction ins = code[pc];
+            const OpCode op = decodeOp(ins);
+            const i32 next = pc + (i32)getOpCodeLength(op);
+            if (next > code.size()) {
+                error = "truncated instruction in " + func.name;
+                return false;
+            }
+
+            i32 target = -1;
+            switch (op) {
+            case OpCode::JMP:
+            case OpCode::JMP_IF:
+            case OpCode::JMP_IF_NOT:
+                target = next + decodeSBx(ins);
+                break;
+            case OpCode::JLT_I:
+            case OpCode::JLE_I:
+            case OpCode::JEQ_I:
+            case OpCode::JNE_I:
+            case OpCode::INCLT_I:
+                target = next + (i32)code[pc + 1];
+                break;
+            case OpCode::RET:
+            case OpCode::RETK:
+                break;
+            default:
+                pc = next;
+                continue;
+            }
+
+            if (target >= 0 && !blockAt(target)) {
+                error = "jump out of range in " + func.name;
+                return false;
+            }
+            blockAt(next);
+            pc = next;
+        }
+        return true;
+    }
+
+
+    llvm::BasicBlock* FunctionLowering::getErrorBlock() {
+        if (error_block) return error_block;
+
+        auto* saved = builder.GetInsertBlock();
+        error_block = llvm::BasicBlock::Create(ctx, "error", function);
+        builder.SetInsertPoint(error_block);
+        builder.CreateStore(builder.getInt32(1), status);
+        ret(builder.getInt64(0));
+        builder.SetInsertPoint(saved);
+        return error_block;
+    }
+
+
+    llvm::BasicBlock* FunctionLowering::getPropagateBlock() {
+        if (propagate_block) return propagate_block;
+
+        // status was already set by the callee
+        auto* saved = builder.GetInsertBlock();
+        propagate_block = llvm::BasicBlock::Create(ctx, "propagate", function);
+        builder.SetInsertPoint(propagate_block);
+        ret(builder.getInt64(0));
+        builder.SetInsertPoint(saved);
+        return propagate_block;
+    }
+
+
+    void FunctionLowering::ret(llvm::Value* value) {
+        if (call_depth) {
+            llvm::Value* depth = builder.CreateIntToPtr(builder.getInt64((u64)(uintptr)call_depth), i32_ptr_type);
+            builder.CreateStore(builder.CreateSub(builder.CreateLoad(i32_type, depth), builder.getInt32(1)), depth);
+        }
+        builder.CreateRet(value);
+    }
+
+
+    void FunctionLowering::enterFrame() {
+        if (!call_depth) return;
+
+        // fails before counting the frame, so the overflow path returns without ret()
+        llvm::Value* depth = builder.CreateIntToPtr(builder.getInt64((u64)(uintptr)call_depth), i32_ptr_type);
+        llvm::Value* current = builder.CreateLoad(i32_type, depth);
+        auto* overflow = llvm::BasicBlock::Create(ctx, "overflow", function);
+        auto* ok = llvm::BasicBlock::Create(ctx, "frame", function);
+        builder.CreateCondBr(builder.CreateICmpUGE(current, builder.getInt32(MAX_CALL_DEPTH)), overflow, ok);
+
+        builder.SetInsertPoint(overflow);
+        builder.CreateStore(builder.getInt32(1), status);
+        builder.CreateRet(builder.getInt64(0));
+
+        builder.SetInsertPoint(ok);
+        builder.CreateStore(builder.CreateAdd(current, builder.getInt32(1)), depth);
+    }
+
+
+    void FunctionLowering::branch(llvm::Value* cond, i32 target, i32 next) {
+        builder.CreateCondBr(cond, blocks[target], blocks[next]);
+    }
+
+
+    void FunctionLowering::divide(u8 dst, u8 lhs, u8 rhs, bool is_mod) {
+        llvm::Value* divisor = load(rhs);
+        auto* ok = llvm::BasicBlock::Create(ctx, "div", function);
+        builder.CreateCondBr(builder.CreateICmpEQ(divisor, builder.getInt64(0)), getErrorBlock(), ok);
+        builder.SetInsertPoint(ok);
+        llvm::Value* dividend = load(lhs);
+        llvm::Value* minus_one = builder.CreateICmpEQ(divisor, builder.getInt64(-1));
+        if (is_mod) {
+            // x % -1 is 0, srem would trap on INT64_MIN like the division
+            store(dst, builder.CreateSRem(dividend, builder.CreateSelect(minus_one, builder.getInt64(1), divisor)));
+            return;
+        }
+        // same error as the interpreter for INT64_MIN / -1
+        auto* no_overflow = llvm::BasicBlock::Create(ctx, "div.ok", function);
+        llvm::Value* overflow = builder.CreateAnd(minus_one, builder.CreateICmpEQ(dividend, builder.getInt64(INT64_MIN)));
+        builder.CreateCondBr(overflow, getErrorBlock(), no_overflow);
+        builder.SetInsertPoint(no_overflow);
+        store(dst, builder.CreateSDiv(dividend, divisor));
+    }
+
+
+    void FunctionLowering::call(u8 base, u32 callee_idx, u8 arg_count, TierTrampoline trampoline, void* runtime) {
+        for (u8 i = 0; i < arg_count; ++i) {
+            builder.CreateStore(load(base + i), builder.CreateGEP(i64_type, call_args, builder.getInt32(i)));
+        }
+
+        llvm::Value* result;
+        const BytecodeFunction& callee = bytecode.getFunction(callee_idx);
+        const NativeEntry native = callee.profile.native_entry;
+        llvm::Function* imported = imports ? (*imports)[callee_idx] : nullptr;
+        if (callee_idx == func.index) {
+            result = builder.CreateCall(entry_type, function, { call_args, status });
+        }
+        else if (imported) {
+            // same module, the optimizer is free to inline it
+            result = builder.CreateCall(entry_type, imported, { call_args, status });
+        }
+        else if (native) {
+            llvm::Value* target = builder.CreateIntToPtr(builder.getInt64((u64)(uintptr)native), entry_type->getPointerTo());
+            result = builder.CreateCall(entry_type, target, { call_args, status });
+        }
+        else {
+            llvm::Value* target = builder.CreateIntToPtr(builder.getInt64((u64)(uintptr)trampoline), trampoline_type->getPointerTo());
+            llvm::Value* context = builder.CreateIntToPtr(builder.getInt64((u64)(uintptr)runtime), builder.getInt8PtrTy());
+            result = builder.CreateCall(trampoline_type, target, { context, builder.getInt32(callee_idx), call_args, status });
+        }
+
+        auto* ok = llvm::BasicBlock::Create(ctx, "call", function);
+        llvm::Value* failed = builder.CreateICmpNE(builder.CreateLoad(i32_type, status), builder.getInt32(0));
+        builder.CreateCondBr(failed, getPropagateBlock(), ok);
+        builder.SetInsertPoint(ok);
+        store(base, result);
+    }
+
+
+    llvm::Value* FunctionLowering::element(u8 array, u32 length, u8 index, bool checked) {
+        llvm::Value* offset = load(index);
+        if (checked) {
+            // unsigned, a negative index fails too
+            auto* ok = llvm::BasicBlock::Create(ctx, "in_bounds", function);
+            builder.CreateCondBr(builder.CreateICmpUGE(offset, builder.getInt64(length)), getErrorBlock(), ok);
+            builder.SetInsertPoint(ok);
+        }
+        else {
+            // the emitter proved it, let the optimizer use it too
+            llvm::Function* assume = llvm::Intrinsic::getDeclaration(&module, llvm::Intrinsic::assume);
+            builder.CreateCall(assume, { builder.CreateICmpULT(offset, builder.getInt64(length)) });
+        }
+        return builder.CreateInBoundsGEP(register_array_type, register_array,
+            { builder.getInt64(0), builder.CreateAdd(offset, builder.getInt64(array)) });
+    }
+
+
+    static void printFromNative(const runtime::FormatProgram* format, const Value* args) {
+        printFormat(*format, args);
+    }
+
+
+    void FunctionLowering::print(u8 base, const runtime::FormatProgram& format, u8 arg_count) {
+        for (u8 i = 0; i < arg_count; ++i) {
+            builder.CreateStore(load(base + i), builder.CreateGEP(i64_type, call_args, builder.getInt32(i)));
+        }
+        llvm::Value* args = arg_count > 0 ? call_args : (llvm::Value*)llvm::ConstantPointerNull::get(llvm::PointerType::getUnqual(i64_type));
+
+        // the module owns its formats, their address is as stable as the bytecode itself
+        auto* print_type = llvm::FunctionType::get(builder.getVoidTy(), { builder.getInt8PtrTy(), i64_ptr_type }, false);
+        llvm::Value* target = builder.CreateIntToPtr(builder.getInt64((u64)(uintptr)&printFromNative), print_type->getPointerTo());
+        llvm::Value* program = builder.CreateIntToPtr(builder.getInt64((u64)(uintptr)&format), builder.getInt8PtrTy());
+        builder.CreateCall(print_type, target, { program, args });
+    }
+
+
+    llvm::Value* FunctionLowering::pointer(u8 reg, u8 width) {
+        return builder.CreateIntToPtr(load(reg), llvm::PointerType::getUnqual(builder.getIntNTy(width * 8)));
+    }
+
+
+    bool FunctionLowering::lowerExportC() {
+        if (func.c_params.size() != func.param_count) {
+            error = "export 'c' " + func.c_symbol + " does not describe every param";
+            return false;
+        }
+
+        llvm::SmallVector<llvm::Type*, 8> params;
+        for (ValueKind kind : func.c_params) {
+            params.push_back(kind == ValueKind::Float ? f64_type : i64_type);
+        }
+        llvm::Type* result_type = func.return_kind == ValueKind::Float ? f64_type
+            : func.return_kind == ValueKind::Int ? i64_type : builder.getVoidTy();
+        auto* c_type = llvm::FunctionType::get(result_type, params, false);
+        auto* c_function = llvm::Function::Create(c_type, llvm::Function::ExternalLinkage, func.c_symbol, module);
+        c_function->setCallingConv(llvm::CallingConv::C);
+
+        // plain spills into the NativeEntry frame, the entry is inlined and they fold away
+        builder.SetInsertPoint(llvm::BasicBlock::Create(ctx, "entry", c_function));
+        llvm::Value* args = builder.CreateAlloca(i64_type, builder.getInt32(func.param_count > 0 ? func.param_count : 1), "args");
+        llvm::Value* c_status = builder.CreateAlloca(i32_type, nullptr, "status");
+        for (u32 i = 0; i < func.param_count; ++i) {
+            llvm::Value* arg = c_function->getArg(i);
+            if (func.c_params[i] == ValueKind::Float) arg = builder.CreateBitCast(arg, i64_type);
+            builder.CreateStore(arg, builder.CreateGEP(i64_type, args, builder.getInt32(i)));
+        }
+        // c has no status, a failing call returns 0
+        llvm::Value* result = builder.CreateCall(entry_type, function, { args, c_status });
+        if (result_type->isVoidTy()) builder.CreateRetVoid();
+        else if (result_type == f64_type) builder.CreateRet(builder.CreateBitCast(result, f64_type));
+        else builder.CreateRet(result);
+
+        std::string message;
+        llvm::raw_string_ostream stream(message);
+        if (llvm::verifyFunction(*c_function, &stream)) {
+            error = "invalid ir for " + func.c_symbol + " : " + stream.str();
+            return false;
+        }
+        return true;
+    }
+
+
+    bool FunctionLowering::lower(const std::string& symbol, TierTrampoline trampoline, void* runtime, FunctionDebugInfo* debug,
+        llvm::GlobalValue::LinkageTypes linkage) {
+        const auto& code = func.code;
+        if (code.empty()) {
+            error = "empty function " + func.name;
+            return false;
+        }
+
+        function = llvm::Function::Create(entry_type, linkage, symbol, module);
+        llvm::Value* args = function->getArg(0);
+        status = function->getArg(1);
+        args->setName("args");
+        status->setName("status");
+
+        auto* entry = llvm::BasicBlock::Create(ctx, "entry", function);
+        builder.SetInsertPoint(entry);
+        if (debug && !debug->begin(function, builder)) debug = nullptr;
+
+        u32 max_args = 0;
+        for (i32 pc = 0; pc < code.size(); pc += getOpCodeLength(decodeOp(code[pc]))) {
+            const OpCode op = decodeOp(code[pc]);
+            if ((op == OpCode::CALL || op == OpCode::PRINTF) && decodeC(code[pc]) > max_args) max_args = decodeC(code[pc]);
+        }
+        if (max_args > 0) {
+            call_args = builder.CreateAlloca(i64_type, builder.getInt32(max_args), "call_args");
+        }
+
+        const u32 register_count = func.register_count > 0 ? func.register_count : 1;
+        for (i32 pc = 0; pc < code.size(); pc += getOpCodeLength(decodeOp(code[pc]))) {
+            const OpCode op = decodeOp(code[pc]);
+            if (op != OpCode::GETX && op != OpCode::SETX && op != OpCode::GETXU && op != OpCode::SETXU) continue;
+            if (pc + 1 >= code.size() || decodeB(code[pc]) + (u64)code[pc + 1] > register_count) {
+                error = "array out of the register file in " + func.name;
+                return false;
+            }
+            register_array_type = llvm::ArrayType::get(i64_type, register_count);
+        }
+        if (register_array_type) {
+            register_array = builder.CreateAlloca(register_array_type, nullptr, "registers");
+        }
+        for (u32 i = 0; i < register_count; ++i) {
+            llvm::Value* reg = register_array
+                ? builder.CreateConstInBoundsGEP2_32(register_array_type, register_array, 0, i, "r" + std::to_string(i))
+                : builder.CreateAlloca(i64_type, nullptr, "r" + std::to_string(i));
+            registers.push(reg);
+            llvm::Value* init = i < func.param_count
+                ? (llvm::Value*)builder.CreateLoad(i64_type, builder.CreateGEP(i64_type, args, builder.getInt32(i)))
+                : (llvm::Value*)builder.getInt64(0);
+            builder.CreateStore(init, reg);
+        }
+
+        if (debug) debug->declareVariables(registers, entry);
+
+        if (!collectBlocks()) return false;
+        enterFrame();
+        builder.CreateBr(blocks[0]);
+
+        for (i32 pc = 0; pc < code.size();) {
+            if (blocks[pc]) {
+                if (!builder.GetInsertBlock()->getTerminator()) builder.CreateBr(blocks[pc]);
+                builder.SetInsertPoint(blocks[pc]);
+            }
+            if (debug) debug->setPc((u32)pc, builder);
+
+            const Instruction ins = code[pc];
+            const OpCode op = decodeOp(ins);
+            const i32 next = pc + (i32)getOpCodeLength(op);
+            const u8 a = decodeA(ins);
+            const u8 b = decodeB(ins);
+            const u8 c = decodeC(ins);
+            if (op >= OpCode::COUNT || a >= register_count) {
+                error = "invalid instruction in " + func.name;
+                return false;
+            }
+
+            switch (op) {
+            case OpCode::NOP:
+                break;
+            case OpCode::MOVE:
+                store(a, load(b));
+                break;
+            case OpCode::LOADK:
+                store(a, builder.getInt64(func.constants[decodeBx(ins)].i));
+                break;
+            case OpCode::LOADI:
+                store(a, builder.getInt64(decodeSBx(ins)));
+                break;
+            case OpCode::ADD_I:
+                store(a, builder.CreateAdd(load(b), load(c)));
+                break;
+            case OpCode::SUB_I:
+                store(a, builder.CreateSub(load(b), load(c)));
+                break;
+            case OpCode::MUL_I:
+                store(a, builder.CreateMul(load(b), load(c)));
+                break;
+            case OpCode::DIV_I:
+                divide(a, b, c, false);
+                break;
+            case OpCode::MOD_I:
+                divide(a, b, c, true);
+                break;
+            case OpCode::NEG_I:
+                store(a, builder.CreateNeg(load(b)));
+                break;
+            case OpCode::ADD_F:
+                storeFloat(a, builder.CreateFAdd(loadFloat(b), loadFloat(c)));
+                break;
+            case OpCode::SUB_F:
+                storeFloat(a, builder.CreateFSub(loadFloat(b), loadFloat(c)));
+                break;
+            case OpCode::MUL_F:
+                storeFloat(a, builder.CreateFMul(loadFloat(b), loadFloat(c)));
+                break;
+            case OpCode::DIV_F:
+                storeFloat(a, builder.CreateFDiv(loadFloat(b), loadFloat(c)));
+                break;
+            case OpCode::NEG_F:
+                storeFloat(a, builder.CreateFNeg(loadFloat(b)));
+                break;
+            case OpCode::I2F:
+                storeFloat(a, builder.CreateSIToFP(load(b), f64_type));
+                break;
+            case OpCode::F2I:
+                store(a, builder.CreateFPToSI(loadFloat(b), i64_type));
+                break;
+            case OpCode::EQ_I:
+                store(a, builder.CreateZExt(builder.CreateICmpEQ(load(b), load(c)), i64_type));
+                break;
+            case OpCode::LT_I:
+                store(a, builder.CreateZExt(builder.CreateICmpSLT(load(b), load(c)), i64_type));
+                break;
+            case OpCode::LE_I:
+                store(a, builder.CreateZExt(builder.CreateICmpSLE(load(b), load(c)), i64_type));
+                break;
+            case OpCode::JMP:
+                builder.CreateBr(blocks[next + decodeSBx(ins)]);
+                break;
+            case OpCode::JMP_IF:
+                branch(builder.CreateICmpNE(load(a), builder.getInt64(0)), next + decodeSBx(ins), next);
+                break;
+            case OpCode::JMP_IF_NOT:
+                branch(builder.CreateICmpEQ(load(a), builder.getInt64(0)), next + decodeSBx(ins), next);
+                break;
+            case OpCode::CALL: {
+                const u32 callee_idx = code[pc + 1];
+                if (callee_idx >= bytecode.getFunctionCount()) {
+                    error = "invalid call target in " + func.name;
+                    return false;
+                }
+                call(a, callee_idx, c, trampoline, runtime);
+                break;
+            }
+            case OpCode::RET:
+                ret(load(a));
+                break;
+            case OpCode::RETK:
+                ret(builder.getInt64(func.constants[decodeBx(ins)].i));
+                break;
+            case OpCode::ADDI:
+                store(a, builder.CreateAdd(load(b), builder.getInt64(decodeSC(ins))));
+                break;
+            case OpCode::JLT_I:
+                branch(builder.CreateICmpSLT(load(a), load(b)), next + (i32)code[pc + 1], next);
+                break;
+            case OpCode::JLE_I:
+                branch(builder.CreateICmpSLE(load(a), load(b)), next + (i32)code[pc + 1], next);
+                break;
+            case OpCode::JEQ_I:
+                branch(builder.CreateICmpEQ(load(a), load(b)), next + (i32)code[pc + 1], next);
+                break;
+            case OpCode::JNE_I:
+                branch(builder.CreateICmpNE(load(a), load(b)), next + (i32)code[pc + 1], next);
+                break;
+            case OpCode::INCLT_I: {
+                llvm::Value* counter = builder.CreateAdd(load(a), builder.getInt64(1));
+                store(a, counter);
+                branch(builder.CreateICmpSLT(counter, load(b)), next + (i32)code[pc + 1], next);
+                break;
+            }
+            case OpCode::GETX:
+            case OpCode::GETXU:
+                store(a, builder.CreateLoad(i64_type, element(b, code[pc + 1], c, op == OpCode::GETX)));
+                break;
+            case OpCode::SETX:
+            case OpCode::SETXU: {
+                llvm::Value* value = load(a);
+                builder.CreateStore(value, element(b, code[pc + 1], c, op == OpCode::SETX));
+                break;
+            }
+            case OpCode::ALLOC: {
+                // declared rather than called through an address, so llvm knows the allocation semantics
+                llvm::FunctionCallee alloc = module.getOrInsertFunction("malloc", builder.getInt8PtrTy(), i64_type);
+                store(a, builder.CreatePtrToInt(builder.CreateCall(alloc, { load(b) }), i64_type));
+                break;
+            }
+            case OpCode::FREE: {
+                llvm::FunctionCallee release = module.getOrInsertFunction("free", builder.getVoidTy(), builder.getInt8PtrTy());
+                builder.CreateCall(release, { pointer(a, 1) });
+                break;
+            }
+            case OpCode::MEMCPY:
+                // a constant size becomes an inline copy after mem2reg
+                builder.CreateMemCpy(pointer(a, 1), llvm::MaybeAlign(1), pointer(b, 1), llvm::MaybeAlign(1), load(c));
+                break;
+            case OpCode::PLOAD:
+            case OpCode::PSTORE: {
+                if (c != 1 && c != 2 && c != 4 && c != 8) {
+                    error = "invalid pointer access width in " + func.name;
+                    return false;
+                }
+                llvm::Type* type = builder.getIntNTy(c * 8);
+                if (op == OpCode::PLOAD) {
+                    store(a, builder.CreateSExt(builder.CreateAlignedLoad(type, pointer(b, c), llvm::MaybeAlign(1)), i64_type));
+                }
+                else {
+                    builder.CreateAlignedStore(builder.CreateTrunc(load(b), type), pointer(a, c), llvm::MaybeAlign(1));
+                }
+                break;
+            }
+            case OpCode::PRINTF: {
+                const u32 format_idx = code[pc + 1];
+                if (format_idx >= bytecode.getFormatCount() || a + (u32)c > register_count) {
+                    error = "invalid print in " + func.name;
+                    return false;
+                }
+                print(a, bytecode.getFormat(format_idx), c);
+                break;
+            }
+            default:
+                error = std::string("unsupported opcode ") + getOpCodeName(op) + " in " + func.name;
+                return false;
+            }
+            pc = next;
+        }
+
+        // the emitter always terminates functions, keep the ir valid for hand written bytecode too
+        if (!builder.GetInsertBlock()->getTerminator()) ret(builder.getInt64(0));
+        if (debug) debug->finish();
+
+        std::string message;
+        llvm::raw_string_ostream stream(message);
+        if (llvm::verifyFunction(*function, &stream)) {
+            error = "invalid ir for " + func.name + " : " + stream.str();
+            return false;
+        }
+        return true;
+    }
+
+    //////////////////////////////////////////////
+    // Cross function import
+    //////////////////////////////////////////////
+
+    // the bytecode module is the whole program, so instead of calling small callees through their
+    // entry pointer (or the interpreter trampoline) their bodies are imported into the caller's module
+    // as private copies. the optimizer then inlines them like thin-lto does across object files
+    struct CalleeImporter {
+        CalleeImporter(llvm::LLVMContext& ctx, llvm::Module& module, const BytecodeModule& bytecode, const std::string& symbol)
+            : ctx(ctx),
+            module(module),
+            bytecode(bytecode),
+            symbol(symbol),
+            imports(bytecode.getAllocator()),
+            visited(bytecode.getAllocator())
+        {
+            imports.resize(bytecode.getFunctionCount());
+            visited.resize(bytecode.getFunctionCount());
+            for (u32 i = 0; i < bytecode.getFunctionCount(); ++i) {
+                imports[i] = nullptr;
+                visited[i] = false;
+            }
+        }
+
+        void importCallees(const BytecodeFunction& func, u32 depth, TierTrampoline trampoline, void* runtime);
+
+        llvm::LLVMContext& ctx;
+        llvm::Module& module;
+        const BytecodeModule& bytecode;
+        const std::string& symbol;
+        Array<llvm::Function*> imports;
+        Array<bool> visited;
+        u32* call_depth = nullptr;
+        u32 count = 0;
+    };
+
+
+    void CalleeImporter::importCallees(const BytecodeFunction& func, u32 depth, TierTrampoline trampoline, void* runtime) {
+        visited[func.index] = true;
+        if (depth >= IMPORT_DEPTH_LIMIT) return;
+
+        const auto& code = func.code;
+        for (i32 pc = 0; pc < code.size(); pc += getOpCodeLength(decodeOp(code[pc]))) {
+            if (decodeOp(code[pc]) != OpCode::CALL || pc + 1 >= code.size()) continue;
+
+            const u32 callee_idx = code[pc + 1];
+            if (callee_idx >= bytecode.getFunctionCount() || visited[callee_idx]) continue;
+            const BytecodeFunction& callee = bytecode.getFunction(callee_idx);
+            if ((u32)callee.code.size() > IMPORT_SIZE_LIMIT || count >= IMPORT_COUNT_LIMIT) continue;
+
+            // leaves first, so the callee's own calls can use them
+            importCallees(callee, depth + 1, trampoline, runtime);
+
+            FunctionLowering lowering(ctx, module, bytecode, callee);
+            lowering.imports = &imports;
+            lowering.call_depth = call_depth;
+            if (!lowering.lower(symbol + "." + callee.name, trampoline, runtime, nullptr, llvm::Function::PrivateLinkage)) {
+                // keep calling it the usual way
+                if (lowering.function) lowering.function->eraseFromParent();
+                continue;
+            }
+            imports[callee_idx] = lowering.function;
+            ++count;
+        }
+    }
+
+    //////////////////////////////////////////////
+    // Jit compiler
+    //////////////////////////////////////////////
+
+    JitCompiler::JitCompiler()
+        : m_exports(getGlobalAllocator())
+    {
+        initializeNativeTarget();
+
+        auto jit = llvm::orc::LLJITBuilder().create();
+        if (!jit) {
+            m_error = llvm::toString(jit.takeError());
+            LogError("[JIT] failed to create LLJIT : ", m_error);
+            return;
+        }
+        m_jit = std::move(*jit);
+
+        // unsafe code calls malloc / free / memcpy directly, resolve them from the process
+        auto process = llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(m_jit->getDataLayout().getGlobalPrefix());
+        if (process) {
+            m_jit->getMainJITDylib().addGenerator(std::move(*process));
+        }
+        else {
+            LogWarn("[JIT] process symbols unavailable : ", llvm::toString(process.takeError()));
+        }
+
+        // measured after codegen, so the size includes whatever dwarf the module carried
+        m_jit->getObjTransformLayer().setTransform([this](std::unique_ptr<llvm::MemoryBuffer> object) -> llvm::Expected<std::unique_ptr<llvm::MemoryBuffer>> {
+            m_stats.object_bytes += object->getBufferSize();
+            return object;
+        });
+    }
+
+
+    void JitCompiler::enableDebuggerSupport() {
+        // registers every emitted object with the gdb / lldb jit interface, so the dwarf is actually seen
+        if (m_debugger_support) return;
+        m_debugger_support = true;
+#if LLVM_VERSION_MAJOR >= 17
+        if (auto err = llvm::orc::enableDebuggerSupport(*m_jit)) {
+            LogWarn("[JIT] no debugger support : ", llvm::toString(std::move(err)));
+        }
+#else
+        if (auto* layer = llvm::dyn_cast<llvm::orc::RTDyldObjectLinkingLayer>(&m_jit->getObjLinkingLayer())) {
+            layer->registerJITEventListener(*llvm::JITEventListener::createGDBRegistrationListener());
+        }
+        else {
+            LogWarn("[JIT] no debugger support for this object linking layer");
+        }
+#endif
+    }
+
+
+    JitCompiler::~JitCompiler() = default;
+
+
+    NativeEntry JitCompiler::compile(const BytecodeModule& module, const BytecodeFunction& func, TierTrampoline trampoline, void* runtime,
+        u32* call_depth) {
+        if (!m_jit) return nullptr;
+        m_error.clear();
+
+        const std::string symbol = "cal_vm_" + func.name + "_" + std::to_string(m_module_counter++);
+        auto ctx = create_unique<llvm::LLVMContext>();
+        auto ir_module = create_unique<llvm::Module>(symbol, *ctx);
+        ir_module->setDataLayout(m_jit->getDataLayout());
+        ir_module->setTargetTriple(m_jit->getTargetTriple().str());
+
+        {
+            CAL_TIME_SCOPE("jit lower");
+            unique<FunctionDebugInfo> debug;
+            if (module.getDebugInfoLevel() != DebugInfoLevel::None && func.location != INVALID_SOURCE_LOCATION) {
+                enableDebuggerSupport();
+                debug = create_unique<FunctionDebugInfo>(*ir_module, module, func);
+            }
+
+            CalleeImporter importer(*ctx, *ir_module, module, symbol);
+            importer.call_depth = call_depth;
+            if (m_import_callees) {
+                importer.importCallees(func, 0, trampoline, runtime);
+                m_stats.imported += importer.count;
+            }
+
+            FunctionLowering lowering(*ctx, *ir_module, module, func);
+            lowering.imports = &importer.imports;
+            lowering.call_depth = call_depth;
+            if (!lowering.lower(symbol, trampoline, runtime, debug.get())) {
+                m_error = lowering.error;
+                return nullptr;
+            }
+            if (!func.c_symbol.empty()) {
+                if (m_exports.find(func.c_symbol).isValid()) {
+                    m_error = "export 'c' " + func.c_symbol + " is already defined";
+                    return nullptr;
+                }
+                if (!lowering.lowerExportC()) {
+                    m_error = lowering.error;
+                    return nullptr;
+                }
+            }
+            if (debug && debug->subprogram) ++m_stats.debug_functions;
+        }
+        {
+            CAL_TIME_SCOPE("jit optimize");
+            optimizeModule(*ir_module);
+        }
+
+        CAL_TIME_SCOPE("jit codegen");
+        if (auto err = m_jit->addIRModule(llvm::orc::ThreadSafeModule(std::move(ir_module), std::move(ctx)))) {
+            m_error = llvm::toString(std::move(err));
+            return nullptr;
+        }
+
+        auto address = m_jit->lookup(symbol);
+        if (!address) {
+            m_error = llvm::toString(address.takeError());
+            return nullptr;
+        }
+        ++m_stats.functions;
+
+        if (!func.c_symbol.empty()) {
+            auto export_address = m_jit->lookup(func.c_symbol);
+            if (!export_address) {
+                m_error = llvm::toString(export_address.takeError());
+                return nullptr;
+            }
+#if LLVM_VERSION_MAJOR >= 15
+            m_exports.insert(func.c_symbol, export_address->toPtr<void*>());
+#else
+            m_exports.insert(func.c_symbol, (void*)export_address->getAddress());
+#endif
+        }
+
+#if LLVM_VERSION_MAJOR >= 15
+        return address->toPtr<NativeEntry>();
+#else
+        return (NativeEntry)address->getAddress();
+#endif
+    }
+
+
+    void* JitCompiler::findExport(const std::string& symbol) const {
+        auto iter = m_exports.find(symbol);
+        return iter.isValid() ? iter.value() : nullptr;
+    }
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "Bytecode.hpp"
+
+#include <string>
+
+namespace llvm::orc {
+    class LLJIT;
+}
+
+namespace cal::vm {
+
+    // functions that are not compiled yet are reached through this hook, args / status follow NativeEntry
+    using TierTrampoline = u64(*)(void* runtime, u32 func_idx, const u64* args, u32* status);
+
+    // lowers bytecode functions to llvm ir and compiles them with an orc LLJIT instance
+    // not thread safe, owned by the tiered runtime's compile thread
+    class JitCompiler
+    {
+    public:
+        // compare runs with different debug info levels to see what dwarf costs
+        struct Stats {
+            u32 functions = 0;
+            u32 debug_functions = 0;     // functions that got dwarf
+            u64 object_bytes = 0;        // every object file handed to the linker, dwarf sections included
+            u32 imported = 0;            // callee bodies lowered into their callers' modules
+        };
+
+        JitCompiler();
+        ~JitCompiler();
+
+        bool isValid() const { return m_jit != nullptr; }
+        const std::string& getError() const { return m_error; }
+        const Stats& getStats() const { return m_stats; }
+
+        // whole program mode : small callees are imported into every module that calls them and inlined there,
+        // a callee changing later is not seen by callers compiled before, the bytecode module is immutable while it runs
+        void setImportCallees(bool enabled) { m_import_callees = enabled; }
+
+        // returns nullptr when the function could not be compiled, see getError()
+        // with call_depth the code counts its frames there and fails past MAX_CALL_DEPTH, like the interpreter
+        NativeEntry compile(const BytecodeModule& module, const BytecodeFunction& func, TierTrampoline trampoline, void* runtime,
+            u32* call_depth = nullptr);
+        // address of an export 'c' function compiled before, callable with the function's c signature
+        void* findExport(const std::string& symbol) const;
+
+    private:
+        void enableDebuggerSupport();
+
+        unique<llvm::orc::LLJIT> m_jit;
+        std::string m_error;
+        u32 m_module_counter = 0;
+        bool m_debugger_support = false;
+        bool m_import_callees = false;
+        Stats m_stats;
+        HashMap<std::string, void*> m_exports;
+    };
+}
@@ -0,0 +1,197 @@
+#include "TieredRuntime.hpp"
+
+#include "JitCompiler.hpp"
+#include "base/Logger.hpp"
+#include "base/threading/Atomic.hpp"
+#include "base/threading/Thread.hpp"
+
+namespace cal::vm {
+
+    struct TierCompileTask final : Thread {
+        TierCompileTask(TieredRuntime& runtime, IAllocator& allocator)
+            : Thread(allocator)
+            , m_runtime(runtime)
+        {}
+
+        ~TierCompileTask() = default;
+
+        void stop();
+        int run() override;
+
+    private:
+        TieredRuntime& m_runtime;
+        volatile bool m_finish = false;
+    };
+
+
+    int TierCompileTask::run() {
+        // the jit lives on this thread only
+        JitCompiler compiler;
+        if (!compiler.isValid()) {
+            LogError("[JIT] tiering disabled : ", compiler.getError());
+        }
+
+        while (!m_finish) {
+            m_runtime.m_semaphore.wait();
+            if (m_finish) break;
+
+            u32 func_idx;
+            {
+                MutexGuard lock(m_runtime.m_mutex);
+                ASSERT(!m_runtime.m_queue.empty());
+                func_idx = m_runtime.m_queue[0];
+                m_runtime.m_queue.erase(0);
+            }
+
+            const BytecodeFunction& func = m_runtime.m_module.getFunction(func_idx);
+            platform::Timer timer;
+            compiler.setImportCallees(m_runtime.m_whole_program);
+            const NativeEntry entry = compiler.compile(m_runtime.m_module, func, &TieredRuntime::callTrampoline, &m_runtime, &m_runtime.m_depth);
+            const float elapsed = timer.getTimeSinceStart();
+
+            MutexGuard lock(m_runtime.m_mutex);
+            m_runtime.m_stats.compile_time += elapsed;
+            m_runtime.m_stats.debug_functions = compiler.getStats().debug_functions;
+            m_runtime.m_stats.object_bytes = compiler.getStats().object_bytes;
+            m_runtime.m_stats.imported = compiler.getStats().imported;
+            if (!entry) {
+                ++m_runtime.m_stats.failed;
+                func.profile.state = (i32)TierState::Failed;
+                LogWarn("[JIT] keeping ", func.name, " interpreted : ", compiler.getError());
+                continue;
+            }
+
+            // publish the entry before the state, readers only ever look at native_entry
+            compareAndExchange64((volatile i64*)&func.profile.native_entry, (i64)(uintptr)entry, 0);
+            func.profile.state = (i32)TierState::Compiled;
+            memoryBarrier();
+
+            if (!func.c_symbol.empty()) m_runtime.m_exports.insert(func.c_symbol, compiler.findExport(func.c_symbol));
+            ++m_runtime.m_stats.compiled;
+            m_runtime.m_stats.steady_state_time = m_runtime.m_timer.getTimeSinceStart();
+            LogInfo("[JIT] compiled ", func.name, " in ", elapsed * 1000.f, " ms");
+        }
+        return 0;
+    }
+
+
+    void TierCompileTask::stop() {
+        m_finish = true;
+        m_runtime.m_semaphore.signal();
+    }
+
+    //////////////////////////////////////////////
+    // Tiered runtime
+    //////////////////////////////////////////////
+
+    TieredRuntime::TieredRuntime(const BytecodeModule& module, IAllocator& alloc, u32 invocation_threshold, u32 backedge_threshold)
+        : m_module(module),
+        m_alloc(alloc),
+        m_interpreter(alloc),
+        m_invocation_threshold(invocation_threshold),
+        m_backedge_threshold(backedge_threshold),
+        m_nested(alloc),
+        m_queue(alloc),
+        m_semaphore(0, 0xffFF),
+        m_exports(alloc)
+    {
+        m_interpreter.setTierListener(this, invocation_threshold, backedge_threshold);
+        m_interpreter.setCallDepth(&m_depth);
+        m_task = CAL_NEW(m_alloc, TierCompileTask)(*this, m_alloc);
+        m_task->create("JitCompiler", true);
+    }
+
+
+    TieredRuntime::~TieredRuntime() {
+        m_task->stop();
+        m_task->destroy();
+        CAL_DEL(m_alloc, m_task);
+        for (Interpreter* interpreter : m_nested) {
+            CAL_DEL(m_alloc, interpreter);
+        }
+    }
+
+
+    void TieredRuntime::onHotFunction(const BytecodeModule& module, const BytecodeFunction& func) {
+        ASSERT(&module == &m_module);
+        if (!compareAndExchange(&func.profile.state, (i32)TierState::Queued, (i32)TierState::Interpreted)) return;
+
+        MutexGuard lock(m_mutex);
+        m_queue.push(func.index);
+        ++m_stats.queued;
+        m_semaphore.signal();
+    }
+
+
+    bool TieredRuntime::run(u32 func_idx, Span<const Value> args, Value& result) {
+        m_error.clear();
+        if (func_idx < m_module.getFunctionCount()) {
+            const BytecodeFunction& func = m_module.getFunction(func_idx);
+            const NativeEntry native = func.profile.native_entry;
+            if (native && args.length() == func.param_count) {
+                u32 status = 0;
+                result.i = (i64)native((const u64*)args.begin(), &status);
+                if (status == 0) return true;
+
+                // an interpreter below reported it already, native code itself carries no message
+                if (m_error.empty()) {
+                    m_error = "native call failed in " + func.name;
+                    LogError("[VM] ", m_error);
+                }
+                return false;
+            }
+        }
+
+        if (m_interpreter.run(m_module, func_idx, args, result)) return true;
+        // keep the innermost error, the outer frames only saw a failed native call
+        if (m_error.empty()) m_error = m_interpreter.getError();
+        return false;
+    }
+
+
+    u64 TieredRuntime::callTrampoline(void* runtime, u32 func_idx, const u64* args, u32* status) {
+        auto* self = (TieredRuntime*)runtime;
+        const BytecodeFunction& func = self->m_module.getFunction(func_idx);
+
+        // the callee may have been compiled after the caller
+        const NativeEntry native = func.profile.native_entry;
+        if (native) return native(args, status);
+
+        if (self->m_nesting == (u32)self->m_nested.size()) {
+            auto* interpreter = CAL_NEW(self->m_alloc, Interpreter)(self->m_alloc);
+            interpreter->setTierListener(self, self->m_invocation_threshold, self->m_backedge_threshold);
+            interpreter->setCallDepth(&self->m_depth);
+            self->m_nested.push(interpreter);
+        }
+
+        Interpreter& interpreter = *self->m_nested[self->m_nesting++];
+        Value result;
+        const bool ok = interpreter.run(self->m_module, func_idx, Span<const Value>((const Value*)args, func.param_count), result);
+        --self->m_nesting;
+        if (!ok) {
+            if (self->m_error.empty()) self->m_error = interpreter.getError();
+            *status = 1;
+            return 0;
+        }
+        return (u64)result.i;
+    }
+
+
+    TieredRuntime::Stats TieredRuntime::getStats() {
+        MutexGuard lock(m_mutex);
+        return m_stats;
+    }
+
+
+    bool TieredRuntime::hasPendingWork() {
+        MutexGuard lock(m_mutex);
+        return m_stats.compiled + m_stats.failed < m_stats.queued;
+    }
+
+
+    void* TieredRuntime::findExport(const std::string& symbol) {
+        MutexGuard lock(m_mutex);
+        auto iter = m_exports.find(symbol);
+        return iter.isValid() ? iter.value() : nullptr;
+    }
+}
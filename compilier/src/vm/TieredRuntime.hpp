@@ -0,0 +1,75 @@
+#pragma once
+
+#include "Interpreter.hpp"
+#include "base/threading/SyncMutex.hpp"
+#include "base/threading/SyncSemaphore.hpp"
+#include "system/SysTimer.hpp"
+
+namespace cal::vm {
+
+    struct TierCompileTask;
+
+    // runs a bytecode module in the interpreter and tiers hot functions up to native code
+    // compilation happens on a background thread, finished functions are published with an
+    // atomic swap of their native entry, so running code picks them up on the next call
+    // there is no on-stack replacement, a long running loop finishes in the interpreter
+    // interpreted and native frames count against one MAX_CALL_DEPTH, nested interpreters are reused between calls
+    class TieredRuntime final : public TierListener
+    {
+    public:
+        struct Stats {
+            u32 queued = 0;
+            u32 compiled = 0;
+            u32 failed = 0;
+            float compile_time = 0;      // seconds spent in the jit, all functions
+            float steady_state_time = 0; // seconds since start until the last function went native
+            u32 debug_functions = 0;     // compiled with dwarf, see BytecodeModule::setDebugInfo()
+            u64 object_bytes = 0;        // machine code plus debug info of every compiled function
+            u32 imported = 0;            // callees inlined across functions, see setWholeProgram()
+        };
+
+        TieredRuntime(const BytecodeModule& module, IAllocator& alloc, u32 invocation_threshold = 1000, u32 backedge_threshold = 10000);
+        ~TieredRuntime();
+
+        // a failing native call is not retried, its side effects already happened
+        [[nodiscard]] bool run(u32 func_idx, Span<const Value> args, Value& result);
+        const std::string& getError() const { return m_error; }
+
+        // small callees get imported and inlined into every hot caller instead of being called through their
+        // entry, trades compile time and code size for call heavy code. affects functions compiled afterwards
+        void setWholeProgram(bool enabled) { m_whole_program = enabled; }
+
+        Stats getStats();
+        bool hasPendingWork();
+        // c entry of an export 'c' function that went native, nullptr until then. valid while the runtime lives
+        void* findExport(const std::string& symbol);
+
+        void onHotFunction(const BytecodeModule& module, const BytecodeFunction& func) override;
+
+    private:
+        friend struct TierCompileTask;
+
+        static u64 callTrampoline(void* runtime, u32 func_idx, const u64* args, u32* status);
+
+        const BytecodeModule& m_module;
+        IAllocator& m_alloc;
+        Interpreter m_interpreter;
+        u32 m_invocation_threshold;
+        u32 m_backedge_threshold;
+        volatile bool m_whole_program = false;
+
+        // interpreters entered from native code through the trampoline, one per nesting level
+        Array<Interpreter*> m_nested;
+        u32 m_nesting = 0;
+        u32 m_depth = 0;
+        std::string m_error;
+
+        TierCompileTask* m_task = nullptr;
+        Array<u32> m_queue;
+        Mutex m_mutex;
+        Semaphore m_semaphore;
+        Stats m_stats;
+        HashMap<std::string, void*> m_exports;
+        platform::Timer m_timer;
+    };
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <globals.hpp>
+#include <base/allocator/IAllocator.hpp>
+#include <vm/BytecodeEmitter.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// helpers shared by the benchmark executables, each one prints a table and exits
+
+namespace cal::bench {
+
+    // results go here so the optimizer can't drop the measured work
+    inline volatile u64 g_sink = 0;
+
+    inline void sink(u64 value) { g_sink = g_sink + value; }
+
+
+    // the baseline allocator benchmarks compare against
+    struct SystemAllocator final : IAllocator {
+        void* allocate(size_t size, size_t align) override {
+            if (align <= alignof(max_align_t)) return malloc(size);
+            return aligned_alloc(align, (size + align - 1) & ~(align - 1));
+        }
+        void deallocate(void* ptr) override { free(ptr); }
+        void* reallocate(void* ptr, size_t new_size, size_t old_size, size_t align) override {
+            if (align <= alignof(max_align_t)) return realloc(ptr, new_size);
+            void* mem = allocate(new_size, align);
+            if (!mem) return nullptr;
+            if (ptr) memcpy(mem, ptr, old_size < new_size ? old_size : new_size);
+            free(ptr);
+            return mem;
+        }
+    };
+
+
+    // deterministic across runs and platforms, rand() is neither
+    inline u32 nextRandom(u32& state) {
+        state = state * 1664525 + 1013904223;
+        return state >> 8;
+    }
+
+
+    // the call heavy loop of the vm benchmarks :
+    // fun sq(x) = x * x + 1
+    // fun wrap(x) = sq(x)
+    // fun calls(n) { s = 0; for (i = 0; i < n; ++i) s += sq(i); return s; }     s += wrap(i) with call_wrapper
+    inline void emitCallLoop(vm::BytecodeEmitter& emitter, bool call_wrapper = false) {
+        using namespace vm;
+        u32 callee_idx = emitter.beginFunction("sq", 1).index;
+        {
+            const u8 t = emitter.allocRegister();
+            emitter.emitBinary(OpCode::MUL_I, t, 0, 0);
+            emitter.emitAddImmediate(t, t, 1);
+            emitter.emitReturn(t, ValueKind::Int);
+        }
+        emitter.endFunction();
+
+        if (call_wrapper) {
+            const u32 sq_idx = callee_idx;
+            callee_idx = emitter.beginFunction("wrap", 1).index;
+            const u8 base = emitter.allocRegister();
+            emitter.emitMove(base, 0);
+            emitter.emitCall(base, sq_idx, 1);
+            emitter.emitReturn(base, ValueKind::Int);
+            emitter.endFunction();
+        }
+
+        emitter.beginFunction("calls", 1);
+        const u8 s = emitter.allocRegister();
+        const u8 i = emitter.allocRegister();
+        emitter.emitLoadInt(s, 0);
+        emitter.emitLoadInt(i, 0);
+        const BytecodeEmitter::Label end = emitter.newLabel();
+        const BytecodeEmitter::Label loop = emitter.newLabel();
+        emitter.emitCompareJump(OpCode::LT_I, i, 0, end, false);
+        emitter.bindLabel(loop);
+        const u8 base = emitter.allocRegister();
+        emitter.emitMove(base, i);
+        emitter.emitCall(base, callee_idx, 1);
+        emitter.emitBinary(OpCode::ADD_I, s, s, base);
+        emitter.freeRegister(base);
+        emitter.emitLoopBackEdge(i, 0, loop);
+        emitter.bindLabel(end);
+        emitter.emitReturn(s, ValueKind::Int);
+        emitter.endFunction();
+    }
+
+
+    // best of `runs` in milliseconds, the best run is the one least disturbed by the rest of the machine
+    template <typename Func>
+    double measure(const char* name, u32 runs, Func&& func) {
+        double best = 1e300;
+        for (u32 i = 0; i < runs; ++i) {
+            const auto begin = std::chrono::steady_clock::now();
+            func();
+            const auto end = std::chrono::steady_clock::now();
+            const double elapsed = std::chrono::duration<double, std::milli>(end - begin).count();
+            if (elapsed < best) best = elapsed;
+        }
+        printf("%-48s %10.3f ms\n", name, best);
+        return best;
+    }
+}
@@ -0,0 +1,153 @@
+#include "Bench.hpp"
+
+#include "driver/Driver.hpp"
+#include "server/CompileServer.hpp"
+
+#include <base/Logger.hpp>
+#include <base/allocator/Allocator.hpp>
+#include <base/math/Math.hpp>
+#include <system/SysIO.hpp>
+#include <system/SysThreading.hpp>
+#include <utils/ArgsParser.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <spawn.h>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// one build of generated sources : a fresh "cal build" process per run against a compile server process,
+// its first request (nothing warm yet but the process) and the requests after it (unchanged inputs)
+// logs go to stderr, run it as CompileServerBench [files] 2>/dev/null
+
+extern char** environ;
+
+using namespace cal;
+
+namespace {
+
+    constexpr u32 RUNS = 5;
+    constexpr u32 LINES_PER_FILE = 400;
+
+
+    void writeSources(const std::string& dir, u32 files) {
+        for (u32 file = 0; file < files; ++file) {
+            char path[MAX_PATH];
+            snprintf(path, sizeof(path), "%s/m%u.cal", dir.c_str(), file);
+            FILE* out = fopen(path, "wb");
+            for (u32 line = 0; line < LINES_PER_FILE; line += 4) {
+                fprintf(out, "var v%u : i32 = %u;\n", line, line * file);
+                fprintf(out, "fun f%u(a : i32, b : i64[4]) : i32 {\n", line);
+                fprintf(out, "    return a + %u; // \"not a string\"\n", line);
+                fprintf(out, "}\n");
+            }
+            fclose(out);
+        }
+    }
+
+
+    pid_t spawnSelf(const char* self, const char* mode, const char* arg) {
+        char* args[] = { (char*)self, (char*)mode, (char*)arg, nullptr };
+        pid_t pid = -1;
+        if (posix_spawn(&pid, self, nullptr, nullptr, args, environ) != 0) return -1;
+        return pid;
+    }
+
+
+    bool waitFor(pid_t pid) {
+        int status = 0;
+        return pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+
+
+    // what "cal build <src>" does in a fresh process
+    i32 runBuild(const char* src) {
+        static Allocator global{ platform::HugePages::Transparent };
+        const char* argv[] = { "cal", "build", src };
+        ArgsParser args{ 3, argv, global, Driver::VALUE_OPTIONS };
+        BuildOptions options{ global };
+        if (!Driver::parseBuildOptions(args, options)) return 1;
+
+        Driver driver{ global };
+        return driver.build(options);
+    }
+
+
+    bool sendBuild(const std::string& socket, const std::string& src) {
+        const char* argv[] = { "cal", "build", src.c_str() };
+        i32 exit_code = 1;
+        return CompileServer::sendRequest(socket.c_str(), 3, (char**)argv, exit_code) && exit_code == 0;
+    }
+
+
+    double elapsedSince(std::chrono::steady_clock::time_point begin) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+    }
+
+
+    // best first request and best later request over RUNS server processes
+    void runServer(const char* self, const std::string& socket, const std::string& src) {
+        double first = 1e300;
+        double later = 1e300;
+        for (u32 run = 0; run < RUNS; ++run) {
+            const pid_t pid = spawnSelf(self, "--serve", socket.c_str());
+            // listening follows the socket file right away, a refused connect is retried untimed
+            while (!platform::fileExists(socket.c_str())) platform::sleep(1);
+
+            bool sent = false;
+            while (!sent) {
+                const auto begin = std::chrono::steady_clock::now();
+                sent = sendBuild(socket, src);
+                if (sent) first = minimum(first, elapsedSince(begin));
+            }
+            for (u32 i = 0; i < RUNS; ++i) {
+                const auto begin = std::chrono::steady_clock::now();
+                if (sendBuild(socket, src)) later = minimum(later, elapsedSince(begin));
+            }
+
+            const char* argv[] = { "cal", "shutdown" };
+            i32 exit_code = 0;
+            (void)CompileServer::sendRequest(socket.c_str(), 2, (char**)argv, exit_code);
+            waitFor(pid);
+        }
+        printf("%-48s %10.3f ms\n", "server, first request", first);
+        printf("%-48s %10.3f ms\n", "server, later requests", later);
+    }
+}
+
+
+int main(int argc, char** argv) {
+    InitStderrLogger();
+    if (argc > 2 && strcmp(argv[1], "--build") == 0) return runBuild(argv[2]);
+    if (argc > 2 && strcmp(argv[1], "--serve") == 0) {
+        static Allocator global{ platform::HugePages::Transparent };
+        CompileServer server{ global };
+        return server.run(argv[2]);
+    }
+    const u32 files = argc > 1 ? (u32)atoi(argv[1]) : 64;
+
+    char root[] = "/tmp/cal-server-bench-XXXXXX";
+    if (!mkdtemp(root)) return 1;
+    const std::string src = std::string(root) + "/src";
+    const std::string socket = std::string(root) + "/server.sock";
+    if (!platform::makePath(src.c_str())) return 1;
+    writeSources(src, files);
+    printf("%u files of %u lines\n", files, LINES_PER_FILE);
+
+    bench::measure("cold process", RUNS, [&]() {
+        if (!waitFor(spawnSelf(argv[0], "--build", src.c_str()))) LogError("[Bench] cold build failed");
+    });
+    runServer(argv[0], socket, src);
+
+    for (u32 file = 0; file < files; ++file) {
+        char path[MAX_PATH];
+        snprintf(path, sizeof(path), "%s/m%u", src.c_str(), file);
+        remove((std::string(path) + ".cal").c_str());
+        remove((std::string(path) + ".tokens").c_str());
+    }
+    rmdir(src.c_str());
+    rmdir(root);
+    return 0;
+}
@@ -0,0 +1,114 @@
+#include "Bench.hpp"
+
+#include "vm/BytecodeEmitter.hpp"
+#include "vm/Interpreter.hpp"
+#include "vm/JitCompiler.hpp"
+
+#include <base/Logger.hpp>
+#include <base/allocator/Allocator.hpp>
+
+#include <cstdlib>
+
+// interpreter dispatch cost: a straight arithmetic loop and a loop doing one call per iteration,
+// then the time to the first result of a short run, interpreted against compiled by a fresh jit
+// DispatchBench [iterations] [short run iterations]
+
+using namespace cal;
+using namespace cal::vm;
+
+namespace {
+
+    // fun arith(n) { s = 0; for (i = 0; i < n; ++i) s = (s + i) * 3 - i; return s; }
+    void emitArith(BytecodeEmitter& emitter) {
+        emitter.beginFunction("arith", 1);
+        const u8 s = emitter.allocRegister();
+        const u8 i = emitter.allocRegister();
+        const u8 k = emitter.allocRegister();
+        emitter.emitLoadInt(s, 0);
+        emitter.emitLoadInt(i, 0);
+        emitter.emitLoadInt(k, 3);
+        const BytecodeEmitter::Label end = emitter.newLabel();
+        const BytecodeEmitter::Label loop = emitter.newLabel();
+        emitter.emitCompareJump(OpCode::LT_I, i, 0, end, false);
+        emitter.bindLabel(loop);
+        emitter.emitBinary(OpCode::ADD_I, s, s, i);
+        emitter.emitBinary(OpCode::MUL_I, s, s, k);
+        emitter.emitBinary(OpCode::SUB_I, s, s, i);
+        emitter.emitLoopBackEdge(i, 0, loop);
+        emitter.bindLabel(end);
+        emitter.emitReturn(s, ValueKind::Int);
+        emitter.endFunction();
+    }
+
+
+    void runLoop(const char* name, const BytecodeModule& module, const char* func, i64 iterations) {
+        Interpreter interpreter{ module.getAllocator() };
+        const u32 func_idx = (u32)module.findFunction(func);
+        const Value arg = Value::fromInt(iterations);
+        const double ms = bench::measure(name, 5, [&]() {
+            Value result;
+            if (!interpreter.run(module, func_idx, Span<const Value>(&arg, 1), result)) {
+                LogError(interpreter.getError());
+                return;
+            }
+            bench::sink(result.i);
+        });
+        printf("%-48s %10.3f ns\n", "  per iteration", ms * 1e6 / (double)iterations);
+    }
+
+
+    u64 noTrampoline(void*, u32, const u64*, u32* status) {
+        *status = 1;
+        return 0;
+    }
+
+
+    // everything a cold process pays before it has the result, callees are imported so nothing is left to the trampoline
+    void runFirstResult(const char* name, const BytecodeModule& module, const char* func, i64 iterations) {
+        const u32 func_idx = (u32)module.findFunction(func);
+        printf("%s, %lld iterations\n", name, (long long)iterations);
+        bench::measure("  interpreter", 5, [&]() {
+            Interpreter interpreter{ module.getAllocator() };
+            const Value arg = Value::fromInt(iterations);
+            Value result;
+            if (!interpreter.run(module, func_idx, Span<const Value>(&arg, 1), result)) {
+                LogError(interpreter.getError());
+                return;
+            }
+            bench::sink(result.i);
+        });
+        bench::measure("  jit : create, compile, call", 5, [&]() {
+            JitCompiler jit;
+            jit.setImportCallees(true);
+            const NativeEntry entry = jit.compile(module, module.getFunction(func_idx), noTrampoline, nullptr);
+            if (!entry) {
+                LogError(jit.getError());
+                return;
+            }
+            const u64 arg = (u64)iterations;
+            u32 status = 0;
+            bench::sink(entry(&arg, &status));
+        });
+    }
+}
+
+
+int main(int argc, char** argv) {
+    InitLogger();
+    const i64 iterations = argc > 1 ? atoll(argv[1]) : 10000000;
+    const i64 short_iterations = argc > 2 ? atoll(argv[2]) : 10000;
+
+    Allocator alloc;
+    BytecodeModule module{ alloc };
+    {
+        BytecodeEmitter emitter{ module };
+        emitArith(emitter);
+        bench::emitCallLoop(emitter);
+    }
+
+    runLoop("arithmetic loop", module, "arith", iterations);
+    runLoop("call loop", module, "calls", iterations);
+    runFirstResult("arithmetic loop", module, "arith", short_iterations);
+    runFirstResult("call loop", module, "calls", short_iterations);
+    return 0;
+}
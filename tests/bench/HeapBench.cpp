@@ -0,0 +1,283 @@
+#include "Bench.hpp"
+
+#include "runtime/Heap.hpp"
+#include "vm/BytecodeEmitter.hpp"
+#include "vm/Interpreter.hpp"
+
+#include <base/Logger.hpp>
+#include <base/allocator/Allocator.hpp>
+
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+// a small tree built and dropped per iteration while one large tree stays alive, the nodes are class
+// instances on the gc heap or the same nodes malloc'd and freed by hand : nursery throughput and pauses
+// HeapBench [iterations]
+
+using namespace cal;
+using namespace cal::vm;
+
+namespace {
+
+    constexpr i64 KEEP_DEPTH = 16;
+    constexpr i64 TEMP_DEPTH = 10;
+
+    // class node { node left; node right; }
+    const u32 NODE_REFERENCES[] = { 0, 8 };
+    const runtime::ObjectLayout NODE_LAYOUT{ "node", 16, 2, NODE_REFERENCES };
+
+
+    // the same program on both kinds of nodes
+    struct TreeEmitter {
+        BytecodeEmitter& emitter;
+        i32 layout;     // -1 when nodes are malloc'd
+
+        bool onHeap() const { return layout >= 0; }
+
+        u8 allocNode() {
+            if (onHeap()) return emitter.allocReference();
+            const u8 reg = emitter.allocRegister();
+            emitter.emitLoadInt(reg, 0);
+            return reg;
+        }
+
+        void emitNode(u8 dst, u8 scratch) {
+            if (onHeap()) {
+                emitter.emitNew(dst, (u32)layout);
+                return;
+            }
+            emitter.emitLoadInt(scratch, 16);
+            emitter.emitAlloc(dst, scratch);
+        }
+
+        void emitGetChild(u8 dst, u8 node, u8 child) {
+            if (onHeap()) {
+                emitter.emitGetField(dst, node, child);
+                return;
+            }
+            emitter.emitAddImmediate(dst, node, child * 8);
+            emitter.emitPointerLoad(dst, dst, 8);
+        }
+
+        void emitSetChild(u8 node, u8 child, u8 src, u8 scratch) {
+            if (onHeap()) {
+                emitter.emitSetField(node, child, src, true);
+                return;
+            }
+            emitter.emitAddImmediate(scratch, node, child * 8);
+            emitter.emitPointerStore(scratch, src, 8);
+        }
+    };
+
+
+    // fun build(depth) = node(depth ? build(depth - 1) : null, depth ? build(depth - 1) : null)
+    // fun count(node) = node ? 1 + count(node.left) + count(node.right) : 0
+    // fun release(node) { if (node) { release(node.left); release(node.right); free(node); } }     malloc only
+    // fun main(n, keep_depth, temp_depth) {
+    //     keep = build(keep_depth); total = 0
+    //     for (i = 0; i < n; ++i) {
+    //         temp = build(temp_depth); total += count(temp)
+    //         if (i % 50 == 0) keep.left.left = temp (the malloc version releases the replaced tree)
+    //         else release(temp)
+    //     }
+    //     return total + count(keep)
+    // }
+    void emitTrees(BytecodeModule& module, bool on_heap) {
+        const i32 layout = on_heap ? (i32)module.addLayout(NODE_LAYOUT) : -1;
+        BytecodeEmitter emitter{ module };
+        TreeEmitter tree{ emitter, layout };
+
+        const u32 build_idx = emitter.beginFunction("build", 1).index;
+        {
+            const u8 node = tree.allocNode();
+            const u8 left = tree.allocNode();
+            const u8 right = tree.allocNode();
+            const u8 t = emitter.allocRegister();
+            const BytecodeEmitter::Label leaf = emitter.newLabel();
+            emitter.emitLoadInt(t, 0);
+            emitter.emitCompareJump(OpCode::EQ_I, 0, t, leaf, true);
+            emitter.emitAddImmediate(t, 0, -1);
+            emitter.emitCall(t, build_idx, 1);
+            emitter.emitMove(left, t);
+            emitter.emitAddImmediate(t, 0, -1);
+            emitter.emitCall(t, build_idx, 1);
+            emitter.emitMove(right, t);
+            emitter.bindLabel(leaf);
+            tree.emitNode(node, t);
+            tree.emitSetChild(node, 0, left, t);
+            tree.emitSetChild(node, 1, right, t);
+            emitter.emitReturn(node, ValueKind::Int);
+        }
+        emitter.endFunction();
+
+        const u32 count_idx = emitter.beginFunction("count", 1).index;
+        {
+            if (on_heap) emitter.markReferenceParam(0);
+            const u8 s = emitter.allocRegister();
+            const u8 t = emitter.allocRegister();
+            const BytecodeEmitter::Label end = emitter.newLabel();
+            emitter.emitLoadInt(s, 0);
+            emitter.emitCompareJump(OpCode::EQ_I, 0, s, end, true);
+            emitter.emitLoadInt(s, 1);
+            for (u8 child = 0; child < 2; ++child) {
+                tree.emitGetChild(t, 0, child);
+                emitter.emitCall(t, count_idx, 1);
+                emitter.emitBinary(OpCode::ADD_I, s, s, t);
+            }
+            emitter.bindLabel(end);
+            emitter.emitReturn(s, ValueKind::Int);
+        }
+        emitter.endFunction();
+
+        u32 release_idx = 0;
+        if (!on_heap) {
+            release_idx = emitter.beginFunction("release", 1).index;
+            const u8 t = emitter.allocRegister();
+            const BytecodeEmitter::Label end = emitter.newLabel();
+            emitter.emitLoadInt(t, 0);
+            emitter.emitCompareJump(OpCode::EQ_I, 0, t, end, true);
+            for (u8 child = 0; child < 2; ++child) {
+                tree.emitGetChild(t, 0, child);
+                emitter.emitCall(t, release_idx, 1);
+            }
+            emitter.emitFree(0);
+            emitter.bindLabel(end);
+            emitter.emitReturnConstant(Value::fromInt(0), ValueKind::Void);
+            emitter.endFunction();
+        }
+
+        emitter.beginFunction("main", 3);
+        {
+            const u8 keep = tree.allocNode();
+            const u8 temp = tree.allocNode();
+            const u8 holder = tree.allocNode();
+            const u8 total = emitter.allocRegister();
+            const u8 i = emitter.allocRegister();
+            const u8 every = emitter.allocRegister();
+            const u8 base = emitter.allocRegister();
+            emitter.emitMove(base, 1);
+            emitter.emitCall(base, build_idx, 1);
+            emitter.emitMove(keep, base);
+            emitter.emitLoadInt(total, 0);
+            emitter.emitLoadInt(i, 0);
+            emitter.emitLoadInt(every, 50);
+
+            const BytecodeEmitter::Label loop = emitter.newLabel();
+            const BytecodeEmitter::Label drop = emitter.newLabel();
+            const BytecodeEmitter::Label next = emitter.newLabel();
+            emitter.bindLabel(loop);
+            emitter.emitMove(base, 2);
+            emitter.emitCall(base, build_idx, 1);
+            emitter.emitMove(temp, base);
+            emitter.emitMove(base, temp);
+            emitter.emitCall(base, count_idx, 1);
+            emitter.emitBinary(OpCode::ADD_I, total, total, base);
+            emitter.emitBinary(OpCode::MOD_I, base, i, every);
+            emitter.emitJumpIf(base, drop, true);
+            tree.emitGetChild(holder, keep, 0);
+            if (!on_heap) {
+                tree.emitGetChild(base, holder, 0);
+                emitter.emitCall(base, release_idx, 1);
+            }
+            tree.emitSetChild(holder, 0, temp, base);
+            emitter.emitJump(next);
+            emitter.bindLabel(drop);
+            if (!on_heap) {
+                emitter.emitMove(base, temp);
+                emitter.emitCall(base, release_idx, 1);
+            }
+            emitter.bindLabel(next);
+            // the collector would keep them alive until the next iteration
+            emitter.emitLoadInt(temp, 0);
+            emitter.emitLoadInt(holder, 0);
+            emitter.emitLoopBackEdge(i, 0, loop);
+
+            emitter.emitMove(base, keep);
+            emitter.emitCall(base, count_idx, 1);
+            emitter.emitBinary(OpCode::ADD_I, total, total, base);
+            if (!on_heap) {
+                emitter.emitMove(base, keep);
+                emitter.emitCall(base, release_idx, 1);
+            }
+            emitter.emitReturn(total, ValueKind::Int);
+        }
+        emitter.endFunction();
+    }
+
+
+    i64 getNodeCount(i64 depth) {
+        return ((i64)2 << depth) - 1;
+    }
+
+
+    bool runMain(Interpreter& interpreter, const BytecodeModule& module, i64 iterations) {
+        const Value args[] = { Value::fromInt(iterations), Value::fromInt(KEEP_DEPTH), Value::fromInt(TEMP_DEPTH) };
+        Value result;
+        if (!interpreter.run(module, (u32)module.findFunction("main"), Span<const Value>(args, 3), result)) return false;
+
+        // keep.left.left went from a KEEP_DEPTH - 2 tree to a TEMP_DEPTH one
+        const i64 kept = getNodeCount(KEEP_DEPTH) - getNodeCount(KEEP_DEPTH - 2) + getNodeCount(TEMP_DEPTH);
+        if (iterations > 0 && result.i != iterations * getNodeCount(TEMP_DEPTH) + kept) {
+            LogError("wrong node count ", result.i);
+            return false;
+        }
+        bench::sink(result.i);
+        return true;
+    }
+
+
+    void runMalloc(IAllocator& alloc, i64 iterations) {
+        BytecodeModule module{ alloc };
+        emitTrees(module, false);
+        Interpreter interpreter{ alloc };
+        bench::measure("malloc / free", 3, [&]() {
+            if (!runMain(interpreter, module, iterations)) LogError(interpreter.getError());
+        });
+    }
+
+
+    // every thread runs main on its own interpreter, they share the heap and stop for each other's collections
+    void runHeap(IAllocator& alloc, i64 iterations, u32 threads) {
+        BytecodeModule module{ alloc };
+        emitTrees(module, true);
+        runtime::Heap heap{ alloc, runtime::Heap::Config{} };
+        if (!heap.isValid()) return;
+
+        char label[64];
+        snprintf(label, sizeof(label), "heap, %u threads", threads);
+        bench::measure(label, 3, [&]() {
+            std::vector<std::thread> workers;
+            for (u32 t = 0; t < threads; ++t) {
+                workers.emplace_back([&]() {
+                    runtime::Mutator* mutator = heap.attachThread();
+                    Interpreter interpreter{ alloc };
+                    interpreter.setHeap(&heap, mutator);
+                    if (!runMain(interpreter, module, iterations / threads)) LogError(interpreter.getError());
+                    interpreter.setHeap(nullptr, nullptr);
+                    heap.detachThread(mutator);
+                });
+            }
+            for (std::thread& worker : workers) worker.join();
+        });
+
+        const runtime::Heap::Stats stats = heap.getStats();
+        printf("  %-46s %10u, %llu us max, %llu us total\n", "minor collections", stats.minor_collections,
+            (unsigned long long)stats.minor_pause_max, (unsigned long long)stats.minor_pause_total);
+        printf("  %-46s %10u, %llu us max, %llu us total\n", "major collections", stats.major_collections,
+            (unsigned long long)stats.major_pause_max, (unsigned long long)stats.major_pause_total);
+        printf("  %-46s %10llu MB allocated, %llu MB promoted\n", "", (unsigned long long)(stats.allocated_bytes >> 20),
+            (unsigned long long)(stats.promoted_bytes >> 20));
+    }
+}
+
+
+int main(int argc, char** argv) {
+    InitLogger();
+    const i64 iterations = argc > 1 ? atoll(argv[1]) : 20000;
+
+    Allocator alloc;
+    runMalloc(alloc, iterations);
+    for (u32 threads : { 1, 4 }) runHeap(alloc, iterations, threads);
+    return 0;
+}
@@ -0,0 +1,72 @@
+#include "Bench.hpp"
+
+#include <base/Logger.hpp>
+#include <base/allocator/Allocator.hpp>
+#include <base/allocator/LinearAllocator.hpp>
+#include <system/Sys.hpp>
+
+#include <cstdlib>
+#include <utility>
+#include <vector>
+
+// pointer chasing through 256 MiB of nodes, tlb bound : 4 KiB pages against transparent huge pages
+// HugePageBench [steps]
+
+using namespace cal;
+
+namespace {
+
+    struct Node {
+        Node* next;
+        u64 pad[7];
+    };
+
+    constexpr size_t NODE_COUNT = 4 << 20;
+
+
+    void chase(const char* name, IAllocator& alloc, u32 steps) {
+        std::vector<Node*> nodes(NODE_COUNT);
+        for (Node*& node : nodes) node = (Node*)alloc.allocate(sizeof(Node), 8);
+
+        // one random cycle through every node
+        u32 state = 1;
+        for (size_t i = NODE_COUNT - 1; i > 0; --i) {
+            std::swap(nodes[i], nodes[bench::nextRandom(state) % (i + 1)]);
+        }
+        for (size_t i = 0; i < NODE_COUNT; ++i) nodes[i]->next = nodes[(i + 1) % NODE_COUNT];
+
+        bench::measure(name, 3, [&]() {
+            const Node* node = nodes[0];
+            for (u32 i = 0; i < steps; ++i) node = node->next;
+            bench::sink((u64)(uintptr)node);
+        });
+        for (Node* node : nodes) alloc.deallocate(node);
+    }
+}
+
+
+int main(int argc, char** argv) {
+    InitLogger();
+    const u32 steps = argc > 1 ? (u32)atoll(argv[1]) : 20000000;
+    printf("huge page %u B, %d numa nodes, %u steps\n", platform::getHugePageSize(), platform::getNumaNodeCount(), steps);
+
+    {
+        Allocator alloc{ platform::HugePages::None };
+        chase("Allocator, 4 KiB pages", alloc, steps);
+    }
+    {
+        Allocator alloc{ platform::HugePages::Transparent, 0 };
+        chase("Allocator, transparent huge pages, node 0", alloc, steps);
+    }
+    {
+        LinearAllocator alloc{ 512 << 20, false, platform::HugePages::None };
+        chase("LinearAllocator, 4 KiB pages", alloc, steps);
+        alloc.reset();
+    }
+    {
+        LinearAllocator alloc{ 512 << 20, false, platform::HugePages::Transparent };
+        chase("LinearAllocator, transparent huge pages", alloc, steps);
+        alloc.reset();
+    }
+    return 0;
+}
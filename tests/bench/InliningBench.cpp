@@ -0,0 +1,60 @@
+#include "Bench.hpp"
+
+#include "vm/BytecodeEmitter.hpp"
+#include "vm/TieredRuntime.hpp"
+
+#include <base/Logger.hpp>
+#include <base/allocator/Allocator.hpp>
+#include <system/SysThreading.hpp>
+
+#include <cstdlib>
+
+// a loop of tiny calls, jitted with and without whole program mode (callees imported and inlined)
+// InliningBench [iterations]
+
+using namespace cal;
+using namespace cal::vm;
+
+namespace {
+
+    // every function of a fresh module tiered up before measuring, steady state only
+    void runJitted(const char* name, IAllocator& alloc, bool whole_program, i64 iterations) {
+        BytecodeModule module{ alloc };
+        {
+            BytecodeEmitter emitter{ module };
+            bench::emitCallLoop(emitter, true);
+        }
+        const u32 func_idx = (u32)module.findFunction("calls");
+
+        TieredRuntime runtime{ module, alloc, 1, 1 };
+        runtime.setWholeProgram(whole_program);
+        const Value warmup = Value::fromInt(1);
+        Value result;
+        if (!runtime.run(func_idx, Span<const Value>(&warmup, 1), result)) {
+            LogError(runtime.getError());
+            return;
+        }
+        while (runtime.hasPendingWork()) platform::sleep(1);
+
+        const Value arg = Value::fromInt(iterations);
+        bench::measure(name, 5, [&]() {
+            if (!runtime.run(func_idx, Span<const Value>(&arg, 1), result)) {
+                LogError(runtime.getError());
+                return;
+            }
+            bench::sink(result.i);
+        });
+        printf("%-48s %10u\n", "  callees imported", runtime.getStats().imported);
+    }
+}
+
+
+int main(int argc, char** argv) {
+    InitLogger();
+    const i64 iterations = argc > 1 ? atoll(argv[1]) : 100000000;
+
+    Allocator alloc;
+    runJitted("jitted, calls through native entries", alloc, false, iterations);
+    runJitted("jitted, whole program", alloc, true, iterations);
+    return 0;
+}
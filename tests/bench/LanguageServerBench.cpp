@@ -0,0 +1,212 @@
+#include "Bench.hpp"
+
+#include "lsp/LanguageServer.hpp"
+
+#include <base/Logger.hpp>
+#include <base/allocator/Allocator.hpp>
+
+#include <json/json.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <spawn.h>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+// "cal lsp" in a child process, driven over its stdin / stdout like an editor would :
+// the first analysis of a big document, then definition requests each right after an edit of that document
+// (the edit's analysis runs on the pool while the request is answered)
+// LanguageServerBench [functions]      a function is 4 lines
+
+extern char** environ;
+
+using namespace cal;
+
+namespace {
+
+    constexpr u32 REQUESTS = 200;
+
+
+    struct Client {
+        bool start(const char* self) {
+            int input[2], output[2];
+            if (pipe(input) != 0 || pipe(output) != 0) return false;
+
+            posix_spawn_file_actions_t actions;
+            posix_spawn_file_actions_init(&actions);
+            posix_spawn_file_actions_adddup2(&actions, input[0], 0);
+            posix_spawn_file_actions_adddup2(&actions, output[1], 1);
+            posix_spawn_file_actions_addclose(&actions, input[1]);
+            posix_spawn_file_actions_addclose(&actions, output[0]);
+            char* args[] = { (char*)self, (char*)"--lsp", nullptr };
+            const bool result = posix_spawn(&pid, self, &actions, nullptr, args, environ) == 0;
+            posix_spawn_file_actions_destroy(&actions);
+
+            close(input[0]);
+            close(output[1]);
+            to_server = fdopen(input[1], "wb");
+            from_server = fdopen(output[0], "rb");
+            return result && to_server && from_server;
+        }
+
+        void send(const Json::Value& message) {
+            Json::StreamWriterBuilder writer;
+            writer["indentation"] = "";
+            const std::string body = Json::writeString(writer, message);
+            fprintf(to_server, "Content-Length: %zu\r\n\r\n", body.size());
+            fwrite(body.data(), 1, body.size(), to_server);
+            fflush(to_server);
+        }
+
+        bool receive(Json::Value& message) {
+            char line[256];
+            size_t length = 0;
+            for (;;) {
+                if (!fgets(line, sizeof(line), from_server)) return false;
+                if (strcmp(line, "\r\n") == 0) break;
+                if (strncmp(line, "Content-Length:", 15) == 0) length = strtoull(line + 15, nullptr, 10);
+            }
+            std::string body(length, '\0');
+            if (fread(body.data(), 1, length, from_server) != length) return false;
+
+            Json::CharReaderBuilder builder;
+            std::unique_ptr<Json::CharReader> reader{ builder.newCharReader() };
+            return reader->parse(body.data(), body.data() + body.size(), &message, nullptr);
+        }
+
+        void notify(const char* method, const Json::Value& params) {
+            Json::Value message;
+            message["jsonrpc"] = "2.0";
+            message["method"] = method;
+            message["params"] = params;
+            send(message);
+        }
+
+        // skips notifications until the response to this request arrives
+        bool request(const char* method, const Json::Value& params, Json::Value& result) {
+            Json::Value message;
+            message["jsonrpc"] = "2.0";
+            message["id"] = ++last_id;
+            message["method"] = method;
+            message["params"] = params;
+            send(message);
+            while (receive(message)) {
+                if (message["id"] == last_id) {
+                    result = message["result"];
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // skips everything until diagnostics of uri arrive
+        bool waitForDiagnostics(const char* uri) {
+            Json::Value message;
+            while (receive(message)) {
+                if (message["method"] == "textDocument/publishDiagnostics" && message["params"]["uri"] == uri) return true;
+            }
+            return false;
+        }
+
+        bool stop() {
+            Json::Value result;
+            const bool shutdown = request("shutdown", Json::Value{}, result);
+            notify("exit", Json::Value{});
+            fclose(to_server);
+            // diagnostics of the last edit may still be on their way, reading on until the server is gone
+            Json::Value message;
+            while (receive(message)) {}
+            fclose(from_server);
+            int status = 0;
+            return shutdown && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        }
+
+        pid_t pid = -1;
+        FILE* to_server = nullptr;
+        FILE* from_server = nullptr;
+        i32 last_id = 0;
+    };
+
+
+    Json::Value makePosition(u32 line, u32 character) {
+        Json::Value position;
+        position["line"] = line;
+        position["character"] = character;
+        return position;
+    }
+
+
+    double elapsedSince(std::chrono::steady_clock::time_point begin) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+    }
+}
+
+
+int main(int argc, char** argv) {
+    // stdout carries the protocol in the child
+    InitStderrLogger();
+    if (argc > 1 && strcmp(argv[1], "--lsp") == 0) {
+        static Allocator global;
+        LanguageServer server{ global };
+        return server.run();
+    }
+    const u32 functions = argc > 1 ? (u32)atoi(argv[1]) : 12500;
+
+    std::string text;
+    char line[256];
+    for (u32 i = 0; i < functions; ++i) {
+        snprintf(line, sizeof(line), "fun f%u(a : i32) : i32 {\n    val v%u = a;\n    return f%u(v%u);\n}\n", i, i, i, i);
+        text += line;
+    }
+
+    Client client;
+    if (!client.start(argv[0])) {
+        LogError("[Bench] could not start the language server");
+        return 1;
+    }
+    Json::Value result;
+    client.request("initialize", Json::Value{ Json::ValueType::objectValue }, result);
+    printf("one document of %u lines\n", functions * 4);
+
+    const char* uri = "file:///bench.cal";
+    Json::Value open;
+    open["textDocument"]["uri"] = uri;
+    open["textDocument"]["version"] = 1;
+    open["textDocument"]["text"] = text;
+    auto begin = std::chrono::steady_clock::now();
+    client.notify("textDocument/didOpen", open);
+    client.waitForDiagnostics(uri);
+    printf("%-48s %10.3f ms\n", "open until diagnostics", elapsedSince(begin));
+
+    // every edit inserts a space at the same place, the request looks up a call near the end
+    std::vector<double> latencies;
+    for (u32 i = 0; i < REQUESTS; ++i) {
+        Json::Value change;
+        change["textDocument"]["uri"] = uri;
+        change["textDocument"]["version"] = (i32)i + 2;
+        Json::Value& edit = change["contentChanges"].append(Json::Value{});
+        edit["range"]["start"] = makePosition(functions, 4);
+        edit["range"]["end"] = makePosition(functions, 4);
+        edit["text"] = " ";
+        client.notify("textDocument/didChange", change);
+
+        Json::Value definition;
+        definition["textDocument"]["uri"] = uri;
+        definition["position"] = makePosition((functions - 1 - i % 100) * 4 + 2, 12);
+        begin = std::chrono::steady_clock::now();
+        if (!client.request("textDocument/definition", definition, result)) break;
+        latencies.push_back(elapsedSince(begin));
+        bench::sink(result.size());
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    if (!latencies.empty()) {
+        printf("%-48s %10.3f ms\n", "definition after an edit, p50", latencies[latencies.size() / 2]);
+        printf("%-48s %10.3f ms\n", "definition after an edit, p99", latencies[latencies.size() * 99 / 100]);
+    }
+    return client.stop() ? 0 : 1;
+}
@@ -0,0 +1,87 @@
+#include "Bench.hpp"
+
+#include <base/Logger.hpp>
+#include <base/allocator/Allocator.hpp>
+#include <base/allocator/PageAllocator.hpp>
+#include <system/io/Stream.hpp>
+
+#include <thread>
+#include <vector>
+
+// PageAllocator churn from several threads, pages handed between threads and paged streams
+// PageAllocatorBench
+
+using namespace cal;
+
+namespace {
+
+    constexpr u32 ROUNDS = 200000;
+    constexpr u32 MAX_HELD = 64;
+
+
+    template <typename Func>
+    void runThreads(u32 threads, Func&& func) {
+        std::vector<std::thread> workers;
+        for (u32 t = 0; t < threads; ++t) workers.emplace_back(func, t);
+        for (std::thread& worker : workers) worker.join();
+    }
+
+
+    // every thread takes a few pages, touches them and gives them back
+    void churn(PageAllocator& pages, u32 threads) {
+        runThreads(threads, [&](u32 t) {
+            void* held[MAX_HELD];
+            u32 state = 1 + t;
+            for (u32 i = 0; i < ROUNDS / threads; ++i) {
+                const u32 count = 1 + bench::nextRandom(state) % MAX_HELD;
+                for (u32 k = 0; k < count; ++k) {
+                    held[k] = pages.allocate();
+                    *(u8*)held[k] = 1;
+                }
+                for (u32 k = 0; k < count; ++k) pages.deallocate(held[k]);
+            }
+        });
+    }
+
+
+    // pages allocated on one thread are freed on another, they have to travel through the batch stack
+    void handoff(PageAllocator& pages, u32 threads) {
+        std::vector<std::vector<void*>> produced(threads);
+        runThreads(threads, [&](u32 t) {
+            produced[t].resize(4096);
+            for (void*& page : produced[t]) page = pages.allocate();
+        });
+        runThreads(threads, [&](u32 t) {
+            for (void* page : produced[(t + 1) % threads]) pages.deallocate(page);
+        });
+    }
+
+
+    void streams(PageAllocator& pages, u32 threads) {
+        runThreads(threads, [&](u32) {
+            u8 data[1000] = {};
+            for (u32 i = 0; i < 2000 / threads; ++i) {
+                PagedOStream stream{ pages };
+                for (u32 k = 0; k < 40; ++k) stream.write(data, sizeof(data));
+            }
+        });
+    }
+}
+
+
+int main() {
+    InitLogger();
+
+    Allocator alloc;
+    PageAllocator pages{ alloc };
+    char label[64];
+    for (u32 threads : { 1, 2, 4, 8 }) {
+        printf("%u threads\n", threads);
+        snprintf(label, sizeof(label), "  churn %u rounds of 1 .. %u pages", ROUNDS, MAX_HELD);
+        bench::measure(label, 3, [&]() { churn(pages, threads); });
+        bench::measure("  4096 pages per thread freed on another", 3, [&]() { handoff(pages, threads); });
+        bench::measure("  2000 paged streams of 40 KB", 3, [&]() { streams(pages, threads); });
+    }
+    printf("%-48s %10u pages\n", "reserved", pages.getReservedCount());
+    return 0;
+}
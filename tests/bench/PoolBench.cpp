@@ -0,0 +1,76 @@
+#include "Bench.hpp"
+
+#include <base/Logger.hpp>
+#include <base/allocator/Allocator.hpp>
+#include <base/allocator/PoolAllocator.hpp>
+
+#include <vector>
+
+// node heavy churn : PoolAllocator and a shared slab behind a SlabCache against CAL_NEW / CAL_DEL
+// PoolBench
+
+using namespace cal;
+
+namespace {
+
+    struct Node {
+        Node* left;
+        Node* right;
+        i64 key;
+        i64 value;
+    };
+
+
+    // builds a tree of nodes, replaces random ones, frees them all
+    template <typename Create, typename Destroy>
+    void churn(Create&& create, Destroy&& destroy) {
+        std::vector<Node*> nodes(200000);
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            Node* node = create();
+            node->key = (i64)i;
+            node->left = i > 0 ? nodes[(i - 1) / 2] : nullptr;
+            nodes[i] = node;
+        }
+
+        u32 state = 1;
+        for (u32 i = 0; i < 400000; ++i) {
+            const u32 index = bench::nextRandom(state) % (u32)nodes.size();
+            destroy(nodes[index]);
+            nodes[index] = create();
+            nodes[index]->key = i;
+        }
+
+        for (Node* node : nodes) {
+            bench::sink((u64)node->key);
+            destroy(node);
+        }
+    }
+}
+
+
+int main() {
+    InitLogger();
+
+    Allocator alloc;
+    PageAllocator pages{ alloc };
+
+    bench::measure("Allocator CAL_NEW / CAL_DEL", 5, [&]() {
+        churn([&]() { return CAL_NEW(alloc, Node)(); }, [&](Node* node) { CAL_DEL(alloc, node); });
+    });
+
+    PoolAllocator<Node> pool{ pages };
+    bench::measure("PoolAllocator<Node>", 5, [&]() {
+        churn([&]() { return pool.create(); }, [&](Node* node) { pool.destroy(node); });
+    });
+
+    PoolAllocator<Node> shared{ pages, true };
+    bench::measure("shared slab, locked", 5, [&]() {
+        churn([&]() { return shared.create(); }, [&](Node* node) { shared.destroy(node); });
+    });
+
+    SlabCache cache{ shared.getSlab() };
+    bench::measure("shared slab + SlabCache", 5, [&]() {
+        churn([&]() { return new (NewPlaceholder(), cache.allocate()) Node(); }, [&](Node* node) { cache.deallocate(node); });
+    });
+    return 0;
+}
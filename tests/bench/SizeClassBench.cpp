@@ -0,0 +1,92 @@
+#include "Bench.hpp"
+
+#include <base/Logger.hpp>
+#include <base/allocator/Allocator.hpp>
+#include <system/Sys.hpp>
+
+#include <cstring>
+#include <vector>
+
+// cal::Allocator against the system allocator across the size classes, large spans and realloc growth
+// SizeClassBench
+
+using namespace cal;
+
+namespace {
+
+    // skewed toward small sizes like real programs, up to max_size
+    size_t pickSize(u32& state, size_t max_size) {
+        const size_t bound = size_t(8) << (bench::nextRandom(state) % 10);
+        return 1 + bench::nextRandom(state) % (bound < max_size ? bound : max_size);
+    }
+
+
+    void churn(IAllocator& alloc, u32 slots, u32 iterations, size_t min_size, size_t max_size) {
+        std::vector<void*> live(slots, nullptr);
+        u32 state = 1;
+        for (u32 i = 0; i < iterations; ++i) {
+            const u32 slot = bench::nextRandom(state) % slots;
+            if (live[slot]) alloc.deallocate(live[slot]);
+            const size_t size = min_size + pickSize(state, max_size - min_size);
+            live[slot] = alloc.allocate(size, 8);
+            ((u8*)live[slot])[0] = 1;
+            ((u8*)live[slot])[size - 1] = 1;
+        }
+        for (void* ptr : live) alloc.deallocate(ptr);
+    }
+
+
+    void growByRealloc(IAllocator& alloc, size_t target) {
+        size_t capacity = 16;
+        u8* data = (u8*)alloc.allocate(capacity, 8);
+        for (size_t size = 0; size < target; size += 4096) {
+            while (size + 4096 > capacity) {
+                data = (u8*)alloc.reallocate(data, capacity * 2, capacity, 8);
+                capacity *= 2;
+            }
+            data[size] = 1;
+        }
+        alloc.deallocate(data);
+    }
+
+
+    // resident memory of 1M live objects against what was asked for
+    void reportOverhead(const char* name, IAllocator& alloc) {
+        std::vector<void*> live(1000000);
+        u32 state = 3;
+        size_t requested = 0;
+        const u64 before = platform::getProcessMemory();
+        for (void*& ptr : live) {
+            const size_t size = pickSize(state, 512);
+            requested += size;
+            ptr = alloc.allocate(size, 8);
+            memset(ptr, 1, size);
+        }
+        const u64 after = platform::getProcessMemory();
+        printf("%-48s %10.1f %% overhead\n", name, 100.0 * ((double)(after - before) - (double)requested) / (double)requested);
+        for (void* ptr : live) alloc.deallocate(ptr);
+    }
+
+
+    void runAll(const char* name, IAllocator& alloc) {
+        printf("%s\n", name);
+        bench::measure("  churn 1 B .. 4 KiB", 3, [&]() { churn(alloc, 4096, 5000000, 0, 4096); });
+        bench::measure("  churn 8 KiB .. 1 MiB", 3, [&]() { churn(alloc, 64, 100000, 8192, 1 << 20); });
+        bench::measure("  realloc growth to 1 MiB x 100", 3, [&]() {
+            for (u32 i = 0; i < 100; ++i) growByRealloc(alloc, 1 << 20);
+        });
+        reportOverhead("  1M objects of 1 .. 512 B", alloc);
+    }
+}
+
+
+int main() {
+    InitLogger();
+
+    Allocator cal_allocator;
+    runAll("cal::Allocator", cal_allocator);
+
+    bench::SystemAllocator system_allocator;
+    runAll("system", system_allocator);
+    return 0;
+}
@@ -0,0 +1,83 @@
+#include "Bench.hpp"
+
+#include <base/Logger.hpp>
+#include <base/allocator/Allocator.hpp>
+
+#include <thread>
+#include <vector>
+
+// small allocations from several threads at once, each on its own heap, with frees crossing threads
+// ThreadHeapBench
+
+using namespace cal;
+
+namespace {
+
+    constexpr u32 OPS = 4000000;
+    constexpr u32 LIVE = 256;
+
+
+    // every thread churns its own slots, with cross the next thread frees what is left
+    void churn(IAllocator& alloc, u32 threads, bool cross) {
+        std::vector<std::vector<void*>> left(threads);
+        std::vector<std::thread> workers;
+        for (u32 t = 0; t < threads; ++t) {
+            workers.emplace_back([&, t]() {
+                std::vector<void*> live(LIVE, nullptr);
+                u32 state = 1 + t;
+                for (u32 i = 0; i < OPS / threads; ++i) {
+                    const u32 random = bench::nextRandom(state);
+                    void*& slot = live[random % LIVE];
+                    if (slot) alloc.deallocate(slot);
+                    slot = alloc.allocate(1 + (random >> 10) % 64, 8);
+                    *(u8*)slot = 1;
+                }
+                left[t] = std::move(live);
+            });
+        }
+        for (std::thread& worker : workers) worker.join();
+        workers.clear();
+
+        for (u32 t = 0; t < threads; ++t) {
+            workers.emplace_back([&, t]() {
+                for (void* ptr : left[cross ? (t + 1) % threads : t]) alloc.deallocate(ptr);
+            });
+        }
+        for (std::thread& worker : workers) worker.join();
+    }
+
+
+    // producer / consumer, everything allocated on one thread is freed on another
+    void handoff(IAllocator& alloc) {
+        std::vector<void*> queue(2000000);
+        std::thread producer([&]() { for (void*& ptr : queue) ptr = alloc.allocate(32, 8); });
+        producer.join();
+        std::thread consumer([&]() { for (void* ptr : queue) alloc.deallocate(ptr); });
+        consumer.join();
+    }
+
+
+    void runAll(const char* name, IAllocator& alloc) {
+        printf("%s\n", name);
+        char label[64];
+        for (u32 threads : { 1, 2, 4, 8 }) {
+            snprintf(label, sizeof(label), "  %u threads", threads);
+            bench::measure(label, 3, [&]() { churn(alloc, threads, false); });
+            snprintf(label, sizeof(label), "  %u threads, frees cross threads", threads);
+            bench::measure(label, 3, [&]() { churn(alloc, threads, true); });
+        }
+        bench::measure("  handoff 2M", 3, [&]() { handoff(alloc); });
+    }
+}
+
+
+int main() {
+    InitLogger();
+
+    Allocator cal_allocator;
+    runAll("cal::Allocator", cal_allocator);
+
+    bench::SystemAllocator system_allocator;
+    runAll("system", system_allocator);
+    return 0;
+}
@@ -0,0 +1,93 @@
+#include "Bench.hpp"
+
+#include "vm/BytecodeEmitter.hpp"
+#include "vm/Interpreter.hpp"
+#include "vm/TieredRuntime.hpp"
+
+#include <base/Logger.hpp>
+#include <base/allocator/Allocator.hpp>
+#include <system/SysThreading.hpp>
+
+#include <cstdlib>
+
+// the same call heavy loop interpreted only and through the tiered runtime :
+// the first runs one after another (the tiering curve, sq and calls go native while they run) and the steady state
+// TieringBench [iterations]
+
+using namespace cal;
+using namespace cal::vm;
+
+namespace {
+
+    template <typename Runner>
+    void runLoop(const char* name, u32 runs, Runner& runner, u32 func_idx, i64 iterations) {
+        const Value arg = Value::fromInt(iterations);
+        bench::measure(name, runs, [&]() {
+            Value result;
+            if (!runner.run(func_idx, Span<const Value>(&arg, 1), result)) {
+                LogError(runner.getError());
+                return;
+            }
+            bench::sink(result.i);
+        });
+    }
+
+
+    // CURVE_RUNS runs of iterations / CURVE_RUNS each, without waiting for the compile thread in between
+    constexpr u32 CURVE_RUNS = 20;
+
+    void runCurve(TieredRuntime& runtime, u32 func_idx, i64 iterations) {
+        const Value arg = Value::fromInt(iterations / CURVE_RUNS);
+        char label[64];
+        for (u32 run = 0; run < CURVE_RUNS; ++run) {
+            const auto start = std::chrono::steady_clock::now();
+            Value result;
+            if (!runtime.run(func_idx, Span<const Value>(&arg, 1), result)) {
+                LogError(runtime.getError());
+                return;
+            }
+            bench::sink(result.i);
+            const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+            snprintf(label, sizeof(label), "  run %u", run);
+            printf("%-48s %10.3f ms\n", label, elapsed.count());
+        }
+    }
+
+
+    struct InterpreterRunner {
+        bool run(u32 func_idx, Span<const Value> args, Value& result) { return interpreter.run(module, func_idx, args, result); }
+        const std::string& getError() const { return interpreter.getError(); }
+
+        const BytecodeModule& module;
+        Interpreter interpreter;
+    };
+}
+
+
+int main(int argc, char** argv) {
+    InitLogger();
+    const i64 iterations = argc > 1 ? atoll(argv[1]) : 10000000;
+
+    Allocator alloc;
+    BytecodeModule module{ alloc };
+    {
+        BytecodeEmitter emitter{ module };
+        bench::emitCallLoop(emitter);
+    }
+    const u32 func_idx = (u32)module.findFunction("calls");
+
+    InterpreterRunner interpreted{ module, Interpreter{ alloc } };
+    runLoop("interpreted", 5, interpreted, func_idx, iterations);
+
+    // a run stays in the interpreter until sq goes native, there is no on-stack replacement for calls
+    TieredRuntime runtime{ module, alloc };
+    printf("tiered, %u runs of %lld iterations\n", CURVE_RUNS, (long long)(iterations / CURVE_RUNS));
+    runCurve(runtime, func_idx, iterations);
+    while (runtime.hasPendingWork()) platform::sleep(1);
+    runLoop("tiered, steady state", 5, runtime, func_idx, iterations);
+
+    const TieredRuntime::Stats stats = runtime.getStats();
+    printf("%-48s %10.3f ms\n", "  jit compile time", stats.compile_time * 1000.0);
+    printf("%-48s %10.3f ms\n", "  time until the last function went native", stats.steady_state_time * 1000.0);
+    return 0;
+}
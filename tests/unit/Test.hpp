@@ -0,0 +1,22 @@
+#pragma once
+
+// minimal test registry, every CAL_TEST in the executable runs unless a name filter is given
+
+namespace cal::test {
+
+    using TestFunc = void(*)();
+
+    struct TestRegistrar {
+        TestRegistrar(const char* name, TestFunc func);
+    };
+
+    void reportFailure(const char* file, int line, const char* expression);
+}
+
+#define CAL_TEST(name)                                                          \
+    static void calTest_##name();                                               \
+    static ::cal::test::TestRegistrar s_calTest_##name{ #name, calTest_##name }; \
+    static void calTest_##name()
+
+// keeps running the test after a failure so one run reports all of them
+#define CAL_EXPECT(x) do { if (!(x)) ::cal::test::reportFailure(__FILE__, __LINE__, #x); } while (false)
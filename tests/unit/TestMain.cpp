@@ -0,0 +1,58 @@
+#include "Test.hpp"
+
+#include <base/Logger.hpp>
+
+#include <cstdio>
+#include <cstring>
+
+namespace cal::test {
+
+    struct TestCase {
+        const char* name;
+        TestFunc func;
+        TestCase* next;
+    };
+
+    // registrars run during static initialization, no allocator exists yet
+    static TestCase* s_tests = nullptr;
+    static TestCase** s_tests_end = &s_tests;
+    static int s_failures = 0;
+
+
+    TestRegistrar::TestRegistrar(const char* name, TestFunc func) {
+        TestCase* test = new TestCase{ name, func, nullptr };
+        *s_tests_end = test;
+        s_tests_end = &test->next;
+    }
+
+
+    void reportFailure(const char* file, int line, const char* expression) {
+        fprintf(stderr, "%s:%d: failed: %s\n", file, line, expression);
+        ++s_failures;
+    }
+}
+
+
+// CalTests [name filter]
+int main(int argc, char** argv) {
+    using namespace cal::test;
+    InitLogger();
+
+    const char* filter = argc > 1 ? argv[1] : nullptr;
+    int ran = 0;
+    int failed = 0;
+    for (TestCase* test = s_tests; test; test = test->next) {
+        if (filter && !strstr(test->name, filter)) continue;
+
+        const int failures_before = s_failures;
+        test->func();
+        ++ran;
+        if (s_failures != failures_before) {
+            ++failed;
+            fprintf(stderr, "FAIL %s\n", test->name);
+        }
+    }
+
+    printf("%d tests, %d failed\n", ran, failed);
+    return failed == 0 ? 0 : 1;
+}
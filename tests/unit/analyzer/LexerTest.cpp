@@ -0,0 +1,83 @@
+#include "Test.hpp"
+
+#include "analyzer/Lexer.hpp"
+
+#include <base/allocator/Allocator.hpp>
+
+#include <cstring>
+
+using namespace cal;
+
+namespace {
+
+    struct Expected {
+        DiagnosticSeverity severity;
+        const char* text;       // the range, found in the source after the previous diagnostic
+        const char* message;
+    };
+}
+
+
+CAL_TEST(lexer_reports_every_broken_declaration) {
+    const std::string source =
+        "var : i32 = 1;\n"
+        "fun f(a i32, b: i32) {}\n"
+        "struct S { x i32, y: i64 }\n"
+        "val s = \"abc\n"
+        "import ;\n"
+        "export 'd' fun g() {}\n"
+        "import std.io;\n"
+        "var ok: i32 = 2;\n"
+        "fun h(c: i32 {}\n"
+        "@\n";
+
+    const Expected expected[] = {
+        { DiagnosticSeverity::Error, ":", "expected a name after 'var'" },
+        { DiagnosticSeverity::Error, "a", "expected ':' and a type after parameter 'a'" },
+        { DiagnosticSeverity::Error, "x", "expected ':' and a type after field 'x'" },
+        { DiagnosticSeverity::Error, "\"abc", "unterminated string literal" },
+        { DiagnosticSeverity::Error, ";", "expected a module name after 'import'" },
+        { DiagnosticSeverity::Error, "'d'", "unknown export target 'd', only 'c' is supported" },
+        { DiagnosticSeverity::Error, "fun h(c: i32", "parameter list is never closed" },
+        { DiagnosticSeverity::Warning, "@", "unexpected character '@'" },
+    };
+
+    Allocator alloc;
+    Lexer lexer{ source, alloc };
+    lexer.analyze();
+    const Array<Diagnostic>& diagnostics = lexer.getDiagnostics();
+    CAL_EXPECT(diagnostics.size() == sizeof(expected) / sizeof(expected[0]));
+    CAL_EXPECT(lexer.hasErrors());
+
+    // the ranges cover the broken part only, not the whitespace after it
+    size_t begin = 0;
+    for (u32 i = 0; i < (u32)diagnostics.size() && i < sizeof(expected) / sizeof(expected[0]); ++i) {
+        const Diagnostic& diagnostic = diagnostics[i];
+        begin = source.find(expected[i].text, begin);
+        CAL_EXPECT(begin != std::string::npos);
+        CAL_EXPECT(diagnostic.severity == expected[i].severity);
+        CAL_EXPECT(diagnostic.begin == begin && diagnostic.end == begin + strlen(expected[i].text));
+        CAL_EXPECT(diagnostic.message == expected[i].message);
+    }
+
+    // lexing went on after every error
+    Array<std::string> imports{ alloc };
+    lexer.collectImports(imports);
+    CAL_EXPECT(imports.size() == 1 && imports[0] == "std.io");
+}
+
+
+CAL_TEST(lexer_accepts_valid_declarations) {
+    const std::string source =
+        "import std.io;\n"
+        "struct S { x: i32, y: const i64 }\n"
+        "export 'c' fun f(a: i32, b: i32[4]): i32 { return a; }\n"
+        "val s = \"a \\\" b\"; // comment\n"
+        "/* block */ var v: i64 = -12;\n";
+
+    Allocator alloc;
+    Lexer lexer{ source, alloc };
+    lexer.analyze();
+    CAL_EXPECT(lexer.getDiagnostics().empty());
+    CAL_EXPECT(!lexer.hasErrors());
+}
@@ -0,0 +1,51 @@
+#include "Test.hpp"
+
+#include "analyzer/ast/types/TypePool.hpp"
+
+using namespace cal;
+
+namespace {
+
+    using Storage = ASTNodeType::ArrayStorage;
+
+    Storage getStorage(const char* name, u64& count) {
+        ASTNodeType* type = TypePool::get().getType(name);
+        CAL_EXPECT(type != nullptr);
+        count = type ? type->getStaticElementCount() : 0;
+        return type ? type->getArrayStorage() : Storage::None;
+    }
+}
+
+
+CAL_TEST(node_type_stores_small_fixed_arrays_inline) {
+    struct Case { const char* name; Storage storage; u64 count; };
+    const Case cases[] = {
+        { "i32", Storage::None, 0 },
+        { "i32[4]", Storage::Inline, 4 },
+        { "i64[8, 8]", Storage::Inline, INLINE_ARRAY_LIMIT },
+        { "i64[8, 9]", Storage::Heap, 72 },
+        { "u8[65]", Storage::Heap, 65 },
+        // a length only known at runtime always lives on the heap
+        { "i32[n]", Storage::Heap, 0 },
+        { "i32[4, n]", Storage::Heap, 0 },
+    };
+    for (const Case& test : cases) {
+        u64 count;
+        CAL_EXPECT(getStorage(test.name, count) == test.storage);
+        CAL_EXPECT(count == test.count);
+    }
+}
+
+
+CAL_TEST(node_type_reports_array_lengths) {
+    ASTNodeType* type = TypePool::get().getType("i32[3, n]");
+    CAL_EXPECT(type != nullptr);
+    if (!type) return;
+
+    u64 length = 0;
+    CAL_EXPECT(type->isArray() && type->getArrayDimension() == 2);
+    CAL_EXPECT(type->getArrayLength(0, length) && length == 3);
+    CAL_EXPECT(!type->getArrayLength(1, length));
+    CAL_EXPECT(!type->getArrayLength(2, length));
+    CAL_EXPECT(!type->isFixedSizeArray());
+}
@@ -0,0 +1,370 @@
+#include "Test.hpp"
+
+#include <base/allocator/Allocator.hpp>
+#include <base/allocator/LinearAllocator.hpp>
+#include <base/allocator/PageAllocator.hpp>
+#include <base/allocator/PoolAllocator.hpp>
+#include <base/allocator/ProfilingAllocator.hpp>
+#include <base/allocator/TagAllocator.hpp>
+#include <base/allocator/ThreadSlots.hpp>
+#include <base/threading/ThreadPool.hpp>
+
+#include <cstddef>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+using namespace cal;
+
+
+CAL_TEST(allocator_large_without_alignment) {
+    Allocator alloc;
+    // 0 means "don't care" and still has to give max_align_t alignment, small and large
+    for (size_t size : { (size_t)24, (size_t)100000, (size_t)4 << 20 }) {
+        void* ptr = alloc.allocate(size, 0);
+        CAL_EXPECT(ptr != nullptr);
+        CAL_EXPECT((uintptr)ptr % alignof(max_align_t) == 0);
+        if (ptr) memset(ptr, 1, size);
+
+        ptr = alloc.reallocate(ptr, size * 2, size, 0);
+        CAL_EXPECT(ptr != nullptr);
+        CAL_EXPECT((uintptr)ptr % alignof(max_align_t) == 0);
+        alloc.deallocate(ptr);
+    }
+}
+
+
+CAL_TEST(allocator_large_alignment) {
+    Allocator alloc;
+    for (size_t align : { (size_t)64, (size_t)4096, (size_t)65536 }) {
+        void* ptr = alloc.allocate(200000, align);
+        CAL_EXPECT(ptr != nullptr && (uintptr)ptr % align == 0);
+        alloc.deallocate(ptr);
+    }
+}
+
+
+CAL_TEST(slab_reuses_slots_and_returns_pages) {
+    Allocator alloc;
+    PageAllocator pages{ alloc };
+    {
+        SlabAllocator slab{ pages, 48, 16, true };
+        void* slots[200];
+        for (void*& slot : slots) {
+            slot = slab.allocate();
+            CAL_EXPECT((uintptr)slot % 16 == 0);
+            memset(slot, 1, 48);
+        }
+        const u32 page_count = slab.getPageCount();
+        CAL_EXPECT(page_count > 1 && slab.getUsedCount() == 200);
+
+        // freed slots come back before new pages, also when they went through a cache
+        {
+            SlabCache cache{ slab };
+            for (void* slot : slots) cache.deallocate(slot);
+            for (void*& slot : slots) slot = cache.allocate();
+        }
+        CAL_EXPECT(slab.getPageCount() == page_count && slab.getUsedCount() == 200);
+        for (void* slot : slots) slab.deallocate(slot);
+        CAL_EXPECT(slab.getUsedCount() == 0);
+    }
+    CAL_EXPECT(pages.getAllocatedCount() == 0);
+}
+
+
+namespace {
+
+    constexpr u32 STRESS_THREADS = 4;
+    constexpr u32 STRESS_HELD = 48;
+
+    // every page gets its owner and round stamped, a page handed out twice fails the check before it's freed
+    void churnPages(PageAllocator& pages, u32 seed, u32 rounds, std::vector<void*>& leftover) {
+        void* held[STRESS_HELD];
+        u32 state = seed;
+        for (u32 round = 0; round < rounds; ++round) {
+            state = state * 1664525 + 1013904223;
+            const u32 count = 1 + (state >> 8) % STRESS_HELD;
+            const u64 stamp = (u64)seed << 32 | round;
+            for (u32 i = 0; i < count; ++i) {
+                held[i] = pages.allocate();
+                CAL_EXPECT((uintptr)held[i] % PageAllocator::PAGE_SIZE == 0);
+                u64* words = (u64*)held[i];
+                words[0] = stamp;
+                words[PageAllocator::PAGE_SIZE / sizeof(u64) - 1] = stamp + i;
+            }
+            for (u32 i = 0; i < count; ++i) {
+                const u64* words = (const u64*)held[i];
+                CAL_EXPECT(words[0] == stamp && words[PageAllocator::PAGE_SIZE / sizeof(u64) - 1] == stamp + i);
+                // some pages outlive their thread and get freed by another one
+                if (i == 0 && round % 64 == 0) leftover.push_back(held[i]);
+                else pages.deallocate(held[i]);
+            }
+        }
+    }
+}
+
+
+CAL_TEST(page_allocator_reuses_pages_across_threads) {
+    Allocator alloc;
+    PageAllocator pages{ alloc };
+    // at most every thread's live pages plus the freed ones sitting in other threads' magazines
+    const u32 bound = STRESS_THREADS * (STRESS_HELD + 2 * PageAllocator::BATCH_SIZE);
+
+    std::vector<void*> leftover[STRESS_THREADS];
+    for (u32 pass = 0; pass < 3; ++pass) {
+        std::vector<void*> kept[STRESS_THREADS];
+        std::vector<std::thread> threads;
+        for (u32 t = 0; t < STRESS_THREADS; ++t) {
+            threads.emplace_back([&, t]() {
+                // the neighbour's pages of the previous pass, freed by another thread than the one that allocated them
+                for (void* page : leftover[(t + 1) % STRESS_THREADS]) pages.deallocate(page);
+                churnPages(pages, 1 + t + pass * STRESS_THREADS, 2000, kept[t]);
+            });
+        }
+        for (std::thread& thread : threads) thread.join();
+        for (u32 t = 0; t < STRESS_THREADS; ++t) leftover[t].swap(kept[t]);
+        // about 200k pages went through the allocator per pass
+        CAL_EXPECT(pages.getReservedCount() <= bound);
+    }
+    for (std::vector<void*>& list : leftover) {
+        for (void* page : list) pages.deallocate(page);
+    }
+    CAL_EXPECT(pages.getAllocatedCount() == 0);
+
+    // the exited threads gave their magazines back, every reserved page comes out again before a new one
+    const u32 reserved = pages.getReservedCount();
+    std::vector<void*> all(reserved);
+    for (void*& page : all) page = pages.allocate();
+    CAL_EXPECT(pages.getReservedCount() == reserved && pages.getAllocatedCount() == reserved);
+    for (void* page : all) pages.deallocate(page);
+    CAL_EXPECT(pages.getAllocatedCount() == 0);
+}
+
+namespace {
+
+    const ProfilingAllocator::TagStats* findTag(const ProfilingAllocator::Snapshot& snapshot, const char* tag) {
+        for (const ProfilingAllocator::TagStats& stats : snapshot.tags) {
+            if (strcmp(stats.tag, tag) == 0) return &stats;
+        }
+        return nullptr;
+    }
+}
+
+
+CAL_TEST(profiling_allocator_counts_tags_and_sites) {
+    Allocator alloc;
+    ProfilingAllocator profiler{ alloc };
+    TagAllocator tagged{ profiler, "test" };
+
+    void* untagged_blocks[10];
+    void* tagged_blocks[5];
+    // one call site each, the tagged ones share the TagAllocator's
+    for (void*& block : untagged_blocks) block = profiler.allocate(100, 8);
+    for (void*& block : tagged_blocks) block = tagged.allocate(1000, 8);
+
+    ProfilingAllocator::Snapshot snapshot{ alloc };
+    profiler.getSnapshot(snapshot);
+    CAL_EXPECT(snapshot.allocations == 15 && snapshot.frees == 0);
+    CAL_EXPECT(snapshot.live_bytes == 6000 && snapshot.peak_bytes == 6000);
+
+    const ProfilingAllocator::TagStats* untagged = findTag(snapshot, "untagged");
+    const ProfilingAllocator::TagStats* test = findTag(snapshot, "test");
+    CAL_EXPECT(untagged && test);
+    if (!untagged || !test) return;
+    CAL_EXPECT(untagged->allocations == 10 && untagged->live_bytes == 1000 && untagged->histogram[6] == 10);
+    CAL_EXPECT(test->allocations == 5 && test->live_bytes == 5000 && test->histogram[9] == 5);
+    // sorted by live bytes
+    CAL_EXPECT(snapshot.tags[0].tag == test->tag);
+
+    CAL_EXPECT(snapshot.sites.size() == 2);
+    if (snapshot.sites.size() == 2) {
+        CAL_EXPECT(snapshot.sites[0].allocations == 5 && snapshot.sites[0].live_bytes == 5000 && snapshot.sites[0].total_bytes == 5000);
+        CAL_EXPECT(snapshot.sites[1].allocations == 10 && snapshot.sites[1].live_bytes == 1000);
+        CAL_EXPECT(snapshot.sites[0].address != snapshot.sites[1].address);
+    }
+
+    // peaks outlive the blocks, sites with nothing live are left out
+    for (void* block : untagged_blocks) profiler.deallocate(block);
+    for (void* block : tagged_blocks) tagged.deallocate(block);
+    profiler.getSnapshot(snapshot);
+    CAL_EXPECT(snapshot.frees == 15 && snapshot.live_bytes == 0 && snapshot.peak_bytes == 6000);
+    test = findTag(snapshot, "test");
+    CAL_EXPECT(test && test->frees == 5 && test->live_bytes == 0 && test->peak_bytes == 5000);
+    CAL_EXPECT(snapshot.sites.empty());
+}
+
+
+CAL_TEST(profiling_allocator_counts_reallocations) {
+    Allocator alloc;
+    ProfilingAllocator profiler{ alloc };
+    ProfilingAllocator::Snapshot snapshot{ alloc };
+
+    // in place : a free of the old size and an allocation of the new one
+    u8* block = (u8*)profiler.reallocate(nullptr, 100, 0, 8);
+    memset(block, 7, 100);
+    block = (u8*)profiler.reallocate(block, 300, 100, 8);
+    CAL_EXPECT(block[99] == 7);
+    profiler.getSnapshot(snapshot);
+    CAL_EXPECT(snapshot.allocations == 2 && snapshot.frees == 1 && snapshot.live_bytes == 300);
+
+    // over aligned blocks are moved, the header keeps the size when old_size is not passed
+    block = (u8*)profiler.reallocate(block, 50, 0, 64);
+    CAL_EXPECT((uintptr)block % 64 == 0 && block[49] == 7);
+    profiler.getSnapshot(snapshot);
+    CAL_EXPECT(snapshot.allocations == 3 && snapshot.frees == 2 && snapshot.live_bytes == 50);
+    CAL_EXPECT(snapshot.peak_bytes >= 300);
+
+    CAL_EXPECT(profiler.reallocate(block, 0, 50, 64) == nullptr);
+    profiler.getSnapshot(snapshot);
+    CAL_EXPECT(snapshot.frees == 3 && snapshot.live_bytes == 0);
+    const ProfilingAllocator::TagStats* untagged = findTag(snapshot, "untagged");
+    // 100, 300 and 50 bytes
+    CAL_EXPECT(untagged && untagged->histogram[6] == 1 && untagged->histogram[8] == 1 && untagged->histogram[5] == 1);
+}
+
+
+CAL_TEST(profiling_allocator_flushes_live_bytes_in_batches) {
+    Allocator alloc;
+    ProfilingAllocator profiler{ alloc };
+
+    // the shared totals only move once a thread's pending bytes of a tag reach FLUSH_BYTES
+    void* first = profiler.allocate(ProfilingAllocator::FLUSH_BYTES - 1, 8);
+    CAL_EXPECT(profiler.m_live_bytes == 0 && profiler.m_peak_bytes == 0);
+    void* second = profiler.allocate(1, 8);
+    CAL_EXPECT(profiler.m_live_bytes == ProfilingAllocator::FLUSH_BYTES && profiler.m_peak_bytes == ProfilingAllocator::FLUSH_BYTES);
+
+    profiler.deallocate(second);
+    CAL_EXPECT(profiler.m_live_bytes == ProfilingAllocator::FLUSH_BYTES);
+    profiler.deallocate(first);
+    CAL_EXPECT(profiler.m_live_bytes == 0 && profiler.m_peak_bytes == ProfilingAllocator::FLUSH_BYTES);
+
+    // a snapshot sums the thread blocks, it's exact without a flush
+    void* small = profiler.allocate(10, 8);
+    ProfilingAllocator::Snapshot snapshot{ alloc };
+    profiler.getSnapshot(snapshot);
+    CAL_EXPECT(profiler.m_live_bytes == 0 && snapshot.live_bytes == 10);
+    profiler.deallocate(small);
+}
+
+
+CAL_TEST(linear_allocator_grows_and_restores_marks) {
+    LinearAllocator linear{ 64 * 1024, false };
+    const LinearAllocator::Mark start = linear.getMark();
+    const size_t first_commited = linear.getCommitedBytes();
+
+    // the first chunk holds about 63 blocks, the rest goes to a chained one and nothing moves
+    u8* blocks[200];
+    for (u32 i = 0; i < 200; ++i) {
+        blocks[i] = (u8*)linear.allocate(1024, 16);
+        CAL_EXPECT((uintptr)blocks[i] % 16 == 0);
+        memset(blocks[i], (int)i, 1024);
+    }
+    CAL_EXPECT(linear.getMark().chunk != start.chunk);
+    CAL_EXPECT(linear.getCommitedBytes() > first_commited);
+    for (u32 i = 0; i < 200; ++i) CAL_EXPECT(blocks[i][0] == (u8)i && blocks[i][1023] == (u8)i);
+
+    // the last block grows in place
+    CAL_EXPECT(linear.reallocate(blocks[199], 2048, 1024, 16) == blocks[199]);
+
+    // a restore hands the same memory out again, chunks chained after the mark included
+    linear.restore(start);
+    CAL_EXPECT(linear.getMark().chunk == start.chunk && linear.getMark().end == start.end);
+    CAL_EXPECT(linear.allocate(1024, 16) == blocks[0]);
+
+    {
+        LinearAllocatorScope scope{ linear };
+        for (u32 i = 0; i < 100; ++i) linear.allocate(1024, 8);
+        CAL_EXPECT(linear.getMark().chunk != start.chunk);
+    }
+    CAL_EXPECT(linear.getMark().chunk == start.chunk && linear.allocate(1024, 16) == blocks[1]);
+    linear.reset();
+}
+
+
+CAL_TEST(linear_allocator_reuses_the_spare_chunk) {
+    LinearAllocator linear{ 64 * 1024, false };
+    const LinearAllocator::Mark start = linear.getMark();
+
+    for (u32 i = 0; i < 70; ++i) linear.allocate(1024, 8);
+    const LinearAllocator::Mark grown = linear.getMark();
+    CAL_EXPECT(grown.chunk != start.chunk);
+    const size_t grown_commited = linear.getCommitedBytes();
+
+    // the dropped chunk stays reserved, decommitted down to its first commit
+    linear.restore(start);
+    CAL_EXPECT(linear.getCommitedBytes() <= grown_commited);
+    for (u32 i = 0; i < 70; ++i) linear.allocate(1024, 8);
+    CAL_EXPECT(linear.getMark().chunk == grown.chunk && linear.getMark().end == grown.end);
+    linear.reset();
+}
+
+
+CAL_TEST(linear_allocator_shared_between_threads) {
+    LinearAllocator linear{ 64 * 1024 };
+    std::vector<u64*> blocks[4];
+    std::vector<std::thread> threads;
+    for (u32 t = 0; t < 4; ++t) {
+        threads.emplace_back([&linear, &blocks, t]() {
+            for (u32 i = 0; i < 2000; ++i) {
+                u64* block = (u64*)linear.allocate(48, 32);
+                CAL_EXPECT((uintptr)block % 32 == 0);
+                for (u32 k = 0; k < 6; ++k) block[k] = (u64)t << 32 | i;
+                blocks[t].push_back(block);
+            }
+        });
+    }
+    for (std::thread& thread : threads) thread.join();
+
+    // blocks never overlap, also across the chunks chained while racing
+    for (u32 t = 0; t < 4; ++t) {
+        for (u32 i = 0; i < 2000; ++i) {
+            for (u32 k = 0; k < 6; ++k) CAL_EXPECT(blocks[t][i][k] == ((u64)t << 32 | i));
+        }
+    }
+    linear.reset();
+}
+
+
+namespace {
+
+    // outer's slots are created while the thread takes a slot of inner, like a page allocator's
+    // magazine allocated from an Allocator whose thread heap does not exist yet
+    struct NestedLists {
+        Mutex mutex;
+        ThreadSlotList inner{ this, mutex, &create };
+        ThreadSlotList outer{ this, mutex, &createOuter };
+        ThreadSlot slots[4] = {};
+        u32 count = 0;
+
+        static ThreadSlot* create(void* owner) {
+            NestedLists& lists = *(NestedLists*)owner;
+            return &lists.slots[lists.count++];
+        }
+
+        static ThreadSlot* createOuter(void* owner) {
+            ((NestedLists*)owner)->inner.get();
+            return create(owner);
+        }
+    };
+}
+
+
+CAL_TEST(thread_slots_of_nested_lists_are_released) {
+    Allocator alloc;
+    NestedLists lists;
+    {
+        ThreadPool pool{ alloc, 1 };
+        pool.push([](void* data) {
+            NestedLists& lists = *(NestedLists*)data;
+            ThreadSlot* slot = lists.outer.get();
+            CAL_EXPECT(slot && lists.outer.find() == slot && lists.inner.find() != nullptr);
+        }, &lists);
+        pool.wait();
+    }
+
+    // the worker exited, neither slot may point into its table anymore
+    CAL_EXPECT(lists.count == 2);
+    for (u32 i = 0; i < lists.count; ++i) CAL_EXPECT(lists.slots[i].table == nullptr);
+    lists.outer.detach();
+    lists.inner.detach();
+}
@@ -0,0 +1,206 @@
+#include "Test.hpp"
+
+#include "driver/Driver.hpp"
+#include "query/QueryEngine.hpp"
+
+#include <base/allocator/Allocator.hpp>
+#include <base/types/String.hpp>
+#include <system/SysIO.hpp>
+#include <utils/ArgsParser.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+
+using namespace cal;
+
+
+CAL_TEST(driver_reads_jobs_between_inputs) {
+    Allocator alloc;
+    const char* argv[] = { "cal", "build", "a.cal", "-j", "4", "b.cal" };
+    ArgsParser args{ 6, argv, alloc, Driver::VALUE_OPTIONS };
+    BuildOptions options{ alloc };
+
+    CAL_EXPECT(Driver::parseBuildOptions(args, options));
+    CAL_EXPECT(options.jobs == 4);
+    CAL_EXPECT(options.inputs.size() == 2);
+    CAL_EXPECT(options.inputs.size() == 2 && options.inputs[0] == "a.cal" && options.inputs[1] == "b.cal");
+}
+
+
+CAL_TEST(driver_rejects_optimization_levels) {
+    Allocator alloc;
+    {
+        const char* argv[] = { "cal", "build", "a.cal", "-O", "2" };
+        ArgsParser args{ 5, argv, alloc, Driver::VALUE_OPTIONS };
+        BuildOptions options{ alloc };
+        CAL_EXPECT(!Driver::parseBuildOptions(args, options));
+    }
+    {
+        const char* argv[] = { "cal", "build", "a.cal", "-O0" };
+        ArgsParser args{ 4, argv, alloc, Driver::VALUE_OPTIONS };
+        BuildOptions options{ alloc };
+        CAL_EXPECT(Driver::parseBuildOptions(args, options));
+    }
+}
+
+
+namespace {
+
+    void writeFile(const std::string& path, const char* content) {
+        FILE* file = fopen(path.c_str(), "wb");
+        fputs(content, file);
+        fclose(file);
+    }
+
+
+    std::string readFile(const std::string& path) {
+        std::string content;
+        FILE* file = fopen(path.c_str(), "rb");
+        if (!file) return content;
+        char buffer[4096];
+        size_t read;
+        while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0) content.append(buffer, read);
+        fclose(file);
+        return content;
+    }
+
+
+    i32 buildIn(const std::string& dir, Driver& driver, IAllocator& alloc) {
+        platform::setCurrentDirectory(dir.c_str());
+        const char* argv[] = { "cal", "build", "m.cal" };
+        ArgsParser args{ 3, argv, alloc, Driver::VALUE_OPTIONS };
+        BuildOptions options{ alloc };
+        if (!Driver::parseBuildOptions(args, options)) return -1;
+        return driver.build(options);
+    }
+}
+
+
+// the compile server builds requests from different directories with one cache, "m.cal" of one
+// directory must not be taken for "m.cal" of another
+CAL_TEST(driver_cache_tells_directories_apart) {
+    Allocator alloc;
+    char root[] = "/tmp/cal-driver-test-XXXXXX";
+    CAL_EXPECT(mkdtemp(root) != nullptr);
+    const std::string first = std::string(root) + "/first";
+    const std::string second = std::string(root) + "/second";
+    CAL_EXPECT(platform::makePath(first.c_str()) && platform::makePath(second.c_str()));
+
+    char cwd[MAX_PATH];
+    platform::getCurrentDirectory(Span<char>(cwd, sizeof(cwd)));
+    {
+        BuildCache cache{ alloc };
+        QueryEngine engine{ alloc };
+        Driver driver{ alloc, &cache, &engine };
+
+        writeFile(second + "/m.cal", "var b = 2;\n");
+        CAL_EXPECT(buildIn(second, driver, alloc) == 0);
+        writeFile(first + "/m.cal", "var a = 1;\n");
+        CAL_EXPECT(buildIn(first, driver, alloc) == 0);
+
+        // same source as the first directory, its stale output has to be rewritten
+        writeFile(second + "/m.cal", "var a = 1;\n");
+        CAL_EXPECT(buildIn(second, driver, alloc) == 0);
+        CAL_EXPECT(readFile(second + "/m.tokens") == readFile(first + "/m.tokens"));
+    }
+    platform::setCurrentDirectory(cwd);
+
+    for (const std::string& dir : { first, second }) {
+        remove((dir + "/m.cal").c_str());
+        remove((dir + "/m.tokens").c_str());
+        rmdir(dir.c_str());
+    }
+    rmdir(root);
+}
+
+
+namespace {
+
+    i32 buildFiles(const std::string& dir, Driver& driver, IAllocator& alloc, i32 argc, const char** argv) {
+        platform::setCurrentDirectory(dir.c_str());
+        ArgsParser args{ argc, argv, alloc, Driver::VALUE_OPTIONS };
+        BuildOptions options{ alloc };
+        if (!Driver::parseBuildOptions(args, options)) return -1;
+        return driver.build(options);
+    }
+}
+
+
+// imports resolve to interfaces on disk or to inputs of the same build, the runtime library is built in
+CAL_TEST(driver_resolves_imports) {
+    Allocator alloc;
+    char root[] = "/tmp/cal-driver-test-XXXXXX";
+    CAL_EXPECT(mkdtemp(root) != nullptr);
+    const std::string lib = std::string(root) + "/lib";
+    CAL_EXPECT(platform::makePath((lib + "/util").c_str()));
+
+    char cwd[MAX_PATH];
+    platform::getCurrentDirectory(Span<char>(cwd, sizeof(cwd)));
+    {
+        Driver driver{ alloc };
+        writeFile(lib + "/util/math.cal", "fun add(a : i32, b : i32) : i32 {\n    return a + b;\n}\n");
+        writeFile(std::string(root) + "/main.cal", "import system.console;\nimport util.math;\nvar a = 1;\n");
+
+        const char* missing[] = { "cal", "build", "main.cal" };
+        CAL_EXPECT(buildFiles(root, driver, alloc, 3, missing) != 0);
+
+        // util/math.cal sits where util.math's interface would be
+        const char* together[] = { "cal", "build", "main.cal", "lib/util/math.cal", "-I", "lib" };
+        CAL_EXPECT(buildFiles(root, driver, alloc, 6, together) == 0);
+
+        const char* interface[] = { "cal", "build", "lib/util/math.cal", "--emit=interface" };
+        CAL_EXPECT(buildFiles(root, driver, alloc, 4, interface) == 0);
+        CAL_EXPECT(platform::fileExists((lib + "/util/math.cali").c_str()));
+        const char* mapped[] = { "cal", "build", "main.cal", "-I", "lib" };
+        CAL_EXPECT(buildFiles(root, driver, alloc, 5, mapped) == 0);
+    }
+    platform::setCurrentDirectory(cwd);
+
+    for (const char* file : { "/main.cal", "/main.tokens", "/lib/util/math.cal", "/lib/util/math.tokens", "/lib/util/math.cali" }) {
+        remove((std::string(root) + file).c_str());
+    }
+    rmdir((lib + "/util").c_str());
+    rmdir(lib.c_str());
+    rmdir(root);
+}
+
+
+// "-o out" keeps the layout of a directory input, two inputs of the same name given as files are refused
+// instead of one silently overwriting the other
+CAL_TEST(driver_keeps_outputs_apart) {
+    Allocator alloc;
+    char root[] = "/tmp/cal-driver-test-XXXXXX";
+    CAL_EXPECT(mkdtemp(root) != nullptr);
+    const std::string src = std::string(root) + "/src";
+    const std::string out = std::string(root) + "/out";
+    CAL_EXPECT(platform::makePath((src + "/a").c_str()) && platform::makePath((src + "/b").c_str()));
+
+    char cwd[MAX_PATH];
+    platform::getCurrentDirectory(Span<char>(cwd, sizeof(cwd)));
+    {
+        Driver driver{ alloc };
+        writeFile(src + "/a/x.cal", "var a = 1;\n");
+        writeFile(src + "/b/x.cal", "var b = 2;\n");
+
+        const char* tree[] = { "cal", "build", "src", "-o", "out" };
+        CAL_EXPECT(buildFiles(root, driver, alloc, 5, tree) == 0);
+        const std::string first = readFile(out + "/a/x.tokens");
+        const std::string second = readFile(out + "/b/x.tokens");
+        CAL_EXPECT(!first.empty() && !second.empty() && first != second);
+
+        const char* files[] = { "cal", "build", "src/a/x.cal", "src/b/x.cal", "-o", "out" };
+        CAL_EXPECT(buildFiles(root, driver, alloc, 6, files) != 0);
+        CAL_EXPECT(!platform::fileExists((out + "/x.tokens").c_str()));
+    }
+    platform::setCurrentDirectory(cwd);
+
+    for (const char* file : { "/src/a/x.cal", "/src/b/x.cal", "/out/a/x.tokens", "/out/b/x.tokens" }) {
+        remove((std::string(root) + file).c_str());
+    }
+    for (const char* dir : { "/src/a", "/src/b", "/src", "/out/a", "/out/b", "/out" }) {
+        rmdir((std::string(root) + dir).c_str());
+    }
+    rmdir(root);
+}
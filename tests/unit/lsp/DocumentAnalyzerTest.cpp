@@ -0,0 +1,150 @@
+#include "Test.hpp"
+
+#include "lsp/DocumentAnalyzer.hpp"
+
+#include <base/allocator/Allocator.hpp>
+
+#include <cstring>
+
+using namespace cal;
+
+namespace {
+
+    const char* const SOURCE =
+        "module app;\n"
+        "struct point {\n"
+        "    x : i32,\n"
+        "    y : i32\n"
+        "}\n"
+        "fun add(a : i32, b : i32) : i32 {\n"
+        "    val c = a;\n"
+        "    return add(c, b);\n"
+        "}\n"
+        "fun sub(a : i32) : i32 {\n"
+        "    return a;\n"
+        "}\n";
+
+
+    DocumentAnalysis* analyze(const std::string& text, IAllocator& alloc) {
+        CancellationSource cancel;
+        return DocumentAnalyzer::analyze(text, StableHash{ text.data(), (u32)text.size() }, alloc, cancel.getToken());
+    }
+
+
+    u32 find(const std::string& text, const char* anchor) {
+        return (u32)text.find(anchor);
+    }
+}
+
+
+CAL_TEST(document_analyzer_collects_symbols) {
+    struct Expected {
+        const char* name;
+        const char* container;
+        DocumentSymbolKind kind;
+        const char* anchor;     // the symbol starts where this text does
+    };
+    const Expected expected[] = {
+        { "app", "", DocumentSymbolKind::Module, "app;" },
+        { "point", "", DocumentSymbolKind::Struct, "point {" },
+        { "x", "point", DocumentSymbolKind::Field, "x :" },
+        { "y", "point", DocumentSymbolKind::Field, "y :" },
+        { "add", "", DocumentSymbolKind::Function, "add(a" },
+        { "a", "add", DocumentSymbolKind::Parameter, "a : i32, b" },
+        { "b", "add", DocumentSymbolKind::Parameter, "b : i32)" },
+        { "c", "add", DocumentSymbolKind::Variable, "c = a" },
+        { "sub", "", DocumentSymbolKind::Function, "sub(" },
+        { "a", "sub", DocumentSymbolKind::Parameter, "a : i32) : i32 {\n    return a;" },
+    };
+
+    Allocator alloc;
+    const std::string text = SOURCE;
+    DocumentAnalysis* analysis = analyze(text, alloc);
+    CAL_EXPECT(analysis != nullptr);
+    if (!analysis) return;
+
+    CAL_EXPECT(analysis->diagnostics.empty());
+    CAL_EXPECT(analysis->symbols.size() == sizeof(expected) / sizeof(expected[0]));
+    for (u32 i = 0; i < (u32)analysis->symbols.size() && i < sizeof(expected) / sizeof(expected[0]); ++i) {
+        const DocumentSymbol& symbol = analysis->symbols[i];
+        CAL_EXPECT(symbol.name == expected[i].name);
+        CAL_EXPECT(symbol.container == expected[i].container);
+        CAL_EXPECT(symbol.kind == expected[i].kind);
+        CAL_EXPECT(symbol.offset == find(text, expected[i].anchor));
+        CAL_EXPECT(symbol.length == strlen(expected[i].name));
+    }
+    CAL_DEL(alloc, analysis);
+}
+
+
+CAL_TEST(document_analyzer_finds_definitions) {
+    Allocator alloc;
+    const std::string text = SOURCE;
+    DocumentAnalysis* analysis = analyze(text, alloc);
+    CAL_EXPECT(analysis != nullptr);
+    if (!analysis) return;
+
+    // "return add(c, b)" : the function, the local and the parameter of add
+    const u32 call = find(text, "add(c, b)");
+    const DocumentSymbol* symbol = analysis->findDefinition(DocumentAnalyzer::getWordAt(text, call + 1), call + 1);
+    CAL_EXPECT(symbol && symbol->kind == DocumentSymbolKind::Function && symbol->offset == find(text, "add(a"));
+    symbol = analysis->findDefinition(DocumentAnalyzer::getWordAt(text, call + 4), call + 4);
+    CAL_EXPECT(symbol && symbol->kind == DocumentSymbolKind::Variable && symbol->offset == find(text, "c = a"));
+
+    // the closest definition before the use wins, "a" in sub is sub's parameter
+    const u32 use = find(text, "return a;") + 7;
+    symbol = analysis->findDefinition(DocumentAnalyzer::getWordAt(text, use), use);
+    CAL_EXPECT(symbol && symbol->container == "sub");
+    // nothing defined before the offset falls back to the first definition
+    symbol = analysis->findDefinition("sub", 0);
+    CAL_EXPECT(symbol && symbol->kind == DocumentSymbolKind::Function);
+    CAL_EXPECT(analysis->findDefinition("missing", use) == nullptr);
+    CAL_DEL(alloc, analysis);
+}
+
+
+CAL_TEST(document_analyzer_reports_brackets) {
+    Allocator alloc;
+    const std::string text = "fun f(a : i32 {\n    return a];\n}\n";
+    DocumentAnalysis* analysis = analyze(text, alloc);
+    CAL_EXPECT(analysis != nullptr);
+    if (!analysis) return;
+
+    bool unmatched = false;
+    for (const Diagnostic& diagnostic : analysis->diagnostics) {
+        if (diagnostic.message != "unmatched ']'") continue;
+        unmatched = true;
+        CAL_EXPECT(diagnostic.severity == DiagnosticSeverity::Error);
+        CAL_EXPECT(diagnostic.begin == find(text, "]") && diagnostic.end == diagnostic.begin + 1);
+    }
+    CAL_EXPECT(unmatched);
+    CAL_DEL(alloc, analysis);
+
+    // a cancelled token stops the analysis
+    CancellationSource cancel;
+    const CancellationToken token = cancel.getToken();
+    cancel.cancel();
+    CAL_EXPECT(DocumentAnalyzer::analyze(SOURCE, StableHash{}, alloc, token) == nullptr);
+}
+
+
+CAL_TEST(document_analyzer_applies_changes) {
+    std::string text = "fun f() {\n    return 1;\n}\n";
+
+    // insert, replace across lines, delete, all in positions of the text before each edit
+    DocumentAnalyzer::applyChange(text, 1, 12, 1, 12, " + 2");
+    CAL_EXPECT(text == "fun f() {\n    return 1 + 2;\n}\n");
+    DocumentAnalyzer::applyChange(text, 0, 8, 1, 4, "\n  ");
+    CAL_EXPECT(text == "fun f() \n  return 1 + 2;\n}\n");
+    DocumentAnalyzer::applyChange(text, 1, 10, 1, 14, "");
+    CAL_EXPECT(text == "fun f() \n  return 1;\n}\n");
+
+    // columns past the end of a line clamp to it, lines past the end to the end of the text
+    DocumentAnalyzer::applyChange(text, 0, 100, 0, 100, "{");
+    CAL_EXPECT(text == "fun f() {\n  return 1;\n}\n");
+    DocumentAnalyzer::applyChange(text, 9, 0, 9, 0, "// end\n");
+    CAL_EXPECT(text == "fun f() {\n  return 1;\n}\n// end\n");
+    // an end before the start inserts
+    DocumentAnalyzer::applyChange(text, 1, 2, 0, 0, "  ");
+    CAL_EXPECT(text == "fun f() {\n    return 1;\n}\n// end\n");
+}
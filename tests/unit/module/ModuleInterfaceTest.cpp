@@ -0,0 +1,197 @@
+#include "Test.hpp"
+
+#include "module/ModuleInterface.hpp"
+#include "vm/BytecodeEmitter.hpp"
+#include "vm/Interpreter.hpp"
+
+#include <base/allocator/Allocator.hpp>
+#include <system/io/Stream.hpp>
+
+using namespace cal;
+using namespace cal::vm;
+
+namespace {
+
+    // fun unused() = 0, fun inc(x) = x + 1, fun twice(x) = inc(x) + inc(x)
+    // unused shifts the indices, the importer's module numbers its functions differently
+    void emitLibrary(BytecodeModule& module) {
+        BytecodeEmitter emitter{ module };
+        emitter.beginFunction("unused", 0);
+        emitter.emitReturnConstant(Value::fromInt(0), ValueKind::Int);
+        emitter.endFunction();
+
+        const u32 inc_idx = emitter.beginFunction("inc", 1).index;
+        {
+            const u8 t = emitter.allocRegister();
+            emitter.emitAddImmediate(t, 0, 1);
+            emitter.emitReturn(t, ValueKind::Int);
+        }
+        emitter.endFunction();
+
+        emitter.beginFunction("twice", 1);
+        {
+            const u8 lhs = emitter.allocRegister();
+            emitter.emitMove(lhs, 0);
+            emitter.emitCall(lhs, inc_idx, 1);
+            const u8 rhs = emitter.allocRegister();
+            emitter.emitMove(rhs, 0);
+            emitter.emitCall(rhs, inc_idx, 1);
+            emitter.emitBinary(OpCode::ADD_I, lhs, lhs, rhs);
+            emitter.emitReturn(lhs, ValueKind::Int);
+        }
+        emitter.endFunction();
+    }
+
+
+    // fun big() = 2^40 (a constant), fun pick(i) { a = [i, i, i, i]; return a[i]; } with a proven index
+    void emitChecked(BytecodeModule& module) {
+        BytecodeEmitter emitter{ module };
+        emitter.beginFunction("big", 0);
+        emitter.emitReturnConstant(Value::fromInt((i64)1 << 40), ValueKind::Int);
+        emitter.endFunction();
+
+        emitter.beginFunction("pick", 1);
+        const u8 array = emitter.allocRegisterBlock(4);
+        for (u32 k = 0; k < 4; ++k) CAL_EXPECT(emitter.emitArraySetConstant(array, 4, k, 0));
+        const u8 value = emitter.allocRegister();
+        emitter.emitArrayGet(value, array, 4, 0, true);
+        emitter.emitReturn(value, ValueKind::Int);
+        emitter.endFunction();
+    }
+}
+
+
+CAL_TEST(module_interface_relocates_inline_calls) {
+    Allocator alloc;
+    BytecodeModule library{ alloc };
+    emitLibrary(library);
+
+    ModuleInterfaceBuilder builder{ alloc };
+    builder.setModuleName("lib");
+    builder.beginFunction("inc", "i64", false);
+    builder.addField("x", "i64", 0);
+    builder.beginFunction("twice", "i64", false);
+    builder.addField("x", "i64", 0);
+    CAL_EXPECT(builder.addInlineBody("inc", library, library.getFunction(1)));
+    CAL_EXPECT(builder.addInlineBody("twice", library, library.getFunction(2)));
+
+    MemoryOStream stream{ alloc };
+    builder.write(stream);
+    ModuleInterface interface;
+    CAL_EXPECT(interface.load(Span<const u8>(stream.data(), (u32)stream.size())));
+
+    const InterfaceSymbol* twice = interface.findSymbol("twice");
+    const InterfaceSymbol* inc = interface.findSymbol("inc");
+    CAL_EXPECT(twice && inc);
+    if (!twice || !inc) return;
+    CAL_EXPECT(interface.getInlineCallees(*twice).length() == 1);
+
+    BytecodeModule module{ alloc };
+    {
+        BytecodeEmitter emitter{ module };
+        emitter.beginFunction("main", 0);
+        emitter.emitReturnConstant(Value::fromInt(0), ValueKind::Int);
+        emitter.endFunction();
+    }
+
+    // its callee is not there yet
+    CAL_EXPECT(interface.importInlineBody(*twice, module) == nullptr);
+    CAL_EXPECT(module.findFunction("twice") < 0);
+
+    CAL_EXPECT(interface.importInlineBody(*inc, module) != nullptr);
+    BytecodeFunction* imported = interface.importInlineBody(*twice, module);
+    CAL_EXPECT(imported != nullptr);
+    if (!imported) return;
+
+    Interpreter interpreter{ alloc };
+    const Value arg = Value::fromInt(3);
+    Value result;
+    CAL_EXPECT(interpreter.run(module, imported->index, Span<const Value>(&arg, 1), result));
+    CAL_EXPECT(result.i == 8);
+}
+
+
+CAL_TEST(module_interface_rejects_invalid_inline_bodies) {
+    Allocator alloc;
+    BytecodeModule library{ alloc };
+    emitLibrary(library);
+    emitChecked(library);
+
+    ModuleInterfaceBuilder builder{ alloc };
+    builder.setModuleName("lib");
+    builder.beginFunction("inc", "i64", false);
+    builder.addField("x", "i64", 0);
+    builder.beginFunction("big", "i64", false);
+    builder.beginFunction("pick", "i64", false);
+    builder.addField("i", "i64", 0);
+    CAL_EXPECT(builder.addInlineBody("inc", library, library.getFunction(1)));
+    CAL_EXPECT(builder.addInlineBody("big", library, library.getFunction(3)));
+    CAL_EXPECT(builder.addInlineBody("pick", library, library.getFunction(4)));
+
+    MemoryOStream stream{ alloc };
+    builder.write(stream);
+    ModuleInterface interface;
+    CAL_EXPECT(interface.load(Span<const u8>(stream.data(), (u32)stream.size())));
+    const InterfaceSymbol* inc = interface.findSymbol("inc");
+    const InterfaceSymbol* big = interface.findSymbol("big");
+    const InterfaceSymbol* pick = interface.findSymbol("pick");
+    CAL_EXPECT(inc && big && pick);
+    if (!inc || !big || !pick) return;
+
+    // the loaded interface points into the stream, the tests corrupt it in place
+    auto canImport = [&](const InterfaceSymbol& symbol) {
+        BytecodeModule module{ alloc };
+        return interface.importInlineBody(symbol, module) != nullptr;
+    };
+    InterfaceSymbol& symbol = const_cast<InterfaceSymbol&>(*inc);
+    Instruction* code = const_cast<Instruction*>(interface.getInlineCode(*inc).begin());
+    CAL_EXPECT(canImport(*inc) && canImport(*big));
+
+    // a register operand past the frame
+    const Instruction add = code[0];
+    code[0] = encodeABC(decodeOp(add), 200, decodeB(add), decodeC(add));
+    CAL_EXPECT(!canImport(*inc));
+    code[0] = add;
+
+    // the frame shrunk below the registers the code uses
+    const u8 registers = symbol.body_register_count;
+    symbol.body_register_count = 1;
+    CAL_EXPECT(!canImport(*inc));
+    symbol.body_register_count = registers;
+
+    // falling off the end
+    const Instruction ret = code[interface.getInlineCode(*inc).length() - 1];
+    code[interface.getInlineCode(*inc).length() - 1] = encodeABC(OpCode::NOP, 0, 0, 0);
+    CAL_EXPECT(!canImport(*inc));
+    code[interface.getInlineCode(*inc).length() - 1] = ret;
+    CAL_EXPECT(canImport(*inc));
+
+    // a constant index past the table
+    InterfaceSymbol& big_symbol = const_cast<InterfaceSymbol&>(*big);
+    CAL_EXPECT(big_symbol.body_constant_count == 1);
+    big_symbol.body_constant_count = 0;
+    CAL_EXPECT(!canImport(*big));
+    big_symbol.body_constant_count = 1;
+
+    // offsets that wrap around in 32 bit land back inside the body section
+    const u32 offset = big_symbol.body_offset;
+    big_symbol.body_offset = 0xffFFffF8;
+    CAL_EXPECT(interface.getInlineCode(*big).length() == 0);
+    CAL_EXPECT(interface.getInlineConstants(*big).length() == 0);
+    CAL_EXPECT(interface.getInlineCallees(*big).length() == 0);
+    CAL_EXPECT(!canImport(*big));
+    big_symbol.body_offset = offset;
+
+    // unchecked array accesses come back checked
+    BytecodeModule module{ alloc };
+    BytecodeFunction* imported = interface.importInlineBody(*pick, module);
+    CAL_EXPECT(imported != nullptr);
+    if (!imported) return;
+    Interpreter interpreter{ alloc };
+    Value result;
+    const Value in_bounds = Value::fromInt(2);
+    CAL_EXPECT(interpreter.run(module, imported->index, Span<const Value>(&in_bounds, 1), result) && result.i == 2);
+    const Value out_of_bounds = Value::fromInt(7);
+    CAL_EXPECT(!interpreter.run(module, imported->index, Span<const Value>(&out_of_bounds, 1), result));
+    CAL_EXPECT(interpreter.getError().find("out of bounds") != std::string::npos);
+}
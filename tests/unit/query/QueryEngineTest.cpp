@@ -0,0 +1,42 @@
+#include "Test.hpp"
+
+#include "analyzer/Lexer.hpp"
+#include "analyzer/SourceMap.hpp"
+#include "query/QueryEngine.hpp"
+
+#include <base/allocator/Allocator.hpp>
+
+using namespace cal;
+
+namespace {
+
+    // "path:line:column: ..." of the first diagnostic, resolved against the text the engine has now
+    std::string reportFirstDiagnostic(QueryEngine& engine, SourceMap& sources, const std::string& path) {
+        const Lexer* lexer = engine.tokens(path);
+        if (!lexer || lexer->getDiagnostics().empty()) return "";
+        const SourceFile* file = sources.addFile(path, *engine.sourceText(path));
+        return formatDiagnostic(*file, lexer->getDiagnostics()[0]);
+    }
+}
+
+
+CAL_TEST(query_diagnostics_follow_whitespace_edits) {
+    Allocator alloc;
+    QueryEngine engine{ alloc };
+    SourceMap sources{ alloc };
+
+    engine.setSourceText("a.cal", "import b;\nvar = 1;\n");
+    CAL_EXPECT(engine.imports("a.cal") != nullptr);
+    const std::string before = reportFirstDiagnostic(engine, sources, "a.cal");
+    CAL_EXPECT(before.find("a.cal:2:") == 0);
+
+    // same tokens, every offset after the import moved by eight lines
+    engine.setSourceText("a.cal", "import b;\n\n\n\n\n\n\n\n\nvar = 1;\n");
+    const std::string after = reportFirstDiagnostic(engine, sources, "a.cal");
+    CAL_EXPECT(after.find("a.cal:10:") == 0);
+
+    // the imports came out unchanged, the edit stops there
+    const QueryEngine::Stats stats_before = engine.getStats();
+    CAL_EXPECT(engine.imports("a.cal") != nullptr);
+    CAL_EXPECT(engine.getStats().cutoffs == stats_before.cutoffs + 1);
+}
@@ -0,0 +1,123 @@
+#include "Test.hpp"
+
+#include "runtime/StringValue.hpp"
+
+#include <base/allocator/Allocator.hpp>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace cal;
+using namespace cal::runtime;
+
+namespace {
+
+    bool equals(const StringValue& value, const std::string& text) {
+        const StringView view = value.view();
+        return view.toStdString() == text && *view.end == '\0';
+    }
+}
+
+
+CAL_TEST(string_value_representations) {
+    const StringValue empty;
+    CAL_EXPECT(empty.empty() && empty.isSmall() && equals(empty, ""));
+
+    const std::string fifteen(StringValue::SMALL_CAPACITY, 'a');
+    const StringValue small{ StringView(fifteen.data(), (u32)fifteen.size()) };
+    CAL_EXPECT(small.isSmall() && small.size() == StringValue::SMALL_CAPACITY && equals(small, fifteen));
+
+    const std::string sixteen = fifteen + "b";
+    const StringValue flat{ StringView(sixteen.data(), (u32)sixteen.size()) };
+    CAL_EXPECT(!flat.isSmall() && !flat.isLiteral() && !flat.isRope() && equals(flat, sixteen));
+
+    // copies share the buffer
+    const StringValue copy = flat;
+    CAL_EXPECT(copy.view().begin == flat.view().begin && copy == flat);
+
+    static const char TEXT[] = "a literal longer than fifteen bytes";
+    const StringValue literal = StringValue::fromLiteral(TEXT, sizeof(TEXT) - 1);
+    CAL_EXPECT(literal.isLiteral() && literal.view().begin == TEXT);
+
+    // equal text compares equal whatever holds it
+    CAL_EXPECT(StringValue(StringView(TEXT, sizeof(TEXT) - 1)) == literal);
+    CAL_EXPECT(small != flat);
+
+    CAL_EXPECT(literal.slice(2, 7).toStdString() == "literal");
+    const StringValue part = literal.substring(2, 7);
+    CAL_EXPECT(part.isSmall() && equals(part, "literal"));
+}
+
+
+CAL_TEST(string_value_concat_builds_ropes) {
+    const StringValue small = StringValue(StringView("abc")) + StringValue(StringView("def"));
+    CAL_EXPECT(small.isSmall() && equals(small, "abcdef"));
+
+    // short results are copied, long ones become ropes and stay balanced
+    std::string expected;
+    StringValue text;
+    const std::string chunk = "0123456789abcdefghijklmnopqrstuvwxyz";
+    for (u32 i = 0; i < 2000; ++i) {
+        const std::string piece = chunk.substr(0, 1 + i % chunk.size());
+        text = text + StringValue(StringView(piece.data(), (u32)piece.size()));
+        expected += piece;
+        if (expected.size() < StringValue::ROPE_MIN_SIZE) CAL_EXPECT(!text.isRope());
+    }
+    CAL_EXPECT(text.isRope() && text.size() == expected.size());
+    CAL_EXPECT(equals(text, expected));
+
+    // the flattened text is cached in the rope and shared by its copies
+    const StringValue copy = text;
+    CAL_EXPECT(copy.view().begin == text.view().begin);
+
+    // prepending works on the same tree
+    const StringValue prefixed = StringValue(StringView("> ")) + text;
+    CAL_EXPECT(equals(prefixed, "> " + expected));
+    CAL_EXPECT(prefixed != text && prefixed.slice(2, text.size()).toStdString() == expected);
+}
+
+
+CAL_TEST(string_value_shared_between_threads) {
+    std::string expected;
+    StringValue text;
+    for (u32 i = 0; i < 64; ++i) {
+        const std::string piece = "piece " + std::to_string(i) + " of a rope shared by threads, ";
+        text = text + StringValue(StringView(piece.data(), (u32)piece.size()));
+        expected += piece;
+    }
+
+    // every thread copies, flattens and releases the same rope, the first flattening wins
+    std::vector<std::thread> threads;
+    std::vector<u32> matches(4, 0);
+    for (u32 t = 0; t < matches.size(); ++t) {
+        threads.emplace_back([&, t]() {
+            for (u32 i = 0; i < 1000; ++i) {
+                const StringValue copy = text;
+                const StringValue longer = copy + StringValue(StringView("!"));
+                if (equals(copy, expected) && longer.size() == expected.size() + 1) ++matches[t];
+            }
+        });
+    }
+    for (std::thread& thread : threads) thread.join();
+    for (u32 count : matches) CAL_EXPECT(count == 1000);
+}
+
+
+CAL_TEST(string_literals_are_interned) {
+    Allocator alloc;
+    StringLiterals literals{ alloc };
+    const u32 hello = literals.intern(StringView("hello"));
+    const u32 world = literals.intern(StringView("world"));
+    CAL_EXPECT(hello != world);
+    CAL_EXPECT(literals.intern(StringView("hello")) == hello);
+    CAL_EXPECT(literals.getCount() == 2 && !literals.isSealed());
+
+    literals.seal();
+    CAL_EXPECT(literals.isSealed());
+    const StringValue first = literals.get(hello);
+    CAL_EXPECT(first.isLiteral() && equals(first, "hello"));
+    // equal literals share their bytes
+    CAL_EXPECT(literals.get(hello).view().begin == first.view().begin);
+    CAL_EXPECT(equals(literals.get(world), "world"));
+}
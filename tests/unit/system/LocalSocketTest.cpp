@@ -0,0 +1,47 @@
+#include "Test.hpp"
+
+#include <system/SysSocket.hpp>
+
+#include <string>
+#include <sys/stat.h>
+
+using namespace cal;
+using namespace cal::platform;
+
+
+CAL_TEST(socket_user_path_is_private) {
+    char path[MAX_PATH];
+    CAL_EXPECT(getUserSocketPath(Span<char>(path, sizeof(path)), "test.sock"));
+
+    const std::string dir = std::string(path).substr(0, std::string(path).find_last_of('/'));
+    struct stat info;
+    CAL_EXPECT(stat(dir.c_str(), &info) == 0);
+    CAL_EXPECT(S_ISDIR(info.st_mode) && info.st_uid == geteuid() && (info.st_mode & 077) == 0);
+}
+
+
+CAL_TEST(socket_listen_keeps_a_live_server) {
+    char path[MAX_PATH];
+    CAL_EXPECT(getUserSocketPath(Span<char>(path, sizeof(path)), "listen-test.sock"));
+
+    LocalSocket server;
+    CAL_EXPECT(server.listen(path));
+    struct stat info;
+    CAL_EXPECT(stat(path, &info) == 0 && (info.st_mode & 077) == 0);
+
+    // a second server must not steal the socket of the running one
+    LocalSocket second;
+    CAL_EXPECT(!second.listen(path));
+
+    LocalSocket client;
+    CAL_EXPECT(client.connect(path));
+    LocalSocket accepted;
+    CAL_EXPECT(server.accept(accepted));
+    CAL_EXPECT(client.isPeerCurrentUser());
+    CAL_EXPECT(accepted.isPeerCurrentUser());
+
+    client.close();
+    accepted.close();
+    server.close();
+    CAL_EXPECT(second.listen(path));
+}
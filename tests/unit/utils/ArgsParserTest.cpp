@@ -0,0 +1,45 @@
+#include "Test.hpp"
+
+#include <base/allocator/Allocator.hpp>
+#include <utils/ArgsParser.hpp>
+
+using namespace cal;
+
+
+CAL_TEST(args_value_option_takes_next_argument) {
+    Allocator alloc;
+    const char* argv[] = { "cal", "build", "a.cal", "-j", "4", "b.cal" };
+    ArgsParser args{ 6, argv, alloc, "jo" };
+
+    CAL_EXPECT(args.getArg("j") == "4");
+    CAL_EXPECT(args.getPositionalCount() == 3);
+    CAL_EXPECT(args.getPositional(0) == "build");
+    CAL_EXPECT(args.getPositional(1) == "a.cal");
+    CAL_EXPECT(args.getPositional(2) == "b.cal");
+}
+
+
+CAL_TEST(args_flag_keeps_next_positional) {
+    Allocator alloc;
+    const char* argv[] = { "cal", "build", "-v", "a.cal", "-j8", "--emit=interface", "--verbose", "b.cal" };
+    ArgsParser args{ 8, argv, alloc, "jo" };
+
+    CAL_EXPECT(args.hasArg("v") && args.getArg("v").empty());
+    CAL_EXPECT(args.getArg("j") == "8");
+    CAL_EXPECT(args.getArg("emit") == "interface");
+    CAL_EXPECT(args.hasArg("verbose"));
+    CAL_EXPECT(args.getPositionalCount() == 3);
+    CAL_EXPECT(args.getPositional(1) == "a.cal");
+    CAL_EXPECT(args.getPositional(2) == "b.cal");
+}
+
+
+CAL_TEST(args_double_dash_ends_options) {
+    Allocator alloc;
+    const char* argv[] = { "cal", "build", "--", "-j", "4" };
+    ArgsParser args{ 5, argv, alloc, "j" };
+
+    CAL_EXPECT(!args.hasArg("j"));
+    CAL_EXPECT(args.getPositionalCount() == 3);
+    CAL_EXPECT(args.getPositional(1) == "-j");
+}
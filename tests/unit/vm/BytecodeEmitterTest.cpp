@@ -0,0 +1,38 @@
+#include "Test.hpp"
+
+#include "vm/BytecodeEmitter.hpp"
+#include "vm/Interpreter.hpp"
+
+#include <base/allocator/Allocator.hpp>
+
+using namespace cal;
+using namespace cal::vm;
+
+
+CAL_TEST(emitter_uses_every_register) {
+    Allocator alloc;
+    BytecodeModule module{ alloc };
+    {
+        // fun f(x) { r1 = x + 1; r2 = r1 + 1; ... return r254; }
+        BytecodeEmitter emitter{ module };
+        emitter.beginFunction("f", 1);
+        u8 last = 0;
+        for (u32 i = 1; i < BytecodeEmitter::MAX_REGISTERS; ++i) {
+            const u8 reg = emitter.allocRegister();
+            CAL_EXPECT(reg == i);
+            emitter.emitAddImmediate(reg, last, 1);
+            last = reg;
+        }
+        emitter.emitReturn(last, ValueKind::Int);
+        for (u32 i = BytecodeEmitter::MAX_REGISTERS - 1; i > 0; --i) emitter.freeRegister((u8)i);
+        emitter.endFunction();
+    }
+    // the highest register still fits the count, nothing wrapped around to 0
+    CAL_EXPECT(module.getFunction(0).register_count == BytecodeEmitter::MAX_REGISTERS);
+
+    Interpreter interpreter{ alloc };
+    const Value arg = Value::fromInt(1000);
+    Value result;
+    CAL_EXPECT(interpreter.run(module, 0, Span<const Value>(&arg, 1), result));
+    CAL_EXPECT(result.i == 1000 + BytecodeEmitter::MAX_REGISTERS - 1);
+}
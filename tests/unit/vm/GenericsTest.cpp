@@ -0,0 +1,132 @@
+#include "Test.hpp"
+
+#include "analyzer/ast/types/TypePool.hpp"
+#include "vm/BytecodeEmitter.hpp"
+#include "vm/Generics.hpp"
+#include "vm/Interpreter.hpp"
+
+#include <base/allocator/Allocator.hpp>
+
+#include <cstdlib>
+#include <initializer_list>
+#include <thread>
+#include <vector>
+
+using namespace cal;
+using namespace cal::vm;
+
+namespace {
+
+    i32 instantiate(BytecodeEmitter& emitter, UnsafeGeneric generic, const char* type) {
+        ASTNodeType* arg = TypePool::get().getType(type);
+        return emitter.instantiateFunction(getUnsafeGeneric(generic), Span<ASTNodeType* const>(&arg, 1));
+    }
+
+
+    i64 call(Interpreter& interpreter, const BytecodeModule& module, i32 func, std::initializer_list<i64> args) {
+        Value values[3];
+        u32 count = 0;
+        for (i64 arg : args) values[count++] = Value::fromInt(arg);
+        Value result;
+        CAL_EXPECT(interpreter.run(module, (u32)func, Span<const Value>(values, count), result));
+        return result.i;
+    }
+}
+
+
+CAL_TEST(generic_instantiations_are_built_once_across_modules) {
+    Allocator alloc;
+    const InstantiationCache::Stats before = InstantiationCache::get().getStats();
+
+    BytecodeModule first{ alloc };
+    BytecodeModule second{ alloc };
+    i32 first_idx, second_idx;
+    {
+        // instantiated while the caller is being emitted
+        BytecodeEmitter emitter{ first };
+        emitter.beginFunction("f", 1);
+        first_idx = instantiate(emitter, UnsafeGeneric::Alloc, "i16");
+        CAL_EXPECT(instantiate(emitter, UnsafeGeneric::Alloc, "i16") == first_idx);
+        const u8 base = emitter.allocRegister();
+        emitter.emitMove(base, 0);
+        emitter.emitCall(base, (u32)first_idx, 1);
+        emitter.emitReturn(base, ValueKind::Int);
+        emitter.endFunction();
+    }
+    {
+        BytecodeEmitter emitter{ second };
+        second_idx = instantiate(emitter, UnsafeGeneric::Alloc, " i16 ");
+    }
+
+    const InstantiationCache::Stats after = InstantiationCache::get().getStats();
+    CAL_EXPECT(after.built == before.built + 1);
+    CAL_EXPECT(after.requests == before.requests + 3);
+    CAL_EXPECT(first.getFunctionCount() == 2 && second.getFunctionCount() == 1);
+    CAL_EXPECT(first.getFunction((u32)first_idx).name == "Unsafe.alloc<i16>");
+    CAL_EXPECT(second.getFunction((u32)second_idx).code.size() == first.getFunction((u32)first_idx).code.size());
+
+    Interpreter interpreter{ alloc };
+    const i64 ptr = call(interpreter, first, 0, { 4 });
+    CAL_EXPECT(ptr != 0);
+    std::free((void*)(uintptr)ptr);
+}
+
+
+CAL_TEST(generic_unsafe_memory_round_trips) {
+    Allocator alloc;
+    BytecodeModule module{ alloc };
+    BytecodeEmitter emitter{ module };
+    const i32 alloc_i32 = instantiate(emitter, UnsafeGeneric::Alloc, "i32");
+    const i32 store_i32 = instantiate(emitter, UnsafeGeneric::Store, "i32");
+    const i32 load_i32 = instantiate(emitter, UnsafeGeneric::Load, "i32");
+    const i32 store_u8 = instantiate(emitter, UnsafeGeneric::Store, "u8");
+    const i32 load_u8 = instantiate(emitter, UnsafeGeneric::Load, "u8");
+    CAL_EXPECT(alloc_i32 >= 0 && store_i32 >= 0 && load_i32 >= 0 && store_u8 >= 0 && load_u8 >= 0);
+
+    Interpreter interpreter{ alloc };
+    const i64 ptr = call(interpreter, module, alloc_i32, { 4 });
+    call(interpreter, module, store_i32, { ptr, 2, -7 });
+    call(interpreter, module, store_i32, { ptr, 3, 9 });
+    CAL_EXPECT(call(interpreter, module, load_i32, { ptr, 2 }) == -7);
+    CAL_EXPECT(call(interpreter, module, load_i32, { ptr, 3 }) == 9);
+
+    // unsigned loads are not sign extended
+    call(interpreter, module, store_u8, { ptr, 1, 255 });
+    CAL_EXPECT(call(interpreter, module, load_u8, { ptr, 1 }) == 255);
+    std::free((void*)(uintptr)ptr);
+}
+
+
+CAL_TEST(generic_failed_instantiations_are_cached) {
+    Allocator alloc;
+    BytecodeModule module{ alloc };
+    BytecodeEmitter emitter{ module };
+
+    const InstantiationCache::Stats before = InstantiationCache::get().getStats();
+    CAL_EXPECT(instantiate(emitter, UnsafeGeneric::Load, "f64") == -1);
+    CAL_EXPECT(instantiate(emitter, UnsafeGeneric::Load, "f64") == -1);
+    CAL_EXPECT(InstantiationCache::get().getStats().built == before.built + 1);
+    CAL_EXPECT(module.getFunctionCount() == 0);
+}
+
+
+CAL_TEST(generic_concurrent_requests_share_one_build) {
+    Allocator alloc;
+    const InstantiationCache::Stats before = InstantiationCache::get().getStats();
+
+    std::vector<i32> indices(8, -1);
+    std::vector<std::thread> threads;
+    for (u32 t = 0; t < indices.size(); ++t) {
+        threads.emplace_back([&, t]() {
+            BytecodeModule module{ alloc };
+            BytecodeEmitter emitter{ module };
+            for (u32 i = 0; i < 8; ++i) indices[t] = instantiate(emitter, UnsafeGeneric::Load, t % 2 ? "i64" : " i64");
+        });
+    }
+    for (std::thread& thread : threads) thread.join();
+
+    for (i32 index : indices) CAL_EXPECT(index == 0);
+    const InstantiationCache::Stats after = InstantiationCache::get().getStats();
+    CAL_EXPECT(after.built == before.built + 1);
+    CAL_EXPECT(after.requests == before.requests + 64);
+}
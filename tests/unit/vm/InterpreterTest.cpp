@@ -0,0 +1,466 @@
+#include "Test.hpp"
+
+#include "vm/BytecodeEmitter.hpp"
+#include "vm/Interpreter.hpp"
+#include "runtime/Console.hpp"
+#include "runtime/Heap.hpp"
+
+#include <base/allocator/Allocator.hpp>
+#include <system/io/Stream.hpp>
+
+#include <cstdint>
+
+using namespace cal;
+using namespace cal::vm;
+
+namespace {
+
+    // fun f(a, b) = a <op> b
+    void emitBinaryFunction(BytecodeModule& module, OpCode op) {
+        BytecodeEmitter emitter{ module };
+        emitter.beginFunction("f", 2);
+        const u8 dst = emitter.allocRegister();
+        emitter.emitBinary(op, dst, 0, 1);
+        emitter.emitReturn(dst, ValueKind::Int);
+        emitter.endFunction();
+    }
+
+
+    bool runBinary(OpCode op, i64 lhs, i64 rhs, Value& result, std::string* error = nullptr) {
+        Allocator alloc;
+        BytecodeModule module{ alloc };
+        emitBinaryFunction(module, op);
+
+        Interpreter interpreter{ alloc };
+        const Value args[] = { Value::fromInt(lhs), Value::fromInt(rhs) };
+        const bool ok = interpreter.run(module, 0, Span<const Value>(args, 2), result);
+        if (error) *error = interpreter.getError();
+        return ok;
+    }
+
+
+    // fun f(i, j, v) { a = [10, 11, 12, 13]; a[i] = v; return a[j]; }
+    // in_bounds drops the checks (GETXU / SETXU) as if the analyzer proved both indices
+    void emitArrayFunction(BytecodeModule& module, bool in_bounds) {
+        BytecodeEmitter emitter{ module };
+        emitter.beginFunction(in_bounds ? "proven" : "checked", 3);
+        const u8 array = emitter.allocRegisterBlock(4);
+        const u8 value = emitter.allocRegister();
+        for (u32 k = 0; k < 4; ++k) {
+            emitter.emitLoadInt(value, 10 + k);
+            CAL_EXPECT(emitter.emitArraySetConstant(array, 4, k, value));
+        }
+        emitter.emitArraySet(array, 4, 0, 2, in_bounds);
+        emitter.emitArrayGet(value, array, 4, 1, in_bounds);
+        emitter.emitReturn(value, ValueKind::Int);
+        emitter.endFunction();
+    }
+
+
+    // class Node { Node left; Node right; int value; }
+    const u32 NODE_REFERENCES[] = { 0, 8 };
+    const runtime::ObjectLayout NODE_LAYOUT{ "Node", 24, 2, NODE_REFERENCES };
+
+    // fun build(depth) = Node(depth ? build(depth - 1) : null, depth ? build(depth - 1) : null, depth + 1)
+    // fun sum(node) = node ? node.value + sum(node.left) + sum(node.right) : 0
+    // fun churn(n, depth) {
+    //     keep = build(depth); total = 0
+    //     for (i = 0; i < n; ++i) { t = build(depth); total += sum(keep.right); keep.right = t; t.value = i + 1; t = null }
+    //     return total + sum(keep.right)
+    // }
+    void emitTrees(BytecodeModule& module) {
+        const u32 layout = module.addLayout(NODE_LAYOUT);
+        BytecodeEmitter emitter{ module };
+
+        const u32 build_idx = emitter.beginFunction("build", 1).index;
+        {
+            const u8 node = emitter.allocReference();
+            const u8 left = emitter.allocReference();
+            const u8 right = emitter.allocReference();
+            const u8 t = emitter.allocRegister();
+            const BytecodeEmitter::Label leaf = emitter.newLabel();
+            emitter.emitLoadInt(t, 0);
+            emitter.emitCompareJump(OpCode::EQ_I, 0, t, leaf, true);
+            emitter.emitAddImmediate(t, 0, -1);
+            emitter.emitCall(t, build_idx, 1);
+            emitter.emitMove(left, t);
+            emitter.emitAddImmediate(t, 0, -1);
+            emitter.emitCall(t, build_idx, 1);
+            emitter.emitMove(right, t);
+            emitter.bindLabel(leaf);
+            emitter.emitNew(node, layout);
+            emitter.emitSetField(node, 0, left, true);
+            emitter.emitSetField(node, 1, right, true);
+            emitter.emitAddImmediate(t, 0, 1);
+            emitter.emitSetField(node, 2, t, false);
+            emitter.emitReturn(node, ValueKind::Int);
+        }
+        emitter.endFunction();
+
+        const u32 sum_idx = emitter.beginFunction("sum", 1).index;
+        {
+            emitter.markReferenceParam(0);
+            const u8 s = emitter.allocRegister();
+            const u8 t = emitter.allocRegister();
+            const BytecodeEmitter::Label end = emitter.newLabel();
+            emitter.emitLoadInt(s, 0);
+            emitter.emitCompareJump(OpCode::EQ_I, 0, s, end, true);
+            emitter.emitGetField(s, 0, 2);
+            for (u8 child = 0; child < 2; ++child) {
+                emitter.emitGetField(t, 0, child);
+                emitter.emitCall(t, sum_idx, 1);
+                emitter.emitBinary(OpCode::ADD_I, s, s, t);
+            }
+            emitter.bindLabel(end);
+            emitter.emitReturn(s, ValueKind::Int);
+        }
+        emitter.endFunction();
+
+        emitter.beginFunction("churn", 2);
+        {
+            const u8 keep = emitter.allocReference();
+            const u8 tree = emitter.allocReference();
+            const u8 total = emitter.allocRegister();
+            const u8 i = emitter.allocRegister();
+            const u8 base = emitter.allocRegister();
+            emitter.emitMove(base, 1);
+            emitter.emitCall(base, build_idx, 1);
+            emitter.emitMove(keep, base);
+            emitter.emitLoadInt(total, 0);
+            emitter.emitLoadInt(i, 0);
+            const BytecodeEmitter::Label loop = emitter.newLabel();
+            emitter.bindLabel(loop);
+            emitter.emitMove(base, 1);
+            emitter.emitCall(base, build_idx, 1);
+            emitter.emitMove(tree, base);
+            emitter.emitGetField(base, keep, 1);
+            emitter.emitCall(base, sum_idx, 1);
+            emitter.emitBinary(OpCode::ADD_I, total, total, base);
+            emitter.emitSetField(keep, 1, tree, true);
+            emitter.emitAddImmediate(base, i, 1);
+            emitter.emitSetField(tree, 2, base, false);
+            emitter.emitLoadInt(tree, 0);
+            emitter.emitLoopBackEdge(i, 0, loop);
+            emitter.emitGetField(base, keep, 1);
+            emitter.emitCall(base, sum_idx, 1);
+            emitter.emitBinary(OpCode::ADD_I, total, total, base);
+            emitter.emitReturn(total, ValueKind::Int);
+        }
+        emitter.endFunction();
+    }
+
+
+    i64 sumTree(i64 depth) {
+        return depth ? depth + 1 + 2 * sumTree(depth - 1) : 1;
+    }
+}
+
+
+CAL_TEST(interpreter_divides) {
+    Value result;
+    CAL_EXPECT(runBinary(OpCode::DIV_I, -7, 2, result) && result.i == -3);
+    CAL_EXPECT(runBinary(OpCode::MOD_I, -7, 2, result) && result.i == -1);
+}
+
+
+CAL_TEST(interpreter_fails_division_by_zero) {
+    Value result;
+    CAL_EXPECT(!runBinary(OpCode::DIV_I, 1, 0, result));
+    CAL_EXPECT(!runBinary(OpCode::MOD_I, 1, 0, result));
+}
+
+
+CAL_TEST(interpreter_fails_division_overflow) {
+    Value result;
+    std::string error;
+    CAL_EXPECT(!runBinary(OpCode::DIV_I, INT64_MIN, -1, result, &error));
+    CAL_EXPECT(error.find("overflow") != std::string::npos);
+
+    // the remainder is defined, only the quotient overflows
+    CAL_EXPECT(runBinary(OpCode::MOD_I, INT64_MIN, -1, result) && result.i == 0);
+}
+
+
+CAL_TEST(interpreter_fails_invalid_opcode) {
+    Allocator alloc;
+    BytecodeModule module{ alloc };
+    emitBinaryFunction(module, OpCode::ADD_I);
+    for (u32 op : { (u32)OpCode::COUNT, 0xffu }) {
+        module.getFunction(0).code[0] = encodeABC((OpCode)op, 2, 0, 1);
+
+        Interpreter interpreter{ alloc };
+        const Value args[] = { Value::fromInt(1), Value::fromInt(2) };
+        Value result;
+        CAL_EXPECT(!interpreter.run(module, 0, Span<const Value>(args, 2), result));
+        CAL_EXPECT(interpreter.getError().find("invalid opcode") != std::string::npos);
+    }
+}
+
+
+CAL_TEST(interpreter_accesses_unaligned_pointers) {
+    Allocator alloc;
+    BytecodeModule module{ alloc };
+    {
+        // fun f(ptr, value, width) { *(iW*)ptr = value; return *(iW*)ptr; } for each width
+        BytecodeEmitter emitter{ module };
+        for (u8 width : { 1, 2, 4, 8 }) {
+            emitter.beginFunction("access" + std::to_string(width), 2);
+            const u8 dst = emitter.allocRegister();
+            emitter.emitPointerStore(0, 1, width);
+            emitter.emitPointerLoad(dst, 0, width);
+            emitter.emitReturn(dst, ValueKind::Int);
+            emitter.endFunction();
+        }
+    }
+
+    alignas(8) u8 buffer[64] = {};
+    const i64 expected[] = { -2, -1234, -123456789, -1234567890123 };
+    Interpreter interpreter{ alloc };
+    for (u32 i = 0; i < 4; ++i) {
+        const Value args[] = { Value::fromInt((i64)(uintptr)(buffer + 1 + i * 16)), Value::fromInt(expected[i]) };
+        Value result;
+        CAL_EXPECT(interpreter.run(module, i, Span<const Value>(args, 2), result));
+        // loads sign extend whatever the signedness of char
+        CAL_EXPECT(result.i == expected[i]);
+    }
+}
+
+
+CAL_TEST(interpreter_checks_array_bounds) {
+    Allocator alloc;
+    BytecodeModule module{ alloc };
+    emitArrayFunction(module, false);
+    emitArrayFunction(module, true);
+
+    struct Case { i64 i, j, v; bool ok; i64 result; };
+    const Case cases[] = {
+        { 1, 1, 7, true, 7 },
+        { 1, 3, 7, true, 13 },
+        { 4, 0, 7, false, 0 },
+        { 0, 4, 7, false, 0 },
+        { -1, 0, 7, false, 0 },
+        { 0, -1, 7, false, 0 },
+    };
+    Interpreter interpreter{ alloc };
+    for (const Case& test : cases) {
+        const Value args[] = { Value::fromInt(test.i), Value::fromInt(test.j), Value::fromInt(test.v) };
+        Value result;
+        CAL_EXPECT(interpreter.run(module, 0, Span<const Value>(args, 3), result) == test.ok);
+        if (!test.ok) {
+            CAL_EXPECT(interpreter.getError().find("out of bounds") != std::string::npos);
+            continue;
+        }
+        CAL_EXPECT(result.i == test.result);
+
+        // the unchecked forms only run with proven indices
+        CAL_EXPECT(interpreter.run(module, 1, Span<const Value>(args, 3), result) && result.i == test.result);
+    }
+}
+
+
+CAL_TEST(interpreter_rejects_constant_indices_out_of_bounds) {
+    Allocator alloc;
+    BytecodeModule module{ alloc };
+    BytecodeEmitter emitter{ module };
+    emitter.beginFunction("f", 0);
+    const u8 array = emitter.allocRegisterBlock(4);
+    const u8 value = emitter.allocRegister();
+    CAL_EXPECT(emitter.emitArrayGetConstant(value, array, 4, 3));
+    CAL_EXPECT(!emitter.emitArrayGetConstant(value, array, 4, 4));
+    CAL_EXPECT(!emitter.emitArrayGetConstant(value, array, 4, -1));
+    CAL_EXPECT(!emitter.emitArraySetConstant(array, 4, 4, value));
+    CAL_EXPECT(!emitter.emitArraySetConstant(array, 4, -1, value));
+    emitter.emitReturn(value, ValueKind::Int);
+    emitter.endFunction();
+}
+
+
+CAL_TEST(interpreter_prints_through_the_console) {
+    Allocator alloc;
+    BytecodeModule module{ alloc };
+    {
+        // fun f(i, f, s) { print("%i %.2f %s %b\n", i, f, s, true); }
+        BytecodeEmitter emitter{ module };
+        emitter.beginFunction("f", 3);
+        const u8 base = emitter.allocRegisterBlock(4);
+        for (u8 i = 0; i < 3; ++i) emitter.emitMove(base + i, i);
+        emitter.emitLoadInt(base + 3, 1);
+        CAL_EXPECT(emitter.emitPrint(base, "%i %.2f %s %b\n", 4));
+        // arg count and format are checked when emitting
+        CAL_EXPECT(!emitter.emitPrint(base, "%i\n", 2));
+        CAL_EXPECT(!emitter.emitPrint(base, "%q", 1));
+        emitter.freeRegisterBlock(base, 4);
+        emitter.endFunction();
+    }
+    CAL_EXPECT(module.getFormatCount() == 1);
+
+    MemoryOStream output{ alloc };
+    runtime::Console::get().setOutput(&output);
+    Interpreter interpreter{ alloc };
+    const Value args[] = { Value::fromInt(-42), Value::fromFloat(2.5), Value::fromInt((i64)(uintptr)"text") };
+    Value result;
+    CAL_EXPECT(interpreter.run(module, 0, Span<const Value>(args, 3), result));
+    CAL_EXPECT(interpreter.run(module, 0, Span<const Value>(args, 3), result));
+    runtime::Console::get().flush();
+    runtime::Console::get().setOutput(nullptr);
+
+    const std::string printed((const char*)output.data(), (size_t)output.size());
+    CAL_EXPECT(printed == "-42 2.50 text true\n-42 2.50 text true\n");
+}
+
+
+CAL_TEST(interpreter_objects_survive_collections) {
+    Allocator alloc;
+    BytecodeModule module{ alloc };
+    emitTrees(module);
+    CAL_EXPECT(module.getFunction(0).reference_maps.size() > 0);
+
+    // every tree outgrows the nursery, collections of both kinds happen while trees are being built
+    // and whatever a missing root left behind in the nursery is overwritten before it is read again
+    runtime::Heap::Config config;
+    config.nursery_size = 64 * 1024;
+    config.buffer_size = 4 * 1024;
+    config.old_size = 64 * runtime::Heap::REGION_SIZE;
+    config.major_threshold = runtime::Heap::REGION_SIZE;
+    runtime::Heap heap{ alloc, config };
+    CAL_EXPECT(heap.isValid());
+    runtime::Mutator* mutator = heap.attachThread();
+
+    Interpreter interpreter{ alloc };
+    interpreter.setHeap(&heap, mutator);
+    const i64 count = 200, depth = 10;
+    const Value args[] = { Value::fromInt(count), Value::fromInt(depth) };
+    Value result;
+    CAL_EXPECT(interpreter.run(module, (u32)module.findFunction("churn"), Span<const Value>(args, 2), result));
+    // keep is old after the first collection, only the write barrier keeps the tree in keep.right
+    // alive through the next build. the stamp in its root tells it apart from a newer tree
+    i64 expected = sumTree(depth - 1);
+    for (i64 i = 1; i <= count; ++i) expected += sumTree(depth) - (depth + 1) + i;
+    CAL_EXPECT(result.i == expected);
+
+    const runtime::Heap::Stats stats = heap.getStats();
+    CAL_EXPECT(stats.minor_collections > 0);
+    CAL_EXPECT(stats.major_collections > 0);
+    CAL_EXPECT(stats.old_bytes < 4 * runtime::Heap::REGION_SIZE);
+
+    interpreter.setHeap(nullptr, nullptr);
+    CAL_EXPECT(mutator->scanner == nullptr);
+    heap.detachThread(mutator);
+}
+
+
+CAL_TEST(interpreter_fails_object_access_without_object) {
+    Allocator alloc;
+    BytecodeModule module{ alloc };
+    emitTrees(module);
+    const Value depth = Value::fromInt(0);
+    Value result;
+
+    Interpreter interpreter{ alloc };
+    CAL_EXPECT(!interpreter.run(module, (u32)module.findFunction("build"), Span<const Value>(&depth, 1), result));
+    CAL_EXPECT(interpreter.getError().find("without a heap") != std::string::npos);
+
+    runtime::Heap::Config config;
+    config.nursery_size = 64 * 1024;
+    config.old_size = 4 * runtime::Heap::REGION_SIZE;
+    runtime::Heap heap{ alloc, config };
+    runtime::Mutator* mutator = heap.attachThread();
+    interpreter.setHeap(&heap, mutator);
+    CAL_EXPECT(interpreter.run(module, (u32)module.findFunction("build"), Span<const Value>(&depth, 1), result));
+    CAL_EXPECT(result.i != 0);
+
+    // sum() guards against null but not against fields the layout does not have
+    BytecodeFunction& sum = module.getFunction((u32)module.findFunction("sum"));
+    for (Instruction& ins : sum.code) {
+        if (decodeOp(ins) == OpCode::GETF && decodeC(ins) == 2) ins = encodeABC(OpCode::GETF, decodeA(ins), decodeB(ins), 3);
+    }
+    CAL_EXPECT(!interpreter.run(module, sum.index, Span<const Value>(&result, 1), result));
+    CAL_EXPECT(interpreter.getError().find("unknown field") != std::string::npos);
+
+    interpreter.setHeap(nullptr, nullptr);
+    heap.detachThread(mutator);
+}
+
+
+CAL_TEST(interpreter_builds_strings) {
+    Allocator alloc;
+    BytecodeModule module{ alloc };
+    {
+        // fun f(n) { s = "ab"; for (i = 0; i < n; ++i) s = s + "0123456789"; print("%i %b %s\n", len(s), s == "ab", s); return s; }
+        BytecodeEmitter emitter{ module };
+        emitter.beginFunction("f", 1);
+        const u8 s = emitter.allocRegister();
+        const u8 piece = emitter.allocRegister();
+        const u8 i = emitter.allocRegister();
+        emitter.emitStringLiteral(s, "ab");
+        emitter.emitStringLiteral(piece, "0123456789");
+        emitter.emitLoadInt(i, 0);
+        const BytecodeEmitter::Label end = emitter.newLabel();
+        const BytecodeEmitter::Label loop = emitter.newLabel();
+        emitter.emitCompareJump(OpCode::LT_I, i, 0, end, false);
+        emitter.bindLabel(loop);
+        emitter.emitStringConcat(s, s, piece);
+        emitter.emitLoopBackEdge(i, 0, loop);
+        emitter.bindLabel(end);
+
+        const u8 base = emitter.allocRegisterBlock(3);
+        emitter.emitStringLength(base, s);
+        emitter.emitStringLiteral(base + 1, "ab");
+        emitter.emitStringEqual(base + 1, s, base + 1);
+        emitter.emitStringData(base + 2, s);
+        CAL_EXPECT(emitter.emitPrint(base, "%i %b %s\n", 3));
+        emitter.freeRegisterBlock(base, 3);
+        emitter.emitReturn(s, ValueKind::Int);
+        emitter.endFunction();
+    }
+    // equal literals share one index
+    CAL_EXPECT(module.getStrings().getCount() == 2);
+
+    Interpreter interpreter{ alloc };
+    const Value zero = Value::fromInt(0);
+    Value result;
+    CAL_EXPECT(!interpreter.run(module, 0, Span<const Value>(&zero, 1), result));
+    CAL_EXPECT(interpreter.getError().find("not sealed") != std::string::npos);
+    module.sealStrings();
+
+    MemoryOStream output{ alloc };
+    runtime::Console::get().setOutput(&output);
+    std::string expected = "ab";
+    for (i64 n : { 0, 1, 30 }) {
+        const Value arg = Value::fromInt(n);
+        CAL_EXPECT(interpreter.run(module, 0, Span<const Value>(&arg, 1), result));
+        // the returned string lives until the next run
+        const runtime::StringValue* str = interpreter.getString(result);
+        CAL_EXPECT(str && str->view().toStdString() == expected);
+        CAL_EXPECT(str && str->isRope() == (n == 30));
+        if (n == 0) expected += "0123456789";
+        else if (n == 1) for (u32 k = 0; k < 29; ++k) expected += "0123456789";
+    }
+    runtime::Console::get().flush();
+    runtime::Console::get().setOutput(nullptr);
+
+    const std::string printed((const char*)output.data(), (size_t)output.size());
+    CAL_EXPECT(printed == "2 true ab\n12 false ab0123456789\n302 false " + expected + "\n");
+}
+
+
+CAL_TEST(interpreter_fails_invalid_string) {
+    Allocator alloc;
+    BytecodeModule module{ alloc };
+    {
+        BytecodeEmitter emitter{ module };
+        emitter.beginFunction("f", 1);
+        const u8 dst = emitter.allocRegister();
+        emitter.emitStringLength(dst, 0);
+        emitter.emitReturn(dst, ValueKind::Int);
+        emitter.endFunction();
+    }
+    module.sealStrings();
+
+    Interpreter interpreter{ alloc };
+    const Value arg = Value::fromInt(3);
+    Value result;
+    CAL_EXPECT(!interpreter.run(module, 0, Span<const Value>(&arg, 1), result));
+    CAL_EXPECT(interpreter.getError().find("invalid string") != std::string::npos);
+    CAL_EXPECT(!interpreter.getString(arg));
+}
@@ -0,0 +1,244 @@
+#include "Test.hpp"
+
+#include "vm/BytecodeEmitter.hpp"
+#include "vm/JitCompiler.hpp"
+#include "runtime/Console.hpp"
+
+#include <base/allocator/Allocator.hpp>
+#include <system/io/Stream.hpp>
+
+#include <cstdint>
+
+using namespace cal;
+using namespace cal::vm;
+
+namespace {
+
+    u64 noTrampoline(void*, u32, const u64*, u32* status) {
+        *status = 1;
+        return 0;
+    }
+
+
+    // native code has to fail exactly where the interpreter fails, tiering up can't change results
+    struct BinaryCase {
+        OpCode op;
+        i64 lhs;
+        i64 rhs;
+        bool ok;
+        i64 result;
+    };
+
+
+    // fun f(i, j, v) { a = [10, 11, 12, 13]; a[i] = v; return a[j]; }, unchecked when in_bounds
+    void emitArrayFunction(BytecodeModule& module, bool in_bounds) {
+        BytecodeEmitter emitter{ module };
+        emitter.beginFunction(in_bounds ? "proven" : "checked", 3);
+        const u8 array = emitter.allocRegisterBlock(4);
+        const u8 value = emitter.allocRegister();
+        for (u32 k = 0; k < 4; ++k) {
+            emitter.emitLoadInt(value, 10 + k);
+            CAL_EXPECT(emitter.emitArraySetConstant(array, 4, k, value));
+        }
+        emitter.emitArraySet(array, 4, 0, 2, in_bounds);
+        emitter.emitArrayGet(value, array, 4, 1, in_bounds);
+        emitter.emitReturn(value, ValueKind::Int);
+        emitter.endFunction();
+    }
+
+
+    // fun roundtrip(value) { a = alloc(16); *a = value; b = alloc(16); memcpy(b, a, 8); r = *b; free(a); free(b); return r; }
+    // fun copy(dst, src, n) { memcpy(dst, src, n); return 0; }
+    void emitMemoryFunctions(BytecodeModule& module) {
+        BytecodeEmitter emitter{ module };
+        emitter.beginFunction("roundtrip", 1);
+        {
+            const u8 a = emitter.allocRegister();
+            const u8 b = emitter.allocRegister();
+            const u8 size = emitter.allocRegister();
+            emitter.emitLoadInt(size, 16);
+            emitter.emitAlloc(a, size);
+            emitter.emitAlloc(b, size);
+            emitter.emitPointerStore(a, 0, 8);
+            // a constant size, lowered to an inline copy
+            emitter.emitLoadInt(size, 8);
+            emitter.emitMemCopy(b, a, size);
+            emitter.emitPointerLoad(size, b, 8);
+            emitter.emitFree(a);
+            emitter.emitFree(b);
+            emitter.emitReturn(size, ValueKind::Int);
+        }
+        emitter.endFunction();
+
+        emitter.beginFunction("copy", 3);
+        emitter.emitMemCopy(0, 1, 2);
+        emitter.emitReturnConstant(Value::fromInt(0), ValueKind::Int);
+        emitter.endFunction();
+    }
+
+
+    // fun axpy(a, x, y) = (f64)a * x + y, export 'c' symbol
+    void emitAxpy(BytecodeModule& module, const char* symbol) {
+        BytecodeEmitter emitter{ module };
+        emitter.beginFunction("axpy", 3);
+        const ValueKind params[] = { ValueKind::Int, ValueKind::Float, ValueKind::Float };
+        emitter.setExportC(symbol, Span<const ValueKind>(params, 3));
+        const u8 result = emitter.allocRegister();
+        emitter.emitUnary(OpCode::I2F, result, 0);
+        emitter.emitBinary(OpCode::MUL_F, result, result, 1);
+        emitter.emitBinary(OpCode::ADD_F, result, result, 2);
+        emitter.emitReturn(result, ValueKind::Float);
+        emitter.endFunction();
+    }
+}
+
+
+CAL_TEST(jit_divides_like_the_interpreter) {
+    const BinaryCase cases[] = {
+        { OpCode::DIV_I, -7, 2, true, -3 },
+        { OpCode::MOD_I, -7, 2, true, -1 },
+        { OpCode::DIV_I, 1, 0, false, 0 },
+        { OpCode::MOD_I, 1, 0, false, 0 },
+        { OpCode::DIV_I, INT64_MIN, -1, false, 0 },
+        { OpCode::MOD_I, INT64_MIN, -1, true, 0 },
+    };
+
+    Allocator alloc;
+    JitCompiler jit;
+    for (const BinaryCase& test : cases) {
+        BytecodeModule module{ alloc };
+        {
+            BytecodeEmitter emitter{ module };
+            emitter.beginFunction("f", 2);
+            const u8 dst = emitter.allocRegister();
+            emitter.emitBinary(test.op, dst, 0, 1);
+            emitter.emitReturn(dst, ValueKind::Int);
+            emitter.endFunction();
+        }
+
+        const NativeEntry entry = jit.compile(module, module.getFunction(0), noTrampoline, nullptr);
+        CAL_EXPECT(entry != nullptr);
+        if (!entry) continue;
+
+        const u64 args[] = { (u64)test.lhs, (u64)test.rhs };
+        u32 status = 0;
+        const i64 result = (i64)entry(args, &status);
+        CAL_EXPECT((status == 0) == test.ok);
+        if (test.ok) CAL_EXPECT(result == test.result);
+    }
+}
+
+
+CAL_TEST(jit_checks_array_bounds_like_the_interpreter) {
+    Allocator alloc;
+    BytecodeModule module{ alloc };
+    emitArrayFunction(module, false);
+    emitArrayFunction(module, true);
+
+    JitCompiler jit;
+    const NativeEntry checked = jit.compile(module, module.getFunction(0), noTrampoline, nullptr);
+    const NativeEntry proven = jit.compile(module, module.getFunction(1), noTrampoline, nullptr);
+    CAL_EXPECT(checked != nullptr && proven != nullptr);
+    if (!checked || !proven) return;
+
+    struct Case { i64 i, j, v; bool ok; i64 result; };
+    const Case cases[] = {
+        { 1, 1, 7, true, 7 },
+        { 1, 3, 7, true, 13 },
+        { 3, 0, -5, true, 10 },
+        { 4, 0, 7, false, 0 },
+        { 0, 4, 7, false, 0 },
+        { -1, 0, 7, false, 0 },
+        { 0, INT64_MIN, 7, false, 0 },
+    };
+    for (const Case& test : cases) {
+        const u64 args[] = { (u64)test.i, (u64)test.j, (u64)test.v };
+        u32 status = 0;
+        const i64 result = (i64)checked(args, &status);
+        CAL_EXPECT((status == 0) == test.ok);
+        if (!test.ok) continue;
+        CAL_EXPECT(result == test.result);
+
+        // the unchecked forms only run with proven indices
+        CAL_EXPECT((i64)proven(args, &status) == test.result && status == 0);
+    }
+}
+
+
+CAL_TEST(jit_allocates_and_copies_memory) {
+    Allocator alloc;
+    BytecodeModule module{ alloc };
+    emitMemoryFunctions(module);
+
+    JitCompiler jit;
+    const NativeEntry roundtrip = jit.compile(module, module.getFunction(0), noTrampoline, nullptr);
+    const NativeEntry copy = jit.compile(module, module.getFunction(1), noTrampoline, nullptr);
+    CAL_EXPECT(roundtrip != nullptr && copy != nullptr);
+    if (!roundtrip || !copy) return;
+
+    u32 status = 0;
+    const u64 value = (u64)-1234567890123;
+    CAL_EXPECT(roundtrip(&value, &status) == value && status == 0);
+
+    // a size only known at runtime, unaligned on both sides
+    u8 src[32], dst[32] = {};
+    for (u32 i = 0; i < sizeof(src); ++i) src[i] = (u8)(i + 1);
+    const u64 args[] = { (u64)(uintptr)(dst + 1), (u64)(uintptr)(src + 3), 13 };
+    CAL_EXPECT(copy(args, &status) == 0 && status == 0);
+    CAL_EXPECT(dst[0] == 0 && dst[14] == 0);
+    for (u32 i = 0; i < 13; ++i) CAL_EXPECT(dst[1 + i] == src[3 + i]);
+}
+
+
+CAL_TEST(jit_exports_c_functions) {
+    Allocator alloc;
+    BytecodeModule module{ alloc };
+    emitAxpy(module, "cal_test_axpy");
+    BytecodeModule duplicate{ alloc };
+    emitAxpy(duplicate, "cal_test_axpy");
+
+    JitCompiler jit;
+    CAL_EXPECT(jit.findExport("cal_test_axpy") == nullptr);
+    CAL_EXPECT(jit.compile(module, module.getFunction(0), noTrampoline, nullptr) != nullptr);
+    auto* axpy = (double(*)(i64, double, double))jit.findExport("cal_test_axpy");
+    CAL_EXPECT(axpy != nullptr);
+    if (axpy) CAL_EXPECT(axpy(3, 1.5, 0.25) == 4.75);
+
+    // a symbol is defined once per jit
+    CAL_EXPECT(jit.compile(duplicate, duplicate.getFunction(0), noTrampoline, nullptr) == nullptr);
+    CAL_EXPECT(jit.getError().find("already defined") != std::string::npos);
+}
+
+
+CAL_TEST(jit_prints_like_the_interpreter) {
+    Allocator alloc;
+    BytecodeModule module{ alloc };
+    {
+        // fun f(i, f, s) { print("[%i|%.1f|%s]", i, f, s); print("done\n"); }
+        BytecodeEmitter emitter{ module };
+        emitter.beginFunction("f", 3);
+        const u8 base = emitter.allocRegisterBlock(3);
+        for (u8 i = 0; i < 3; ++i) emitter.emitMove(base + i, i);
+        CAL_EXPECT(emitter.emitPrint(base, "[%i|%.1f|%s]", 3));
+        CAL_EXPECT(emitter.emitPrint(base, "done\n", 0));
+        emitter.freeRegisterBlock(base, 3);
+        emitter.endFunction();
+    }
+
+    JitCompiler jit;
+    const NativeEntry entry = jit.compile(module, module.getFunction(0), noTrampoline, nullptr);
+    CAL_EXPECT(entry != nullptr);
+    if (!entry) return;
+
+    MemoryOStream output{ alloc };
+    runtime::Console::get().setOutput(&output);
+    const u64 args[] = { 7, (u64)Value::fromFloat(-1.5).i, (u64)(uintptr)"abc" };
+    u32 status = 0;
+    entry(args, &status);
+    runtime::Console::get().flush();
+    runtime::Console::get().setOutput(nullptr);
+
+    CAL_EXPECT(status == 0);
+    const std::string printed((const char*)output.data(), (size_t)output.size());
+    CAL_EXPECT(printed == "[7|-1.5|abc]done\n");
+}
@@ -0,0 +1,145 @@
+#include "Test.hpp"
+
+#include "vm/BytecodeEmitter.hpp"
+#include "vm/TieredRuntime.hpp"
+
+#include <base/allocator/Allocator.hpp>
+#include <system/SysThreading.hpp>
+
+using namespace cal;
+using namespace cal::vm;
+
+namespace {
+
+    // tiers up on the first call, the jit thread finishes in the background
+    void waitForTierUp(TieredRuntime& runtime) {
+        for (u32 i = 0; i < 1000 && runtime.hasPendingWork(); ++i) {
+            platform::sleep(5);
+        }
+    }
+
+
+    // fun bump(p, d) { *p = *p + 1; return 1 / d; }
+    void emitBump(BytecodeModule& module) {
+        BytecodeEmitter emitter{ module };
+        emitter.beginFunction("bump", 2);
+        const u8 value = emitter.allocRegister();
+        const u8 one = emitter.allocRegister();
+        emitter.emitPointerLoad(value, 0, 8);
+        emitter.emitAddImmediate(value, value, 1);
+        emitter.emitPointerStore(0, value, 8);
+        emitter.emitLoadInt(one, 1);
+        emitter.emitBinary(OpCode::DIV_I, value, one, 1);
+        emitter.emitReturn(value, ValueKind::Int);
+        emitter.endFunction();
+    }
+
+
+    // fun ping(n) = n == 0 ? 0 : pong(n)
+    // fun pong(n) = ping(n - 1)
+    void emitPingPong(BytecodeModule& module) {
+        BytecodeEmitter emitter{ module };
+        const u32 ping_idx = 0;
+        const u32 pong_idx = 1;
+
+        emitter.beginFunction("ping", 1);
+        {
+            const u8 zero = emitter.allocRegister();
+            emitter.emitLoadInt(zero, 0);
+            const BytecodeEmitter::Label done = emitter.newLabel();
+            emitter.emitCompareJump(OpCode::EQ_I, 0, zero, done);
+            const u8 base = emitter.allocRegister();
+            emitter.emitMove(base, 0);
+            emitter.emitCall(base, pong_idx, 1);
+            emitter.emitReturn(base, ValueKind::Int);
+            emitter.bindLabel(done);
+            emitter.emitReturnConstant(Value::fromInt(0), ValueKind::Int);
+        }
+        emitter.endFunction();
+
+        emitter.beginFunction("pong", 1);
+        {
+            const u8 base = emitter.allocRegister();
+            emitter.emitAddImmediate(base, 0, -1);
+            emitter.emitCall(base, ping_idx, 1);
+            emitter.emitReturn(base, ValueKind::Int);
+        }
+        emitter.endFunction();
+    }
+}
+
+
+CAL_TEST(tiered_runtime_does_not_rerun_failed_native_code) {
+    Allocator alloc;
+    BytecodeModule module{ alloc };
+    emitBump(module);
+
+    TieredRuntime runtime{ module, alloc, 1, 1 };
+    i64 counter = 0;
+    Value args[] = { Value::fromInt((i64)(uintptr)&counter), Value::fromInt(1) };
+    Value result;
+    CAL_EXPECT(runtime.run(0, Span<const Value>(args, 2), result) && result.i == 1);
+    waitForTierUp(runtime);
+    CAL_EXPECT(module.getFunction(0).profile.native_entry != nullptr);
+
+    // the store happened once, running it again in the interpreter would bump twice
+    args[1] = Value::fromInt(0);
+    CAL_EXPECT(!runtime.run(0, Span<const Value>(args, 2), result));
+    CAL_EXPECT(counter == 2);
+    CAL_EXPECT(!runtime.getError().empty());
+}
+
+
+CAL_TEST(tiered_runtime_limits_depth_across_tiers) {
+    Allocator alloc;
+    BytecodeModule module{ alloc };
+    emitPingPong(module);
+
+    // only ping goes native, pong keeps running in interpreters nested below the trampoline
+    TieredRuntime runtime{ module, alloc, 1, 1 };
+    Value arg = Value::fromInt(0);
+    Value result;
+    CAL_EXPECT(runtime.run(0, Span<const Value>(&arg, 1), result));
+    waitForTierUp(runtime);
+    CAL_EXPECT(module.getFunction(0).profile.native_entry != nullptr);
+
+    // deep enough to overflow the native stack without a shared limit
+    arg = Value::fromInt(1000000);
+    CAL_EXPECT(!runtime.run(0, Span<const Value>(&arg, 1), result));
+    CAL_EXPECT(!runtime.getError().empty());
+
+    // the failed run left no frames behind
+    arg = Value::fromInt(200);
+    CAL_EXPECT(runtime.run(0, Span<const Value>(&arg, 1), result) && result.i == 0);
+    CAL_EXPECT(runtime.run(1, Span<const Value>(&arg, 1), result) && result.i == 0);
+}
+
+
+CAL_TEST(tiered_runtime_finds_exports) {
+    Allocator alloc;
+    BytecodeModule module{ alloc };
+    {
+        // fun scale(x) = x * 3, export 'c' cal_test_scale
+        BytecodeEmitter emitter{ module };
+        emitter.beginFunction("scale", 1);
+        const ValueKind params[] = { ValueKind::Int };
+        emitter.setExportC("cal_test_scale", Span<const ValueKind>(params, 1));
+        const u8 result = emitter.allocRegister();
+        emitter.emitLoadInt(result, 3);
+        emitter.emitBinary(OpCode::MUL_I, result, result, 0);
+        emitter.emitReturn(result, ValueKind::Int);
+        emitter.endFunction();
+    }
+
+    TieredRuntime runtime{ module, alloc, 1, 1 };
+    CAL_EXPECT(runtime.findExport("cal_test_scale") == nullptr);
+    const Value arg = Value::fromInt(7);
+    Value result;
+    CAL_EXPECT(runtime.run(0, Span<const Value>(&arg, 1), result) && result.i == 21);
+    waitForTierUp(runtime);
+
+    auto* scale = (i64(*)(i64))runtime.findExport("cal_test_scale");
+    CAL_EXPECT(scale != nullptr);
+    if (scale) CAL_EXPECT(scale(-5) == -15);
+    CAL_EXPECT(runtime.findExport("scale") == nullptr);
+}